@@ -9,13 +9,18 @@
  */
 
 #include <iostream>
+#include <thread>
+#include <mutex>
 #include <string.h>
+#include <stddef.h>
+#include <errno.h>
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 
 #include "cgmath.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
 #include "CObject.h"
 #include "CVertices.h"
 #include "CShader.h"
@@ -25,72 +30,65 @@
 #include "CPerspective.h"
 #include "CView.h"
 #include "CTexture.h"
+#include "CTextureManager.h"
+#include "CCulling.h"
+#include "CMaze.h"
+#include "CLod.h"
+#include "CRingBuffer.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
 
 using namespace std;
 
 CBlock *CBlock::m_instance = NULL;
-#define MAZE_SIZE 10
-
-bool showtex=false;
 
 CBlock::CBlock(void)
-: m_geometry_updated(true)
-, m_color_updated(true)
+: m_ring(NULL)
+, m_texture(0)
+, m_tiles(0)
+, m_object(-1)
+, m_layerShift(0)
 , m_loaded(false)
 {
+	CMaze *maze = CMaze::GetInstance();
 	int i;
 
-	int y;
-	int x;
-
-	char map[][MAZE_SIZE] = {
-		{ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
-		{ 0, 0, 0, 1, 1, 0, 0, 0, 0, 1 },
-		{ 1, 1, 0, 0, 0, 0, 1, 0, 1, 1 },
-		{ 1, 1, 1, 1, 1, 0, 0, 0, 1, 1 },
-		{ 1, 0, 0, 1, 1, 0, 1, 0, 0, 1 },
-		{ 1, 1, 0, 1, 0, 0, 1, 1, 0, 1 },
-		{ 1, 0, 0, 1, 1, 1, 1, 0, 0, 1 },
-		{ 1, 0, 1, 1, 0, 0, 0, 0, 1, 1 },
-		{ 1, 0, 0, 0, 0, 1, 1, 0, 0, 1 },
-		{ 1, 1, 0, 1, 1, 1, 1, 1, 1, 1 }
-	};
-
-	m_iCount = 0;
-	for (y = 0; y < MAZE_SIZE; y++)
-		for (x = 0; x < MAZE_SIZE; x++)
-			m_iCount += (map[y][x] == 1);
+	m_iCount = maze->WallCount();
+	// The other draws of CMultiDraw read an element of the instance buffers as well
+	m_capacity = max(m_iCount, MULTIDRAW_MAX);
 
 	try {
-		m_offset = new vec4[m_iCount];
+		m_offset = new vec4[m_capacity];
+		m_chunk = new GLuint[m_capacity];
 	} catch (...) {
 		cerr << "Failed to allocate m_offset" << endl;
 		m_iCount = 1;
+		m_capacity = 1;
 		return;
 	}
 
-	i = 0;
-	for (y = 0; y < MAZE_SIZE; y++) {
-		for (x = 0; x < MAZE_SIZE; x++) {
-			if (map[y][x] == 0)
-				continue;
-
-			m_offset[i][0] = (x - (MAZE_SIZE / 2)) * (BLOCK_WIDTH * 2);
-			m_offset[i][1] = 0.0f;
-			m_offset[i][2] = (y - (MAZE_SIZE / 2)) * (BLOCK_WIDTH * 2);
-			m_offset[i][3] = 1.0f;
-			i++;
-		}
+	// Instances are ordered chunk by chunk, see CMaze
+	maze->FillOffsets(m_offset, m_chunk);
+	for (i = m_iCount; i < m_capacity; i++) {
+		m_offset[i] = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+		m_chunk[i] = 0;
 	}
 
-	cout << m_iCount << " instances are created " << i << endl;
+	cout << m_iCount << " instances are created" << endl;
 	glGenBuffers(1, &m_VBO);
 }
 
 CBlock::~CBlock(void)
 {
 	delete[] m_offset;
+	delete[] m_chunk;
+	delete m_ring;
 	glDeleteBuffers(1, &m_VBO);
+
+	if (m_texture > 0)
+		CTextureManager::GetInstance()->Release(m_texture);
+	if (m_tiles > 0)
+		CTextureManager::GetInstance()->Release(m_tiles);
 }
 
 CBlock *CBlock::GetInstance(void)
@@ -115,11 +113,21 @@ void CBlock::Destroy(void)
 	delete this;
 }
 
+/**
+ * \brief
+ * Moves every wall to the next layer of the texture array, nothing is rebound.
+ */
 void CBlock::ChangeTex(void)
 {
-	showtex = !showtex;	
-	//cout << "showtex" << endl;
-	Load();
+	int layers = CTexture::GetInstance()->Layers();
+
+	if (layers <= 1)
+		return;
+
+	m_layerShift = (m_layerShift + 1) % layers;
+	CShader::GetInstance()->UseProgram();
+	glUniform1i(glGetUniformLocation(CShader::GetInstance()->Program(), "layerShift"), m_layerShift);
+	StatusPrint();
 }
 
 int CBlock::Load(void)
@@ -132,7 +140,7 @@ int CBlock::Load(void)
 		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 		StatusPrint();
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(*m_offset) * m_iCount, m_offset, GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(*m_offset) * m_capacity, m_offset, GL_STATIC_DRAW);
 
 		m_offsetId = glGetAttribLocation(CShader::GetInstance()->Program(), "offset");
 		cout << "offset index: " << m_offsetId << endl;
@@ -146,47 +154,129 @@ int CBlock::Load(void)
 		// glVertexAttribDivisor should be called before unmapping the VAO
 		glVertexAttribDivisor(m_offsetId, 1);
 
+		// Only the merged boxes of CLod are scaled
+		m_scaleId = glGetAttribLocation(CShader::GetInstance()->Program(), "scale");
+		if (m_scaleId >= 0)
+			glVertexAttrib4f(m_scaleId, 1.0f, 1.0f, 1.0f, 1.0f);
+
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		CVertices::GetInstance()->UnbindVAO();
 
+		// The instanced draw is used if the GPU culling is not available
+		CCulling::GetInstance()->Load(m_offset, m_chunk, m_iCount, m_offsetId);
+
+		if (!m_ring) {
+			try {
+				m_ring = new CRingBuffer(GL_ARRAY_BUFFER, sizeof(*m_offset) * m_capacity);
+			} catch (...) {
+				cerr << "Failed to allocate the ring buffer" << endl;
+			}
+
+			if (m_ring && m_ring->Load() < 0) {
+				delete m_ring;
+				m_ring = NULL;
+			}
+		}
+
 	}
 
-	m_isBlockId = glGetUniformLocation(CShader::GetInstance()->Program(), "isBlock");
-	cout << "isBlock index: " << m_isBlockId << endl;
+	// The instanced draw is object 0, see CMultiDraw
+	if (m_object < 0)
+		m_object = CFrame::GetInstance()->AddObject(CFrame::BLOCK | CFrame::WORLD | CFrame::INSTANCED);
+
+	// A reload keeps the handles it has
+	if (m_texture <= 0)
+		m_texture = CTexture::GetInstance()->Load();
 
-	m_texImageId = CTexture::GetInstance()->Load();
-	if (m_texImageId == 0) {
+	if (m_texture <= 0) {
 		cerr << "Failed to create a texture image id" << endl;
 	}
 	else {
-		GLint texId; // Texture Sampler 2D
+		GLuint program = CShader::GetInstance()->Program();
+		GLint texId; // Texture Sampler 2D array
+
+		// Nothing has used the program yet on the old GL
+		glUseProgram(program);
+		texId = glGetUniformLocation(program, "tex");
+		glUniform1i(texId, 0);	// map GL_TEXTURE0
+
+		// The material of an instance wraps around the layers
+		glUniform1i(glGetUniformLocation(program, "layers"), CTexture::GetInstance()->Layers());
+		glUniform1i(glGetUniformLocation(program, "layerShift"), m_layerShift);
+		StatusPrint();
+	}
 
-		//cout << "showtex " << showtex << endl;
+	// The old shader samples the image as it is
+	if (!__OLD_GL && m_tiles <= 0)
+		m_tiles = CTexture::GetInstance()->LoadTiles();
 
-		if(showtex)
-			glActiveTexture(GL_TEXTURE0);
-		else
-			glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, m_texImageId);
+	if (m_tiles > 0) {
+		GLint tilesId;
 
-		texId = glGetUniformLocation(CShader::GetInstance()->Program(), "tex");
-		glUniform1i(texId, 0);	// map GL_TEXTURE0
+		tilesId = glGetUniformLocation(CShader::GetInstance()->Program(), "tiles");
+		glUniform1i(tilesId, TILE_TEXTURE_UNIT);
 	}
 
 	m_loaded = true;
 	return 0;
 }
 
-int CBlock::Render(void)
+/**
+ * \brief
+ * Points the offset attribute to the instances to draw.
+ * The instance count is returned, or -1 if only the GPU knows it (see CCulling).
+ */
+int CBlock::BindInstances(void)
 {
-	mat4 mvp;
+	// The instances of the last frame are consumed by the commands issued so far
+	if (m_ring)
+		m_ring->Fence();
+
+	if (CCulling::GetInstance()->Enabled())
+		return CCulling::GetInstance()->Bind();
+
+	if (CLod::GetInstance()->Enabled() && m_ring) {
+		CMaze *maze = CMaze::GetInstance();
+		const CMaze::Chunk *chunk;
+		vec4 *visible;
+		GLintptr offset;
+		int count = 0;
+		int i;
+		int j;
 
-	mvp = CPerspective::GetInstance()->Matrix() * CView::GetInstance()->Matrix() * CModel::GetInstance()->Matrix();
+		visible = (vec4 *)m_ring->Alloc(sizeof(*m_offset) * m_capacity, &offset);
+		if (!visible)
+			return 0;
 
-	glUniformMatrix4fv(CShader::GetInstance()->MVPId(), 1, GL_TRUE, (const GLfloat *)mvp);
-	StatusPrint();
+		// Chunks are contiguous ranges, the ones at the full level are packed into a single draw
+		for (i = 0; i < maze->ChunkCount(); i++) {
+			chunk = maze->GetChunk(i);
+			if (CLod::GetInstance()->GetLevel(i) != CLod::FULL)
+				continue;
+
+			for (j = 0; j < chunk->count; j++)
+				visible[count++] = m_offset[chunk->first + j];
+		}
+		m_ring->Flush();
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_ring->Buffer());
+		glVertexAttribPointer(m_offsetId, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, (void *)offset);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return count;
+	}
+
+	// CCulling points the offset attribute to its own buffer
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+	glVertexAttribPointer(m_offsetId, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return m_iCount;
+}
+
+int CBlock::Render(void)
+{
+	int count;
 
-	glUniform1i(m_isBlockId, 1);
+	CFrame::GetInstance()->BindObject(m_object);
 
 	// Drawing blocks
 	if (__OLD_GL) {
@@ -195,16 +285,32 @@ int CBlock::Render(void)
 		for (i = 0; i < m_iCount; i++) {
 			glUniform4f(m_offsetId, m_offset[i].x, m_offset[i].y, m_offset[i].z, m_offset[i].w);
 			StatusPrint();
-			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-			StatusPrint();
+			CVertices::GetInstance()->Draw(CVertices::CUBE);
 		}
 	} else {
-		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, m_iCount);
-		StatusPrint();
+		count = BindInstances();
+		if (count < 0)
+			CCulling::GetInstance()->Draw();
+		else if (count > 0)
+			CVertices::GetInstance()->Draw(CVertices::CUBE, count);
 	}
-	glUniform1i(m_isBlockId, 0);
 
 	return 0;
 }
 
+int CBlock::Record(GLuint arg)
+{
+	int count;
+
+	if (__OLD_GL)
+		return -EINVAL;
+
+	count = BindInstances();
+	if (count < 0)
+		return CMultiDraw::GetInstance()->AddIndirect(CVertices::CUBE, m_object, CCulling::GetInstance()->CommandBuffer(),
+			offsetof(CVertices::DrawCommand, instanceCount));
+
+	return CMultiDraw::GetInstance()->Add(CVertices::CUBE, m_object, count);
+}
+
 /* End of a file */
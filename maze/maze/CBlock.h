@@ -2,19 +2,27 @@
 #if !defined(__CBLOCK_H)
 #define __CBLOCK_H
 
+class CRingBuffer;
+
 class CBlock : public CObject {
 private:
 	vec4 *m_offset;
+	GLuint *m_chunk; // Chunk index of each instance
 	GLuint m_VBO; // Vertex Buffer Object
-	GLuint m_texImageId;
+	CRingBuffer *m_ring; // Instances of the chunks at the full level, rebuilt every frame
+	int m_texture; // Handle of CTextureManager, the wall array
+	int m_tiles; // Handle of the tile index
 	GLint m_offsetId;
-	GLint m_isBlockId;
+	GLint m_scaleId;
+	int m_object; // Slot of CFrame
+	int m_layerShift; // Added to the material of every wall, see ChangeTex()
 	int m_iCount;
+	int m_capacity; // Elements of the instance buffers
 
-	bool m_geometry_updated;
-	bool m_color_updated;
 	bool m_loaded;	
 
+	int BindInstances(void);
+
 	CBlock(void);
 	virtual ~CBlock(void);
 
@@ -27,6 +35,8 @@ public:
 	void ChangeTex(void);
 	int Load(void);
 	int Render(void);
+	int Record(GLuint arg);
+	const char *Name(void) { return "Block"; }
 };
 
 #endif
@@ -13,12 +13,16 @@
 #include "CModel.h"
 #include "CPerspective.h"
 #include "CView.h"
+#include "CVertices.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
 
 using namespace std;
 
 CCoordinate *CCoordinate::m_instance = NULL;
 
 CCoordinate::CCoordinate(void)
+: m_object(-1)
 {
 
 }
@@ -50,21 +54,28 @@ void CCoordinate::Destroy(void)
 
 int CCoordinate::Render(void)
 {
-	mat4 mvp;
+	CFrame::GetInstance()->BindObject(m_object);
+	CVertices::GetInstance()->Draw(CVertices::AXES);
 
-	mvp = CPerspective::GetInstance()->Matrix() * CView::GetInstance()->Matrix();// * CModel::GetInstance()->Matrix();
-
-	glUniformMatrix4fv(CShader::GetInstance()->MVPId(), 1, GL_TRUE, (const GLfloat *)mvp);
-	StatusPrint();
+	return 0;
+}
 
-	glDrawElements(GL_LINES, 8, GL_UNSIGNED_INT, (void *)(sizeof(GLuint) * 37));
-	StatusPrint();
+int CCoordinate::Record(GLuint arg)
+{
+	return CMultiDraw::GetInstance()->Add(CVertices::AXES, m_object);
+}
 
-	return 0;
+GLuint CCoordinate::Program(void)
+{
+	return CShader::GetInstance()->Program(CShader::LINES);
 }
 
 int CCoordinate::Load(void)
 {
+	// Axes of the world, the model stays the identity
+	if (m_object < 0)
+		m_object = CFrame::GetInstance()->AddObject(0);
+
 	return 0;
 }
 
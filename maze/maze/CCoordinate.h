@@ -8,6 +8,7 @@ private:
 	virtual ~CCoordinate(void);
 
 	GLint m_mvpId;
+	int m_object; // Slot of CFrame
 
 	static CCoordinate *m_instance;
 
@@ -17,6 +18,9 @@ public:
 	static CCoordinate *GetInstance(void);
 	void Destroy(void);
 	int Render(void);
+	int Record(GLuint arg);
+	GLuint Program(void);
+	const char *Name(void) { return "Coordinate"; }
 	int Load(void);
 };
 
@@ -0,0 +1,539 @@
+/**
+ * \brief
+ * Culls the block instances on the GPU.
+ * The full instance list is uploaded once, visible instances are compacted
+ * by the GPU into a second buffer which feeds the "offset" attribute.
+ * The CPU never reads or writes per-instance data after Load().
+ *
+ * Hi-Z occlusion uses the depth buffer of the previous frame,
+ * so a block which is disoccluded by a fast camera move can appear one frame late.
+ */
+
+#include <iostream>
+#include <stddef.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CVertices.h"
+#include "CShader.h"
+#include "CMovable.h"
+#include "CModel.h"
+#include "CPerspective.h"
+#include "CView.h"
+#include "CCulling.h"
+#include "CObject.h"
+#include "CLod.h"
+#include "CMultiDraw.h"
+#include "CFrame.h"
+
+using namespace std;
+
+
+CCulling *CCulling::m_instance = NULL;
+
+CCulling::CCulling(void)
+: m_mode(NONE)
+, m_cullProgram(0)
+, m_hizProgram(0)
+, m_mvpId(-1)
+, m_viewportsId(-1)
+, m_rectsId(-1)
+, m_useHiZId(-1)
+, m_useLodId(-1)
+, m_srcLodId(-1)
+, m_feedbackVAO(0)
+, m_visibleCount(0)
+, m_depthTex(0)
+, m_hizTex(0)
+, m_hizWidth(0)
+, m_hizHeight(0)
+, m_hizLevels(0)
+, m_hizValid(false)
+, m_offsetId(-1)
+, m_iCount(0)
+, m_frame(0)
+, m_enabled(true)
+, m_loaded(false)
+{
+	int i;
+
+	m_VBO[INSTANCES] = m_VBO[VISIBLE] = m_VBO[COMMAND] = m_VBO[CHUNKS] = 0;
+	for (i = 0; i < FEEDBACK_BUFFERS; i++) {
+		m_feedback[i] = 0;
+		m_query[i] = 0;
+	}
+}
+
+CCulling::~CCulling(void)
+{
+	glDeleteBuffers(MAX, m_VBO);
+	glDeleteBuffers(FEEDBACK_BUFFERS, m_feedback);
+
+	if (m_query[0])
+		glDeleteQueries(FEEDBACK_BUFFERS, m_query);
+
+	if (m_feedbackVAO)
+		glDeleteVertexArrays(1, &m_feedbackVAO);
+
+	if (m_depthTex)
+		glDeleteTextures(1, &m_depthTex);
+
+	if (m_hizTex)
+		glDeleteTextures(1, &m_hizTex);
+
+	if (m_cullProgram)
+		glDeleteProgram(m_cullProgram);
+
+	if (m_hizProgram)
+		glDeleteProgram(m_hizProgram);
+}
+
+CCulling *CCulling::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CCulling();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CCulling::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+bool CCulling::Enabled(void)
+{
+	return m_loaded && m_enabled && m_mode != NONE;
+}
+
+void CCulling::Toggle(void)
+{
+	m_enabled = !m_enabled;
+	// Feedback results of the old frames are stale now
+	m_frame = 0;
+	cout << "GPU culling " << (m_enabled ? "on" : "off") << endl;
+}
+
+int CCulling::Load(const vec4 *offset, const GLuint *chunk, int count, GLint offsetId)
+{
+	CVertices::DrawCommand command;
+	GLsizeiptr size;
+	GLint attrId;
+	int i;
+
+	// CBlock::Load() is called again on every texture change
+	if (m_loaded)
+		return 0;
+
+	if (!offset || !chunk || count <= 0 || offsetId < 0)
+		return -EINVAL;
+
+	// instanceCount is written by the compute shader
+	CVertices::GetInstance()->Command(CVertices::CUBE, 0, 0, &command);
+
+	if (IsGLVersion_4_3()) {
+		m_cullProgram = CShader::GetInstance()->LoadCompute(CMisc::m_cullComputeShaderFile);
+		m_hizProgram = CShader::GetInstance()->LoadCompute(CMisc::m_hizComputeShaderFile);
+		if (m_cullProgram && m_hizProgram) {
+			m_mode = COMPUTE;
+		} else {
+			glDeleteProgram(m_cullProgram);
+			glDeleteProgram(m_hizProgram);
+			m_cullProgram = m_hizProgram = 0;
+		}
+	}
+
+	if (m_mode == NONE && IsGLVersion_3_2()) {
+		m_cullProgram = CShader::GetInstance()->LoadFeedback(CMisc::m_cullVertexShaderFile,
+			CMisc::m_cullGeometryShaderFile, "visibleOffset");
+		if (m_cullProgram)
+			m_mode = FEEDBACK;
+	}
+
+	if (m_mode == NONE) {
+		cerr << "GPU culling is not available" << endl;
+		return -EFAULT;
+	}
+
+	m_iCount = count;
+	m_offsetId = offsetId;
+
+	// The other draws of CMultiDraw read an element of the instance buffers as well
+	size = sizeof(*offset) * max(count, MULTIDRAW_MAX);
+
+	glGenBuffers(MAX, m_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[INSTANCES]);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(*offset) * count, offset);
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[CHUNKS]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(*chunk) * count, chunk, GL_STATIC_DRAW);
+	StatusPrint();
+
+	if (m_mode == COMPUTE) {
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO[VISIBLE]);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_VBO[COMMAND]);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		StatusPrint();
+
+		glUseProgram(m_cullProgram);
+		glUniform1ui(glGetUniformLocation(m_cullProgram, "instanceCount"), count);
+		glUniform1f(glGetUniformLocation(m_cullProgram, "halfExtent"), BLOCK_WIDTH);
+		glUniform1i(glGetUniformLocation(m_cullProgram, "hiZ"), HIZ_TEXTURE_UNIT);
+		m_mvpId = glGetUniformLocation(m_cullProgram, "mvp");
+		m_viewportsId = glGetUniformLocation(m_cullProgram, "viewports");
+		m_rectsId = glGetUniformLocation(m_cullProgram, "rects");
+		m_useHiZId = glGetUniformLocation(m_cullProgram, "useHiZ");
+		m_useLodId = glGetUniformLocation(m_cullProgram, "useLod");
+
+		glUseProgram(m_hizProgram);
+		glUniform1i(glGetUniformLocation(m_hizProgram, "src"), HIZ_TEXTURE_UNIT);
+		m_srcLodId = glGetUniformLocation(m_hizProgram, "srcLod");
+		StatusPrint();
+	} else {
+		glGenBuffers(FEEDBACK_BUFFERS, m_feedback);
+		for (i = 0; i < FEEDBACK_BUFFERS; i++) {
+			glBindBuffer(GL_ARRAY_BUFFER, m_feedback[i]);
+			glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+		}
+		glGenQueries(FEEDBACK_BUFFERS, m_query);
+
+		glGenVertexArrays(1, &m_feedbackVAO);
+		glBindVertexArray(m_feedbackVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO[INSTANCES]);
+		attrId = glGetAttribLocation(m_cullProgram, "offset");
+		if (attrId >= 0) {
+			glEnableVertexAttribArray(attrId);
+			glVertexAttribPointer(attrId, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, 0);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO[CHUNKS]);
+		attrId = glGetAttribLocation(m_cullProgram, "chunk");
+		if (attrId >= 0) {
+			glEnableVertexAttribArray(attrId);
+			glVertexAttribIPointer(attrId, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+		}
+		glBindVertexArray(0);
+		StatusPrint();
+
+		glUseProgram(m_cullProgram);
+		glUniform1f(glGetUniformLocation(m_cullProgram, "halfExtent"), BLOCK_WIDTH);
+		glUniform1i(glGetUniformLocation(m_cullProgram, "chunkLevel"), LOD_TEXTURE_UNIT);
+		m_mvpId = glGetUniformLocation(m_cullProgram, "mvp");
+		m_viewportsId = glGetUniformLocation(m_cullProgram, "viewports");
+		m_useLodId = glGetUniformLocation(m_cullProgram, "useLod");
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CShader::GetInstance()->UseProgram();
+
+	cout << "GPU culling: " << (m_mode == COMPUTE ? "compute" : "transform feedback") << endl;
+	m_loaded = true;
+	return 0;
+}
+
+int CCulling::Cull(void)
+{
+	CFrame *frame = CFrame::GetInstance();
+	mat4 mvp[VIEWPORT_MAX];
+	int count;
+	int i;
+
+	if (!Enabled())
+		return 0;
+
+	// The blocks as they are drawn in this frame, in every viewport
+	count = frame->Viewports();
+	for (i = 0; i < count; i++)
+		mvp[i] = CPerspective::GetInstance(i)->Matrix() * frame->View(i) * frame->World();
+
+	if (m_mode == COMPUTE)
+		return CullCompute(mvp, count);
+
+	return CullFeedback(mvp, count);
+}
+
+/**
+ * \brief
+ * The Hi-Z buffer is of the whole window, a viewport tests its own part of it.
+ */
+int CCulling::CullCompute(const mat4 *mvp, int count)
+{
+	CLod *lod = CLod::GetInstance();
+	GLfloat rects[VIEWPORT_MAX][4];
+	const GLint *viewport;
+	GLuint zero = 0;
+	GLint unit;
+	int i;
+
+	// Only the instance counter is reset, count/firstIndex stay as loaded
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_VBO[COMMAND]);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offsetof(CVertices::DrawCommand, instanceCount), sizeof(zero), &zero);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	for (i = 0; i < count; i++) {
+		viewport = CFrame::GetInstance()->Viewport(i);
+		rects[i][0] = (GLfloat)viewport[0] / max(m_hizWidth, 1);
+		rects[i][1] = (GLfloat)viewport[1] / max(m_hizHeight, 1);
+		rects[i][2] = (GLfloat)viewport[2] / max(m_hizWidth, 1);
+		rects[i][3] = (GLfloat)viewport[3] / max(m_hizHeight, 1);
+	}
+
+	glUseProgram(m_cullProgram);
+	glUniformMatrix4fv(m_mvpId, count, GL_TRUE, (const GLfloat *)mvp);
+	glUniform1i(m_viewportsId, count);
+	glUniform4fv(m_rectsId, count, (const GLfloat *)rects);
+	glUniform1i(m_useHiZId, m_hizValid);
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, m_hizTex);
+	glActiveTexture(unit);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_VBO[INSTANCES]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_VBO[VISIBLE]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_VBO[COMMAND]);
+
+	glUniform1i(m_useLodId, lod->Enabled());
+	if (lod->Enabled()) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_VBO[CHUNKS]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lod->LevelBuffer());
+	}
+
+	glDispatchCompute((m_iCount + 63) / 64, 1, 1);
+	StatusPrint();
+
+	// The results are consumed as vertex attributes and as the indirect command
+	// CMultiDraw copies instanceCount out of the command buffer
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	CShader::GetInstance()->UseProgram();
+	return 0;
+}
+
+int CCulling::CullFeedback(const mat4 *mvp, int count)
+{
+	CLod *lod = CLod::GetInstance();
+	int cur = m_frame % FEEDBACK_BUFFERS;
+	GLint unit;
+
+	glUseProgram(m_cullProgram);
+	glUniformMatrix4fv(m_mvpId, count, GL_TRUE, (const GLfloat *)mvp);
+	glUniform1i(m_viewportsId, count);
+
+	glUniform1i(m_useLodId, lod->Enabled());
+	if (lod->Enabled()) {
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+		glActiveTexture(GL_TEXTURE0 + LOD_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, lod->LevelTexture());
+		glActiveTexture(unit);
+	}
+
+	glBindVertexArray(m_feedbackVAO);
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_feedback[cur]);
+
+	glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, m_query[cur]);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, m_iCount);
+	CMisc::CountDraw();
+	glEndTransformFeedback();
+	glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+	StatusPrint();
+
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(0);
+
+	CShader::GetInstance()->UseProgram();
+	m_frame++;
+	return 0;
+}
+
+/**
+ * \brief
+ * Points the offset attribute to the visible blocks.
+ * The number of the visible blocks is returned, or -1 if it is only in CommandBuffer().
+ */
+int CCulling::Bind(void)
+{
+	GLuint buffer = m_VBO[INSTANCES];
+	GLuint available = 0;
+	unsigned int i;
+	int slot;
+
+	if (!Enabled())
+		return -EINVAL;
+
+	if (m_mode == COMPUTE) {
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO[VISIBLE]);
+		glVertexAttribPointer(m_offsetId, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return -1;
+	}
+
+	/**
+	 * Reading the query of the current frame would stall the pipeline.
+	 * The newest earlier frame whose query is done is used instead,
+	 * and every instance is drawn while none of them is.
+	 */
+	m_visibleCount = m_iCount;
+	for (i = 2; i <= FEEDBACK_BUFFERS && i <= m_frame; i++) {
+		slot = (m_frame - i) % FEEDBACK_BUFFERS;
+		glGetQueryObjectuiv(m_query[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+
+		glGetQueryObjectuiv(m_query[slot], GL_QUERY_RESULT, &m_visibleCount);
+		buffer = m_feedback[slot];
+		break;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glVertexAttribPointer(m_offsetId, 4, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return m_visibleCount;
+}
+
+/**
+ * \brief
+ * Draws the visible blocks, the VAO and EBO of CVertices should be bound.
+ */
+int CCulling::Draw(void)
+{
+	int count;
+
+	count = Bind();
+	if (count == -EINVAL)
+		return -EINVAL;
+
+	if (count < 0) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_VBO[COMMAND]);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0);
+		CMisc::CountDraw();
+		StatusPrint();
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		return 0;
+	}
+
+	CVertices::GetInstance()->Draw(CVertices::CUBE, count);
+	return 0;
+}
+
+/**
+ * \brief
+ * Indirect command of the visible blocks (compute path), see CVertices::DrawCommand.
+ */
+GLuint CCulling::CommandBuffer(void)
+{
+	return m_VBO[COMMAND];
+}
+
+int CCulling::ResizeHiZ(int w, int h)
+{
+	if (m_depthTex)
+		glDeleteTextures(1, &m_depthTex);
+
+	if (m_hizTex)
+		glDeleteTextures(1, &m_hizTex);
+
+	m_depthTex = m_hizTex = 0;
+	m_hizValid = false;
+	m_hizWidth = w;
+	m_hizHeight = h;
+
+	if (w <= 0 || h <= 0)
+		return -EINVAL;
+
+	m_hizLevels = 1;
+	while ((max(w, h) >> m_hizLevels) > 0)
+		m_hizLevels++;
+
+	glGenTextures(1, &m_depthTex);
+	glBindTexture(GL_TEXTURE_2D, m_depthTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, w, h);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &m_hizTex);
+	glBindTexture(GL_TEXTURE_2D, m_hizTex);
+	glTexStorage2D(GL_TEXTURE_2D, m_hizLevels, GL_R32F, w, h);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	StatusPrint();
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Should be called after every object is rendered, before swapping buffers.
+ * The viewport should be the whole window, the split-screen puts it back first.
+ */
+int CCulling::BuildHiZ(void)
+{
+	GLint viewport[4];
+	GLint unit;
+	int level;
+	int w;
+	int h;
+
+	if (!Enabled() || m_mode != COMPUTE)
+		return 0;
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if (viewport[2] != m_hizWidth || viewport[3] != m_hizHeight) {
+		if (ResizeHiZ(viewport[2], viewport[3]) < 0)
+			return -EFAULT;
+	}
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT);
+
+	// Depth of the framebuffer of the frame, see CMisc::Framebuffer()
+	glBindTexture(GL_TEXTURE_2D, m_depthTex);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], m_hizWidth, m_hizHeight);
+	StatusPrint();
+
+	glUseProgram(m_hizProgram);
+
+	w = m_hizWidth;
+	h = m_hizHeight;
+	for (level = 0; level < m_hizLevels; level++) {
+		if (level == 1)
+			glBindTexture(GL_TEXTURE_2D, m_hizTex);
+
+		if (level > 0) {
+			w = max(1, w / 2);
+			h = max(1, h / 2);
+		}
+
+		glUniform1i(m_srcLodId, level - 1);
+		glBindImageTexture(0, m_hizTex, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+	StatusPrint();
+
+	glActiveTexture(unit);
+	CShader::GetInstance()->UseProgram();
+
+	m_hizValid = true;
+	return 0;
+}
+
+/* End of a file */
@@ -0,0 +1,91 @@
+#pragma once
+#if !defined(__CCULLING_H)
+#define __CCULLING_H
+
+#define FEEDBACK_BUFFERS 3	// Frames of transform feedback results, see Bind()
+
+/**
+ * \brief
+ * GPU-driven culling of the block instances.
+ * GL 4.3: compute shader culls against the frustum and the Hi-Z buffer,
+ *         then the draw is issued by glDrawElementsIndirect.
+ * GL 3.2: transform feedback culls against the frustum only, the draw takes
+ *         the results of the newest earlier frame whose count query is done,
+ *         every instance while none is, so reading the count never stalls.
+ * Instances of the chunks which CLod draws with a lower level are dropped as well.
+ * The split-screen culls once for all of its viewports, an instance which any of
+ * them sees is kept, so the blocks are culled and drawn once for every viewport.
+ */
+class CCulling {
+private:
+	enum Mode {
+		NONE = 0x00,
+		COMPUTE = 0x01,
+		FEEDBACK = 0x02
+	};
+
+	enum VBO {
+		INSTANCES = 0x00,
+		VISIBLE = 0x01,
+		COMMAND = 0x02,
+		CHUNKS = 0x03,
+		MAX = 0x04
+	};
+
+	Mode m_mode;
+	GLuint m_VBO[MAX];
+	GLuint m_cullProgram;
+	GLuint m_hizProgram;
+	GLint m_mvpId;	// A matrix a viewport
+	GLint m_viewportsId;
+	GLint m_rectsId;
+	GLint m_useHiZId;
+	GLint m_useLodId;
+	GLint m_srcLodId;
+
+	// Transform feedback, a buffer and a query a frame
+	GLuint m_feedbackVAO;
+	GLuint m_feedback[FEEDBACK_BUFFERS];
+	GLuint m_query[FEEDBACK_BUFFERS];
+	GLuint m_visibleCount;
+
+	// Hi-Z pyramid built from the depth buffer of the previous frame
+	GLuint m_depthTex;
+	GLuint m_hizTex;
+	int m_hizWidth;
+	int m_hizHeight;
+	int m_hizLevels;
+	bool m_hizValid;
+
+	GLint m_offsetId;
+	int m_iCount;
+	unsigned int m_frame;
+	bool m_enabled;
+	bool m_loaded;
+
+	int CullCompute(const mat4 *mvp, int count);
+	int CullFeedback(const mat4 *mvp, int count);
+	int ResizeHiZ(int w, int h);
+
+	CCulling(void);
+	virtual ~CCulling(void);
+
+	static CCulling *m_instance;
+
+public:
+	static CCulling *GetInstance(void);
+	void Destroy(void);
+
+	int Load(const vec4 *offset, const GLuint *chunk, int count, GLint offsetId);
+	int Cull(void);
+	int Bind(void);
+	int Draw(void);
+	GLuint CommandBuffer(void);
+	int BuildHiZ(void);
+
+	bool Enabled(void);
+	void Toggle(void);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,228 @@
+/**
+ * \brief
+ * glDebugMessageCallback and glDebugMessageControl are core in GL 4.3,
+ * they are looked up by name for a context which has KHR_debug only.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+
+using namespace std;
+
+#define SEVERITY_DEFAULT 3	// Up to GL_DEBUG_SEVERITY_LOW
+
+static PFNGLDEBUGMESSAGECONTROLPROC debugMessageControl = NULL;
+
+// By the levels of SetSeverity()
+static const GLenum severities[] = {
+	GL_DEBUG_SEVERITY_HIGH,
+	GL_DEBUG_SEVERITY_MEDIUM,
+	GL_DEBUG_SEVERITY_LOW,
+	GL_DEBUG_SEVERITY_NOTIFICATION
+};
+
+CDebug::Message CDebug::m_messages[DEBUG_MESSAGES];
+int CDebug::m_count = 0;
+int CDebug::m_dropped = 0;
+int CDebug::m_severity = SEVERITY_DEFAULT;
+bool CDebug::m_output = false;
+
+CDebug::CDebug(void)
+{
+}
+
+CDebug::~CDebug(void)
+{
+}
+
+static const char *SourceName(GLenum source)
+{
+	switch (source) {
+	case GL_DEBUG_SOURCE_API:
+		return "api";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+		return "window";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER:
+		return "shader";
+	case GL_DEBUG_SOURCE_THIRD_PARTY:
+		return "third party";
+	case GL_DEBUG_SOURCE_APPLICATION:
+		return "application";
+	default:
+		return "other";
+	}
+}
+
+static const char *TypeName(GLenum type)
+{
+	switch (type) {
+	case GL_DEBUG_TYPE_ERROR:
+		return "error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+		return "deprecated";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+		return "undefined";
+	case GL_DEBUG_TYPE_PORTABILITY:
+		return "portability";
+	case GL_DEBUG_TYPE_PERFORMANCE:
+		return "performance";
+	case GL_DEBUG_TYPE_MARKER:
+		return "marker";
+	default:
+		return "other";
+	}
+}
+
+static const char *SeverityName(GLenum severity)
+{
+	switch (severity) {
+	case GL_DEBUG_SEVERITY_HIGH:
+		return "high";
+	case GL_DEBUG_SEVERITY_MEDIUM:
+		return "medium";
+	case GL_DEBUG_SEVERITY_LOW:
+		return "low";
+	default:
+		return "notification";
+	}
+}
+
+/**
+ * \brief
+ * Keeps the message for the next Check(), it is called within the GL call.
+ */
+void APIENTRY CDebug::Callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar *message, const void *userParam)
+{
+	Message *msg;
+
+	if (m_count >= DEBUG_MESSAGES) {
+		m_dropped++;
+		return;
+	}
+
+	if (length < 0)
+		length = (GLsizei)strlen(message);
+	if (length >= DEBUG_MESSAGE_MAX)
+		length = DEBUG_MESSAGE_MAX - 1;
+
+	msg = &m_messages[m_count++];
+	msg->source = source;
+	msg->type = type;
+	msg->severity = severity;
+	msg->id = id;
+	memcpy(msg->text, message, length);
+	msg->text[length] = '\0';
+}
+
+/**
+ * \brief
+ * The driver drops the messages below the severity, before the callback.
+ */
+int CDebug::Filter(void)
+{
+	int i;
+
+	if (!m_output)
+		return 0;
+
+	debugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+	for (i = 0; i < m_severity; i++)
+		debugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severities[i], 0, NULL, GL_TRUE);
+
+	return 0;
+}
+
+/**
+ * \brief
+ * 1 prints the errors of high severity only, 4 everything up to the
+ * notifications of the driver, 0 turns the output off.
+ * May be set before Load().
+ */
+int CDebug::SetSeverity(int severity)
+{
+	if (severity < 0 || severity > (int)(sizeof(severities) / sizeof(severities[0])))
+		return -EINVAL;
+
+	m_severity = severity;
+	return Filter();
+}
+
+/**
+ * \brief
+ * Installs the callback for the context which is current.
+ */
+int CDebug::Load(void)
+{
+#if !defined(NDEBUG)
+	PFNGLDEBUGMESSAGECALLBACKPROC debugMessageCallback = NULL;
+
+	if (GLAD_GL_VERSION_4_3) {
+		debugMessageCallback = glDebugMessageCallback;
+		debugMessageControl = glDebugMessageControl;
+	} else if (CMisc::ExtensionSupported("GL_KHR_debug")) {
+		debugMessageCallback = (PFNGLDEBUGMESSAGECALLBACKPROC)CMisc::ProcAddress("glDebugMessageCallback");
+		debugMessageControl = (PFNGLDEBUGMESSAGECONTROLPROC)CMisc::ProcAddress("glDebugMessageControl");
+	}
+
+	if (!debugMessageCallback || !debugMessageControl) {
+		cout << "No debug output, the errors are polled" << endl;
+		return -ENOSYS;
+	}
+
+	// Not a debug context might stay quiet, but it takes the callback
+	debugMessageCallback(Callback, NULL);
+	glEnable(GL_DEBUG_OUTPUT);
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	m_output = true;
+	Filter();
+
+	cout << "Debug output up to " << (m_severity ? SeverityName(severities[m_severity - 1]) : "none") << endl;
+#endif
+	return 0;
+}
+
+/**
+ * \brief
+ * Prints the messages of the calls since the last check, see StatusPrint().
+ */
+void CDebug::Check(const char *file, const char *func, int line)
+{
+	GLenum status;
+	int i;
+
+	if (!m_output) {
+		status = glGetError();
+		if (status != GL_NO_ERROR)
+			cerr << file << ":" << line << ":" << func << ": " << status << endl;
+		return;
+	}
+
+	if (m_count == 0)
+		return;
+
+	for (i = 0; i < m_count; i++) {
+		cerr << file << ":" << line << ":" << func << ": "
+			<< SourceName(m_messages[i].source) << " "
+			<< TypeName(m_messages[i].type) << " "
+			<< SeverityName(m_messages[i].severity) << " "
+			<< m_messages[i].id << ": " << m_messages[i].text << endl;
+	}
+
+	if (m_dropped > 0)
+		cerr << file << ":" << line << ":" << func << ": " << m_dropped << " more" << endl;
+
+	m_count = 0;
+	m_dropped = 0;
+}
+
+/* End of a file */
@@ -0,0 +1,51 @@
+#pragma once
+#if !defined(__CDEBUG_H)
+#define __CDEBUG_H
+
+#define DEBUG_MESSAGES 16	// Held until the next StatusPrint(), the rest are counted
+#define DEBUG_MESSAGE_MAX 256
+
+/**
+ * \brief
+ * The GL errors and warnings of the driver, by the callback of GL_DEBUG_OUTPUT
+ * (GL 4.3 or KHR_debug), which replaces the glGetError() of every StatusPrint().
+ *
+ * The output is synchronous, so a message is raised by the call which causes it.
+ * The callback keeps it and the next StatusPrint() prints it with its function
+ * and line, as the glGetError() did, without a round trip to the driver.
+ * Messages below the severity of SetSeverity() are filtered by the driver.
+ * Without the debug output StatusPrint() falls back to glGetError().
+ *
+ * Release builds (NDEBUG) leave StatusPrint() empty and Load() does nothing.
+ */
+class CDebug {
+private:
+	struct Message {
+		GLenum source;
+		GLenum type;
+		GLenum severity;
+		GLuint id;
+		char text[DEBUG_MESSAGE_MAX];
+	};
+
+	static Message m_messages[DEBUG_MESSAGES];
+	static int m_count;
+	static int m_dropped;
+	static int m_severity;	// 0: off, 1: high ... 4: notification
+	static bool m_output;	// GL_DEBUG_OUTPUT is enabled
+
+	static void APIENTRY Callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+		GLsizei length, const GLchar *message, const void *userParam);
+	static int Filter(void);
+
+	CDebug(void);
+	virtual ~CDebug(void);
+
+public:
+	static int SetSeverity(int severity);
+	static int Load(void);
+	static void Check(const char *file, const char *func, int line);
+};
+
+#endif
+/* End of a file */
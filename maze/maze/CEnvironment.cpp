@@ -13,13 +13,16 @@
 #include "CModel.h"
 #include "CPerspective.h"
 #include "CView.h"
-#include "CTexture.h"
+#include "CVertices.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
 
 using namespace std;
 
 CEnvironment *CEnvironment::m_instance = NULL;
 
 CEnvironment::CEnvironment(void)
+: m_object(-1)
 {
 
 }
@@ -51,25 +54,28 @@ void CEnvironment::Destroy(void)
 
 int CEnvironment::Load(void)
 {
+	if (m_object < 0)
+		m_object = CFrame::GetInstance()->AddObject(CFrame::WORLD);
 
-	
 	return 0;
 }
 
 int CEnvironment::Render(void)
 {
-	mat4 mvp;
+	CFrame::GetInstance()->BindObject(m_object);
+	CVertices::GetInstance()->Draw(CVertices::LAND);
 
-	mvp = CPerspective::GetInstance()->Matrix() * CView::GetInstance()->Matrix() * CModel::GetInstance()->Matrix();
-
-	
-	glUniformMatrix4fv(CShader::GetInstance()->MVPId(), 1, GL_TRUE, (const GLfloat *)mvp);
-	StatusPrint();
+	return 0;
+}
 
-	glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_INT, (void *)(sizeof(GLuint) * 46));
-	StatusPrint();
+int CEnvironment::Record(GLuint arg)
+{
+	return CMultiDraw::GetInstance()->Add(CVertices::LAND, m_object);
+}
 
-	return 0;
+GLuint CEnvironment::Program(void)
+{
+	return CShader::GetInstance()->Program(CShader::ENV);
 }
 
 /* End of a file */
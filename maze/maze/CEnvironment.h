@@ -8,6 +8,7 @@ private:
 	virtual ~CEnvironment(void);
 	static CEnvironment *m_instance;
 	GLint m_isEnvIdx;
+	int m_object; // Slot of CFrame
 
 public:
 	static CEnvironment *GetInstance(void);
@@ -15,6 +16,9 @@ public:
 
 	int Load(void);
 	int Render(void);
+	int Record(GLuint arg);
+	GLuint Program(void);
+	const char *Name(void) { return "Environment"; }
 };
 
 #endif
@@ -0,0 +1,461 @@
+/**
+ * \brief
+ * A cell is seen when the line from the eye to the nearest point of the cell
+ * crosses no wall, the cell at its end aside, so a wall is seen as it blocks.
+ * The line starts at the eye, not at the center of its cell, so the pass runs again
+ * when the eye moves by a step, FOG_STEPS steps a cell. An eye within a wall
+ * looks out of it, as the faces of the walls are culled from behind: the walls
+ * around the eye do not block until the line leaves them. The lines walk the
+ * cells of the maze, a 2D DDA as CLightmap does.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CMaze.h"
+#include "CFrame.h"
+#include "CTextureManager.h"
+#include "CObject.h"
+#include "CLod.h"
+#include "CMinimap.h"
+#include "CFog.h"
+
+using namespace std;
+
+#define FOG_STEPS 4	// Of a cell, a move of the eye by one runs the pass again
+#define FOG_INSET 0.05f	// Of the end of a line into its cell
+
+CFog *CFog::m_instance = NULL;
+
+CFog::CFog(void)
+: m_players(0)
+, m_width(0)
+, m_height(0)
+, m_pitch(0)
+, m_tilesX(0)
+, m_tilesY(0)
+, m_texture(0)
+, m_handle(0)
+, m_enabled(true)
+, m_loaded(false)
+{
+	int i;
+
+	for (i = 0; i < FOG_PLAYERS_MAX; i++) {
+		m_bits[i] = NULL;
+		m_dirty[i] = NULL;
+		m_eyes[i][0] = INT_MIN;
+		m_eyes[i][1] = INT_MIN;
+	}
+}
+
+CFog::~CFog(void)
+{
+	int i;
+
+	// The texture belongs to CTextureManager
+	if (m_handle > 0)
+		CTextureManager::GetInstance()->Release(m_handle);
+
+	for (i = 0; i < FOG_PLAYERS_MAX; i++) {
+		delete[] m_bits[i];
+		delete[] m_dirty[i];
+	}
+}
+
+CFog *CFog::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CFog();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CFog::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * Players which explore the maze, 0 for no fog. Should be called before Load().
+ */
+int CFog::SetPlayers(int players)
+{
+	if (m_loaded || players < 0 || players > FOG_PLAYERS_MAX)
+		return -EINVAL;
+
+	m_players = players;
+	return 0;
+}
+
+bool CFog::Enabled(void)
+{
+	return m_texture && m_enabled;
+}
+
+void CFog::Toggle(void)
+{
+	if (!m_texture)
+		return;
+
+	m_enabled = !m_enabled;
+	SetUniforms();
+	CLod::GetInstance()->Invalidate();
+	CMinimap::GetInstance()->Invalidate(0, 0, m_width, m_height);
+	cout << "Fog " << (m_enabled ? "on" : "off") << endl;
+}
+
+/**
+ * \brief
+ * Maze size and the player of maze.frag, player -1 is no fog.
+ */
+void CFog::SetUniforms(void)
+{
+	CShader *shader = CShader::GetInstance();
+	GLuint program;
+	GLint location;
+	int i;
+
+	for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+		glUseProgram(program);
+		location = glGetUniformLocation(program, "fog");
+		if (location >= 0)
+			glUniform3i(location, m_width, m_height, Enabled() ? 0 : -1);
+	}
+	shader->UseProgram();
+	StatusPrint();
+}
+
+bool CFog::Explored(int player, int x, int y)
+{
+	if (player < 0 || player >= m_players || !m_bits[player])
+		return false;
+
+	if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+		return false;
+
+	return (m_bits[player][y * m_pitch + (x >> 3)] >> (x & 7)) & 1;
+}
+
+/**
+ * \brief
+ * Should be called after CMaze is generated.
+ * The old GL has no integer textures, it has no fog.
+ */
+int CFog::Load(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	CTextureManager *manager = CTextureManager::GetInstance();
+	CShader *shader = CShader::GetInstance();
+	GLuint program;
+	GLint location;
+	GLint unit;
+	int tiles;
+	int i;
+
+	if (m_loaded)
+		return 0;
+
+	m_width = maze->Width();
+	m_height = maze->Height();
+
+	if (!__OLD_GL) {
+		// The sampler takes its unit with or without the fog, no two types may share a unit
+		for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+			glUseProgram(program);
+			location = glGetUniformLocation(program, "explored");
+			if (location >= 0)
+				glUniform1i(location, FOG_TEXTURE_UNIT);
+		}
+		SetUniforms();
+	}
+
+	if (__OLD_GL || m_players == 0) {
+		m_loaded = true;
+		return 0;
+	}
+
+	m_pitch = (m_width + 7) / 8;
+	m_tilesX = (m_width + FOG_TILE - 1) / FOG_TILE;
+	m_tilesY = (m_height + FOG_TILE - 1) / FOG_TILE;
+	tiles = (m_tilesX * m_tilesY + 7) / 8;
+
+	for (i = 0; i < m_players; i++) {
+		try {
+			m_bits[i] = new unsigned char[m_pitch * m_height];
+			m_dirty[i] = new unsigned char[tiles];
+		} catch (...) {
+			cerr << "Failed to allocate the fog" << endl;
+			return -ENOMEM;
+		}
+
+		memset(m_bits[i], 0, m_pitch * m_height);
+		memset(m_dirty[i], 0, tiles);
+	}
+
+	// Nothing is explored yet
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + FOG_TEXTURE_UNIT);
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, m_pitch, m_height, m_players, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (i = 0; i < m_players; i++)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, m_pitch, m_height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_bits[i]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(unit);
+	StatusPrint();
+
+	// The manager deletes the texture
+	m_handle = manager->Acquire("fog", 0);
+	if (m_handle < 0) {
+		glDeleteTextures(1, &m_texture);
+		m_texture = 0;
+		m_handle = 0;
+		cerr << "Failed to register the fog texture" << endl;
+		return -EFAULT;
+	}
+	manager->Assign(m_handle, GL_TEXTURE_2D_ARRAY, m_texture);
+	SetUniforms();
+	CMinimap::GetInstance()->Invalidate(0, 0, m_width, m_height);
+
+	cout << "Fog of " << m_players << " players, " << m_pitch * m_height * m_players << " bytes" << endl;
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Whether the cell x1, y1 is seen from the point gx, gy of the grid. The line
+ * goes to the point of the cell which is the nearest to the eye, so the face of
+ * a wall along a corridor is seen before the wall next to it blocks its center.
+ */
+bool CFog::Sees(float gx, float gy, int x1, int y1)
+{
+	CMaze *maze = CMaze::GetInstance();
+	float dx = min(max(gx, x1 + FOG_INSET), x1 + 1.0f - FOG_INSET) - gx;
+	float dy = min(max(gy, y1 + FOG_INSET), y1 + 1.0f - FOG_INSET) - gy;
+	float tMaxX;
+	float tMaxY;
+	float tDeltaX;
+	float tDeltaY;
+	int stepX;
+	int stepY;
+	int x = (int)floorf(gx);
+	int y = (int)floorf(gy);
+	bool inside = maze->IsWall(x, y);
+
+	stepX = dx > 0.0f ? 1 : -1;
+	stepY = dy > 0.0f ? 1 : -1;
+	tDeltaX = dx != 0.0f ? 1.0f / fabsf(dx) : FLT_MAX;
+	tDeltaY = dy != 0.0f ? 1.0f / fabsf(dy) : FLT_MAX;
+	tMaxX = dx != 0.0f ? (dx > 0.0f ? x + 1 - gx : gx - x) * tDeltaX : FLT_MAX;
+	tMaxY = dy != 0.0f ? (dy > 0.0f ? y + 1 - gy : gy - y) * tDeltaY : FLT_MAX;
+
+	// The end of the line is within the cell, whatever the rounding
+	while (min(tMaxX, tMaxY) < 1.0f) {
+		if (tMaxX < tMaxY) {
+			x += stepX;
+			tMaxX += tDeltaX;
+		} else {
+			y += stepY;
+			tMaxY += tDeltaY;
+		}
+
+		if (x == x1 && y == y1)
+			return true;
+
+		if (!maze->IsWall(x, y))
+			inside = false;
+		else if (!inside)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief
+ * A cell is explored, its tile is uploaded by Update().
+ * The impostor of its chunk and the minimap show the fog of player 0, the
+ * chunk is captured again and the cell is packed again.
+ */
+void CFog::Mark(int player, int x, int y)
+{
+	unsigned char *byte = &m_bits[player][y * m_pitch + (x >> 3)];
+	int tile;
+
+	if (*byte & (1 << (x & 7)))
+		return;
+
+	*byte |= 1 << (x & 7);
+	tile = y / FOG_TILE * m_tilesX + x / FOG_TILE;
+	m_dirty[player][tile >> 3] |= 1 << (tile & 7);
+
+	if (player == 0) {
+		CLod::GetInstance()->Invalidate(y / CHUNK_SIZE * ((m_width + CHUNK_SIZE - 1) / CHUNK_SIZE) + x / CHUNK_SIZE);
+		CMinimap::GetInstance()->Invalidate(x, y, x + 1, y + 1);
+	}
+}
+
+/**
+ * \brief
+ * Visibility pass of a player whose eye is at a point of the model space,
+ * returns 0 when the eye stays within the step of the last pass.
+ */
+int CFog::See(int player, const vec3 &eye)
+{
+	static const int sides[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	CMaze *maze = CMaze::GetInstance();
+	bool seen[FOG_RADIUS * 2 + 3][FOG_RADIUS * 2 + 3];
+	float gx;
+	float gy;
+	int ex;
+	int ey;
+	int nx;
+	int ny;
+	int x;
+	int y;
+	int i;
+
+	if (player < 0 || player >= m_players)
+		return -EINVAL;
+
+	if (!m_bits[player])
+		return 0;
+
+	// Cells of the grid, cell x spans [x, x + 1)
+	gx = eye.x / BLOCK_WIDTH + (m_width / 2) + 0.5f;
+	gy = eye.z / BLOCK_WIDTH + (m_height / 2) + 0.5f;
+	x = (int)floorf(gx * FOG_STEPS);
+	y = (int)floorf(gy * FOG_STEPS);
+	if (x == m_eyes[player][0] && y == m_eyes[player][1])
+		return 0;
+
+	m_eyes[player][0] = x;
+	m_eyes[player][1] = y;
+	ex = (int)floorf(gx);
+	ey = (int)floorf(gy);
+
+	// A border of a cell for the neighbours below
+	memset(seen, 0, sizeof(seen));
+	for (y = max(ey - FOG_RADIUS, 0); y <= min(ey + FOG_RADIUS, m_height - 1); y++) {
+		for (x = max(ex - FOG_RADIUS, 0); x <= min(ex + FOG_RADIUS, m_width - 1); x++) {
+			if ((x - ex) * (x - ex) + (y - ey) * (y - ey) > FOG_RADIUS * FOG_RADIUS)
+				continue;
+
+			if ((x == ex && y == ey) || Sees(gx, gy, x, y)) {
+				seen[y - ey + FOG_RADIUS + 1][x - ex + FOG_RADIUS + 1] = true;
+				Mark(player, x, y);
+			}
+		}
+	}
+
+	// The lines only graze the faces along a corridor, a face is seen with the cell before it
+	for (y = max(ey - FOG_RADIUS, 0); y <= min(ey + FOG_RADIUS, m_height - 1); y++) {
+		for (x = max(ex - FOG_RADIUS, 0); x <= min(ex + FOG_RADIUS, m_width - 1); x++) {
+			if (!maze->IsWall(x, y) || seen[y - ey + FOG_RADIUS + 1][x - ex + FOG_RADIUS + 1])
+				continue;
+
+			for (i = 0; i < 4; i++) {
+				nx = x + sides[i][0];
+				ny = y + sides[i][1];
+				if (!seen[ny - ey + FOG_RADIUS + 1][nx - ex + FOG_RADIUS + 1] || maze->IsWall(nx, ny))
+					continue;
+
+				// The face looks at the eye
+				if ((sides[i][0] < 0 && gx < x) || (sides[i][0] > 0 && gx > x + 1)
+					|| (sides[i][1] < 0 && gy < y) || (sides[i][1] > 0 && gy > y + 1)) {
+					Mark(player, x, y);
+					break;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * \brief
+ * Visibility pass of the players from the eyes of their viewports of CFrame,
+ * then the dirty tiles of every player are uploaded. Returns the count of the uploads.
+ */
+int CFog::Update(void)
+{
+	CFrame *frame = CFrame::GetInstance();
+	mat4 inv;
+	vec4 eye;
+	GLint unit;
+	int uploads = 0;
+	int tile;
+	int width;
+	int height;
+	int x;
+	int y;
+	int i;
+
+	if (!Enabled())
+		return 0;
+
+	// A viewport of the split-screen is a player
+	for (i = 0; i < min(frame->Viewports(), m_players); i++) {
+		inv = (mat4(frame->View(i)) * frame->World()).inverse();
+		eye = inv * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		See(i, vec3(eye.x, eye.y, eye.z) / eye.w);
+	}
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + FOG_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_pitch);
+
+	// A tile is FOG_TILE / 8 bytes of FOG_TILE rows
+	for (i = 0; i < m_players; i++) {
+		for (tile = 0; tile < m_tilesX * m_tilesY; tile++) {
+			if (!(m_dirty[i][tile >> 3] & (1 << (tile & 7))))
+				continue;
+
+			x = tile % m_tilesX * (FOG_TILE / 8);
+			y = tile / m_tilesX * FOG_TILE;
+			width = min(FOG_TILE / 8, m_pitch - x);
+			height = min(FOG_TILE, m_height - y);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, i, width, height, 1,
+				GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_bits[i] + y * m_pitch + x);
+			m_dirty[i][tile >> 3] &= ~(1 << (tile & 7));
+			uploads++;
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(unit);
+	StatusPrint();
+	return uploads;
+}
+
+/* End of a file */
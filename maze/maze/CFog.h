@@ -0,0 +1,68 @@
+#pragma once
+#if !defined(__CFOG_H)
+#define __CFOG_H
+
+#define FOG_PLAYERS_MAX 4	// Local players, a layer of the texture each
+#define FOG_TILE 64	// Cells per side of a tile, a tile is uploaded as a whole
+#define FOG_RADIUS 12	// Cells which a player sees around it
+
+/**
+ * \brief
+ * Cells of CMaze which every player has seen, the others are drawn dark.
+ *
+ * A player has a bit a cell, eight cells of a row in a byte, and a bit a
+ * FOG_TILE x FOG_TILE tile which is set when a cell of the tile is seen first.
+ * See() is the visibility pass of a player: the cells within FOG_RADIUS of its
+ * eye which a line of sight reaches through the corridors, walls included.
+ * It runs again when the eye moves by a part of a cell. Update() uploads the
+ * dirty tiles only, to an R8UI array of the same bits, a layer a player, which
+ * maze.frag reads for the walls and the land. The eye of a player is the one of
+ * its viewport of the split-screen, see CFrame.
+ *
+ * The impostors of CLod are captured with the fog of player 0, a chunk is
+ * captured again when player 0 sees a cell of it first. CMinimap shows the
+ * fog of player 0 as well, the cell is packed again.
+ */
+class CFog {
+private:
+	unsigned char *m_bits[FOG_PLAYERS_MAX];	// Explored cells, rows of m_pitch bytes
+	unsigned char *m_dirty[FOG_PLAYERS_MAX];	// Tiles to upload
+	int m_eyes[FOG_PLAYERS_MAX][2];	// Step of the eye of the last pass, see CFog.cpp
+
+	int m_players;
+	int m_width;	// Cells of the maze
+	int m_height;
+	int m_pitch;	// Bytes of a row
+	int m_tilesX;
+	int m_tilesY;
+
+	GLuint m_texture;
+	int m_handle;	// Of CTextureManager
+	bool m_enabled;
+	bool m_loaded;
+
+	bool Sees(float gx, float gy, int x1, int y1);
+	void Mark(int player, int x, int y);
+	void SetUniforms(void);
+
+	CFog(void);
+	virtual ~CFog(void);
+
+	static CFog *m_instance;
+
+public:
+	static CFog *GetInstance(void);
+	void Destroy(void);
+
+	int SetPlayers(int players);
+	int Load(void);
+	int See(int player, const vec3 &eye);
+	int Update(void);
+	bool Explored(int player, int x, int y);
+
+	bool Enabled(void);
+	void Toggle(void);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,583 @@
+/**
+ * \brief
+ * Uniform blocks which replace the "mvp" uniform of every draw.
+ * Update() writes the camera once per frame, the objects register a slot
+ * by AddObject() and only point the "drawId" attribute at it before drawing.
+ * The matrices are blended between the last two snapshots of the simulation,
+ * a tick turns the camera by a few degrees at most, so the blend of the elements
+ * is close enough to the rotation between them.
+ */
+
+#include <iostream>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CMovable.h"
+#include "CModel.h"
+#include "CPerspective.h"
+#include "CView.h"
+#include "CRingBuffer.h"
+#include "CLights.h"
+#include "CFrame.h"
+
+using namespace std;
+
+// Any instance count is below this, so "drawId" always reads element baseInstance
+#define DRAW_ID_DIVISOR 0x40000000
+
+// Cameras (main, impostor captures and shadow faces) and object updates of a frame
+#define FRAME_ALLOCS 16
+
+CFrame *CFrame::m_instance = NULL;
+
+static bool Same(const mat4 &a, const mat4 &b)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (a[i] != b[i])
+			return false;
+	}
+
+	return true;
+}
+
+static mat4 Blend(const mat4 &from, const mat4 &to, float alpha)
+{
+	mat4 m;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = from[i] + (to[i] - from[i]) * alpha;
+
+	return m;
+}
+
+CFrame::CFrame(void)
+: m_ring(NULL)
+, m_drawIdVBO(0)
+, m_drawIdId(-1)
+, m_objectCount(0)
+, m_objectsDirty(true)
+, m_modelsChanged(false)
+, m_version(1)
+, m_drawnVersion(0)
+, m_cameraOffset(0)
+, m_mainOffset(0)
+, m_viewports(1)
+, m_program(0)
+, m_loaded(false)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < OBJECT_MAX; i++) {
+		m_objectFlags[i] = 0;
+		m_mvpValid[i] = false;
+		for (j = 0; j < 4; j++)
+			m_objects.flags[i][j] = 0;
+	}
+
+	for (i = 0; i < VIEWPORT_MAX; i++) {
+		for (j = 0; j < 4; j++)
+			m_rects[i][j] = 0;
+	}
+}
+
+CFrame::~CFrame(void)
+{
+	delete m_ring;
+	glDeleteBuffers(1, &m_drawIdVBO);
+}
+
+CFrame *CFrame::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CFrame();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CFrame::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * Should be called after the shader and CVertices are loaded.
+ */
+int CFrame::Load(void)
+{
+	CShader *shader = CShader::GetInstance();
+	GLuint drawId[OBJECT_MAX];
+	GLuint program;
+	int i;
+
+	if (m_loaded)
+		return 0;
+
+	if (__OLD_GL) {
+		m_loaded = true;
+		return 0;
+	}
+
+	// Every variant of the main program reads the same blocks
+	for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+		if (BindProgram(program) < 0) {
+			cerr << "Shader does not have the frame uniform blocks" << endl;
+			return -EFAULT;
+		}
+	}
+
+	m_drawIdId = shader->AttribLocation("drawId");
+	if (m_drawIdId < 0) {
+		cerr << "Shader does not have the draw id" << endl;
+		return -EFAULT;
+	}
+
+	try {
+		m_ring = new CRingBuffer(GL_UNIFORM_BUFFER, (sizeof(Objects) + sizeof(Frame)) * FRAME_ALLOCS);
+	} catch (...) {
+		cerr << "Failed to allocate the frame buffer" << endl;
+		return -EFAULT;
+	}
+
+	if (m_ring->Load() < 0) {
+		delete m_ring;
+		m_ring = NULL;
+		return -EFAULT;
+	}
+
+	for (i = 0; i < OBJECT_MAX; i++)
+		drawId[i] = i;
+
+	glGenBuffers(1, &m_drawIdVBO);
+	CVertices::GetInstance()->BindVAO();
+	glBindBuffer(GL_ARRAY_BUFFER, m_drawIdVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(drawId), drawId, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(m_drawIdId);
+	glVertexAttribIPointer(m_drawIdId, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(m_drawIdId, DRAW_ID_DIVISOR);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CVertices::GetInstance()->UnbindVAO();
+	StatusPrint();
+
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Connects the uniform blocks of a program to the buffers of this class.
+ * A program may use either of them.
+ */
+int CFrame::BindProgram(GLuint program)
+{
+	GLuint frameIdx;
+	GLuint objectsIdx;
+
+	frameIdx = glGetUniformBlockIndex(program, "Frame");
+	objectsIdx = glGetUniformBlockIndex(program, "Objects");
+	if (frameIdx == GL_INVALID_INDEX && objectsIdx == GL_INVALID_INDEX)
+		return -EINVAL;
+
+	if (frameIdx != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, frameIdx, FRAME_BINDING);
+
+	if (objectsIdx != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, objectsIdx, OBJECTS_BINDING);
+
+	StatusPrint();
+	return 0;
+}
+
+/**
+ * \brief
+ * Reserves an object slot, the slot is returned.
+ * Only the INSTANCED object gets slot 0, see CMultiDraw.
+ */
+int CFrame::AddObject(unsigned int flags)
+{
+	int object;
+
+	if (flags & INSTANCED) {
+		if (m_objectFlags[0] & INSTANCED)
+			return -EBUSY;
+		object = 0;
+	} else {
+		if (m_objectCount == 0)
+			m_objectCount = 1;
+
+		if (m_objectCount >= OBJECT_MAX)
+			return -ENOSPC;
+		object = m_objectCount++;
+	}
+
+	m_objectFlags[object] = flags;
+	m_objects.model[object].setIdentity();
+	m_models[object].setIdentity();
+	m_objects.flags[object][0] = (flags & BLOCK) ? 1 : 0;
+	m_objectsDirty = true;
+	return object;
+}
+
+/**
+ * \brief
+ * Only the objects which move by themselves need this, WORLD objects follow CModel.
+ * The model is published by the next Capture().
+ */
+int CFrame::SetModel(int object, const mat4 &model)
+{
+	if (object < 0 || object >= OBJECT_MAX)
+		return -EINVAL;
+
+	if (Same(m_models[object], model))
+		return 0;
+
+	m_models[object] = model;
+	m_modelsChanged = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Copies the camera and the models of the tick which has just run.
+ * Returns 1 if they changed since the last capture.
+ */
+int CFrame::Capture(Snapshot *snapshot)
+{
+	bool changed;
+	int i;
+
+	if (!snapshot)
+		return -EINVAL;
+
+	// Matrix() clears the flags
+	changed = CModel::GetInstance()->Updated() || m_modelsChanged;
+	for (i = 0; i < m_viewports; i++)
+		changed = CView::GetInstance(i)->Updated() || changed;
+	if (changed) {
+		m_version++;
+		m_modelsChanged = false;
+	}
+	snapshot->version = m_version;
+
+	for (i = 0; i < m_viewports; i++)
+		snapshot->views[i] = CView::GetInstance(i)->Matrix();
+	snapshot->world = CModel::GetInstance()->Matrix();
+
+	for (i = 0; i < OBJECT_MAX; i++) {
+		if (m_objectFlags[i] & WORLD)
+			m_models[i] = snapshot->world;
+		snapshot->models[i] = m_models[i];
+	}
+
+	return changed ? 1 : 0;
+}
+
+/**
+ * \brief
+ * Whether Update() of the snapshots would draw something else than the last frame.
+ */
+bool CFrame::Changed(const Snapshot &previous, const Snapshot &current)
+{
+	int i;
+
+	if (previous.version != current.version || current.version != m_drawnVersion)
+		return true;
+
+	for (i = 0; i < m_viewports; i++) {
+		if (CPerspective::GetInstance(i)->Updated())
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * \brief
+ * Writes the camera of the frame. Should be called first in a frame.
+ * alpha is the time since the current tick over the tick, 0.0f draws the previous one.
+ */
+int CFrame::Update(const Snapshot &previous, const Snapshot &current, float alpha)
+{
+	int status;
+	int i;
+
+	// Every range of the last frame is consumed by the commands issued so far
+	if (m_ring)
+		m_ring->Fence();
+
+	// The blend of the same version is the same, the matrices of the last frame are kept
+	if (Changed(previous, current)) {
+		m_world = Blend(previous.world, current.world, alpha);
+		for (i = 0; i < OBJECT_MAX; i++)
+			m_objects.model[i] = Blend(previous.models[i], current.models[i], alpha);
+
+		for (i = 0; i < m_viewports; i++)
+			m_views[i] = Blend(previous.views[i], current.views[i], alpha);
+		InvalidateMVP();
+	}
+	m_drawnVersion = previous.version == current.version ? current.version : 0;
+
+	// The range of the last frame is in another region now
+	m_objectsDirty = true;
+
+	status = SetCamera(m_views[0], CPerspective::GetInstance()->Matrix(), true);
+	if (status < 0)
+		return status;
+
+	m_mainViewProjection = m_viewProjection;
+	m_mainOffset = m_cameraOffset;
+
+	// The packets of any program may read the objects from now on
+	return FlushObjects();
+}
+
+/**
+ * \brief
+ * The main camera of a viewport and CModel as drawn in this frame, for the passes
+ * which have to agree with the draws such as the culling.
+ */
+const mat4 &CFrame::View(int idx)
+{
+	if (idx < 0 || idx >= m_viewports)
+		idx = 0;
+
+	return m_views[idx];
+}
+
+const mat4 &CFrame::World(void)
+{
+	return m_world;
+}
+
+/**
+ * \brief
+ * The model of an object as drawn in this frame, object 0 for an invalid one.
+ */
+const mat4 &CFrame::Model(int object)
+{
+	if (object < 0 || object >= OBJECT_MAX)
+		object = 0;
+
+	return m_objects.model[object];
+}
+
+/**
+ * \brief
+ * Rectangles of the viewports in the window, a CView and a CPerspective each.
+ * Should be called before the simulation starts, see CUI::SetViewports().
+ */
+int CFrame::SetViewports(int count, const GLint rects[][4])
+{
+	int i;
+	int j;
+
+	if (count < 1 || count > VIEWPORT_MAX || !rects)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < 4; j++)
+			m_rects[i][j] = rects[i][j];
+	}
+
+	m_viewports = count;
+	return 0;
+}
+
+int CFrame::Viewports(void)
+{
+	return m_viewports;
+}
+
+const GLint *CFrame::Viewport(int idx)
+{
+	if (idx < 0 || idx >= m_viewports)
+		return NULL;
+
+	return m_rects[idx];
+}
+
+/**
+ * \brief
+ * Binds another camera, such as the one of an impostor capture.
+ * RestoreCamera() binds the camera of Update() again.
+ * main is set by Update() only, the lights are binned for that camera,
+ * and it draws into every viewport.
+ */
+int CFrame::SetCamera(const mat4 &view, const mat4 &projection, bool main)
+{
+	mat4 viewProjection = mat4(projection) * view;
+	Frame *frame;
+	GLintptr offset;
+	int count;
+	int i;
+	int j;
+
+	if (!Same(viewProjection, m_viewProjection)) {
+		m_viewProjection = viewProjection;
+		InvalidateMVP();
+	}
+	if (!m_ring)
+		return 0;
+
+	frame = (Frame *)m_ring->Alloc(sizeof(*frame), &offset);
+	if (!frame) {
+		cerr << "Frame buffer is full" << endl;
+		return -ENOSPC;
+	}
+
+	frame->view = view;
+	frame->projection = projection;
+	frame->viewProjection = m_viewProjection;
+	CLights::GetInstance()->Grid(main, frame->clusterScale, frame->clusterGrid, frame->ambient);
+
+	count = main ? m_viewports : 1;
+	for (i = 0; i < count; i++) {
+		frame->views[i] = main ? m_views[i] : view;
+		frame->viewProjections[i] = main ? mat4(CPerspective::GetInstance(i)->Matrix()) * m_views[i] : m_viewProjection;
+		for (j = 0; j < 4; j++)
+			frame->viewportRects[i][j] = main ? (GLfloat)m_rects[i][j] : 0.0f;
+	}
+	frame->viewports[0] = count;
+	frame->viewports[1] = frame->viewports[2] = frame->viewports[3] = 0;
+	m_ring->Flush();
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, m_ring->Buffer(), offset, sizeof(*frame));
+	m_cameraOffset = offset;
+	return 0;
+}
+
+int CFrame::RestoreCamera(void)
+{
+	if (!Same(m_mainViewProjection, m_viewProjection)) {
+		m_viewProjection = m_mainViewProjection;
+		InvalidateMVP();
+	}
+	if (!m_ring)
+		return 0;
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING, m_ring->Buffer(), m_mainOffset, sizeof(Frame));
+	return 0;
+}
+
+void CFrame::InvalidateMVP(void)
+{
+	int i;
+
+	for (i = 0; i < OBJECT_MAX; i++)
+		m_mvpValid[i] = false;
+}
+
+int CFrame::FlushObjects(void)
+{
+	Objects *objects;
+	GLintptr offset;
+	int i;
+	int j;
+
+	if (!m_objectsDirty || !m_ring)
+		return 0;
+
+	objects = (Objects *)m_ring->Alloc(sizeof(*objects), &offset);
+	if (!objects) {
+		cerr << "Frame buffer is full" << endl;
+		return -ENOSPC;
+	}
+
+	for (i = 0; i < OBJECT_MAX; i++) {
+		objects->model[i] = m_objects.model[i];
+		for (j = 0; j < 4; j++)
+			objects->flags[i][j] = m_objects.flags[i][j];
+	}
+	m_ring->Flush();
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECTS_BINDING, m_ring->Buffer(), offset, sizeof(*objects));
+	m_objectsDirty = false;
+	return 0;
+}
+
+/**
+ * \brief
+ * Distance from the eye of the frame to a point of an object along the view direction,
+ * the depth of the packets of CRenderQueue. The split-screen sorts by the first viewport.
+ */
+float CFrame::Depth(int object, const vec3 &position)
+{
+	const float *m;
+	float z = 0.0f;
+	float row;
+	int i;
+
+	if (object < 0 || object >= OBJECT_MAX)
+		return 0.0f;
+
+	m = m_objects.model[object];
+
+	// Only the z row of view * model is needed
+	for (i = 0; i < 4; i++) {
+		row = m_views[0]._31 * m[i] + m_views[0]._32 * m[4 + i] + m_views[0]._33 * m[8 + i] + m_views[0]._34 * m[12 + i];
+		z += row * (i < 3 ? position[i] : 1.0f);
+	}
+
+	return -z;
+}
+
+/**
+ * \brief
+ * The variant which CRenderQueue binds for the next draws, 0 for the main program.
+ * The old shader finds its MVP uniform in it, the GL state is not queried per draw.
+ */
+void CFrame::UseProgram(GLuint program)
+{
+	m_program = program;
+}
+
+/**
+ * \brief
+ * Selects the object of the next draws, the VAO of CVertices should be bound.
+ * "drawId" reads element [object + baseInstance], so CMultiDraw binds object 0.
+ */
+int CFrame::BindObject(int object)
+{
+	if (object < 0 || object >= OBJECT_MAX)
+		return -EINVAL;
+
+	if (!m_ring) {
+		// Old shader, the only path which still uploads uniforms per draw
+		if (!m_mvpValid[object]) {
+			m_mvp[object] = m_viewProjection * m_objects.model[object];
+			m_mvpValid[object] = true;
+		}
+		// The variant which CRenderQueue has bound for the object
+		glUniformMatrix4fv(CShader::GetInstance()->MVPId(m_program), 1, GL_TRUE, (const GLfloat *)m_mvp[object]);
+		StatusPrint();
+		return 0;
+	}
+
+	FlushObjects();
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_drawIdVBO);
+	glVertexAttribIPointer(m_drawIdId, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void *)(sizeof(GLuint) * object));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return 0;
+}
+
+/* End of a file */
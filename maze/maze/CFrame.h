@@ -0,0 +1,142 @@
+#pragma once
+#if !defined(__CFRAME_H)
+#define __CFRAME_H
+
+#define OBJECT_MAX 8	// Same as maze.vert
+
+class CRingBuffer;
+
+/**
+ * \brief
+ * Frame constants (view, projection, viewProjection) and the per-object data
+ * (model, flags) in two uniform blocks. The camera is written once per frame,
+ * the objects are written whenever a model changes, both through a ring buffer.
+ *
+ * A draw selects its object by the "drawId" attribute, which reads
+ * element [object + baseInstance] of a constant buffer (see BindObject),
+ * so no uniform is uploaded per draw.
+ * The old shader has no uniform blocks, "mvp" is uploaded instead.
+ *
+ * The simulation thread moves the camera and the models at a fixed tick and
+ * publishes a Snapshot of them by Capture(), Update() draws the frame between
+ * the last two snapshots. SetModel() and Capture() belong to the simulation thread,
+ * the rest to the render thread.
+ *
+ * A snapshot carries the version of the state, which goes up when the
+ * Updated() flag of CView or CModel or a model of SetModel() says it changed,
+ * so Changed() tells whether a frame would draw the same as the last one.
+ *
+ * The split-screen has a CView and a CPerspective a viewport, see SetViewports().
+ * The main camera carries all of them in the arrays of the Frame block, maze.geom
+ * draws a primitive into every viewport, so the draws are not repeated a viewport.
+ * View() and the old shader are the camera of the first viewport.
+ */
+class CFrame {
+public:
+	enum Flag {
+		BLOCK = 0x01,	// Textured block, offset by instance
+		WORLD = 0x02,	// Model follows CModel
+		INSTANCED = 0x04	// Object 0, its per-instance attributes start at the first element
+	};
+
+	// Camera and models of a tick, not changed once published
+	struct Snapshot {
+		mat4 views[VIEWPORT_MAX];	// A camera a viewport
+		mat4 world;	// CModel
+		mat4 models[OBJECT_MAX];
+		double time;	// glfwGetTime() of the tick
+		unsigned int version;	// Of the camera and the models
+	};
+
+private:
+	enum Binding {
+		FRAME_BINDING = 0x00,
+		OBJECTS_BINDING = 0x01
+	};
+
+	// std140 layout of maze.vert, matrices are row major as cgmath
+	struct Frame {
+		mat4 view;
+		mat4 projection;
+		mat4 viewProjection;
+		GLfloat clusterScale[4];	// See CLights::Grid
+		GLint clusterGrid[4];
+		GLfloat ambient[4];
+		mat4 views[VIEWPORT_MAX];	// Of the viewports, see maze.geom
+		mat4 viewProjections[VIEWPORT_MAX];
+		GLfloat viewportRects[VIEWPORT_MAX][4];	// x, y, width, height in pixels
+		GLint viewports[4];	// x: count, 1 for a camera which is not the main one
+	};
+
+	struct Objects {
+		mat4 model[OBJECT_MAX];
+		GLint flags[OBJECT_MAX][4];
+	};
+
+	CRingBuffer *m_ring;
+	GLuint m_drawIdVBO;
+	GLint m_drawIdId;
+
+	Objects m_objects;	// Interpolated, as uploaded
+	unsigned int m_objectFlags[OBJECT_MAX];
+	int m_objectCount;
+	bool m_objectsDirty;
+
+	mat4 m_models[OBJECT_MAX];	// Simulation thread
+	bool m_modelsChanged;
+	unsigned int m_version;
+	unsigned int m_drawnVersion;	// Blended state of the last Update(), 0: between two versions
+
+	mat4 m_views[VIEWPORT_MAX];	// Main cameras, interpolated
+	mat4 m_world;	// CModel, interpolated
+	mat4 m_viewProjection;	// Bound camera
+	mat4 m_mainViewProjection;
+	GLintptr m_cameraOffset;
+	GLintptr m_mainOffset;
+
+	GLint m_rects[VIEWPORT_MAX][4];	// Of the window, see SetViewports()
+	int m_viewports;
+
+	// Old shader, viewProjection * model of the bound camera
+	mat4 m_mvp[OBJECT_MAX];
+	bool m_mvpValid[OBJECT_MAX];
+	GLuint m_program;	// Variant of the next draws, 0: the main program, see UseProgram()
+
+	bool m_loaded;
+
+	int FlushObjects(void);
+	void InvalidateMVP(void);
+
+	CFrame(void);
+	virtual ~CFrame(void);
+
+	static CFrame *m_instance;
+
+public:
+	static CFrame *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+	int BindProgram(GLuint program);
+
+	int AddObject(unsigned int flags);
+	int SetModel(int object, const mat4 &model);
+
+	int Capture(Snapshot *snapshot);
+	bool Changed(const Snapshot &previous, const Snapshot &current);
+	int Update(const Snapshot &previous, const Snapshot &current, float alpha);
+	const mat4 &View(int idx = 0);
+	const mat4 &World(void);
+	const mat4 &Model(int object);
+	int SetViewports(int count, const GLint rects[][4]);
+	int Viewports(void);
+	const GLint *Viewport(int idx);
+	int SetCamera(const mat4 &view, const mat4 &projection, bool main = false);
+	int RestoreCamera(void);
+	void UseProgram(GLuint program);
+	int BindObject(int object);
+	float Depth(int object, const vec3 &position);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,683 @@
+/**
+ * \brief
+ * A texel of a face is lit as a point of the face, pushed off it by BAKE_BIAS:
+ * the ambient light times the rays of a fixed hemisphere pattern which leave
+ * the walls, plus the torches which it sees, with the falloff of maze.frag.
+ * The torches of a wall are the ones whose spheres reach it, found once a wall.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CMaze.h"
+#include "CTextureManager.h"
+#include "CLights.h"
+#include "CLightmap.h"
+
+#if defined(_WIN32)
+	// Define for windows
+#include <direct.h>
+#define MKDIR(path) _mkdir(path)
+#else
+	// Define for linux
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
+using namespace std;
+
+#define LIGHTMAP_RANGE 2.0f	// Light of a texel at 255, same as maze.frag
+#define BAKE_BIAS 0.01f	// Off the face, so a ray does not start in its wall
+#define AO_RAYS 32
+#define AO_DISTANCE BLOCK_WIDTH	// A cell of the model space
+#define AO_STRENGTH 0.8f	// Of the ambient, which a fully occluded texel loses
+
+#define CACHE_DIR "lightcache"
+#define CACHE_MAGIC 0x4d4c5a4d	// "MZLM"
+#define CACHE_VERSION 1
+
+enum Texture {
+	ATLAS = 0x00,
+	CELLS = 0x01
+};
+
+// Header of a cache file, followed by the layers of the atlas
+struct CacheHeader {
+	GLuint magic;
+	GLuint version;
+	GLuint width;	// Of the maze
+	GLuint height;
+	GLuint layers;
+	GLuint texels;	// LIGHTMAP_TEXELS
+	GLuint lights;
+	GLuint hash;	// Of the walls and the lights
+};
+
+// Forward and up of the faces, same as CShadows.cpp and maze.frag
+static const float faces[LIGHTMAP_FACES][2][3] = {
+	{ { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { 0.0f, 0.0f, -1.0f }, { 0.0f, 1.0f, 0.0f } },
+};
+
+CLightmap *CLightmap::m_instance = NULL;
+
+CLightmap::CLightmap(void)
+: m_atlas(NULL)
+, m_cells(NULL)
+, m_width(0)
+, m_height(0)
+, m_layers(0)
+, m_hash(0)
+, m_nextJob(0)
+, m_mode(RUNTIME)
+, m_loaded(false)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		m_textures[i] = 0;
+		m_handles[i] = 0;
+	}
+}
+
+CLightmap::~CLightmap(void)
+{
+	int i;
+
+	// The textures belong to CTextureManager
+	for (i = 0; i < 2; i++) {
+		if (m_handles[i] > 0)
+			CTextureManager::GetInstance()->Release(m_handles[i]);
+	}
+
+	delete[] m_atlas;
+	delete[] m_cells;
+}
+
+CLightmap *CLightmap::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CLightmap();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CLightmap::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * Should be called before Load().
+ */
+int CLightmap::SetMode(int mode)
+{
+	if (mode < RUNTIME || mode > VERTEX_AO || m_loaded)
+		return -EINVAL;
+
+	m_mode = (Mode)mode;
+	return 0;
+}
+
+CLightmap::Mode CLightmap::GetMode(void)
+{
+	return m_mode;
+}
+
+bool CLightmap::IsWall(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+		return false;
+
+	return m_cells[y * m_width + x] != LIGHTMAP_CELL_OPEN;
+}
+
+/**
+ * \brief
+ * Numbers the walls of every chunk in the order of CMaze::FillOffsets,
+ * and hashes them with the lights for the cache.
+ */
+int CLightmap::BuildCells(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	CLights *lights = CLights::GetInstance();
+	const CMaze::Chunk *chunk;
+	const CLights::Light *light;
+	const unsigned char *bytes;
+	unsigned char slot;
+	int c;
+	int x;
+	int y;
+	int i;
+
+	m_width = maze->Width();
+	m_height = maze->Height();
+	m_layers = maze->ChunkCount();
+
+	try {
+		m_cells = new unsigned char[m_width * m_height];
+	} catch (...) {
+		cerr << "Failed to allocate the lightmap cells" << endl;
+		return -ENOMEM;
+	}
+
+	memset(m_cells, LIGHTMAP_CELL_OPEN, m_width * m_height);
+	for (c = 0; c < m_layers; c++) {
+		chunk = maze->GetChunk(c);
+		slot = 0;
+		for (y = chunk->y0; y < chunk->y1; y++) {
+			for (x = chunk->x0; x < chunk->x1; x++) {
+				if (maze->IsWall(x, y))
+					m_cells[y * m_width + x] = slot++;
+			}
+		}
+	}
+
+	// FNV-1a
+	m_hash = 2166136261u;
+	for (i = 0; i < m_width * m_height; i++)
+		m_hash = (m_hash ^ m_cells[i]) * 16777619u;
+
+	for (i = 0; i < lights->Count(); i++) {
+		light = lights->GetLight(i);
+		bytes = (const unsigned char *)light;
+		for (c = 0; c < (int)(sizeof(float) * 7); c++)
+			m_hash = (m_hash ^ bytes[c]) * 16777619u;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Walks the cells of the segment in the model space, a 2D DDA in x and z.
+ * A wall blocks it if the segment is within the height of the wall in that cell.
+ */
+bool CLightmap::Blocked(const vec3 &from, const vec3 &to)
+{
+	float gx;
+	float gz;
+	float dx;
+	float dz;
+	float tMaxX;
+	float tMaxZ;
+	float tDeltaX;
+	float tDeltaZ;
+	float t = 0.0f;
+	float next;
+	float y0;
+	float y1;
+	int stepX;
+	int stepZ;
+	int x;
+	int z;
+
+	// Cells of the grid, cell x spans [x, x + 1)
+	gx = from.x / BLOCK_WIDTH + (m_width / 2) + 0.5f;
+	gz = from.z / BLOCK_WIDTH + (m_height / 2) + 0.5f;
+	dx = to.x / BLOCK_WIDTH + (m_width / 2) + 0.5f - gx;
+	dz = to.z / BLOCK_WIDTH + (m_height / 2) + 0.5f - gz;
+	x = (int)floorf(gx);
+	z = (int)floorf(gz);
+
+	stepX = dx > 0.0f ? 1 : -1;
+	stepZ = dz > 0.0f ? 1 : -1;
+	tDeltaX = dx != 0.0f ? 1.0f / fabsf(dx) : FLT_MAX;
+	tDeltaZ = dz != 0.0f ? 1.0f / fabsf(dz) : FLT_MAX;
+	tMaxX = dx != 0.0f ? (dx > 0.0f ? x + 1 - gx : gx - x) * tDeltaX : FLT_MAX;
+	tMaxZ = dz != 0.0f ? (dz > 0.0f ? z + 1 - gz : gz - z) * tDeltaZ : FLT_MAX;
+
+	for (;;) {
+		next = min(min(tMaxX, tMaxZ), 1.0f);
+		if (IsWall(x, z)) {
+			y0 = from.y + (to.y - from.y) * t;
+			y1 = from.y + (to.y - from.y) * next;
+			if (max(y0, y1) > -BLOCK_WIDTH * 0.5f && min(y0, y1) < BLOCK_WIDTH * 0.5f)
+				return true;
+		}
+
+		if (next >= 1.0f)
+			return false;
+
+		if (tMaxX < tMaxZ) {
+			x += stepX;
+			t = tMaxX;
+			tMaxX += tDeltaX;
+		} else {
+			z += stepZ;
+			t = tMaxZ;
+			tMaxZ += tDeltaZ;
+		}
+	}
+}
+
+/**
+ * \brief
+ * Light of a point of a face, reach lists the lights which may get to it.
+ */
+vec3 CLightmap::Texel(const vec3 &position, const vec3 &normal, const int *reach, int count)
+{
+	CLights *lights = CLights::GetInstance();
+	const CLights::Light *light;
+	vec3 from = position + normal * BAKE_BIAS;
+	vec3 tangent;
+	vec3 bitangent;
+	vec3 direction;
+	vec3 toLight;
+	vec3 result;
+	float distance;
+	float lambert;
+	float window;
+	float r;
+	float phi;
+	int hits = 0;
+	int i;
+
+	tangent = normal.y != 0.0f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+	bitangent = normal.cross(tangent);
+
+	// Cosine weighted, the golden angle spreads the rays around the normal
+	for (i = 0; i < AO_RAYS; i++) {
+		r = sqrtf((i + 0.5f) / AO_RAYS);
+		phi = i * 2.39996323f;
+		direction = tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + normal * sqrtf(1.0f - r * r);
+		if (Blocked(from, from + direction * AO_DISTANCE))
+			hits++;
+	}
+
+	result = vec3(1.0f, 1.0f, 1.0f) * (LIGHT_AMBIENT * (1.0f - AO_STRENGTH * hits / AO_RAYS));
+
+	for (i = 0; i < count; i++) {
+		light = lights->GetLight(reach[i]);
+		toLight = light->position - position;
+		distance = max(toLight.length(), 0.0001f);
+		if (distance >= light->radius)
+			continue;
+
+		lambert = normal.dot(toLight) / distance;
+		if (lambert <= 0.0f || Blocked(from, light->position))
+			continue;
+
+		window = 1.0f - powf(distance / light->radius, 4.0f);
+		result = result + light->color * (lambert * window * window / (1.0f + LIGHT_FALLOFF * distance * distance));
+	}
+
+	return result;
+}
+
+/**
+ * \brief
+ * Bakes the faces of the walls of a chunk into its layer. The faces which touch
+ * another wall are baked too, they are seen from within the walls.
+ */
+void CLightmap::BakeChunk(int idx)
+{
+	CMaze *maze = CMaze::GetInstance();
+	CLights *lights = CLights::GetInstance();
+	const CMaze::Chunk *chunk = maze->GetChunk(idx);
+	const CLights::Light *light;
+	unsigned char *layer = m_atlas + (size_t)idx * LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4;
+	unsigned char *texel;
+	int reach[LIGHT_MAX];
+	vec3 forward;
+	vec3 up;
+	vec3 right;
+	vec3 center;
+	vec3 value;
+	vec3 d;
+	float s;
+	float t;
+	int slot;
+	int count;
+	int f;
+	int u;
+	int v;
+	int x;
+	int y;
+	int i;
+
+	for (y = chunk->y0; y < chunk->y1; y++) {
+		for (x = chunk->x0; x < chunk->x1; x++) {
+			slot = m_cells[y * m_width + x];
+			if (slot == LIGHTMAP_CELL_OPEN)
+				continue;
+
+			center = vec3((float)(x - m_width / 2) * BLOCK_WIDTH, 0.0f, (float)(y - m_height / 2) * BLOCK_WIDTH);
+
+			// A wall is within a cell diagonal of its center
+			count = 0;
+			for (i = 0; i < lights->Count(); i++) {
+				light = lights->GetLight(i);
+				d = light->position - center;
+				if (d.length() < light->radius + BLOCK_WIDTH)
+					reach[count++] = i;
+			}
+
+			for (f = 0; f < LIGHTMAP_FACES; f++) {
+				forward = vec3(faces[f][0][0], faces[f][0][1], faces[f][0][2]);
+				up = vec3(faces[f][1][0], faces[f][1][1], faces[f][1][2]);
+				right = forward.cross(up);
+
+				for (v = 0; v < LIGHTMAP_TEXELS; v++) {
+					texel = layer + (((slot / LIGHTMAP_WALLS_X) * LIGHTMAP_TEXELS + v) * LIGHTMAP_WIDTH
+						+ ((slot % LIGHTMAP_WALLS_X) * LIGHTMAP_FACES + f) * LIGHTMAP_TEXELS) * 4;
+					t = ((v + 0.5f) / LIGHTMAP_TEXELS - 0.5f) * BLOCK_WIDTH;
+
+					for (u = 0; u < LIGHTMAP_TEXELS; u++, texel += 4) {
+						s = ((u + 0.5f) / LIGHTMAP_TEXELS - 0.5f) * BLOCK_WIDTH;
+						value = Texel(center + forward * (BLOCK_WIDTH * 0.5f) + right * s + up * t, forward, reach, count);
+
+						texel[0] = (unsigned char)(min(value.x / LIGHTMAP_RANGE, 1.0f) * 255.0f + 0.5f);
+						texel[1] = (unsigned char)(min(value.y / LIGHTMAP_RANGE, 1.0f) * 255.0f + 0.5f);
+						texel[2] = (unsigned char)(min(value.z / LIGHTMAP_RANGE, 1.0f) * 255.0f + 0.5f);
+						texel[3] = 0xff;
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * \brief
+ * Body of a worker, bakes the chunks until there is none left.
+ * The workers read the maze and the lights, and write their own layers.
+ */
+void CLightmap::Work(void)
+{
+	int job;
+
+	for (;;) {
+		{
+			lock_guard<mutex> guard(m_lock);
+
+			if (m_nextJob >= m_layers)
+				return;
+			job = m_nextJob++;
+		}
+
+		BakeChunk(job);
+	}
+}
+
+/**
+ * \brief
+ * Bakes every chunk on the workers, here if there is none.
+ */
+int CLightmap::Bake(void)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	unsigned int threads;
+	int i;
+
+	try {
+		m_atlas = new unsigned char[(size_t)m_layers * LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4];
+	} catch (...) {
+		cerr << "Failed to allocate the lightmap" << endl;
+		return -ENOMEM;
+	}
+
+	memset(m_atlas, 0, (size_t)m_layers * LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4);
+	m_nextJob = 0;
+
+	threads = thread::hardware_concurrency();
+	if (threads == 0 || threads > BAKE_THREADS_MAX)
+		threads = BAKE_THREADS_MAX;
+	if (threads > (unsigned int)m_layers)
+		threads = m_layers;
+
+	for (i = 0; i < (int)threads; i++) {
+		try {
+			m_workers[i] = thread(&CLightmap::Work, this);
+		} catch (...) {
+			cerr << "Failed to start a bake thread" << endl;
+			break;
+		}
+	}
+
+	if (i == 0)
+		Work();
+
+	for (i = 0; i < BAKE_THREADS_MAX; i++) {
+		if (m_workers[i].joinable())
+			m_workers[i].join();
+	}
+
+	cout << "Lightmap of " << m_layers << " chunks is baked by " << max((int)threads, 1) << " threads in "
+		<< chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+	return 0;
+}
+
+/**
+ * \brief
+ * Reads the atlas of this maze, if its cache file matches the walls and the lights.
+ */
+int CLightmap::LoadCache(void)
+{
+	CacheHeader header;
+	ifstream file;
+	char path[256];
+	size_t size = (size_t)m_layers * LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4;
+
+	snprintf(path, sizeof(path), "%s/maze_%dx%d.lmap", CACHE_DIR, m_width, m_height);
+	file.open(path, ios::binary);
+	if (!file.is_open())
+		return -EINVAL;
+
+	file.read((char *)&header, sizeof(header));
+	if (!file || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION
+		|| header.width != (GLuint)m_width || header.height != (GLuint)m_height
+		|| header.layers != (GLuint)m_layers || header.texels != LIGHTMAP_TEXELS
+		|| header.lights != (GLuint)CLights::GetInstance()->Count() || header.hash != m_hash)
+		return -EINVAL;
+
+	try {
+		m_atlas = new unsigned char[size];
+	} catch (...) {
+		return -ENOMEM;
+	}
+
+	file.read((char *)m_atlas, size);
+	if (!file) {
+		delete[] m_atlas;
+		m_atlas = NULL;
+		return -EINVAL;
+	}
+
+	cout << "Lightmap is read from " << path << endl;
+	return 0;
+}
+
+int CLightmap::SaveCache(void)
+{
+	CacheHeader header;
+	ofstream out;
+	char path[256];
+
+	// It may exist already
+	MKDIR(CACHE_DIR);
+
+	snprintf(path, sizeof(path), "%s/maze_%dx%d.lmap", CACHE_DIR, m_width, m_height);
+	out.open(path, ios::binary | ios::trunc);
+	if (!out.is_open()) {
+		cerr << "Failed to write lightmap " << path << endl;
+		return -EFAULT;
+	}
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.width = m_width;
+	header.height = m_height;
+	header.layers = m_layers;
+	header.texels = LIGHTMAP_TEXELS;
+	header.lights = CLights::GetInstance()->Count();
+	header.hash = m_hash;
+
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)m_atlas, (size_t)m_layers * LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4);
+	out.close();
+
+	if (!out) {
+		cerr << "Failed to write lightmap " << path << endl;
+		remove(path);
+		return -EFAULT;
+	}
+
+	cout << "Lightmap " << path << " is written" << endl;
+	return 0;
+}
+
+/**
+ * \brief
+ * The cells for both modes, the atlas when it is baked.
+ */
+int CLightmap::Upload(void)
+{
+	CTextureManager *manager = CTextureManager::GetInstance();
+	static const char *names[2] = { "lightmap", "cells" };
+	static const GLenum targets[2] = { GL_TEXTURE_2D_ARRAY, GL_TEXTURE_2D };
+	GLint unit;
+	int i;
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+
+	if (m_atlas) {
+		glActiveTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
+		glGenTextures(1, &m_textures[ATLAS]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_textures[ATLAS]);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, LIGHTMAP_WIDTH, LIGHTMAP_HEIGHT, m_layers,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, m_atlas);
+	}
+
+	glActiveTexture(GL_TEXTURE0 + CELL_TEXTURE_UNIT);
+	glGenTextures(1, &m_textures[CELLS]);
+	glBindTexture(GL_TEXTURE_2D, m_textures[CELLS]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, m_width, m_height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_cells);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glActiveTexture(unit);
+	StatusPrint();
+
+	// The manager deletes the textures
+	for (i = 0; i < 2; i++) {
+		if (!m_textures[i])
+			continue;
+
+		m_handles[i] = manager->Acquire(names[i], 0);
+		if (m_handles[i] < 0) {
+			glDeleteTextures(1, &m_textures[i]);
+			m_handles[i] = 0;
+			cerr << "Failed to register the " << names[i] << " texture" << endl;
+			return -EFAULT;
+		}
+		manager->Assign(m_handles[i], targets[i], m_textures[i]);
+	}
+
+	// The GPU has its copy
+	delete[] m_atlas;
+	m_atlas = NULL;
+	return 0;
+}
+
+/**
+ * \brief
+ * Should be called after CLights is loaded and before CShadows, which is off
+ * when the lights are baked. The old GL has no lights, nothing is baked for it.
+ */
+int CLightmap::Load(void)
+{
+	CShader *shader = CShader::GetInstance();
+	static const char *names[2] = { "lightmap", "cells" };
+	static const int units[2] = { LIGHTMAP_TEXTURE_UNIT, CELL_TEXTURE_UNIT };
+	GLuint program;
+	GLint location;
+	int status;
+	int i;
+	int j;
+
+	if (m_loaded)
+		return 0;
+
+	if (__OLD_GL) {
+		m_loaded = true;
+		return 0;
+	}
+
+	if (m_mode != RUNTIME) {
+		status = BuildCells();
+		if (status < 0)
+			return status;
+
+		if (m_mode == BAKED && LoadCache() < 0) {
+			status = Bake();
+			if (status < 0)
+				return status;
+			SaveCache();
+		}
+
+		status = Upload();
+		if (status < 0)
+			return status;
+
+		if (m_mode == BAKED)
+			CLights::GetInstance()->SetBaked(true);
+	}
+
+	// The samplers take their units in every mode, no two types may share a unit
+	for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+		glUseProgram(program);
+		location = glGetUniformLocation(program, "lightMode");
+		if (location >= 0)
+			glUniform1i(location, m_mode);
+
+		for (j = 0; j < 2; j++) {
+			location = glGetUniformLocation(program, names[j]);
+			if (location >= 0)
+				glUniform1i(location, units[j]);
+		}
+	}
+	shader->UseProgram();
+	StatusPrint();
+
+	m_loaded = true;
+	return 0;
+}
+
+/* End of a file */
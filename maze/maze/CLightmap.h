@@ -0,0 +1,83 @@
+#pragma once
+#if !defined(__CLIGHTMAP_H)
+#define __CLIGHTMAP_H
+
+#define LIGHTMAP_TEXELS 8	// Texels per side of a face, same as maze.frag
+#define LIGHTMAP_FACES 6	// Of a wall, in the order of CShadows
+#define LIGHTMAP_WALLS_X 4	// Walls per row of a layer, same as maze.frag
+#define LIGHTMAP_WIDTH (LIGHTMAP_WALLS_X * LIGHTMAP_FACES * LIGHTMAP_TEXELS)
+#define LIGHTMAP_HEIGHT (CHUNK_SIZE * CHUNK_SIZE / LIGHTMAP_WALLS_X * LIGHTMAP_TEXELS)
+#define LIGHTMAP_CELL_OPEN 0xff	// A cell without a wall, same as maze.vert and maze.frag
+#define BAKE_THREADS_MAX 16
+
+/**
+ * \brief
+ * Light of the walls, baked once for the maze instead of lit every frame.
+ *
+ * BAKED:     the torches of CLights and the ambient occlusion of the walls are
+ *            baked into an atlas, a layer a chunk of CMaze, and a face of a wall
+ *            has LIGHTMAP_TEXELS x LIGHTMAP_TEXELS texels. maze.frag finds the
+ *            texels of a fragment by its cell, so the boxes and impostors of CLod
+ *            sample the same atlas. CLights and CShadows are off.
+ * VERTEX_AO: the runtime lights, and the ambient of a corner of a wall side is
+ *            darkened by the walls of its neighbour cells, see maze.vert.
+ *
+ * The rays of the bake walk the cells of the maze (a 2D DDA), a wall blocks a
+ * ray where the ray is within its height. The chunks are baked by worker threads,
+ * a chunk a job. The atlas is cached in lightcache/, keyed by the maze size,
+ * its lights and the layout of the atlas; a mismatched cache is baked again.
+ * The land is not baked, it keeps the ambient light.
+ */
+class CLightmap {
+public:
+	enum Mode {
+		RUNTIME = 0x00,	// CLights and CShadows every frame
+		BAKED = 0x01,
+		VERTEX_AO = 0x02
+	};
+
+private:
+	unsigned char *m_atlas;	// RGBA8, a layer per chunk
+	unsigned char *m_cells;	// Slot of the wall of a cell in its chunk, LIGHTMAP_CELL_OPEN for none
+	int m_width;	// Of the maze
+	int m_height;
+	int m_layers;
+	unsigned int m_hash;	// Of the walls and the lights, see the cache
+
+	GLuint m_textures[2];	// Atlas, cells
+	int m_handles[2];	// Of CTextureManager
+
+	std::thread m_workers[BAKE_THREADS_MAX];
+	std::mutex m_lock;
+	int m_nextJob;	// Under m_lock, next chunk to bake
+
+	Mode m_mode;
+	bool m_loaded;
+
+	int BuildCells(void);
+	bool IsWall(int x, int y);
+	bool Blocked(const vec3 &from, const vec3 &to);
+	vec3 Texel(const vec3 &position, const vec3 &normal, const int *reach, int count);
+	void BakeChunk(int idx);
+	void Work(void);
+	int Bake(void);
+	int LoadCache(void);
+	int SaveCache(void);
+	int Upload(void);
+
+	CLightmap(void);
+	virtual ~CLightmap(void);
+
+	static CLightmap *m_instance;
+
+public:
+	static CLightmap *GetInstance(void);
+	void Destroy(void);
+
+	int SetMode(int mode);
+	Mode GetMode(void);
+	int Load(void);
+};
+
+#endif
+/* End of a file */
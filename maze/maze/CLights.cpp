@@ -0,0 +1,622 @@
+/**
+ * \brief
+ * The lights are binned in view space, a cluster is the box which bounds its
+ * part of the frustum: the tile in x and y between the depths of its slice.
+ * A light is tested against the clusters of its screen rectangle and its
+ * slices only, so the binning costs the clusters a light covers.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CMaze.h"
+#include "CFrame.h"
+#include "CPerspective.h"
+#include "CTextureManager.h"
+#include "CObject.h"
+#include "CLod.h"
+#include "CLights.h"
+#include "CShadows.h"
+
+using namespace std;
+
+#define CLUSTER_NEAR 0.5f	// First slice is from the eye to here
+#define CLUSTER_FAR 128.0f	// Last slice is from here to infinity
+
+#define LIGHT_RADIUS (BLOCK_WIDTH * 3.0f)	// Three cells in the model space
+#define LIGHT_SPACING 5	// One wall side of so many has a torch
+#define LIGHT_TEXELS 3	// Of a light in the lights texture
+#define LIGHT_FLOATS (LIGHT_MAX * LIGHT_TEXELS * 4)	// Of the lights of a viewport
+
+enum Buffer {
+	LIGHTS = 0x00,
+	CLUSTERS = 0x01
+};
+
+// The neighbours of a cell, in the order of the hash
+static const int sides[4][2] = {
+	{ 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 }
+};
+
+CLights *CLights::m_instance = NULL;
+
+CLights::CLights(void)
+: m_lights(NULL)
+, m_count(0)
+, m_lightData(NULL)
+, m_clusterData(NULL)
+, m_pairs(NULL)
+, m_counts(NULL)
+, m_width(0)
+, m_height(0)
+, m_tileWidth(1.0f)
+, m_tileHeight(1.0f)
+, m_sliceScale(0.0f)
+, m_sliceBias(0.0f)
+, m_enabled(true)
+, m_baked(false)
+, m_loaded(false)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		m_buffers[i] = 0;
+		m_textures[i] = 0;
+		m_handles[i] = 0;
+	}
+}
+
+CLights::~CLights(void)
+{
+	int i;
+
+	// The textures belong to CTextureManager
+	for (i = 0; i < 2; i++) {
+		if (m_handles[i] > 0)
+			CTextureManager::GetInstance()->Release(m_handles[i]);
+	}
+	glDeleteBuffers(2, m_buffers);
+
+	delete[] m_lights;
+	delete[] m_lightData;
+	delete[] m_clusterData;
+	delete[] m_pairs;
+	delete[] m_counts;
+}
+
+CLights *CLights::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CLights();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CLights::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+bool CLights::Enabled(void)
+{
+	return m_loaded && m_enabled && !m_baked && m_count > 0;
+}
+
+/**
+ * \brief
+ * The lights are in the lightmap, they keep their places but are not drawn.
+ */
+void CLights::SetBaked(bool baked)
+{
+	m_baked = baked;
+}
+
+bool CLights::Baked(void)
+{
+	return m_baked;
+}
+
+/**
+ * \brief
+ * The impostors are captured with the lighting of their time, they are captured again.
+ */
+void CLights::Toggle(void)
+{
+	if (!m_loaded || m_count == 0)
+		return;
+
+	if (m_baked) {
+		cout << "Lights are baked, see -lightmap" << endl;
+		return;
+	}
+
+	m_enabled = !m_enabled;
+	CLod::GetInstance()->Invalidate();
+	cout << "Lights " << (m_enabled ? "on" : "off") << endl;
+}
+
+int CLights::Count(void)
+{
+	return m_count;
+}
+
+/**
+ * \brief
+ * position is in the model space of the blocks.
+ */
+int CLights::Add(const vec3 &position, const vec3 &color, float radius)
+{
+	Light *light;
+
+	if (!m_lights || radius <= 0.0f)
+		return -EINVAL;
+
+	if (m_count >= LIGHT_MAX)
+		return -ENOSPC;
+
+	light = &m_lights[m_count];
+	light->position = position;
+	light->radius = radius;
+	light->color = color;
+	light->version = 0;
+	return m_count++;
+}
+
+/**
+ * \brief
+ * The shadow map of the light is drawn again.
+ * The torches stay where Place() puts them, a light which a caster of CShadows carries follows it.
+ */
+int CLights::Move(int idx, const vec3 &position)
+{
+	if (idx < 0 || idx >= m_count)
+		return -EINVAL;
+
+	m_lights[idx].position = position;
+	m_lights[idx].version++;
+	return 0;
+}
+
+const CLights::Light *CLights::GetLight(int idx)
+{
+	if (idx < 0 || idx >= m_count)
+		return NULL;
+
+	return &m_lights[idx];
+}
+
+/**
+ * \brief
+ * Puts a torch on some sides of the walls which face a corridor.
+ * The sides are picked by a hash of the cell, as CMaze::Material() does,
+ * so a maze has the same torches on every launch.
+ */
+int CLights::Place(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	unsigned int h;
+	vec4 offset;
+	vec3 position;
+	vec3 color;
+	int nx;
+	int ny;
+	int x;
+	int y;
+	int i;
+
+	for (y = 0; y < maze->Height(); y++) {
+		for (x = 0; x < maze->Width(); x++) {
+			if (maze->IsWall(x, y))
+				continue;
+
+			for (i = 0; i < 4; i++) {
+				nx = x + sides[i][0];
+				ny = y + sides[i][1];
+				if (nx < 0 || ny < 0 || nx >= maze->Width() || ny >= maze->Height()
+					|| !maze->IsWall(nx, ny))
+					continue;
+
+				h = (unsigned int)x * 0x9e3779b1u ^ (unsigned int)y * 0x85ebca77u ^ (unsigned int)i * 0xc2b2ae3du;
+				h ^= h >> 16;
+				h *= 0x7feb352du;
+				h ^= h >> 15;
+				if (h % LIGHT_SPACING)
+					continue;
+
+				// On the wall, half way up, in the instance space of the cells
+				offset = maze->CellOffset(x, y);
+				position = vec3(offset.x + sides[i][0] * BLOCK_WIDTH * 0.8f,
+					BLOCK_WIDTH * 0.5f,
+					offset.z + sides[i][1] * BLOCK_WIDTH * 0.8f);
+
+				// Flames differ a little
+				color = vec3(1.0f, 0.55f, 0.2f) * (1.0f + (float)((h >> 8) & 0xff) / 255.0f * 0.6f);
+
+				if (Add(position * 0.5f, color, LIGHT_RADIUS) == -ENOSPC)
+					return m_count;
+			}
+		}
+	}
+
+	return m_count;
+}
+
+/**
+ * \brief
+ * Should be called after the shader, CMaze and CLod are loaded.
+ * The old GL has no texture buffers, it draws without the lights.
+ */
+int CLights::Load(void)
+{
+	CShader *shader = CShader::GetInstance();
+	CTextureManager *manager = CTextureManager::GetInstance();
+	static const GLenum formats[2] = { GL_RGBA32F, GL_R32UI };
+	static const char *names[2] = { "lights", "clusters" };
+	static const int units[2] = { LIGHT_TEXTURE_UNIT, CLUSTER_TEXTURE_UNIT };
+	GLsizeiptr sizes[2];
+	GLint active;
+	GLuint program;
+	GLint location;
+	int i;
+	int j;
+
+	if (m_loaded)
+		return 0;
+
+	if (__OLD_GL) {
+		m_loaded = true;
+		return 0;
+	}
+
+	try {
+		m_lights = new Light[LIGHT_MAX];
+		m_lightData = new GLfloat[LIGHT_FLOATS * VIEWPORT_MAX];
+		m_clusterData = new GLuint[CLUSTER_COUNT * VIEWPORT_MAX + CLUSTER_INDEX_MAX];
+		m_pairs = new GLuint[CLUSTER_INDEX_MAX];
+		m_counts = new GLuint[CLUSTER_COUNT * VIEWPORT_MAX];
+	} catch (...) {
+		cerr << "Failed to allocate the lights" << endl;
+		return -ENOMEM;
+	}
+
+	Place();
+
+	sizes[LIGHTS] = sizeof(GLfloat) * LIGHT_FLOATS * VIEWPORT_MAX;
+	sizes[CLUSTERS] = sizeof(GLuint) * (CLUSTER_COUNT * VIEWPORT_MAX + CLUSTER_INDEX_MAX);
+
+	glGenBuffers(2, m_buffers);
+	glGenTextures(2, m_textures);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+	for (i = 0; i < 2; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+	}
+	glActiveTexture(active);
+	StatusPrint();
+
+	// The manager deletes the textures, it binds them again if another user takes the units
+	for (i = 0; i < 2; i++) {
+		m_handles[i] = manager->Acquire(names[i], 0);
+		if (m_handles[i] < 0) {
+			glDeleteTextures(2 - i, &m_textures[i]);
+			m_handles[i] = 0;
+			cerr << "Failed to register the " << names[i] << " texture" << endl;
+			return -EFAULT;
+		}
+		manager->Assign(m_handles[i], GL_TEXTURE_BUFFER, m_textures[i]);
+	}
+
+	// Every variant of the main program may read them, LINES does not
+	for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+		glUseProgram(program);
+		for (j = 0; j < 2; j++) {
+			location = glGetUniformLocation(program, names[j]);
+			if (location >= 0)
+				glUniform1i(location, units[j]);
+		}
+	}
+	shader->UseProgram();
+	StatusPrint();
+
+	cout << m_count << " lights" << endl;
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * The slice of a view depth, the depths are positive.
+ */
+int CLights::Slice(float depth)
+{
+	int slice;
+
+	if (depth <= CLUSTER_NEAR)
+		return 0;
+
+	slice = (int)(logf(depth) * m_sliceScale + m_sliceBias);
+	return clamp(slice, 0, CLUSTER_Z - 1);
+}
+
+/**
+ * \brief
+ * Whether a sphere in view space touches the box around a cluster.
+ * xs and ys are the scales of the projection, _11 and _22.
+ */
+bool CLights::Touches(const vec3 &center, float radius, int x, int y, int z, float xs, float ys)
+{
+	vec3 lo;
+	vec3 hi;
+	float nearDepth;
+	float farDepth;
+	float x0;
+	float x1;
+	float y0;
+	float y1;
+	float d;
+	float dist;
+	int i;
+
+	// Depths of the slice, the first one starts at the eye, the last one never ends
+	nearDepth = z == 0 ? 0.0f : expf((z - m_sliceBias) / m_sliceScale);
+	farDepth = expf((z + 1 - m_sliceBias) / m_sliceScale);
+	if (z == CLUSTER_Z - 1)
+		farDepth = max(farDepth, -center.z + radius);
+
+	// NDC of the tile
+	x0 = x * m_tileWidth * 2.0f / m_width - 1.0f;
+	x1 = (x + 1) * m_tileWidth * 2.0f / m_width - 1.0f;
+	y0 = y * m_tileHeight * 2.0f / m_height - 1.0f;
+	y1 = (y + 1) * m_tileHeight * 2.0f / m_height - 1.0f;
+
+	// The sides of the tile are planes through the eye, at a depth d they are at ndc * d / scale
+	lo.x = min(x0 * nearDepth, x0 * farDepth) / xs;
+	hi.x = max(x1 * nearDepth, x1 * farDepth) / xs;
+	lo.y = min(y0 * nearDepth, y0 * farDepth) / ys;
+	hi.y = max(y1 * nearDepth, y1 * farDepth) / ys;
+	lo.z = -farDepth;
+	hi.z = -nearDepth;
+
+	dist = 0.0f;
+	for (i = 0; i < 3; i++) {
+		if (center[i] < lo[i])
+			d = lo[i] - center[i];
+		else if (center[i] > hi[i])
+			d = center[i] - hi[i];
+		else
+			continue;
+		dist += d * d;
+	}
+
+	return dist <= radius * radius;
+}
+
+/**
+ * \brief
+ * Fills the cluster fields of the Frame block for a camera.
+ * main is the camera of CFrame::Update(), its viewports and projections
+ * are the ones which Update() bins the lights for, the viewports have the same size.
+ * The other cameras get no lights, and the ambient light when the lights are on.
+ */
+int CLights::Grid(bool main, GLfloat scale[4], GLint grid[4], GLfloat ambient[4])
+{
+	const GLint *viewport;
+	float level;
+	int i;
+
+	// The baked walls have their ambient in the lightmap, the land keeps this one
+	level = Enabled() || m_baked ? LIGHT_AMBIENT : 1.0f;
+	for (i = 0; i < 3; i++)
+		ambient[i] = level;
+	ambient[3] = 1.0f;
+
+	grid[0] = CLUSTER_X;
+	grid[1] = CLUSTER_Y;
+	grid[2] = CLUSTER_Z;
+	grid[3] = 0;
+
+	if (!Enabled()) {
+		for (i = 0; i < 4; i++)
+			scale[i] = 0.0f;
+		return 0;
+	}
+
+	if (main) {
+		viewport = CFrame::GetInstance()->Viewport(0);
+		m_width = max(viewport[2], 1);
+		m_height = max(viewport[3], 1);
+		m_tileWidth = ceilf((float)m_width / CLUSTER_X);
+		m_tileHeight = ceilf((float)m_height / CLUSTER_Y);
+
+		// slice = log(depth) * scale + bias, 0 at CLUSTER_NEAR and CLUSTER_Z at CLUSTER_FAR
+		m_sliceScale = CLUSTER_Z / logf(CLUSTER_FAR / CLUSTER_NEAR);
+		m_sliceBias = -logf(CLUSTER_NEAR) * m_sliceScale;
+
+		grid[3] = m_count;
+	}
+
+	scale[0] = 1.0f / m_tileWidth;
+	scale[1] = 1.0f / m_tileHeight;
+	scale[2] = m_sliceScale;
+	scale[3] = m_sliceBias;
+	return 0;
+}
+
+/**
+ * \brief
+ * Bins the lights for the camera of a viewport, after the pairs of the viewports before it.
+ * The counts of the clusters of the viewport should be 0, the pairs so far are returned.
+ */
+int CLights::Bin(int viewport, const mat4 &view, const mat4 &projection, int pairs)
+{
+	CShadows *shadows = CShadows::GetInstance();
+	GLuint *counts = &m_counts[viewport * CLUSTER_COUNT];
+	vec4 p;
+	vec3 center;
+	GLfloat *data;
+	float radius;
+	float nearDepth;
+	float farDepth;
+	float xs;
+	float ys;
+	float ndc[4];
+	int rect[4];
+	int slices[2];
+	int cluster;
+	int i;
+	int x;
+	int y;
+	int z;
+
+	xs = projection._11;
+	ys = projection._22;
+
+	for (i = 0; i < m_count; i++) {
+		p = mat4(view) * vec4(m_lights[i].position, 1.0f);
+		center = vec3(p.x, p.y, p.z);
+		radius = m_lights[i].radius;
+
+		data = &m_lightData[viewport * LIGHT_FLOATS + i * LIGHT_TEXELS * 4];
+		data[0] = center.x;
+		data[1] = center.y;
+		data[2] = center.z;
+		data[3] = radius;
+		data[4] = m_lights[i].color.x;
+		data[5] = m_lights[i].color.y;
+		data[6] = m_lights[i].color.z;
+		data[7] = 0.0f;
+		data[8] = m_lights[i].position.x;
+		data[9] = m_lights[i].position.y;
+		data[10] = m_lights[i].position.z;
+		data[11] = (float)shadows->Slot(i);
+
+		// Behind the eye
+		nearDepth = -center.z - radius;
+		farDepth = -center.z + radius;
+		if (farDepth <= 0.0f)
+			continue;
+
+		slices[0] = Slice(nearDepth);
+		slices[1] = Slice(farDepth);
+
+		// The screen rectangle of the sphere, by the corners of its box
+		if (nearDepth <= CLUSTER_NEAR) {
+			rect[0] = 0;
+			rect[1] = 0;
+			rect[2] = CLUSTER_X - 1;
+			rect[3] = CLUSTER_Y - 1;
+		} else {
+			ndc[0] = min((center.x - radius) / nearDepth, (center.x - radius) / farDepth) * xs;
+			ndc[1] = min((center.y - radius) / nearDepth, (center.y - radius) / farDepth) * ys;
+			ndc[2] = max((center.x + radius) / nearDepth, (center.x + radius) / farDepth) * xs;
+			ndc[3] = max((center.y + radius) / nearDepth, (center.y + radius) / farDepth) * ys;
+			if (ndc[0] > 1.0f || ndc[1] > 1.0f || ndc[2] < -1.0f || ndc[3] < -1.0f)
+				continue;
+
+			rect[0] = (int)((ndc[0] + 1.0f) * 0.5f * m_width / m_tileWidth);
+			rect[1] = (int)((ndc[1] + 1.0f) * 0.5f * m_height / m_tileHeight);
+			rect[2] = (int)((ndc[2] + 1.0f) * 0.5f * m_width / m_tileWidth);
+			rect[3] = (int)((ndc[3] + 1.0f) * 0.5f * m_height / m_tileHeight);
+			rect[0] = clamp(rect[0], 0, CLUSTER_X - 1);
+			rect[1] = clamp(rect[1], 0, CLUSTER_Y - 1);
+			rect[2] = clamp(rect[2], 0, CLUSTER_X - 1);
+			rect[3] = clamp(rect[3], 0, CLUSTER_Y - 1);
+		}
+
+		for (z = slices[0]; z <= slices[1]; z++) {
+			for (y = rect[1]; y <= rect[3]; y++) {
+				for (x = rect[0]; x <= rect[2]; x++) {
+					cluster = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+					if (counts[cluster] >= CLUSTER_LIGHTS_MAX || pairs >= CLUSTER_INDEX_MAX)
+						continue;
+					if (!Touches(center, radius, x, y, z, xs, ys))
+						continue;
+
+					m_pairs[pairs++] = ((GLuint)(viewport * CLUSTER_COUNT + cluster) << 16) | (GLuint)i;
+					counts[cluster]++;
+				}
+			}
+		}
+	}
+
+	return pairs;
+}
+
+/**
+ * \brief
+ * Bins the lights for the cameras of this frame and uploads them.
+ * Should be called after CFrame::Update() and CShadows::Update(), before the draws.
+ */
+int CLights::Update(void)
+{
+	CFrame *frame = CFrame::GetInstance();
+	CTextureManager *manager = CTextureManager::GetInstance();
+	GLuint offset;
+	int viewports;
+	int headers;
+	int pairs = 0;
+	int count;
+	int i;
+
+	if (!Enabled())
+		return 0;
+
+	viewports = frame->Viewports();
+	headers = CLUSTER_COUNT * viewports;
+	memset(m_counts, 0, sizeof(GLuint) * headers);
+
+	for (i = 0; i < viewports; i++)
+		pairs = Bin(i, mat4(frame->View(i)) * frame->World(), CPerspective::GetInstance(i)->Matrix(), pairs);
+
+	// Headers, the counts become the cursors of the clusters
+	offset = headers;
+	for (i = 0; i < headers; i++) {
+		m_clusterData[i] = (offset << 8) | m_counts[i];
+		count = (int)m_counts[i];
+		m_counts[i] = offset;
+		offset += count;
+	}
+
+	for (i = 0; i < pairs; i++)
+		m_clusterData[m_counts[m_pairs[i] >> 16]++] = m_pairs[i] & 0xffff;
+
+	// Orphaned, the last frame may still read them
+	glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[LIGHTS]);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GLfloat) * LIGHT_FLOATS * VIEWPORT_MAX, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLfloat) * (LIGHT_FLOATS * (viewports - 1) + m_count * LIGHT_TEXELS * 4), m_lightData);
+	glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[CLUSTERS]);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint) * (CLUSTER_COUNT * VIEWPORT_MAX + CLUSTER_INDEX_MAX), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(GLuint) * offset, m_clusterData);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	manager->Bind(m_handles[LIGHTS], LIGHT_TEXTURE_UNIT);
+	manager->Bind(m_handles[CLUSTERS], CLUSTER_TEXTURE_UNIT);
+	StatusPrint();
+
+	return pairs;
+}
+
+/* End of a file */
@@ -0,0 +1,102 @@
+#pragma once
+#if !defined(__CLIGHTS_H)
+#define __CLIGHTS_H
+
+#define LIGHT_MAX 1024
+#define CLUSTER_X 16	// Tiles of the screen
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24	// Slices of the view depth
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_LIGHTS_MAX 255	// Per cluster, the count shares a word with the offset
+#define CLUSTER_INDEX_MAX 32768	// Light indices of a frame
+#define LIGHT_AMBIENT 0.35f
+#define LIGHT_FALLOFF 0.25f	// Of the squared distance, same as maze.frag
+
+/**
+ * \brief
+ * Point lights (torches on the walls of CMaze) drawn by clustered forward shading.
+ *
+ * The view frustum is split into CLUSTER_X x CLUSTER_Y tiles of the screen and
+ * CLUSTER_Z slices of the view depth, exponential from CLUSTER_NEAR to CLUSTER_FAR.
+ * Update() bins the lights into the clusters which their spheres touch, once per
+ * frame on the CPU, and uploads two texture buffers:
+ *   lights:   RGBA32F, three texels a light, view space position and radius, color,
+ *             model space position and the slot of CShadows
+ *   clusters: R32UI, a word a cluster, (first index << 8) | count,
+ *             followed by the light indices of the clusters
+ * The fragment shader finds its cluster by gl_FragCoord and its view depth,
+ * and loops over the lights of that cluster only, so a light costs the
+ * fragments near it, not every fragment.
+ *
+ * The positions are in the model space of the blocks, half the instance space
+ * (see CLod), the lights follow CModel as the blocks do.
+ * Grid() fills the cluster fields of the Frame block of CFrame. A camera which is
+ * not the main one, e.g. an impostor capture, gets the ambient light only.
+ * The split-screen bins the lights once a viewport of CFrame, the lights and the
+ * cluster headers of a viewport follow the ones of the viewport before it.
+ * Lights which are baked by CLightmap are not drawn, see SetBaked().
+ */
+class CLights {
+public:
+	struct Light {
+		vec3 position;	// Model space
+		float radius;
+		vec3 color;	// Times the intensity
+		unsigned int version;	// Goes up when it moves, see CShadows
+	};
+
+private:
+	Light *m_lights;
+	int m_count;
+
+	GLuint m_buffers[2];	// Lights, clusters
+	GLuint m_textures[2];	// Texture buffer views
+	int m_handles[2];	// Of CTextureManager
+
+	GLfloat *m_lightData;	// Staging of the uploads
+	GLuint *m_clusterData;
+	GLuint *m_pairs;	// (cluster << 16) | light, in the order of the lights
+	GLuint *m_counts;	// Lights of a cluster, then its cursor, of every viewport
+
+	// Of the main camera, see Grid()
+	int m_width;
+	int m_height;
+	float m_tileWidth;
+	float m_tileHeight;
+	float m_sliceScale;
+	float m_sliceBias;
+
+	bool m_enabled;
+	bool m_baked;
+	bool m_loaded;
+
+	int Place(void);
+	int Bin(int viewport, const mat4 &view, const mat4 &projection, int pairs);
+	int Slice(float depth);
+	bool Touches(const vec3 &center, float radius, int x, int y, int z, float xs, float ys);
+
+	CLights(void);
+	virtual ~CLights(void);
+
+	static CLights *m_instance;
+
+public:
+	static CLights *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+	int Add(const vec3 &position, const vec3 &color, float radius);
+	int Move(int idx, const vec3 &position);
+	int Count(void);
+	const Light *GetLight(int idx);
+	int Update(void);
+	int Grid(bool main, GLfloat scale[4], GLint grid[4], GLfloat ambient[4]);
+
+	bool Enabled(void);
+	void Toggle(void);
+	void SetBaked(bool baked);
+	bool Baked(void);
+};
+
+#endif
+/* End of a file */
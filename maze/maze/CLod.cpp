@@ -0,0 +1,671 @@
+/**
+ * \brief
+ * Picks a level of detail for every chunk of the maze from its distance to the eye.
+ * Near chunks are left to CBlock/CCulling, far chunks are drawn here
+ * as merged boxes or as impostors.
+ *
+ * Distances are measured in the instance space of CBlock,
+ * which is twice the model space (the offsets are added with w = 1, see maze.vert).
+ * Impostors are captured in the model space, so they are drawn with the model of the blocks.
+ *
+ * The viewports of the split-screen share the levels, a chunk is as near as the
+ * nearest of their eyes. An impostor faces one eye only, so the split-screen
+ * keeps the far chunks at the box level.
+ */
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <string.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CObject.h"
+#include "CVertices.h"
+#include "CShader.h"
+#include "CMovable.h"
+#include "CModel.h"
+#include "CPerspective.h"
+#include "CView.h"
+#include "CMaze.h"
+#include "CTexture.h"
+#include "CLod.h"
+#include "CFrame.h"
+#include "CRenderQueue.h"
+
+using namespace std;
+
+#define IMPOSTOR_SIZE 256	// Texels per side of an impostor
+#define IMPOSTOR_BUDGET 2	// Impostors captured per frame
+#define IMPOSTOR_ANGLE 0.996f	// cos(5 degree)
+#define IMPOSTOR_RATIO 0.25f	// Distance change which invalidates an impostor
+
+CLod *CLod::m_instance = NULL;
+
+CLod::CLod(void)
+: m_levelTex(0)
+, m_quadVAO(0)
+, m_FBO(0)
+, m_depthRBO(0)
+, m_program(0)
+, m_object(-1)
+, m_captureObject(-1)
+, m_offsetId(-1)
+, m_scaleId(-1)
+, m_chunkCount(0)
+, m_boxFirst(NULL)
+, m_boxCount(NULL)
+, m_levels(NULL)
+, m_impostors(NULL)
+, m_boxDistance(6.0f)
+, m_impostorDistance(12.0f)
+, m_enabled(true)
+, m_loaded(false)
+{
+	m_VBO[BOX] = m_VBO[LEVEL] = m_VBO[QUAD] = 0;
+}
+
+CLod::~CLod(void)
+{
+	int i;
+
+	if (m_impostors) {
+		for (i = 0; i < m_chunkCount; i++) {
+			if (m_impostors[i].texture)
+				glDeleteTextures(1, &m_impostors[i].texture);
+		}
+	}
+
+	delete[] m_boxFirst;
+	delete[] m_boxCount;
+	delete[] m_levels;
+	delete[] m_impostors;
+
+	glDeleteBuffers(MAX, m_VBO);
+
+	if (m_levelTex)
+		glDeleteTextures(1, &m_levelTex);
+
+	if (m_quadVAO)
+		glDeleteVertexArrays(1, &m_quadVAO);
+
+	if (m_depthRBO)
+		glDeleteRenderbuffers(1, &m_depthRBO);
+
+	if (m_FBO)
+		glDeleteFramebuffers(1, &m_FBO);
+
+	if (m_program)
+		glDeleteProgram(m_program);
+}
+
+CLod *CLod::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CLod();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CLod::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+bool CLod::Enabled(void)
+{
+	return m_loaded && m_enabled && !__OLD_GL;
+}
+
+void CLod::Toggle(void)
+{
+	m_enabled = !m_enabled;
+	cout << "LOD " << (m_enabled ? "on" : "off") << endl;
+}
+
+/**
+ * \brief
+ * The impostors are captured again, e.g. when the lighting changes.
+ */
+void CLod::Invalidate(void)
+{
+	int i;
+
+	if (!m_impostors)
+		return;
+
+	for (i = 0; i < m_chunkCount; i++)
+		m_impostors[i].valid = false;
+}
+
+/**
+ * \brief
+ * The impostor of a chunk is captured again, e.g. when its cells are explored.
+ */
+void CLod::Invalidate(int idx)
+{
+	if (!m_impostors || idx < 0 || idx >= m_chunkCount)
+		return;
+
+	m_impostors[idx].valid = false;
+}
+
+CLod::Level CLod::GetLevel(int idx)
+{
+	if (!Enabled() || idx < 0 || idx >= m_chunkCount)
+		return FULL;
+
+	return (Level)m_levels[idx];
+}
+
+GLuint CLod::LevelBuffer(void)
+{
+	return m_VBO[LEVEL];
+}
+
+GLuint CLod::LevelTexture(void)
+{
+	return m_levelTex;
+}
+
+/**
+ * \brief
+ * Merges the walls of every chunk into rectangles, greedily row by row.
+ * A box takes the layer of CTexture of every wall in it, maze.vert wraps the
+ * materials around the layers, so the far walls keep their textures.
+ */
+int CLod::BuildBoxes(Box *boxes)
+{
+	CMaze *maze = CMaze::GetInstance();
+	const CMaze::Chunk *chunk;
+	bool used[CHUNK_SIZE][CHUNK_SIZE];
+	vec4 lo;
+	vec4 hi;
+	int total = 0;
+	int layers = CTexture::GetInstance()->Layers();
+	int material;
+	int c;
+	int x;
+	int y;
+	int w;
+	int h;
+	int i;
+
+	// No texture yet, the materials themselves are compared
+	if (layers <= 0)
+		layers = MATERIAL_MAX;
+
+	for (c = 0; c < m_chunkCount; c++) {
+		chunk = maze->GetChunk(c);
+		memset(used, 0, sizeof(used));
+		m_boxFirst[c] = total;
+
+		for (y = chunk->y0; y < chunk->y1; y++) {
+			for (x = chunk->x0; x < chunk->x1; x++) {
+				if (!maze->IsWall(x, y) || used[y - chunk->y0][x - chunk->x0])
+					continue;
+
+				material = maze->Material(x, y);
+				w = 1;
+				while (x + w < chunk->x1 && maze->IsWall(x + w, y) && maze->Material(x + w, y) % layers == material % layers
+					&& !used[y - chunk->y0][x + w - chunk->x0])
+					w++;
+
+				for (h = 1; y + h < chunk->y1; h++) {
+					for (i = 0; i < w; i++) {
+						if (!maze->IsWall(x + i, y + h) || maze->Material(x + i, y + h) % layers != material % layers
+							|| used[y + h - chunk->y0][x + i - chunk->x0])
+							break;
+					}
+					if (i < w)
+						break;
+				}
+
+				for (i = 0; i < h * w; i++)
+					used[y + i / w - chunk->y0][x + i % w - chunk->x0] = true;
+
+				lo = maze->CellOffset(x, y);
+				hi = maze->CellOffset(x + w - 1, y + h - 1);
+				boxes[total].offset = (lo + hi) * 0.5f;
+				boxes[total].offset.w = (float)material;
+				boxes[total].scale = vec4((float)w, 1.0f, (float)h, 1.0f);
+				total++;
+			}
+		}
+
+		m_boxCount[c] = total - m_boxFirst[c];
+	}
+
+	return total;
+}
+
+int CLod::Load(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	Box *boxes;
+	GLuint program;
+	GLint attrId;
+	GLint unit;
+	int total;
+	int i;
+
+	if (m_loaded)
+		return 0;
+
+	// Levels are picked per instance attribute, which the old path does not have
+	if (__OLD_GL)
+		return -EFAULT;
+
+	m_chunkCount = maze->ChunkCount();
+
+	try {
+		m_boxFirst = new int[m_chunkCount];
+		m_boxCount = new int[m_chunkCount];
+		m_levels = new GLuint[m_chunkCount];
+		m_impostors = new Impostor[m_chunkCount];
+		boxes = new Box[maze->WallCount() + 1];
+	} catch (...) {
+		cerr << "Failed to allocate LOD data" << endl;
+		return -EFAULT;
+	}
+
+	for (i = 0; i < m_chunkCount; i++) {
+		m_levels[i] = FULL;
+		m_impostors[i].texture = 0;
+		m_impostors[i].valid = false;
+		m_impostors[i].distance = 0.0f;
+	}
+
+	total = BuildBoxes(boxes);
+	cout << total << " boxes for " << maze->WallCount() << " blocks" << endl;
+
+	glGenBuffers(MAX, m_VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[BOX]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(*boxes) * total, boxes, GL_STATIC_DRAW);
+	delete[] boxes;
+
+	glBindBuffer(GL_TEXTURE_BUFFER, m_VBO[LEVEL]);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(*m_levels) * m_chunkCount, m_levels, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glGenTextures(1, &m_levelTex);
+	glActiveTexture(GL_TEXTURE0 + LOD_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, m_levelTex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_VBO[LEVEL]);
+	glActiveTexture(unit);
+	StatusPrint();
+
+	program = CShader::GetInstance()->Program();
+	m_offsetId = glGetAttribLocation(program, "offset");
+	m_scaleId = glGetAttribLocation(program, "scale");
+	if (m_offsetId < 0 || m_scaleId < 0) {
+		cerr << "LOD needs the offset and scale attributes" << endl;
+		return -EFAULT;
+	}
+
+	CVertices::GetInstance()->BindVAO();
+	glVertexAttribDivisor(m_scaleId, 1);
+	CVertices::GetInstance()->UnbindVAO();
+
+	m_object = CFrame::GetInstance()->AddObject(CFrame::BLOCK | CFrame::WORLD);
+	m_captureObject = CFrame::GetInstance()->AddObject(CFrame::BLOCK);
+
+	// Without impostors, the far chunks stay at the box level
+	m_program = CShader::GetInstance()->LoadProgram(CMisc::m_impostorVertexShaderFile, CMisc::m_impostorFragmentShaderFile);
+	if (m_program) {
+		glUseProgram(m_program);
+		glUniform1i(glGetUniformLocation(m_program, "tex"), IMPOSTOR_TEXTURE_UNIT);
+		glUniform1i(glGetUniformLocation(m_program, "object"), m_object);
+		CFrame::GetInstance()->BindProgram(m_program);
+
+		glGenVertexArrays(1, &m_quadVAO);
+		glBindVertexArray(m_quadVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_VBO[QUAD]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(QuadVertex) * 6 * m_chunkCount, NULL, GL_DYNAMIC_DRAW);
+
+		attrId = glGetAttribLocation(m_program, "position");
+		if (attrId >= 0) {
+			glEnableVertexAttribArray(attrId);
+			glVertexAttribPointer(attrId, 4, GL_FLOAT, GL_FALSE, sizeof(QuadVertex), (void *)offsetof(QuadVertex, position));
+		}
+		attrId = glGetAttribLocation(m_program, "texCoord");
+		if (attrId >= 0) {
+			glEnableVertexAttribArray(attrId);
+			glVertexAttribPointer(attrId, 2, GL_FLOAT, GL_FALSE, sizeof(QuadVertex), (void *)offsetof(QuadVertex, texCoord));
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glGenFramebuffers(1, &m_FBO);
+		glGenRenderbuffers(1, &m_depthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depthRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		StatusPrint();
+
+		CShader::GetInstance()->UseProgram();
+	} else {
+		cerr << "Impostors are not available" << endl;
+	}
+
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Renders the boxes of a chunk from the eye into its impostor texture,
+ * then places the quad which covers the bounding sphere of the chunk.
+ */
+int CLod::Capture(int idx, const vec3 &eye, const vec3 &up)
+{
+	const CMaze::Chunk *chunk = CMaze::GetInstance()->GetChunk(idx);
+	Impostor *impostor = &m_impostors[idx];
+	QuadVertex quad[6];
+	GLint viewport[4];
+	GLint unit;
+	vec3 center;
+	vec3 forward;
+	vec3 right;
+	vec3 top;
+	float radius;
+	float distance;
+	float half;
+
+	center = vec3(chunk->center) * 0.5f;
+	radius = chunk->radius * 0.5f;
+	forward = eye - center;
+	distance = forward.length();
+	if (distance <= radius * 1.01f)
+		return -EINVAL;
+
+	forward = forward / distance;
+	right = up.cross(forward).normalize();
+	top = forward.cross(right);
+
+	if (!impostor->texture) {
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+		glActiveTexture(GL_TEXTURE0 + IMPOSTOR_TEXTURE_UNIT);
+		glGenTextures(1, &impostor->texture);
+		glBindTexture(GL_TEXTURE_2D, impostor->texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, IMPOSTOR_SIZE, IMPOSTOR_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glActiveTexture(unit);
+	}
+
+	// The frustum is fitted to the bounding sphere
+	CFrame::GetInstance()->SetCamera(mat4::lookAt(eye, center, top),
+		mat4::perspective(2.0f * asinf(radius / distance), 1.0f, distance - radius, distance + radius));
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, impostor->texture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRBO);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		glBindFramebuffer(GL_FRAMEBUFFER, CMisc::Framebuffer());
+		cerr << "Impostor framebuffer is not complete" << endl;
+		return -EFAULT;
+	}
+
+	glViewport(0, 0, IMPOSTOR_SIZE, IMPOSTOR_SIZE);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	CShader::GetInstance()->UseProgram();
+	CVertices::GetInstance()->BindVAO();
+	CVertices::GetInstance()->BindEBO();
+	CFrame::GetInstance()->BindObject(m_captureObject);
+	DrawBoxes(m_boxFirst[idx], m_boxCount[idx]);
+	CVertices::GetInstance()->UnbindEBO();
+	CVertices::GetInstance()->UnbindVAO();
+	CFrame::GetInstance()->RestoreCamera();
+	StatusPrint();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, CMisc::Framebuffer());
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	// Half size of the quad at the center, which matches the fov above
+	half = radius * distance / sqrtf(distance * distance - radius * radius);
+	right = right * half;
+	top = top * half;
+
+	quad[0].position = vec4(center - right - top, 1.0f);
+	quad[0].texCoord = vec2(0.0f, 0.0f);
+	quad[1].position = vec4(center + right - top, 1.0f);
+	quad[1].texCoord = vec2(1.0f, 0.0f);
+	quad[2].position = vec4(center + right + top, 1.0f);
+	quad[2].texCoord = vec2(1.0f, 1.0f);
+	quad[3] = quad[0];
+	quad[4] = quad[2];
+	quad[5].position = vec4(center - right + top, 1.0f);
+	quad[5].texCoord = vec2(0.0f, 1.0f);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[QUAD]);
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(quad) * idx, sizeof(quad), quad);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	impostor->dir = forward;
+	impostor->distance = distance;
+	impostor->valid = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Draws the boxes of the chunks which a sphere touches, in the model space,
+ * for the camera which is bound, e.g. the faces of a shadow map of CShadows.
+ * The depth only, by the DEPTH variant of CShader.
+ */
+int CLod::DrawCasters(const vec3 &center, float radius)
+{
+	CMaze *maze = CMaze::GetInstance();
+	const CMaze::Chunk *chunk;
+	int i;
+
+	if (!m_loaded || __OLD_GL)
+		return -EFAULT;
+
+	glUseProgram(CShader::GetInstance()->Program(CShader::BLOCK | CShader::DEPTH));
+	CVertices::GetInstance()->BindVAO();
+	CVertices::GetInstance()->BindEBO();
+	CFrame::GetInstance()->BindObject(m_captureObject);
+
+	for (i = 0; i < m_chunkCount; i++) {
+		chunk = maze->GetChunk(i);
+		if ((vec3(chunk->center) * 0.5f - center).length() > chunk->radius * 0.5f + radius)
+			continue;
+
+		DrawBoxes(m_boxFirst[i], m_boxCount[i]);
+	}
+
+	CVertices::GetInstance()->UnbindEBO();
+	CVertices::GetInstance()->UnbindVAO();
+	StatusPrint();
+	return 0;
+}
+
+/**
+ * \brief
+ * Updates the levels and the stale impostors.
+ * Should be called before CCulling::Cull() and before the frame is cleared.
+ * Returns 1 if the budget ran out, the rest of the impostors are updated in the next frames.
+ */
+int CLod::Update(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	CFrame *frame = CFrame::GetInstance();
+	const CMaze::Chunk *chunk;
+	Impostor *impostor;
+	mat4 inv;
+	vec4 eye4;
+	vec4 up4;
+	vec3 eyes[VIEWPORT_MAX];
+	vec3 eye;
+	vec3 up;
+	vec3 dir;
+	float distance;
+	GLuint level;
+	bool changed = false;
+	int budget = IMPOSTOR_BUDGET;
+	int viewports;
+	int i;
+	int v;
+
+	if (!Enabled())
+		return 0;
+
+	// Eyes of the model space, inv is left at the first viewport for the up
+	viewports = frame->Viewports();
+	for (v = viewports - 1; v >= 0; v--) {
+		inv = (mat4(frame->View(v)) * frame->World()).inverse();
+		eye4 = inv * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		eyes[v] = vec3(eye4.x, eye4.y, eye4.z) / eye4.w;
+	}
+	up4 = inv * vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	eye = eyes[0];
+	up = vec3(up4.x, up4.y, up4.z).normalize();
+
+	for (i = 0; i < m_chunkCount; i++) {
+		chunk = maze->GetChunk(i);
+		dir = eye * 2.0f - chunk->center;
+		distance = dir.length() / chunk->radius;
+		for (v = 1; v < viewports; v++)
+			distance = min(distance, (eyes[v] * 2.0f - chunk->center).length() / chunk->radius);
+
+		if (distance < m_boxDistance)
+			level = FULL;
+		else if (distance < m_impostorDistance || !m_program || viewports > 1)
+			level = BOXES;
+		else
+			level = IMPOSTOR;
+
+		if (level != m_levels[i]) {
+			m_levels[i] = level;
+			changed = true;
+		}
+
+		if (level != IMPOSTOR || budget == 0)
+			continue;
+
+		impostor = &m_impostors[i];
+		distance = dir.length() * 0.5f;
+		dir = dir.normalize();
+		if (impostor->valid && dir.dot(impostor->dir) > IMPOSTOR_ANGLE
+			&& fabsf(distance / impostor->distance - 1.0f) < IMPOSTOR_RATIO)
+			continue;
+
+		if (Capture(i, eye, up) == 0)
+			budget--;
+	}
+
+	if (changed) {
+		glBindBuffer(GL_TEXTURE_BUFFER, m_VBO[LEVEL]);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(*m_levels) * m_chunkCount, m_levels);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	return budget == 0 ? 1 : 0;
+}
+
+/**
+ * \brief
+ * Draws a range of merged boxes, the VAO and EBO of CVertices should be bound.
+ */
+int CLod::DrawBoxes(int first, int count)
+{
+	if (count <= 0)
+		return 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[BOX]);
+	glVertexAttribPointer(m_offsetId, 4, GL_FLOAT, GL_FALSE, sizeof(Box), (void *)(sizeof(Box) * first + offsetof(Box, offset)));
+	glVertexAttribPointer(m_scaleId, 4, GL_FLOAT, GL_FALSE, sizeof(Box), (void *)(sizeof(Box) * first + offsetof(Box, scale)));
+	glEnableVertexAttribArray(m_scaleId);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	CVertices::GetInstance()->Draw(CVertices::CUBE, count);
+
+	// Blocks use the constant scale
+	glDisableVertexAttribArray(m_scaleId);
+	glVertexAttrib4f(m_scaleId, 1.0f, 1.0f, 1.0f, 1.0f);
+	return 0;
+}
+
+/**
+ * \brief
+ * A packet per chunk which is not at the full level, arg is (chunk << 1 | impostor).
+ */
+int CLod::Submit(CRenderQueue *queue)
+{
+	CRenderQueue::Packet packet;
+	const CMaze::Chunk *chunk;
+	float depth;
+	int i;
+
+	if (!Enabled())
+		return 0;
+
+	for (i = 0; i < m_chunkCount; i++) {
+		if (m_levels[i] == FULL)
+			continue;
+
+		chunk = CMaze::GetInstance()->GetChunk(i);
+		depth = CFrame::GetInstance()->Depth(m_object, vec3(chunk->center) * 0.5f);
+
+		if (m_levels[i] == IMPOSTOR && m_impostors[i].valid && m_program) {
+			packet.owner = this;
+			packet.program = m_program;
+			packet.vao = m_quadVAO;
+			packet.texture = m_impostors[i].texture;
+			packet.unit = IMPOSTOR_TEXTURE_UNIT;
+			packet.arg = (i << 1) | 1;
+			queue->Add(packet, CRenderQueue::OPAQUE, depth);
+		} else {
+			queue->Add(this, i << 1, depth);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief
+ * CRenderQueue binds the program, the VAO and the impostor texture.
+ */
+int CLod::Execute(GLuint arg)
+{
+	int i = arg >> 1;
+
+	if (i >= m_chunkCount)
+		return -EINVAL;
+
+	if (arg & 1) {
+		glDrawArrays(GL_TRIANGLES, i * 6, 6);
+		CMisc::CountDraw();
+		return 0;
+	}
+
+	CFrame::GetInstance()->BindObject(m_object);
+	return DrawBoxes(m_boxFirst[i], m_boxCount[i]);
+}
+
+/* End of a file */
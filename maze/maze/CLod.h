@@ -0,0 +1,101 @@
+#pragma once
+#if !defined(__CLOD_H)
+#define __CLOD_H
+
+/**
+ * \brief
+ * Hierarchical level of detail of the maze chunks (see CMaze).
+ * FULL:     every block of the chunk is drawn (CBlock, CCulling)
+ * BOXES:    runs of blocks are merged into a few scaled boxes
+ * IMPOSTOR: a camera facing quad textured with a capture of the boxes
+ */
+class CLod : public CObject {
+public:
+	enum Level {
+		FULL = 0x00,
+		BOXES = 0x01,
+		IMPOSTOR = 0x02
+	};
+
+private:
+	enum VBO {
+		BOX = 0x00,
+		LEVEL = 0x01,
+		QUAD = 0x02,
+		MAX = 0x03
+	};
+
+	// Instance data of a merged box, "offset" and "scale" attributes of maze.vert
+	struct Box {
+		vec4 offset;
+		vec4 scale;
+	};
+
+	struct Impostor {
+		GLuint texture;
+		bool valid;
+		vec3 dir;	// Direction from the chunk to the eye when captured
+		float distance;
+	};
+
+	struct QuadVertex {
+		vec4 position;
+		vec2 texCoord;
+	};
+
+	GLuint m_VBO[MAX];
+	GLuint m_levelTex;	// Texture buffer view of m_VBO[LEVEL]
+	GLuint m_quadVAO;
+	GLuint m_FBO;
+	GLuint m_depthRBO;
+	GLuint m_program;	// Impostor program
+	int m_object;	// Slot of CFrame
+	int m_captureObject;	// Slot of CFrame for the captures, in the space of the chunks
+
+	GLint m_offsetId;
+	GLint m_scaleId;
+
+	int m_chunkCount;
+	int *m_boxFirst;
+	int *m_boxCount;
+	GLuint *m_levels;
+	Impostor *m_impostors;
+
+	float m_boxDistance;		// In chunk radii
+	float m_impostorDistance;
+
+	bool m_enabled;
+	bool m_loaded;
+
+	int BuildBoxes(Box *boxes);
+	int Capture(int idx, const vec3 &eye, const vec3 &up);
+	int DrawBoxes(int first, int count);
+
+	CLod(void);
+	virtual ~CLod(void);
+
+	static CLod *m_instance;
+
+public:
+	static CLod *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+	int Update(void);
+	int Submit(CRenderQueue *queue);
+	int Execute(GLuint arg);
+	int DrawCasters(const vec3 &center, float radius);
+	const char *Name(void) { return "Lod"; }
+
+	bool Enabled(void);
+	void Toggle(void);
+	void Invalidate(void);
+	void Invalidate(int idx);
+	Level GetLevel(int idx);
+
+	GLuint LevelBuffer(void);
+	GLuint LevelTexture(void);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,301 @@
+#include <iostream>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CVertices.h"
+#include "CMaze.h"
+
+using namespace std;
+
+CMaze *CMaze::m_instance = NULL;
+
+#define DEFAULT_MAZE_SIZE 10
+#define MAZE_SIZE_MIN 5
+#define MAZE_SEED 0x2545f491u	// Same maze of the same size on every launch
+
+CMaze::CMaze(void)
+: m_width(DEFAULT_MAZE_SIZE)
+, m_height(DEFAULT_MAZE_SIZE)
+, m_cells(NULL)
+, m_chunkX(0)
+, m_chunkY(0)
+, m_chunks(NULL)
+, m_wallCount(0)
+{
+	const char map[][DEFAULT_MAZE_SIZE] = {
+		{ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 },
+		{ 0, 0, 0, 1, 1, 0, 0, 0, 0, 1 },
+		{ 1, 1, 0, 0, 0, 0, 1, 0, 1, 1 },
+		{ 1, 1, 1, 1, 1, 0, 0, 0, 1, 1 },
+		{ 1, 0, 0, 1, 1, 0, 1, 0, 0, 1 },
+		{ 1, 1, 0, 1, 0, 0, 1, 1, 0, 1 },
+		{ 1, 0, 0, 1, 1, 1, 1, 0, 0, 1 },
+		{ 1, 0, 1, 1, 0, 0, 0, 0, 1, 1 },
+		{ 1, 0, 0, 0, 0, 1, 1, 0, 0, 1 },
+		{ 1, 1, 0, 1, 1, 1, 1, 1, 1, 1 }
+	};
+
+	m_cells = new char[m_width * m_height];
+	memcpy(m_cells, map, m_width * m_height);
+
+	BuildChunks();
+}
+
+CMaze::~CMaze(void)
+{
+	delete[] m_cells;
+	delete[] m_chunks;
+}
+
+CMaze *CMaze::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CMaze();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CMaze::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+int CMaze::BuildChunks(void)
+{
+	Chunk *chunk;
+	int cx;
+	int cy;
+	int x;
+	int y;
+	float hx;
+	float hz;
+
+	m_chunkX = (m_width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	m_chunkY = (m_height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+	delete[] m_chunks;
+	m_chunks = new Chunk[m_chunkX * m_chunkY];
+
+	m_wallCount = 0;
+	for (cy = 0; cy < m_chunkY; cy++) {
+		for (cx = 0; cx < m_chunkX; cx++) {
+			chunk = &m_chunks[cy * m_chunkX + cx];
+			chunk->x0 = cx * CHUNK_SIZE;
+			chunk->y0 = cy * CHUNK_SIZE;
+			chunk->x1 = min(chunk->x0 + CHUNK_SIZE, m_width);
+			chunk->y1 = min(chunk->y0 + CHUNK_SIZE, m_height);
+
+			chunk->first = m_wallCount;
+			for (y = chunk->y0; y < chunk->y1; y++)
+				for (x = chunk->x0; x < chunk->x1; x++)
+					m_wallCount += IsWall(x, y);
+			chunk->count = m_wallCount - chunk->first;
+
+			chunk->center.x = ((chunk->x0 + chunk->x1 - 1) * 0.5f - (m_width / 2)) * (BLOCK_WIDTH * 2);
+			chunk->center.y = 0.0f;
+			chunk->center.z = ((chunk->y0 + chunk->y1 - 1) * 0.5f - (m_height / 2)) * (BLOCK_WIDTH * 2);
+
+			hx = (chunk->x1 - chunk->x0) * BLOCK_WIDTH;
+			hz = (chunk->y1 - chunk->y0) * BLOCK_WIDTH;
+			chunk->radius = sqrtf(hx * hx + BLOCK_WIDTH * BLOCK_WIDTH + hz * hz);
+		}
+	}
+
+	return 0;
+}
+
+static unsigned int NextRandom(unsigned int *state)
+{
+	// xorshift32
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**
+ * \brief
+ * Replaces the maze by a random one of the size, carved by a depth first walk
+ * from cell (1, 1) with an explicit stack. The sizes are made odd, so the
+ * border is a wall but the entrance at (0, 1), as the default maze has.
+ * Should be called before the objects which read the maze are created.
+ */
+int CMaze::Generate(int width, int height)
+{
+	static const int dx[4] = { 1, -1, 0, 0 };
+	static const int dy[4] = { 0, 0, 1, -1 };
+	unsigned int state = MAZE_SEED;
+	char *cells;
+	int *stack;
+	int options[4];
+	int count;
+	int top = 0;
+	int cell;
+	int x;
+	int y;
+	int nx;
+	int ny;
+	int d;
+
+	if (width < MAZE_SIZE_MIN || height < MAZE_SIZE_MIN)
+		return -EINVAL;
+
+	width |= 1;
+	height |= 1;
+
+	try {
+		cells = new char[width * height];
+	} catch (...) {
+		return -ENOMEM;
+	}
+
+	try {
+		stack = new int[(width / 2) * (height / 2)];
+	} catch (...) {
+		delete[] cells;
+		return -ENOMEM;
+	}
+
+	memset(cells, 1, width * height);
+	cells[1 * width + 1] = 0;
+	stack[top++] = 1 * width + 1;
+
+	while (top > 0) {
+		cell = stack[top - 1];
+		x = cell % width;
+		y = cell / width;
+
+		// Rooms two cells away which are not carved yet
+		count = 0;
+		for (d = 0; d < 4; d++) {
+			nx = x + dx[d] * 2;
+			ny = y + dy[d] * 2;
+			if (nx > 0 && ny > 0 && nx < width - 1 && ny < height - 1 && cells[ny * width + nx])
+				options[count++] = d;
+		}
+
+		if (count == 0) {
+			top--;
+			continue;
+		}
+
+		d = options[NextRandom(&state) % count];
+		cells[(y + dy[d]) * width + x + dx[d]] = 0;
+		cells[(y + dy[d] * 2) * width + x + dx[d] * 2] = 0;
+		stack[top++] = (y + dy[d] * 2) * width + x + dx[d] * 2;
+	}
+
+	cells[1 * width + 0] = 0;
+	delete[] stack;
+
+	delete[] m_cells;
+	m_cells = cells;
+	m_width = width;
+	m_height = height;
+	BuildChunks();
+
+	cout << "Maze " << m_width << "x" << m_height << ", " << m_wallCount << " walls" << endl;
+	return 0;
+}
+
+int CMaze::Width(void)
+{
+	return m_width;
+}
+
+int CMaze::Height(void)
+{
+	return m_height;
+}
+
+bool CMaze::IsWall(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+		return false;
+
+	return m_cells[y * m_width + x] == 1;
+}
+
+vec4 CMaze::CellOffset(int x, int y)
+{
+	return vec4((x - (m_width / 2)) * (BLOCK_WIDTH * 2), 0.0f, (y - (m_height / 2)) * (BLOCK_WIDTH * 2), 1.0f);
+}
+
+/**
+ * \brief
+ * Same material for the same cell on every launch.
+ */
+int CMaze::Material(int x, int y)
+{
+	unsigned int h;
+
+	h = (unsigned int)x * 0x8da6b343u ^ (unsigned int)y * 0xd8163841u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+
+	return (int)(h % MATERIAL_MAX);
+}
+
+int CMaze::WallCount(void)
+{
+	return m_wallCount;
+}
+
+/**
+ * \brief
+ * Lists the offsets of the walls chunk by chunk.
+ * chunk (optional) receives the chunk index of each wall.
+ */
+int CMaze::FillOffsets(vec4 *offset, GLuint *chunk)
+{
+	int i = 0;
+	int c;
+	int x;
+	int y;
+
+	for (c = 0; c < m_chunkX * m_chunkY; c++) {
+		for (y = m_chunks[c].y0; y < m_chunks[c].y1; y++) {
+			for (x = m_chunks[c].x0; x < m_chunks[c].x1; x++) {
+				if (!IsWall(x, y))
+					continue;
+
+				offset[i] = CellOffset(x, y);
+				offset[i].w = (float)Material(x, y);
+				if (chunk)
+					chunk[i] = c;
+				i++;
+			}
+		}
+	}
+
+	return i;
+}
+
+int CMaze::ChunkCount(void)
+{
+	return m_chunkX * m_chunkY;
+}
+
+const CMaze::Chunk *CMaze::GetChunk(int idx)
+{
+	if (idx < 0 || idx >= m_chunkX * m_chunkY)
+		return NULL;
+
+	return &m_chunks[idx];
+}
+
+/* End of a file */
@@ -0,0 +1,65 @@
+#pragma once
+#if !defined(__CMAZE_H)
+#define __CMAZE_H
+
+#define CHUNK_SIZE 8	// Cells per side of a chunk
+#define MATERIAL_MAX 256	// Materials of the walls, wrapped around the layers of CTexture
+
+/**
+ * \brief
+ * Grid of the maze cells.
+ * Cells are grouped into CHUNK_SIZE x CHUNK_SIZE chunks,
+ * wall instances are listed chunk by chunk so that a chunk is a contiguous range.
+ * The w component of an instance offset is the material of the wall.
+ */
+class CMaze {
+public:
+	struct Chunk {
+		int x0;		// First cell (inclusive)
+		int y0;
+		int x1;		// Last cell (exclusive)
+		int y1;
+		int first;	// First wall instance
+		int count;	// Number of wall instances
+		vec3 center;	// Instance space
+		float radius;
+	};
+
+private:
+	int m_width;
+	int m_height;
+	char *m_cells;
+
+	int m_chunkX;
+	int m_chunkY;
+	Chunk *m_chunks;
+	int m_wallCount;
+
+	int BuildChunks(void);
+
+	CMaze(void);
+	virtual ~CMaze(void);
+
+	static CMaze *m_instance;
+
+public:
+	static CMaze *GetInstance(void);
+	void Destroy(void);
+
+	int Generate(int width, int height);
+
+	int Width(void);
+	int Height(void);
+	bool IsWall(int x, int y);
+	vec4 CellOffset(int x, int y);
+	int Material(int x, int y);
+
+	int WallCount(void);
+	int FillOffsets(vec4 *offset, GLuint *chunk);
+
+	int ChunkCount(void);
+	const Chunk *GetChunk(int idx);
+};
+
+#endif
+/* End of a file */
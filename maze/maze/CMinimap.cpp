@@ -0,0 +1,441 @@
+/**
+ * \brief
+ * A dirty rectangle is packed again from level 0 up, a level from the one
+ * below it, level 0 widened to whole texels of eight cells, the levels above
+ * to the rows which their bytes wrap around, then uploaded from the copy of
+ * the texture through GL_UNPACK_ROW_LENGTH.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CMaze.h"
+#include "CFrame.h"
+#include "CTextureManager.h"
+#include "CFog.h"
+#include "CMinimap.h"
+
+using namespace std;
+
+CMinimap *CMinimap::m_instance = NULL;
+
+CMinimap::CMinimap(void)
+: m_bits(NULL)
+, m_pitch(0)
+, m_rows(0)
+, m_levelCount(0)
+, m_dirtyCount(0)
+, m_texture(0)
+, m_VAO(0)
+, m_program(0)
+, m_handle(0)
+, m_levelLocation(-1)
+, m_eyeLocation(-1)
+, m_widthLocation(-1)
+, m_enabled(false)
+, m_loaded(false)
+{
+}
+
+CMinimap::~CMinimap(void)
+{
+	// The texture belongs to CTextureManager
+	if (m_handle > 0)
+		CTextureManager::GetInstance()->Release(m_handle);
+
+	if (m_VAO)
+		glDeleteVertexArrays(1, &m_VAO);
+
+	if (m_program)
+		glDeleteProgram(m_program);
+
+	delete[] m_bits;
+}
+
+CMinimap *CMinimap::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CMinimap();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CMinimap::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+bool CMinimap::Enabled(void)
+{
+	return m_enabled;
+}
+
+void CMinimap::Toggle(void)
+{
+	if (!m_program)
+		return;
+
+	m_enabled = !m_enabled;
+	cout << "Minimap " << (m_enabled ? "on" : "off") << endl;
+}
+
+/**
+ * \brief
+ * Walls of a cell of a level, 0 to 255. Level 0 is CMaze itself,
+ * with the cells which player 0 has not explored as walls.
+ */
+int CMinimap::Value(int level, int x, int y)
+{
+	const Level *l = &m_levels[level];
+	CFog *fog;
+
+	if (level == 0) {
+		fog = CFog::GetInstance();
+		return CMaze::GetInstance()->IsWall(x, y) || (fog->Enabled() && !fog->Explored(0, x, y)) ? 255 : 0;
+	}
+
+	if (x < 0 || y < 0 || x >= l->width || y >= l->height)
+		return 0;
+
+	return m_bits[l->row * m_pitch + y * l->width + x];
+}
+
+/**
+ * \brief
+ * Packs the cells of a level which cover a rectangle of level 0 cells,
+ * texels is the rectangle of the texture which has changed.
+ */
+void CMinimap::Pack(int level, const Rect &cells, Rect *texels)
+{
+	const Level *l = &m_levels[level];
+	unsigned char *texel;
+	int x0;
+	int x1;
+	int y0;
+	int y1;
+	int x;
+	int y;
+
+	x0 = cells.x0 >> level;
+	x1 = min((cells.x1 + (1 << level) - 1) >> level, l->width);
+	y0 = cells.y0 >> level;
+	y1 = min((cells.y1 + (1 << level) - 1) >> level, l->height);
+
+	// Bits of eight cells, whole texels
+	if (level == 0) {
+		x0 &= ~7;
+		for (y = y0; y < y1; y++) {
+			for (x = x0; x < x1; x++) {
+				texel = &m_bits[(l->row + y) * m_pitch + (x >> 3)];
+				if (Value(0, x, y))
+					*texel |= 1 << (x & 7);
+				else
+					*texel &= ~(1 << (x & 7));
+			}
+		}
+
+		texels->x0 = x0 >> 3;
+		texels->x1 = (x1 + 7) >> 3;
+		texels->y0 = y0;
+		texels->y1 = y1;
+		return;
+	}
+
+	// The mean of the four cells below
+	for (y = y0; y < y1; y++) {
+		for (x = x0; x < x1; x++) {
+			m_bits[l->row * m_pitch + y * l->width + x] = (unsigned char)((Value(level - 1, x * 2, y * 2)
+				+ Value(level - 1, x * 2 + 1, y * 2) + Value(level - 1, x * 2, y * 2 + 1)
+				+ Value(level - 1, x * 2 + 1, y * 2 + 1) + 2) / 4);
+		}
+	}
+
+	// The rows of the texture which the bytes wrap around
+	texels->x0 = 0;
+	texels->x1 = m_pitch;
+	texels->y0 = l->row + (y0 * l->width + x0) / m_pitch;
+	texels->y1 = y0 < y1 && x0 < x1 ? l->row + ((y1 - 1) * l->width + x1 - 1) / m_pitch + 1 : texels->y0;
+}
+
+/**
+ * \brief
+ * Should be called after CMaze is generated.
+ * The old GL has no GLSL 1.40, it has no map.
+ */
+int CMinimap::Load(void)
+{
+	CMaze *maze = CMaze::GetInstance();
+	CTextureManager *manager = CTextureManager::GetInstance();
+	Level *level;
+	Rect cells;
+	Rect texels;
+	GLint unit;
+	GLint location;
+	int i;
+
+	if (m_loaded)
+		return 0;
+
+	if (__OLD_GL) {
+		m_loaded = true;
+		return 0;
+	}
+
+	// Until a level fits the pixels of the map
+	m_pitch = (maze->Width() + 7) / 8;
+	m_levels[0].row = 0;
+	m_levels[0].width = maze->Width();
+	m_levels[0].height = maze->Height();
+	m_rows = maze->Height();
+	for (m_levelCount = 1; m_levelCount < MINIMAP_LEVELS; m_levelCount++) {
+		level = &m_levels[m_levelCount - 1];
+		if (max(level->width, level->height) <= MINIMAP_PIXELS)
+			break;
+
+		m_levels[m_levelCount].row = m_rows;
+		m_levels[m_levelCount].width = (level->width + 1) / 2;
+		m_levels[m_levelCount].height = (level->height + 1) / 2;
+		m_rows += (m_levels[m_levelCount].width * m_levels[m_levelCount].height + m_pitch - 1) / m_pitch;
+	}
+
+	try {
+		m_bits = new unsigned char[m_pitch * m_rows];
+	} catch (...) {
+		cerr << "Failed to allocate the minimap" << endl;
+		return -ENOMEM;
+	}
+
+	memset(m_bits, 0, m_pitch * m_rows);
+	cells.x0 = 0;
+	cells.y0 = 0;
+	cells.x1 = maze->Width();
+	cells.y1 = maze->Height();
+	for (i = 0; i < m_levelCount; i++)
+		Pack(i, cells, &texels);
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + MINIMAP_TEXTURE_UNIT);
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, m_pitch, m_rows, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_bits);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(unit);
+	StatusPrint();
+
+	// The manager deletes the texture
+	m_handle = manager->Acquire("minimap", 0);
+	if (m_handle < 0) {
+		glDeleteTextures(1, &m_texture);
+		m_handle = 0;
+		cerr << "Failed to register the minimap texture" << endl;
+		return -EFAULT;
+	}
+	manager->Assign(m_handle, GL_TEXTURE_2D, m_texture);
+
+	m_program = CShader::GetInstance()->LoadProgram(CMisc::m_minimapVertexShaderFile, CMisc::m_minimapFragmentShaderFile);
+	if (!m_program) {
+		cerr << "Failed to load the minimap program" << endl;
+		return -EFAULT;
+	}
+
+	glUseProgram(m_program);
+	location = glGetUniformLocation(m_program, "map");
+	if (location >= 0)
+		glUniform1i(location, MINIMAP_TEXTURE_UNIT);
+	m_levelLocation = glGetUniformLocation(m_program, "level");
+	m_eyeLocation = glGetUniformLocation(m_program, "eye");
+	m_widthLocation = glGetUniformLocation(m_program, "levelWidth");
+	CShader::GetInstance()->UseProgram();
+
+	glGenVertexArrays(1, &m_VAO);
+	StatusPrint();
+
+	cout << "Minimap of " << m_levelCount << " levels, " << m_pitch * m_rows << " bytes" << endl;
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * The cells of CMaze in [x0, x1) x [y0, y1) have changed, they are uploaded by Update().
+ */
+int CMinimap::Invalidate(int x0, int y0, int x1, int y1)
+{
+	Rect *rect;
+	int i;
+
+	if (!m_bits)
+		return 0;
+
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, m_levels[0].width);
+	y1 = min(y1, m_levels[0].height);
+	if (x0 >= x1 || y0 >= y1)
+		return -EINVAL;
+
+	// Out of rectangles, a single one bounds them all
+	if (m_dirtyCount == MINIMAP_DIRTY_MAX) {
+		rect = &m_dirty[0];
+		for (i = 1; i < m_dirtyCount; i++) {
+			rect->x0 = min(rect->x0, m_dirty[i].x0);
+			rect->y0 = min(rect->y0, m_dirty[i].y0);
+			rect->x1 = max(rect->x1, m_dirty[i].x1);
+			rect->y1 = max(rect->y1, m_dirty[i].y1);
+		}
+		rect->x0 = min(rect->x0, x0);
+		rect->y0 = min(rect->y0, y0);
+		rect->x1 = max(rect->x1, x1);
+		rect->y1 = max(rect->y1, y1);
+		m_dirtyCount = 1;
+		return 0;
+	}
+
+	// Next to the last one, e.g. the cells of a pass of CFog, they are bounded together
+	rect = m_dirtyCount > 0 ? &m_dirty[m_dirtyCount - 1] : NULL;
+	if (rect && x0 <= rect->x1 && x1 >= rect->x0 && y0 <= rect->y1 && y1 >= rect->y0) {
+		rect->x0 = min(rect->x0, x0);
+		rect->y0 = min(rect->y0, y0);
+		rect->x1 = max(rect->x1, x1);
+		rect->y1 = max(rect->y1, y1);
+		return 0;
+	}
+
+	rect = &m_dirty[m_dirtyCount++];
+	rect->x0 = x0;
+	rect->y0 = y0;
+	rect->x1 = x1;
+	rect->y1 = y1;
+	return 0;
+}
+
+/**
+ * \brief
+ * Uploads the rectangles of Invalidate(), returns the count of the uploads.
+ */
+int CMinimap::Update(void)
+{
+	Rect texels;
+	GLint unit;
+	int uploads = 0;
+	int i;
+	int j;
+
+	if (!m_bits || m_dirtyCount == 0)
+		return 0;
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + MINIMAP_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_pitch);
+
+	for (i = 0; i < m_dirtyCount; i++) {
+		for (j = 0; j < m_levelCount; j++) {
+			Pack(j, m_dirty[i], &texels);
+			if (texels.x0 >= texels.x1 || texels.y0 >= texels.y1)
+				continue;
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, texels.x0, texels.y0,
+				texels.x1 - texels.x0, texels.y1 - texels.y0, GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+				m_bits + texels.y0 * m_pitch + texels.x0);
+			uploads++;
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glActiveTexture(unit);
+	StatusPrint();
+
+	m_dirtyCount = 0;
+	return uploads;
+}
+
+/**
+ * \brief
+ * Draws the map over the frame, in a corner of the viewport, with the eye on it.
+ * A viewport of the split-screen has its own map with its own eye.
+ */
+int CMinimap::Draw(void)
+{
+	CFrame *frame = CFrame::GetInstance();
+	const GLint *rect;
+	GLint viewport[4];
+	mat4 inv;
+	vec4 eye;
+	int size;
+	int cells;
+	int level;
+	int i;
+
+	if (!m_enabled || !m_program)
+		return 0;
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	rect = frame->Viewports() > 1 ? frame->Viewport(0) : viewport;
+	size = min(MINIMAP_PIXELS, min(rect[2], rect[3]) - MINIMAP_MARGIN * 2);
+	if (size <= 0)
+		return 0;
+
+	// The finest level whose cells are no smaller than the pixels
+	cells = max(m_levels[0].width, m_levels[0].height);
+	for (level = 0; level + 1 < m_levelCount && (cells >> level) > size; level++)
+		;
+
+	glUseProgram(m_program);
+	glUniform4i(m_levelLocation, m_levels[level].row, level, m_levels[0].width, m_levels[0].height);
+	glUniform1i(m_widthLocation, m_levels[level].width);
+	CTextureManager::GetInstance()->Bind(m_handle, MINIMAP_TEXTURE_UNIT);
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBindVertexArray(m_VAO);
+
+	for (i = 0; i < frame->Viewports(); i++) {
+		if (frame->Viewports() > 1)
+			rect = frame->Viewport(i);
+
+		// Eye of the model space, in cells of level 0
+		inv = (mat4(frame->View(i)) * frame->World()).inverse();
+		eye = inv * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		glUniform2f(m_eyeLocation, eye.x / eye.w / BLOCK_WIDTH + m_levels[0].width / 2 + 0.5f,
+			eye.z / eye.w / BLOCK_WIDTH + m_levels[0].height / 2 + 0.5f);
+
+		glViewport(rect[0] + rect[2] - MINIMAP_MARGIN - size,
+			rect[1] + rect[3] - MINIMAP_MARGIN - size, size, size);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		CMisc::CountDraw();
+	}
+
+	glBindVertexArray(0);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	CShader::GetInstance()->UseProgram();
+	StatusPrint();
+	return 0;
+}
+
+/* End of a file */
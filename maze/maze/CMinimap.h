@@ -0,0 +1,85 @@
+#pragma once
+#if !defined(__CMINIMAP_H)
+#define __CMINIMAP_H
+
+#define MINIMAP_PIXELS 256	// Side of the map on the screen
+#define MINIMAP_MARGIN 16	// From the top right corner of the viewport
+#define MINIMAP_LEVELS 16	// Of the pyramid, enough for 65536 cells a side
+#define MINIMAP_DIRTY_MAX 32	// Rectangles of a frame, more are merged into one
+
+/**
+ * \brief
+ * Overview map of CMaze, a textured quad in a corner of the screen.
+ *
+ * The cells are packed a bit each, eight cells of a row in a texel of an R8UI
+ * texture. A maze which is larger than the map has a pyramid above them:
+ * level l has a cell for 2^l x 2^l cells of the maze, a byte of their walls
+ * (0: none, 255: every one), as a maze of corridors a cell wide has no bit
+ * which stands for four of its cells. The texture is as wide as the bits of
+ * level 0, the bytes of a level above follow the level below, row by row,
+ * wrapped around the rows of the texture. The map reads the level whose cells
+ * are no smaller than its pixels, so it costs its pixels whatever the maze size.
+ *
+ * The cells which player 0 has not explored are drawn as walls while CFog is
+ * on. CFog calls Invalidate() for the cells which it marks and for the whole
+ * maze when it is toggled, Update() packs the rectangles again for every level
+ * and uploads them by glTexSubImage2D, so a change costs its area, not the maze.
+ */
+class CMinimap {
+private:
+	struct Rect {
+		int x0;	// Cells of level 0, x1 and y1 exclusive
+		int y0;
+		int x1;
+		int y1;
+	};
+
+	struct Level {
+		int row;	// First row of the level in the texture
+		int width;	// Cells
+		int height;
+	};
+
+	unsigned char *m_bits;	// Copy of the texture
+	int m_pitch;	// Bytes of a row of the texture, the bits of a row of level 0
+	int m_rows;
+	Level m_levels[MINIMAP_LEVELS];
+	int m_levelCount;
+
+	Rect m_dirty[MINIMAP_DIRTY_MAX];
+	int m_dirtyCount;
+
+	GLuint m_texture;
+	GLuint m_VAO;	// No attributes, the quad comes from gl_VertexID
+	GLuint m_program;
+	int m_handle;	// Of CTextureManager
+	GLint m_levelLocation;
+	GLint m_eyeLocation;
+	GLint m_widthLocation;
+
+	bool m_enabled;
+	bool m_loaded;
+
+	int Value(int level, int x, int y);
+	void Pack(int level, const Rect &cells, Rect *texels);
+
+	CMinimap(void);
+	virtual ~CMinimap(void);
+
+	static CMinimap *m_instance;
+
+public:
+	static CMinimap *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+	int Invalidate(int x0, int y0, int x1, int y1);
+	int Update(void);
+	int Draw(void);
+
+	bool Enabled(void);
+	void Toggle(void);
+};
+
+#endif
+/* End of a file */
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string.h>
 
 #include "glad/glad.h"
 
@@ -7,10 +8,26 @@
 using namespace std;
 
 bool CMisc::m_ver3_1 = false;
+bool CMisc::m_ver3_2 = false;
+bool CMisc::m_ver4_1 = false;
+bool CMisc::m_ver4_3 = false;
+bool CMisc::m_ver4_4 = false;
+GLADloadproc CMisc::m_loader = NULL;
+GLuint CMisc::m_framebuffer = 0;
+unsigned int CMisc::m_drawCalls = 0;
 const char * const CMisc::m_oldVertexShaderFile = "maze.old.vert";
 const char * const CMisc::m_oldFragmentShaderFile = "maze.old.frag";
 const char * const CMisc::m_vertexShaderFile = "maze.vert";
 const char * const CMisc::m_fragmentShaderFile = "maze.frag";
+const char * const CMisc::m_geometryShaderFile = "maze.geom";
+const char * const CMisc::m_cullComputeShaderFile = "maze.cull.comp";
+const char * const CMisc::m_hizComputeShaderFile = "maze.hiz.comp";
+const char * const CMisc::m_cullVertexShaderFile = "maze.cull.vert";
+const char * const CMisc::m_cullGeometryShaderFile = "maze.cull.geom";
+const char * const CMisc::m_impostorVertexShaderFile = "maze.impostor.vert";
+const char * const CMisc::m_impostorFragmentShaderFile = "maze.impostor.frag";
+const char * const CMisc::m_minimapVertexShaderFile = "maze.minimap.vert";
+const char * const CMisc::m_minimapFragmentShaderFile = "maze.minimap.frag";
 
 CMisc::CMisc(void)
 {
@@ -31,4 +48,136 @@ void CMisc::EnableVersion_3_1(void)
 	CMisc::m_ver3_1 = true;
 }
 
+bool CMisc::IsGLVersion_3_2(void)
+{
+	return m_ver3_2;
+}
+
+void CMisc::EnableVersion_3_2(void)
+{
+	cout << "Version 3.2" << endl;
+	CMisc::m_ver3_2 = true;
+}
+
+bool CMisc::IsGLVersion_4_1(void)
+{
+	return m_ver4_1;
+}
+
+void CMisc::EnableVersion_4_1(void)
+{
+	cout << "Version 4.1" << endl;
+	CMisc::m_ver4_1 = true;
+}
+
+bool CMisc::IsGLVersion_4_3(void)
+{
+	return m_ver4_3;
+}
+
+void CMisc::EnableVersion_4_3(void)
+{
+	cout << "Version 4.3" << endl;
+	CMisc::m_ver4_3 = true;
+}
+
+bool CMisc::IsGLVersion_4_4(void)
+{
+	return m_ver4_4;
+}
+
+void CMisc::EnableVersion_4_4(void)
+{
+	cout << "Version 4.4" << endl;
+	CMisc::m_ver4_4 = true;
+}
+
+void CMisc::SetLoader(GLADloadproc loader)
+{
+	m_loader = loader;
+}
+
+/**
+ * \brief
+ * Functions which glad does not load, e.g. of a version above its own.
+ */
+void *CMisc::ProcAddress(const char *name)
+{
+	if (!m_loader)
+		return NULL;
+
+	return m_loader(name);
+}
+
+/**
+ * \brief
+ * Extension of the current context, which may have no window.
+ */
+bool CMisc::ExtensionSupported(const char *name)
+{
+	const char *extensions;
+	const char *found;
+	GLint count = 0;
+	GLint i;
+	size_t length;
+
+	if (!name)
+		return false;
+
+	if (IsGLVersion_3_1()) {
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (i = 0; i < count; i++) {
+			if (!strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name))
+				return true;
+		}
+		return false;
+	}
+
+	extensions = (const char *)glGetString(GL_EXTENSIONS);
+	if (!extensions)
+		return false;
+
+	// A whole name, not the prefix of a longer one
+	length = strlen(name);
+	for (found = strstr(extensions, name); found; found = strstr(found + length, name)) {
+		if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+			return true;
+	}
+
+	return false;
+}
+
+void CMisc::SetFramebuffer(GLuint framebuffer)
+{
+	m_framebuffer = framebuffer;
+}
+
+/**
+ * \brief
+ * What a pass which renders elsewhere binds back, the offscreen target if there is no window.
+ */
+GLuint CMisc::Framebuffer(void)
+{
+	return m_framebuffer;
+}
+
+/**
+ * \brief
+ * Called next to every glDraw* of the render thread, see CUI::Benchmark().
+ */
+void CMisc::CountDraw(void)
+{
+	m_drawCalls++;
+}
+
+unsigned int CMisc::DrawCalls(void)
+{
+	return m_drawCalls;
+}
+
+void CMisc::ResetDrawCalls(void)
+{
+	m_drawCalls = 0;
+}
+
 /* End of a file */
@@ -6,13 +6,42 @@
 #define __func__ __FUNCTION__
 #endif
 
-#define StatusPrint() do { GLenum status; status = glGetError(); if (status != GL_NO_ERROR) cerr << __func__ << ":" << __LINE__ << ":" << status << endl; } while (0)
+// Messages of the GL calls before it, see CDebug
+#if defined(NDEBUG)
+#define StatusPrint() do { } while (0)
+#else
+#define StatusPrint() CDebug::Check(__FILE__, __func__, __LINE__)
+#endif
 
 #define __OLD_GL	!IsGLVersion_3_1()
 
+// Unit 0 is the wall array, bound by CTextureManager
+#define UPLOAD_TEXTURE_UNIT	1	// CTexture builds its textures here, nothing samples it
+#define LIGHT_TEXTURE_UNIT	2	// Texture buffers of CLights
+#define CLUSTER_TEXTURE_UNIT	3
+#define TILE_TEXTURE_UNIT	4
+#define LOD_TEXTURE_UNIT	5
+#define IMPOSTOR_TEXTURE_UNIT	6
+#define HIZ_TEXTURE_UNIT	7
+#define SHADOW_TEXTURE_UNIT	8	// Depth array of CShadows
+#define LIGHTMAP_TEXTURE_UNIT	9	// Atlas of CLightmap
+#define CELL_TEXTURE_UNIT	10	// Walls of the cells, see CLightmap
+#define MINIMAP_TEXTURE_UNIT	11	// Bits of the cells, see CMinimap
+#define FOG_TEXTURE_UNIT	12	// Explored cells, see CFog
+
+#define VIEWPORT_MAX	4	// Split-screen views, see CUI::SetViewports()
+
 class CMisc {
 private:
 	static bool m_ver3_1;	// glPrimitiveRestartIndex
+	static bool m_ver3_2;	// Geometry shader
+	static bool m_ver4_1;	// Geometry shader invocations, viewport arrays
+	static bool m_ver4_3;	// Compute shader, SSBO, glDrawElementsIndirect
+	static bool m_ver4_4;	// glBufferStorage
+
+	static GLADloadproc m_loader;	// Of the context, GLFW or EGL
+	static GLuint m_framebuffer;	// Drawn by the frames, 0 with a window
+	static unsigned int m_drawCalls;
 
 	CMisc(void);
 	virtual ~CMisc(void);
@@ -22,9 +51,37 @@ public:
 	static const char * const m_oldFragmentShaderFile;
 	static const char * const m_vertexShaderFile;
 	static const char * const m_fragmentShaderFile;
+	static const char * const m_geometryShaderFile;
+	static const char * const m_cullComputeShaderFile;
+	static const char * const m_hizComputeShaderFile;
+	static const char * const m_cullVertexShaderFile;
+	static const char * const m_cullGeometryShaderFile;
+	static const char * const m_impostorVertexShaderFile;
+	static const char * const m_impostorFragmentShaderFile;
+	static const char * const m_minimapVertexShaderFile;
+	static const char * const m_minimapFragmentShaderFile;
 
 	static bool IsGLVersion_3_1(void);
 	static void EnableVersion_3_1(void);
+	static bool IsGLVersion_3_2(void);
+	static void EnableVersion_3_2(void);
+	static bool IsGLVersion_4_1(void);
+	static void EnableVersion_4_1(void);
+	static bool IsGLVersion_4_3(void);
+	static void EnableVersion_4_3(void);
+	static bool IsGLVersion_4_4(void);
+	static void EnableVersion_4_4(void);
+
+	static void SetLoader(GLADloadproc loader);
+	static void *ProcAddress(const char *name);
+	static bool ExtensionSupported(const char *name);
+
+	static void SetFramebuffer(GLuint framebuffer);
+	static GLuint Framebuffer(void);
+
+	static void CountDraw(void);
+	static unsigned int DrawCalls(void);
+	static void ResetDrawCalls(void);
 };
 
 static inline bool IsGLVersion_3_1(void)
@@ -32,5 +89,25 @@ static inline bool IsGLVersion_3_1(void)
 	return CMisc::IsGLVersion_3_1();
 }
 
+static inline bool IsGLVersion_3_2(void)
+{
+	return CMisc::IsGLVersion_3_2();
+}
+
+static inline bool IsGLVersion_4_1(void)
+{
+	return CMisc::IsGLVersion_4_1();
+}
+
+static inline bool IsGLVersion_4_3(void)
+{
+	return CMisc::IsGLVersion_4_3();
+}
+
+static inline bool IsGLVersion_4_4(void)
+{
+	return CMisc::IsGLVersion_4_4();
+}
+
 #endif
 /* end of a file */
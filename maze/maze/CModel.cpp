@@ -1,5 +1,7 @@
 #include <iostream>
 
+#include "glad/glad.h"
+
 #include "cgmath.h"
 
 #include "CMisc.h"
@@ -0,0 +1,258 @@
+/**
+ * \brief
+ * Draws every recorded object from the shared buffers of CVertices
+ * with as few glMultiDrawElementsIndirect calls as there are primitive modes.
+ * The matrices and flags of the draws are in the uniform blocks of CFrame.
+ */
+
+#include <iostream>
+#include <stddef.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CFrame.h"
+#include "CRingBuffer.h"
+#include "CMultiDraw.h"
+#include "CProfiler.h"
+
+using namespace std;
+
+CMultiDraw *CMultiDraw::m_instance = NULL;
+
+CMultiDraw::CMultiDraw(void)
+: m_ring(NULL)
+, m_count(0)
+, m_countBuffer(0)
+, m_countOffset(0)
+, m_enabled(true)
+, m_loaded(false)
+{
+	Begin();
+}
+
+CMultiDraw::~CMultiDraw(void)
+{
+	delete m_ring;
+}
+
+CMultiDraw *CMultiDraw::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CMultiDraw();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CMultiDraw::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+bool CMultiDraw::Enabled(void)
+{
+	return m_loaded && m_enabled;
+}
+
+void CMultiDraw::Toggle(void)
+{
+	m_enabled = !m_enabled;
+	cout << "Multi draw " << (m_enabled ? "on" : "off") << endl;
+}
+
+int CMultiDraw::Load(void)
+{
+	if (m_loaded)
+		return 0;
+
+	if (!IsGLVersion_4_3()) {
+		cerr << "Multi draw indirect is not available" << endl;
+		return -EFAULT;
+	}
+
+	if (glGetAttribLocation(CShader::GetInstance()->Program(), "drawId") < 0) {
+		cerr << "Shader does not support multi draw" << endl;
+		return -EFAULT;
+	}
+
+	try {
+		m_ring = new CRingBuffer(GL_DRAW_INDIRECT_BUFFER, sizeof(m_commands) * MULTIDRAW_FLUSHES);
+	} catch (...) {
+		cerr << "Failed to allocate the command buffer" << endl;
+		return -EFAULT;
+	}
+
+	if (m_ring->Load() < 0) {
+		delete m_ring;
+		m_ring = NULL;
+		return -EFAULT;
+	}
+
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * Drops the draws of the previous frame.
+ */
+int CMultiDraw::Begin(void)
+{
+	int i;
+
+	for (i = 0; i < MULTIDRAW_MAX; i++)
+		m_used[i] = false;
+
+	m_count = 0;
+	m_countBuffer = 0;
+	m_countOffset = 0;
+	return 0;
+}
+
+int CMultiDraw::Set(int object, CVertices::Mesh mesh, GLuint instanceCount)
+{
+	const CVertices::MeshInfo *info = CVertices::GetInstance()->GetMesh(mesh);
+
+	if (object < 0 || object >= MULTIDRAW_MAX)
+		return -EINVAL;
+
+	if (m_used[object])
+		return -EBUSY;
+
+	if (!info || CVertices::GetInstance()->Command(mesh, instanceCount, object, &m_commands[object]) < 0)
+		return -EINVAL;
+
+	m_modes[object] = info->mode;
+	m_used[object] = true;
+	m_count++;
+	return object;
+}
+
+/**
+ * \brief
+ * Records a draw of an object, the draw index is returned.
+ */
+int CMultiDraw::Add(CVertices::Mesh mesh, int object, GLuint instanceCount)
+{
+	// The other objects would read the per-instance attributes from element [object]
+	if (instanceCount != 1 && object != 0)
+		return -EINVAL;
+
+	return Set(object, mesh, instanceCount);
+}
+
+/**
+ * \brief
+ * Records the instanced draw whose instance count is written by the GPU
+ * (GLuint at countOffset of countBuffer), see CCulling.
+ */
+int CMultiDraw::AddIndirect(CVertices::Mesh mesh, int object, GLuint countBuffer, GLintptr countOffset)
+{
+	int status;
+
+	status = Add(mesh, object, 0);
+	if (status < 0)
+		return status;
+
+	m_countBuffer = countBuffer;
+	m_countOffset = countOffset;
+	return status;
+}
+
+/**
+ * \brief
+ * The VAO and EBO of CVertices should be bound, and the main program in use.
+ */
+int CMultiDraw::Draw(void)
+{
+	CVertices::DrawCommand *commands;
+	GLintptr offset;
+	GLenum runMode[MULTIDRAW_MAX];
+	int runFirst[MULTIDRAW_MAX];
+	int runCount[MULTIDRAW_MAX];
+	bool emitted[MULTIDRAW_MAX];
+	int runs = 0;
+	int count = 0;
+	int instanced = -1;
+	int i;
+	int j;
+
+	if (!Enabled() || m_count == 0)
+		return 0;
+
+	CProfiler::Zone zone("MultiDraw");
+
+	// A full region is closed, the draws so far are the last ones which read it
+	commands = (CVertices::DrawCommand *)m_ring->Alloc(sizeof(*commands) * m_count, &offset);
+	if (!commands) {
+		m_ring->Fence();
+		commands = (CVertices::DrawCommand *)m_ring->Alloc(sizeof(*commands) * m_count, &offset);
+		if (!commands)
+			return -ENOMEM;
+	}
+
+	// Commands are grouped by the primitive mode, one call per group
+	for (i = 0; i < MULTIDRAW_MAX; i++)
+		emitted[i] = false;
+
+	for (i = 0; i < MULTIDRAW_MAX; i++) {
+		if (!m_used[i] || emitted[i])
+			continue;
+
+		runMode[runs] = m_modes[i];
+		runFirst[runs] = count;
+		for (j = i; j < MULTIDRAW_MAX; j++) {
+			if (!m_used[j] || emitted[j] || m_modes[j] != m_modes[i])
+				continue;
+
+			if (j == 0)
+				instanced = count;
+			commands[count++] = m_commands[j];
+			emitted[j] = true;
+		}
+		runCount[runs] = count - runFirst[runs];
+		runs++;
+	}
+
+	m_ring->Flush();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_ring->Buffer());
+
+	// The visible count never comes back to the CPU
+	if (m_countBuffer && instanced >= 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, m_countBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_DRAW_INDIRECT_BUFFER, m_countOffset,
+			offset + sizeof(*commands) * instanced + offsetof(CVertices::DrawCommand, instanceCount), sizeof(GLuint));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	StatusPrint();
+
+	// baseInstance is the object
+	CFrame::GetInstance()->BindObject(0);
+
+	for (i = 0; i < runs; i++) {
+		glMultiDrawElementsIndirect(runMode[i], GL_UNSIGNED_INT,
+			(void *)(offset + sizeof(*commands) * runFirst[i]), runCount[i], 0);
+		CMisc::CountDraw();
+	}
+	StatusPrint();
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	return 0;
+}
+
+/* End of a file */
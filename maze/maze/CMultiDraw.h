@@ -0,0 +1,63 @@
+#pragma once
+#if !defined(__CMULTIDRAW_H)
+#define __CMULTIDRAW_H
+
+#define MULTIDRAW_MAX 8	// A draw per object, same as OBJECT_MAX
+#define MULTIDRAW_FLUSHES 64	// Draw() calls whose commands fit a region of the ring
+
+class CRingBuffer;
+
+/**
+ * \brief
+ * Collects the draws of the objects for a frame and issues them by
+ * glMultiDrawElementsIndirect, one call per primitive mode (GL 4.3).
+ *
+ * The object of a draw (see CFrame) is its draw index, which reaches the shader
+ * as the baseInstance of the command, through the "drawId" attribute
+ * whose divisor is larger than any instance count.
+ * Only object 0 may be instanced, so its per-instance attributes start at the first element.
+ * The other draws read element [object] of the per-instance attributes,
+ * so those buffers should hold at least MULTIDRAW_MAX elements.
+ * The commands are written to a CRingBuffer, never over the ones of a draw
+ * which the GPU may still read.
+ */
+class CMultiDraw {
+private:
+	CRingBuffer *m_ring;	// Commands
+
+	CVertices::DrawCommand m_commands[MULTIDRAW_MAX];
+	GLenum m_modes[MULTIDRAW_MAX];
+	bool m_used[MULTIDRAW_MAX];
+	int m_count;
+
+	// Instance count of object 0 which is written by the GPU
+	GLuint m_countBuffer;
+	GLintptr m_countOffset;
+
+	bool m_enabled;
+	bool m_loaded;
+
+	int Set(int object, CVertices::Mesh mesh, GLuint instanceCount);
+
+	CMultiDraw(void);
+	virtual ~CMultiDraw(void);
+
+	static CMultiDraw *m_instance;
+
+public:
+	static CMultiDraw *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+
+	int Begin(void);
+	int Add(CVertices::Mesh mesh, int object, GLuint instanceCount = 1);
+	int AddIndirect(CVertices::Mesh mesh, int object, GLuint countBuffer, GLintptr countOffset);
+	int Draw(void);
+
+	bool Enabled(void);
+	void Toggle(void);
+};
+
+#endif
+/* End of a file */
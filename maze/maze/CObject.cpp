@@ -1,7 +1,16 @@
 #include <iostream>
+#include <stdint.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
 
 #include "CMisc.h"
 #include "CObject.h"
+#include "CShader.h"
+#include "CRenderQueue.h"
 
 using namespace std;
 
@@ -40,4 +49,24 @@ CObject *CObject::Prev(void)
 	return m_prev;
 }
 
+int CObject::Submit(CRenderQueue *queue)
+{
+	return queue->Add(this);
+}
+
+int CObject::Record(GLuint arg)
+{
+	return -ENOSYS;
+}
+
+int CObject::Execute(GLuint arg)
+{
+	return Render();
+}
+
+GLuint CObject::Program(void)
+{
+	return CShader::GetInstance()->Program();
+}
+
 /* End of a file */
@@ -2,10 +2,19 @@
 #if !defined(__COBJECT_H)
 #define __COBJECT_H
 
+class CRenderQueue;
+
 /**
  * \brief
  * Classes which inherit this, could be managed by list.
- * Each object should be linked. to render them all in the Render function of CUI class.
+ * Each object should be linked. to render them all in the Run function of CUI class.
+ * Submit() adds the draw packets of an object to CRenderQueue, which calls
+ * Record() to queue a packet to CMultiDraw, or Execute() to draw it.
+ * By default an object submits a single packet which is drawn by Render(),
+ * with the variant of the main program which Program() returns.
+ * Name() labels the object in the zones of CProfiler.
+ * Bounds() is the sphere of the object in the world space, false for none,
+ * an object with a sphere may cast a shadow by Render(), see CShadows.
  */
 class CObject {
 private:
@@ -18,6 +27,12 @@ public:
 
 	virtual int Render(void) { return 0; }
 	virtual int Load(void) { return 0; }
+	virtual int Submit(CRenderQueue *queue);
+	virtual int Record(GLuint arg);
+	virtual int Execute(GLuint arg);
+	virtual GLuint Program(void);
+	virtual const char *Name(void) { return "Object"; }
+	virtual bool Bounds(vec3 *center, float *radius) { return false; }
 
 	/* List operator */
 	virtual int AddTail(CObject *obj);
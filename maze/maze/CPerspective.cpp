@@ -1,5 +1,7 @@
 #include <iostream>
 
+#include "glad/glad.h"
+
 #include "cgmath.h"
 
 #include "CMisc.h"
@@ -7,14 +9,15 @@
 
 using namespace std;
 
-CPerspective *CPerspective::m_instance = NULL;
+CPerspective *CPerspective::m_instances[VIEWPORT_MAX] = { NULL, };
 
-CPerspective::CPerspective(void)
+CPerspective::CPerspective(int index)
 : m_fov(PI/2.0f)
 , m_ratio(1024.0f/768.0f)
 , m_near(0.1f)
 , m_far(10000.0f)
 , m_updated(true)
+, m_index(index)
 {
 
 }
@@ -24,24 +27,27 @@ CPerspective::~CPerspective(void)
 
 }
 
-CPerspective *CPerspective::GetInstance(void)
+CPerspective *CPerspective::GetInstance(int idx)
 {
-	if (!m_instance) {
+	if (idx < 0 || idx >= VIEWPORT_MAX)
+		return NULL;
+
+	if (!m_instances[idx]) {
 		try {
-			m_instance = new CPerspective();
+			m_instances[idx] = new CPerspective(idx);
 		}
 		catch (...) {
 			return NULL;
 		}
 	}
 
-	return m_instance;
+	return m_instances[idx];
 }
 
 
 void CPerspective::Destroy(void)
 {
-	m_instance = NULL;
+	m_instances[m_index] = NULL;
 	delete this;
 }
 
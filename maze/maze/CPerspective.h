@@ -2,6 +2,10 @@
 #if !defined(__CPERSPECTIVE_H)
 #define __CPERSPECTIVE_H
 
+/**
+ * \brief
+ * Projection of a viewport of the split-screen, GetInstance() is the first one.
+ */
 class CPerspective {
 private:
 	mat4 m_perspective;
@@ -10,15 +14,16 @@ private:
 	float m_near;
 	float m_far;
 	bool m_updated;
+	int m_index;	// Viewport, see CUI::SetViewports()
 
-	static CPerspective *m_instance;
+	static CPerspective *m_instances[VIEWPORT_MAX];
 
-	CPerspective(void);
+	CPerspective(int index);
 	virtual ~CPerspective(void);
 
 public:
 
-	static CPerspective *GetInstance(void);
+	static CPerspective *GetInstance(int idx = 0);
 	void Destroy(void);
 
 	void SetFOV(float fov);
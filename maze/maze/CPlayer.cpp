@@ -1,4 +1,5 @@
 #include <iostream>
+#include <math.h>
 
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
@@ -14,12 +15,15 @@
 #include "CPerspective.h"
 #include "CModel.h"
 #include "CView.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
 
 using namespace std;
 
 CPlayer *CPlayer::m_instance = NULL;
 
 CPlayer::CPlayer(void)
+: m_object(-1)
 {
 	m_translate.setIdentity();
 	m_rotate.setIdentity();
@@ -53,25 +57,65 @@ void CPlayer::Destroy(void)
 
 int CPlayer::Render(void)
 {
-	mat4 mvp;
+	// Drawing a player
+	CFrame::GetInstance()->BindObject(m_object);
+	CVertices::GetInstance()->Draw(CVertices::CUBE);
 
-	mvp = CPerspective::GetInstance()->Matrix() * CView::GetInstance()->Matrix() * m_translate * m_scale * m_rotate;
+	return 0;
+}
 
-	glUniformMatrix4fv(CShader::GetInstance()->MVPId(), 1, GL_TRUE, (const GLfloat *)mvp);
-	StatusPrint();
+int CPlayer::Record(GLuint arg)
+{
+	return CMultiDraw::GetInstance()->Add(CVertices::CUBE, m_object);
+}
 
-	// Drawing a player
-	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void *)0);
-	StatusPrint();
+GLuint CPlayer::Program(void)
+{
+	return CShader::GetInstance()->Program(CShader::ENV);
+}
 
-	return 0;
+/**
+ * \brief
+ * Around the cube as drawn in this frame, the simulation thread may be moving it.
+ */
+bool CPlayer::Bounds(vec3 *center, float *radius)
+{
+	mat4 model = CFrame::GetInstance()->Model(m_object);
+	vec4 origin;
+	float scale;
+
+	if (m_object < 0 || !center || !radius)
+		return false;
+
+	origin = model * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	*center = vec3(origin.x, origin.y, origin.z);
+
+	// The longest axis of the model, the cube is BLOCK_WIDTH from its center to a face
+	scale = max(vec3(model._11, model._21, model._31).length(),
+		max(vec3(model._12, model._22, model._32).length(), vec3(model._13, model._23, model._33).length()));
+	*radius = BLOCK_WIDTH * sqrtf(3.0f) * scale;
+	return true;
 }
 
 int CPlayer::Load(void)
 {
+	if (m_object < 0) {
+		m_object = CFrame::GetInstance()->AddObject(0);
+		UpdateModel();
+	}
+
 	return 0;
 }
 
+/**
+ * \brief
+ * The model is only written when the player moves.
+ */
+void CPlayer::UpdateModel(void)
+{
+	CFrame::GetInstance()->SetModel(m_object, m_translate * m_scale * m_rotate);
+}
+
 void CPlayer::Translate(CMovable::Direction d, float amount)
 {
 	switch (d) {
@@ -90,16 +134,20 @@ void CPlayer::Translate(CMovable::Direction d, float amount)
 	default:
 		break;
 	}
+
+	UpdateModel();
 }
 
 void CPlayer::Rotate(vec3 axis, float angle)
 {
 	m_rotate = mat4::rotate(axis, angle) * m_rotate;
+	UpdateModel();
 }
 
 void CPlayer::Scale(vec4 scale)
 {
 	m_scale = mat4::scale(scale.x, scale.y, scale.z) * m_scale;
+	UpdateModel();
 }
 
 /* End of a file */
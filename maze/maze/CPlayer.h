@@ -12,11 +12,18 @@ private:
 	mat4 m_translate;
 	mat4 m_rotate;
 	mat4 m_scale;
+	int m_object; // Slot of CFrame
+
+	void UpdateModel(void);
 
 public:
 	static CPlayer *GetInstance(void);
 	void Destroy(void);
 	int Render(void);
+	int Record(GLuint arg);
+	GLuint Program(void);
+	const char *Name(void) { return "Player"; }
+	bool Bounds(vec3 *center, float *radius);
 	int Load(void);
 
 	virtual void Translate(CMovable::Direction d, float amount);
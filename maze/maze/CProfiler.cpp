@@ -0,0 +1,388 @@
+/**
+ * \brief
+ * The queries of a frame are named by the slot of the frame, frame % PROFILER_BUFFERS,
+ * and by the index of the zone, so a zone takes the same two queries every frame.
+ * BeginFrame() reads the slot before it is used again.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <chrono>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CProfiler.h"
+
+using namespace std;
+
+#define TRACE_PID 1
+#define TRACE_CPU_TID 1
+#define TRACE_GPU_TID 2
+
+CProfiler *CProfiler::m_instance = NULL;
+
+CProfiler::Zone::Zone(const char *name, bool gpu)
+: m_zone(CProfiler::GetInstance()->Begin(name, gpu))
+{
+}
+
+CProfiler::Zone::~Zone(void)
+{
+	CProfiler::GetInstance()->End(m_zone);
+}
+
+CProfiler::CProfiler(void)
+: m_history(NULL)
+, m_path(NULL)
+, m_depth(0)
+, m_frame(-1)
+, m_origin(0)
+, m_enabled(false)
+, m_timer(false)
+{
+	memset(m_queries, 0, sizeof(m_queries));
+}
+
+CProfiler::~CProfiler(void)
+{
+	if (m_timer)
+		glDeleteQueries(PROFILER_BUFFERS * PROFILER_ZONES * 2, &m_queries[0][0]);
+
+	delete[] m_history;
+}
+
+CProfiler *CProfiler::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CProfiler();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CProfiler::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * Starts recording, the trace is written to path. The GPU times need
+ * the timer queries of GL 3.3, without them the zones have their CPU times only.
+ */
+int CProfiler::Load(const char *path)
+{
+	int i;
+
+	if (!path)
+		return -EINVAL;
+
+	if (m_enabled)
+		return 0;
+
+	try {
+		m_history = new Record[PROFILER_HISTORY];
+	} catch (...) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < PROFILER_HISTORY; i++) {
+		m_history[i].frame = -1;
+		m_history[i].count = 0;
+		m_history[i].lastQuery = -1;
+		m_history[i].resolved = false;
+	}
+
+	m_timer = GLAD_GL_VERSION_3_3 != 0;
+	if (m_timer)
+		glGenQueries(PROFILER_BUFFERS * PROFILER_ZONES * 2, &m_queries[0][0]);
+	else
+		cout << "No timer queries, the profile has CPU times only" << endl;
+
+	StatusPrint();
+
+	m_path = path;
+	m_origin = 0;
+	m_origin = Now();
+	m_enabled = true;
+	return 0;
+}
+
+bool CProfiler::Enabled(void)
+{
+	return m_enabled;
+}
+
+int64_t CProfiler::Now(void)
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count() - m_origin;
+}
+
+CProfiler::Record *CProfiler::Current(void)
+{
+	return &m_history[m_frame % PROFILER_HISTORY];
+}
+
+/**
+ * \brief
+ * Reads the GPU times of a frame, if its last query is done.
+ * The timestamps are written in order, so the others are done when the last
+ * issued one is. It is the end of the frame zone, as the zones close in
+ * reverse order, not the end of the last opened zone.
+ */
+int CProfiler::Resolve(int64_t frame)
+{
+	Record *record = &m_history[frame % PROFILER_HISTORY];
+	GLuint *queries = m_queries[frame % PROFILER_BUFFERS];
+	GLuint available = 0;
+	int last = -1;
+	int i;
+
+	if (record->frame != frame)
+		return -EINVAL;
+
+	for (i = 0; i < record->count; i++) {
+		if (record->samples[i].gpu)
+			last = i;
+	}
+
+	if (last < 0 || record->lastQuery < 0)
+		return 0;
+
+	glGetQueryObjectuiv(queries[record->lastQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return 0;
+
+	for (i = 0; i <= last; i++) {
+		if (!record->samples[i].gpu)
+			continue;
+
+		glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &record->samples[i].gpuBegin);
+		glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &record->samples[i].gpuEnd);
+	}
+
+	StatusPrint();
+	record->resolved = true;
+	return 1;
+}
+
+/**
+ * \brief
+ * Opens the frame zone, which holds the others of the frame.
+ */
+int CProfiler::BeginFrame(void)
+{
+	Record *record;
+
+	if (!m_enabled)
+		return 0;
+
+	// Zones which are left open by the last frame
+	m_depth = 0;
+	m_frame++;
+
+	// The queries of this slot are reused by this frame
+	if (m_timer && m_frame >= PROFILER_BUFFERS)
+		Resolve(m_frame - PROFILER_BUFFERS);
+
+	record = Current();
+	record->frame = m_frame;
+	record->count = 0;
+	record->lastQuery = -1;
+	record->resolved = false;
+
+	return Begin("Frame");
+}
+
+int CProfiler::EndFrame(void)
+{
+	if (!m_enabled || m_frame < 0)
+		return 0;
+
+	// The frame zone is the first one, it closes the others
+	if (m_depth > 0)
+		End(m_stack[0]);
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Returns the zone which End() takes, -1 if it is not recorded.
+ * name should live as long as the profiler, e.g. a literal.
+ */
+int CProfiler::Begin(const char *name, bool gpu)
+{
+	Record *record;
+	Sample *sample;
+
+	if (!m_enabled || m_frame < 0)
+		return -1;
+
+	record = Current();
+	if (record->count >= PROFILER_ZONES || m_depth >= PROFILER_DEPTH)
+		return -1;
+
+	sample = &record->samples[record->count];
+	sample->name = name;
+	sample->depth = m_depth;
+	sample->cpuBegin = Now();
+	sample->cpuEnd = sample->cpuBegin;
+	sample->gpuBegin = 0;
+	sample->gpuEnd = 0;
+	sample->gpu = gpu && m_timer;
+
+	if (sample->gpu) {
+		glQueryCounter(m_queries[m_frame % PROFILER_BUFFERS][record->count * 2], GL_TIMESTAMP);
+		record->lastQuery = record->count * 2;
+	}
+
+	m_stack[m_depth++] = record->count;
+	return record->count++;
+}
+
+/**
+ * \brief
+ * Closes a zone and the zones which are opened after it.
+ */
+int CProfiler::End(int zone)
+{
+	Record *record;
+	Sample *sample;
+	int index;
+
+	if (!m_enabled || zone < 0 || m_frame < 0)
+		return -EINVAL;
+
+	record = Current();
+	if (zone >= record->count)
+		return -EINVAL;
+
+	while (m_depth > 0) {
+		index = m_stack[--m_depth];
+		sample = &record->samples[index];
+		sample->cpuEnd = Now();
+
+		if (sample->gpu) {
+			glQueryCounter(m_queries[m_frame % PROFILER_BUFFERS][index * 2 + 1], GL_TIMESTAMP);
+			record->lastQuery = index * 2 + 1;
+		}
+
+		if (index == zone)
+			break;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Writes the frames of the history as complete events ("ph": "X"),
+ * the CPU zones on a thread and the GPU zones on another.
+ * The GPU clock is not the CPU clock, the GPU zones of a frame are placed
+ * from the start of its CPU frame zone.
+ */
+int CProfiler::WriteTrace(void)
+{
+	const Record *record;
+	const Sample *sample;
+	const Sample *frame;
+	ofstream file;
+	int64_t first;
+	bool written;
+	int i;
+
+	if (!m_enabled)
+		return -EFAULT;
+
+	// The frames in flight which are done by now
+	if (m_timer) {
+		for (first = m_frame - PROFILER_BUFFERS + 1; first <= m_frame; first++) {
+			if (first >= 0 && !m_history[first % PROFILER_HISTORY].resolved)
+				Resolve(first);
+		}
+	}
+
+	file.open(m_path, ios::trunc);
+	if (!file.is_open()) {
+		cerr << "Failed to open " << m_path << endl;
+		return -EINVAL;
+	}
+
+	// Microseconds, the GPU times have fractions of them
+	file.setf(ios::fixed);
+	file.precision(3);
+
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << TRACE_PID
+		<< ", \"tid\": " << TRACE_CPU_TID << ", \"args\": {\"name\": \"CPU\"}}," << endl
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << TRACE_PID
+		<< ", \"tid\": " << TRACE_GPU_TID << ", \"args\": {\"name\": \"GPU\"}}";
+
+	// Oldest frame first
+	first = m_frame - PROFILER_HISTORY + 1;
+	if (first < 0)
+		first = 0;
+
+	for (; first <= m_frame; first++) {
+		record = &m_history[first % PROFILER_HISTORY];
+		if (record->frame != first || record->count == 0)
+			continue;
+
+		frame = &record->samples[0];
+		for (i = 0; i < record->count; i++) {
+			sample = &record->samples[i];
+			file << "," << endl
+				<< "{\"name\": \"" << sample->name << "\", \"cat\": \"cpu\", \"ph\": \"X\""
+				<< ", \"pid\": " << TRACE_PID << ", \"tid\": " << TRACE_CPU_TID
+				<< ", \"ts\": " << sample->cpuBegin
+				<< ", \"dur\": " << sample->cpuEnd - sample->cpuBegin
+				<< ", \"args\": {\"frame\": " << record->frame << "}}";
+		}
+
+		if (!record->resolved || !frame->gpu)
+			continue;
+
+		for (i = 0; i < record->count; i++) {
+			sample = &record->samples[i];
+			if (!sample->gpu)
+				continue;
+
+			file << "," << endl
+				<< "{\"name\": \"" << sample->name << "\", \"cat\": \"gpu\", \"ph\": \"X\""
+				<< ", \"pid\": " << TRACE_PID << ", \"tid\": " << TRACE_GPU_TID
+				<< ", \"ts\": " << frame->cpuBegin + (double)(sample->gpuBegin - frame->gpuBegin) / 1000.0
+				<< ", \"dur\": " << (double)(sample->gpuEnd - sample->gpuBegin) / 1000.0
+				<< ", \"args\": {\"frame\": " << record->frame << "}}";
+		}
+	}
+
+	file << endl << "]}" << endl;
+	written = file.good();
+	file.close();
+
+	if (!written) {
+		cerr << "Failed to write " << m_path << endl;
+		return -EIO;
+	}
+
+	cout << "Trace of " << (m_frame < PROFILER_HISTORY ? m_frame + 1 : PROFILER_HISTORY)
+		<< " frames is written to " << m_path << endl;
+	return 0;
+}
+
+/* End of a file */
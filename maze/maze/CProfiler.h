@@ -0,0 +1,90 @@
+#pragma once
+#if !defined(__CPROFILER_H)
+#define __CPROFILER_H
+
+#define PROFILER_ZONES 128	// Zones of a frame, the rest are dropped
+#define PROFILER_DEPTH 16	// Nested zones
+#define PROFILER_BUFFERS 2	// Frames whose queries are in flight
+#define PROFILER_HISTORY 300	// Frames kept for the trace
+
+/**
+ * \brief
+ * CPU and GPU time of the zones of the frames, e.g. the passes of CUI::Frame()
+ * and the objects which CRenderQueue executes.
+ *
+ * A zone is opened by Begin() and closed by End(), or by a Zone on the stack.
+ * The GPU time of a zone is taken by two GL_TIMESTAMP queries, as the
+ * GL_TIME_ELAPSED queries of the zones could not nest. The queries of a frame
+ * are read PROFILER_BUFFERS frames later, a frame whose queries are not
+ * available by then keeps its CPU times only, so the reads never wait.
+ *
+ * The last PROFILER_HISTORY frames are kept, WriteTrace() writes them
+ * as a Chrome trace to the file of Load(), which chrome://tracing and Perfetto open.
+ * Nothing is recorded until Load().
+ */
+class CProfiler {
+public:
+	class Zone {
+	private:
+		int m_zone;
+
+	public:
+		Zone(const char *name, bool gpu = true);
+		~Zone(void);
+	};
+
+private:
+	struct Sample {
+		const char *name;	// Static string
+		int depth;
+		int64_t cpuBegin;	// us from m_origin
+		int64_t cpuEnd;
+		GLuint64 gpuBegin;	// ns, GL_TIMESTAMP
+		GLuint64 gpuEnd;
+		bool gpu;	// Has GPU queries
+	};
+
+	struct Record {
+		int64_t frame;	// -1: empty
+		int count;
+		int lastQuery;	// Of the queries of the frame, the last one issued, -1: none
+		bool resolved;	// GPU times are read
+		Sample samples[PROFILER_ZONES];
+	};
+
+	Record *m_history;
+	const char *m_path;	// Of the trace
+	GLuint m_queries[PROFILER_BUFFERS][PROFILER_ZONES * 2];
+	int m_stack[PROFILER_DEPTH];
+	int m_depth;
+	int64_t m_frame;	// Current frame, -1: none
+	int64_t m_origin;	// us of the steady clock at Load()
+	bool m_enabled;
+	bool m_timer;	// GL_TIMESTAMP queries are available
+
+	int64_t Now(void);
+	Record *Current(void);
+	int Resolve(int64_t frame);
+
+	CProfiler(void);
+	virtual ~CProfiler(void);
+
+	static CProfiler *m_instance;
+
+public:
+	static CProfiler *GetInstance(void);
+	void Destroy(void);
+
+	int Load(const char *path);
+	bool Enabled(void);
+
+	int BeginFrame(void);
+	int EndFrame(void);
+	int Begin(const char *name, bool gpu = true);
+	int End(int zone);
+
+	int WriteTrace(void);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,359 @@
+/**
+ * \brief
+ * Objects submit packets by CObject::Submit() every frame.
+ * The packets are sorted by a LSD radix sort of their keys, 8 bits per pass,
+ * and the passes over bytes which are the same for every key are skipped.
+ * The sort is stable, so the packets of the same key keep the order of submission.
+ * Consecutive packets which CMultiDraw accepts are drawn by a single call,
+ * which is flushed whenever the state changes.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CObject.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
+#include "CRenderQueue.h"
+#include "CProfiler.h"
+
+using namespace std;
+
+#define QUEUE_MIN 64
+
+#define KEY_PASS_SHIFT 60
+#define KEY_PROGRAM_SHIFT 48
+#define KEY_TEXTURE_SHIFT 36
+#define KEY_DEPTH_SHIFT 4
+#define KEY_NAME_MASK 0xFFFull
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+CRenderQueue *CRenderQueue::m_instance = NULL;
+
+CRenderQueue::CRenderQueue(void)
+: m_packets(NULL)
+, m_items(NULL)
+, m_sorted(NULL)
+, m_count(0)
+, m_capacity(0)
+, m_program(0)
+, m_vao(0)
+, m_batching(false)
+{
+	int i;
+
+	for (i = 0; i < QUEUE_UNITS; i++)
+		m_texture[i] = 0;
+}
+
+CRenderQueue::~CRenderQueue(void)
+{
+	delete[] m_packets;
+	delete[] m_items;
+	delete[] m_sorted;
+}
+
+CRenderQueue *CRenderQueue::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CRenderQueue();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CRenderQueue::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+int CRenderQueue::Grow(void)
+{
+	Packet *packets;
+	Item *items;
+	Item *sorted;
+	int capacity;
+
+	capacity = m_capacity ? m_capacity * 2 : QUEUE_MIN;
+
+	try {
+		packets = new Packet[capacity];
+	} catch (...) {
+		return -ENOMEM;
+	}
+
+	try {
+		items = new Item[capacity];
+	} catch (...) {
+		delete[] packets;
+		return -ENOMEM;
+	}
+
+	try {
+		sorted = new Item[capacity];
+	} catch (...) {
+		delete[] packets;
+		delete[] items;
+		return -ENOMEM;
+	}
+
+	if (m_count > 0) {
+		memcpy(packets, m_packets, sizeof(*packets) * m_count);
+		memcpy(items, m_items, sizeof(*items) * m_count);
+	}
+
+	delete[] m_packets;
+	delete[] m_items;
+	delete[] m_sorted;
+
+	m_packets = packets;
+	m_items = items;
+	m_sorted = sorted;
+	m_capacity = capacity;
+	return 0;
+}
+
+/**
+ * \brief
+ * Drops the packets of the last frame. The storage is kept.
+ */
+int CRenderQueue::Begin(void)
+{
+	m_count = 0;
+	return 0;
+}
+
+int CRenderQueue::Add(const Packet &packet, Pass pass, float depth)
+{
+	uint32_t bits;
+	uint64_t key;
+
+	if (!packet.owner)
+		return -EINVAL;
+
+	if (m_count == m_capacity && Grow() < 0) {
+		cerr << "Failed to grow the render queue" << endl;
+		return -ENOMEM;
+	}
+
+	// A positive float sorts as its bits do, the packets behind the eye go first
+	if (!(depth > 0.0f))
+		depth = 0.0f;
+	memcpy(&bits, &depth, sizeof(bits));
+	if (pass == TRANSPARENT)
+		bits = ~bits;
+
+	key = ((uint64_t)pass << KEY_PASS_SHIFT)
+		| (((uint64_t)packet.program & KEY_NAME_MASK) << KEY_PROGRAM_SHIFT)
+		| (((uint64_t)packet.texture & KEY_NAME_MASK) << KEY_TEXTURE_SHIFT)
+		| ((uint64_t)bits << KEY_DEPTH_SHIFT);
+
+	m_packets[m_count] = packet;
+	m_items[m_count].key = key;
+	m_items[m_count].index = m_count;
+	return m_count++;
+}
+
+/**
+ * \brief
+ * Submits a packet drawn by the variant of the main program of the owner,
+ * from the buffers of CVertices.
+ */
+int CRenderQueue::Add(CObject *owner, GLuint arg, float depth)
+{
+	Packet packet;
+
+	packet.owner = owner;
+	packet.program = owner->Program();
+	packet.vao = CVertices::GetInstance()->VAO();
+	packet.texture = 0;
+	packet.unit = 0;
+	packet.arg = arg;
+
+	return Add(packet, OPAQUE, depth);
+}
+
+int CRenderQueue::Count(void)
+{
+	return m_count;
+}
+
+/**
+ * \brief
+ * Returns the sorted items, which is either m_items or m_sorted.
+ */
+CRenderQueue::Item *CRenderQueue::Sort(void)
+{
+	int histogram[RADIX_SIZE];
+	Item *src = m_items;
+	Item *dst = m_sorted;
+	Item *tmp;
+	int shift;
+	int digit;
+	int sum;
+	int count;
+	int i;
+
+	for (shift = 0; shift < 64; shift += RADIX_BITS) {
+		for (i = 0; i < RADIX_SIZE; i++)
+			histogram[i] = 0;
+
+		for (i = 0; i < m_count; i++)
+			histogram[(src[i].key >> shift) & (RADIX_SIZE - 1)]++;
+
+		// Every key has the same digit, this pass would not move anything
+		if (histogram[(src[0].key >> shift) & (RADIX_SIZE - 1)] == m_count)
+			continue;
+
+		sum = 0;
+		for (i = 0; i < RADIX_SIZE; i++) {
+			count = histogram[i];
+			histogram[i] = sum;
+			sum += count;
+		}
+
+		for (i = 0; i < m_count; i++) {
+			digit = (src[i].key >> shift) & (RADIX_SIZE - 1);
+			dst[histogram[digit]++] = src[i];
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	return src;
+}
+
+/**
+ * \brief
+ * Binds the state of a packet which differs from the bound one.
+ */
+int CRenderQueue::Bind(const Packet *packet)
+{
+	bool tracked = packet->unit < QUEUE_UNITS;
+	GLint unit;
+
+	if (packet->program != m_program || packet->vao != m_vao
+		|| (packet->texture && (!tracked || packet->texture != m_texture[packet->unit])))
+		Flush();
+
+	if (packet->program != m_program) {
+		glUseProgram(packet->program);
+		CFrame::GetInstance()->UseProgram(packet->program);
+		m_program = packet->program;
+	}
+
+	if (packet->vao != m_vao) {
+		glBindVertexArray(packet->vao);
+		// The element buffer of CVertices is not kept by its VAO
+		if (packet->vao == CVertices::GetInstance()->VAO())
+			CVertices::GetInstance()->BindEBO();
+		m_vao = packet->vao;
+	}
+
+	if (packet->texture && (!tracked || packet->texture != m_texture[packet->unit])) {
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+		glActiveTexture(GL_TEXTURE0 + packet->unit);
+		glBindTexture(GL_TEXTURE_2D, packet->texture);
+		glActiveTexture(unit);
+		if (tracked)
+			m_texture[packet->unit] = packet->texture;
+	}
+
+	StatusPrint();
+	return 0;
+}
+
+/**
+ * \brief
+ * Draws the packets which are recorded by CMultiDraw so far.
+ */
+int CRenderQueue::Flush(void)
+{
+	if (!m_batching)
+		return 0;
+
+	CMultiDraw::GetInstance()->Draw();
+	CMultiDraw::GetInstance()->Begin();
+	m_batching = false;
+	return 0;
+}
+
+/**
+ * \brief
+ * Sorts and draws the packets of the frame.
+ * The main program is in use and no VAO is bound afterwards.
+ */
+int CRenderQueue::Execute(void)
+{
+	CMultiDraw *multiDraw = CMultiDraw::GetInstance();
+	CProfiler *profiler = CProfiler::GetInstance();
+	GLuint mainProgram = CShader::GetInstance()->Program();
+	GLuint vao = CVertices::GetInstance()->VAO();
+	const Packet *packet;
+	Item *items;
+	bool batch;
+	int zone;
+	int i;
+
+	if (m_count == 0)
+		return 0;
+
+	items = Sort();
+	batch = multiDraw->Enabled();
+
+	// Other passes such as the culling change the state between frames
+	m_program = 0;
+	m_vao = 0;
+	for (i = 0; i < QUEUE_UNITS; i++)
+		m_texture[i] = 0;
+
+	if (batch)
+		multiDraw->Begin();
+	m_batching = false;
+
+	for (i = 0; i < m_count; i++) {
+		packet = &m_packets[items[i].index];
+		Bind(packet);
+
+		if (batch && packet->vao == vao && packet->owner->Record(packet->arg) >= 0) {
+			m_batching = true;
+			continue;
+		}
+
+		// Drawn by itself, after the recorded draws which it could disturb
+		Flush();
+		zone = profiler->Begin(packet->owner->Name());
+		packet->owner->Execute(packet->arg);
+		profiler->End(zone);
+	}
+	Flush();
+
+	CVertices::GetInstance()->UnbindEBO();
+	glBindVertexArray(0);
+	glUseProgram(mainProgram);
+	CFrame::GetInstance()->UseProgram(0);
+	return 0;
+}
+
+/* End of a file */
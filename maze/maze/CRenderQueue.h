@@ -0,0 +1,79 @@
+#pragma once
+#if !defined(__CRENDERQUEUE_H)
+#define __CRENDERQUEUE_H
+
+#define QUEUE_UNITS 8	// Texture units whose binding is tracked
+
+class CObject;
+
+/**
+ * \brief
+ * Draw packets of a frame, sorted by a 64 bits key and executed in that order.
+ *
+ * Key (MSB to LSB): pass 4 | program 12 | texture 12 | depth 32 | unused 4
+ * Programs and textures are grouped by the low bits of their names,
+ * the packet keeps the full names so a collision only costs a bind.
+ * The depth is the float bits of the view space distance, front to back,
+ * and back to front in the TRANSPARENT pass.
+ *
+ * The queue owns the program, the VAO and the texture of a packet,
+ * CObject::Execute() only draws, and leaves them bound.
+ */
+class CRenderQueue {
+public:
+	enum Pass {
+		OPAQUE = 0x00,
+		TRANSPARENT = 0x01,
+		OVERLAY = 0x02
+	};
+
+	struct Packet {
+		CObject *owner;	// Executes the packet
+		GLuint program;
+		GLuint vao;
+		GLuint texture;	// 0: none
+		GLuint unit;	// Texture unit of texture
+		GLuint arg;	// Defined by the owner
+	};
+
+private:
+	struct Item {
+		uint64_t key;
+		GLuint index;
+	};
+
+	Packet *m_packets;
+	Item *m_items;
+	Item *m_sorted;
+	int m_count;
+	int m_capacity;
+
+	// Bound by the last packet
+	GLuint m_program;
+	GLuint m_vao;
+	GLuint m_texture[QUEUE_UNITS];
+	bool m_batching;
+
+	int Grow(void);
+	Item *Sort(void);
+	int Bind(const Packet *packet);
+	int Flush(void);
+
+	CRenderQueue(void);
+	virtual ~CRenderQueue(void);
+
+	static CRenderQueue *m_instance;
+
+public:
+	static CRenderQueue *GetInstance(void);
+	void Destroy(void);
+
+	int Begin(void);
+	int Add(const Packet &packet, Pass pass, float depth);
+	int Add(CObject *owner, GLuint arg = 0, float depth = 0.0f);
+	int Execute(void);
+	int Count(void);
+};
+
+#endif
+/* End of a file */
@@ -0,0 +1,250 @@
+/**
+ * \brief
+ * Triple buffered streaming buffer.
+ * Alloc() hands out aligned ranges of the current region, Fence() closes the region
+ * after the draws which read it are issued, and moves on to the next one.
+ * The next Alloc() on a region waits for its fence, which is normally signaled
+ * RING_FRAMES - 1 frames ago, so neither the driver nor the CPU stalls.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CRingBuffer.h"
+
+using namespace std;
+
+// GL 4.4, not loaded by glad
+#if !defined(GL_MAP_PERSISTENT_BIT)
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#if !defined(GL_MAP_COHERENT_BIT)
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+#define RING_ALIGN 16	// vec4
+#define RING_TIMEOUT 1000000000ull	// 1 sec
+
+CRingBuffer::CRingBuffer(GLenum target, GLsizeiptr size)
+: m_target(target)
+, m_buffer(0)
+, m_size(size)
+, m_align(RING_ALIGN)
+, m_used(0)
+, m_flushed(0)
+, m_region(0)
+, m_mapped(NULL)
+, m_shadow(NULL)
+{
+	int i;
+
+	for (i = 0; i < RING_FRAMES; i++)
+		m_fence[i] = NULL;
+}
+
+CRingBuffer::~CRingBuffer(void)
+{
+	int i;
+
+	for (i = 0; i < RING_FRAMES; i++) {
+		if (m_fence[i])
+			glDeleteSync(m_fence[i]);
+	}
+
+	if (m_mapped) {
+		glBindBuffer(m_target, m_buffer);
+		glUnmapBuffer(m_target);
+		glBindBuffer(m_target, 0);
+	}
+
+	if (m_buffer)
+		glDeleteBuffers(1, &m_buffer);
+
+	delete[] m_shadow;
+}
+
+int CRingBuffer::Load(void)
+{
+	PFNGLBUFFERSTORAGEPROC bufferStorage = NULL;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLint align;
+
+	if (m_buffer)
+		return 0;
+
+	if (m_size <= 0)
+		return -EINVAL;
+
+	// Every region starts at an offset which can be bound as a uniform block
+	if (m_target == GL_UNIFORM_BUFFER) {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		if (align > m_align)
+			m_align = align;
+	}
+	m_size = (m_size + m_align - 1) / m_align * m_align;
+
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(m_target, m_buffer);
+
+	if (IsGLVersion_4_4())
+		bufferStorage = (PFNGLBUFFERSTORAGEPROC)CMisc::ProcAddress("glBufferStorage");
+
+	if (bufferStorage) {
+		bufferStorage(m_target, m_size * RING_FRAMES, NULL, flags);
+		m_mapped = (char *)glMapBufferRange(m_target, 0, m_size * RING_FRAMES, flags);
+		StatusPrint();
+	}
+
+	if (!m_mapped) {
+		// Storage of glBufferStorage is immutable, start over with a new name
+		if (bufferStorage) {
+			glDeleteBuffers(1, &m_buffer);
+			glGenBuffers(1, &m_buffer);
+			glBindBuffer(m_target, m_buffer);
+		}
+
+		glBufferData(m_target, m_size * RING_FRAMES, NULL, GL_STREAM_DRAW);
+		StatusPrint();
+
+		try {
+			m_shadow = new char[m_size];
+		} catch (...) {
+			cerr << "Failed to allocate the ring buffer shadow" << endl;
+			glBindBuffer(m_target, 0);
+			return -EFAULT;
+		}
+	}
+
+	glBindBuffer(m_target, 0);
+
+	cout << "Ring buffer: " << RING_FRAMES << " x " << m_size << " bytes, "
+		<< (m_mapped ? "persistent" : (IsGLVersion_3_2() ? "unsynchronized map" : "sub data")) << endl;
+	return 0;
+}
+
+int CRingBuffer::Wait(int region)
+{
+	GLenum status;
+
+	if (!m_fence[region])
+		return 0;
+
+	do {
+		status = glClientWaitSync(m_fence[region], GL_SYNC_FLUSH_COMMANDS_BIT, RING_TIMEOUT);
+	} while (status == GL_TIMEOUT_EXPIRED);
+
+	glDeleteSync(m_fence[region]);
+	m_fence[region] = NULL;
+
+	if (status == GL_WAIT_FAILED) {
+		StatusPrint();
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Reserves size bytes of the current region.
+ * offset receives the offset of the range in Buffer().
+ * NULL is returned if the region is full, nothing is allocated in that case.
+ */
+void *CRingBuffer::Alloc(GLsizeiptr size, GLintptr *offset)
+{
+	GLintptr start;
+
+	if (!m_buffer || size <= 0 || !offset)
+		return NULL;
+
+	start = (m_used + m_align - 1) / m_align * m_align;
+	if (start + size > m_size)
+		return NULL;
+
+	// The GPU could still read this region RING_FRAMES frames ago
+	if (m_used == 0)
+		Wait(m_region);
+
+	m_used = start + size;
+	*offset = m_size * m_region + start;
+
+	if (m_mapped)
+		return m_mapped + *offset;
+
+	return m_shadow + start;
+}
+
+/**
+ * \brief
+ * Makes the allocated ranges visible to the GPU, call it before drawing from them.
+ * Nothing to do for the coherent mapping.
+ */
+int CRingBuffer::Flush(void)
+{
+	GLintptr base;
+	void *dst;
+
+	if (m_mapped || m_flushed >= m_used)
+		return 0;
+
+	base = m_size * m_region;
+	glBindBuffer(m_target, m_buffer);
+
+	if (IsGLVersion_3_2()) {
+		// The fence already guarantees that the GPU is done with this range
+		dst = glMapBufferRange(m_target, base + m_flushed, m_used - m_flushed,
+			GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (dst) {
+			memcpy(dst, m_shadow + m_flushed, m_used - m_flushed);
+			glUnmapBuffer(m_target);
+		}
+	} else {
+		glBufferSubData(m_target, base + m_flushed, m_used - m_flushed, m_shadow + m_flushed);
+	}
+	StatusPrint();
+
+	glBindBuffer(m_target, 0);
+	m_flushed = m_used;
+	return 0;
+}
+
+/**
+ * \brief
+ * Closes the current region, call it after the draws which read it.
+ */
+int CRingBuffer::Fence(void)
+{
+	if (m_used == 0)
+		return 0;
+
+	Flush();
+
+	// Fences are GL 3.2, glBufferSubData is synchronized by the driver anyway
+	if (IsGLVersion_3_2())
+		m_fence[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_region = (m_region + 1) % RING_FRAMES;
+	m_used = 0;
+	m_flushed = 0;
+	return 0;
+}
+
+GLuint CRingBuffer::Buffer(void)
+{
+	return m_buffer;
+}
+
+bool CRingBuffer::Persistent(void)
+{
+	return m_mapped != NULL;
+}
+
+/* End of a file */
@@ -0,0 +1,48 @@
+#pragma once
+#if !defined(__CRINGBUFFER_H)
+#define __CRINGBUFFER_H
+
+#define RING_FRAMES 3	// Frames in flight
+
+/**
+ * \brief
+ * Streaming buffer for the data which changes every frame.
+ * The buffer is split into RING_FRAMES regions, the CPU writes one region
+ * while the GPU still reads the others. A fence guards every region.
+ *
+ * GL 4.4: glBufferStorage, mapped once (persistent, coherent)
+ * GL 3.2: unsynchronized glMapBufferRange of the written range
+ * GL 3.1: glBufferSubData
+ */
+class CRingBuffer {
+private:
+	GLenum m_target;
+	GLuint m_buffer;
+	GLsizeiptr m_size;	// Size of a region
+	GLintptr m_align;
+	GLintptr m_used;	// Allocated bytes of the current region
+	GLintptr m_flushed;	// Uploaded bytes of the current region (non persistent)
+	int m_region;
+	GLsync m_fence[RING_FRAMES];
+
+	char *m_mapped;	// Whole buffer, persistent mapping
+	char *m_shadow;	// Current region, non persistent
+
+	int Wait(int region);
+
+public:
+	CRingBuffer(GLenum target, GLsizeiptr size);
+	virtual ~CRingBuffer(void);
+
+	int Load(void);
+
+	void *Alloc(GLsizeiptr size, GLintptr *offset);
+	int Flush(void);
+	int Fence(void);
+
+	GLuint Buffer(void);
+	bool Persistent(void);
+};
+
+#endif
+/* End of a file */
@@ -16,6 +16,9 @@ OpenGL Version	GLSL Version	#version tag
 #include <iostream>
 #include <fstream>
 
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "glad/glad.h"
@@ -23,6 +26,7 @@ OpenGL Version	GLSL Version	#version tag
 #include "cgmath.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
 #include "CMovable.h"
 #include "CView.h"
 #include "CPerspective.h"
@@ -31,29 +35,102 @@ OpenGL Version	GLSL Version	#version tag
 
 #if defined(_WIN32)
 	// Define for windows
+#include <direct.h>
+#define MKDIR(path) _mkdir(path)
 #else
 	// Define for linux
+#include <sys/stat.h>
+#define MKDIR(path) mkdir(path, 0755)
 #endif
 
+#define CACHE_DIR "shadercache"
+#define CACHE_MAGIC 0x42505a4d	// "MZPB"
+#define CACHE_VERSION 3	// Also the fixed attribute locations
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
 using namespace std;
 
+#define DEFINES_MAX 128	// Text of the defines of a variant
+
+// Header of a cache file, followed by the binary
+struct CacheHeader {
+	GLuint magic;
+	GLuint version;
+	GLenum format;
+	GLuint length;
+	uint64_t key;
+};
+
+// A shader stage of a program which is being built, see Begin() and Finish()
+struct CShader::Pending {
+	GLuint program;
+	GLuint shaders[STAGE_MAX];
+	const Stage *stages;
+	int count;
+	uint64_t key;
+	bool cached;	// The binary is saved when linked
+	bool loaded;	// From the binary cache
+};
+
+// Every program binds the attributes to the same locations,
+// so a VAO of CVertices is usable by every variant
+static const struct {
+	GLuint location;
+	const char *name;
+} attributes[] = {
+	{ 0, "position" },
+	{ 1, "texCoord" },
+	{ 2, "color" },
+	{ 3, "offset" },
+	{ 4, "scale" },
+	{ 5, "drawId" },
+	{ 6, "normal" },
+};
+
+static const struct {
+	GLuint define;
+	const char *name;
+} defineNames[] = {
+	{ CShader::BLOCK, "BLOCK" },
+	{ CShader::ENV, "ENV" },
+	{ CShader::LINES, "LINES" },
+	{ CShader::LEGACY_OFFSET, "LEGACY_OFFSET" },
+	{ CShader::VIEWPORTS, "VIEWPORTS" },
+	{ CShader::DEPTH, "DEPTH" },
+};
+
+// Variants of the main program, built by Load()
+static const GLuint variants[] = {
+	CShader::BLOCK,
+	CShader::ENV,
+	CShader::LINES,
+	CShader::BLOCK | CShader::DEPTH,	// Walls of CLod into the shadow maps
+	CShader::DEPTH,	// Casters of CShadows
+};
+
 CShader *CShader::m_pInstance = NULL;
 
 CShader::CShader()
 	: m_program(0)
+	, m_mvpId(-1)
+	, m_variantCount(0)
+	, m_viewports(1)
 {
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_DEPTH_TEST);
 	glCullFace(GL_BACK);
-//	glEnable(GL_DEBUG_OUTPUT);
 }
 
 CShader::~CShader()
 {
-	if (m_program > 0) {
-		glDeleteProgram(m_program);
-		m_program = 0;
-	}
+	int i;
+
+	// The main program is one of the variants
+	for (i = 0; i < m_variantCount; i++)
+		glDeleteProgram(m_variants[i].program);
+	m_program = 0;
 }
 
 void CShader::Destroy(void)
@@ -77,35 +154,392 @@ CShader *CShader::GetInstance(void)
 	return m_pInstance;
 }
 
-GLuint CShader::LoadNCompile(GLenum type, const char *filename)
+/**
+ * \brief
+ * Starts to compile a shader, the defines are put right after the #version line.
+ * The status is not read here, see Finish().
+ */
+GLuint CShader::LoadNCompile(GLenum type, const char *code, const char *defines)
 {
-	char *code;
+	char text[DEFINES_MAX + 16];
+	const char *strings[3];
+	GLint lengths[3];
+	const char *body;
 	GLuint shader;
-	GLint status;
+	int version = 0;
 
-	code = ReadFile(filename);
-	if (!code)
-		return 0u;
+	body = strchr(code, '\n');
+	body = body ? body + 1 : code + strlen(code);
 
-	cout << "begin" << endl;
-	cout << code << endl;
-	cout << "end" << endl;
+	// The errors keep the lines of the file, GLSL before 3.30 numbers
+	// the line after "#line n" as n + 1
+	sscanf(code, "#version %d", &version);
+	snprintf(text, sizeof(text), "%s#line %d\n", defines, version < 330 ? 1 : 2);
+
+	strings[0] = code;
+	lengths[0] = (GLint)(body - code);
+	strings[1] = text;
+	lengths[1] = -1;
+	strings[2] = body;
+	lengths[2] = -1;
 
 	shader = glCreateShader(type);
-	glShaderSource(shader, 1, &code, NULL);
+	glShaderSource(shader, 3, strings, lengths);
 	glCompileShader(shader);
-	delete[] code;
+
+	return shader;
+}
+
+static void DefineText(GLuint defines, char *text, size_t size)
+{
+	size_t used = 0;
+	unsigned int i;
+
+	text[0] = '\0';
+	for (i = 0; i < sizeof(defineNames) / sizeof(defineNames[0]); i++) {
+		if (defines & defineNames[i].define)
+			used += snprintf(text + used, size - used, "#define %s\n", defineNames[i].name);
+	}
+}
+
+static bool CheckShader(GLuint shader, const char *file)
+{
+	char buffer[256];
+	GLint status;
+	int len;
 
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_FALSE)
+		return true;
+
+	glGetShaderInfoLog(shader, sizeof(buffer) - 1, &len, buffer);
+	buffer[len] = '\0';
+	cerr << "Failed to compiler shader " << file << ": " << buffer << endl;
+	return false;
+}
+
+static uint64_t Hash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static uint64_t Hash(uint64_t hash, const char *string)
+{
+	// The terminator keeps "ab" + "c" apart from "a" + "bc"
+	return Hash(hash, string, strlen(string) + 1);
+}
+
+/**
+ * \brief
+ * glGetProgramBinary is in GL 4.1, and a driver may have no binary format at all.
+ */
+static bool BinarySupported(void)
+{
+	GLint formats = 0;
+
+	if (!glGetProgramBinary || !glProgramBinary || !glProgramParameteri)
+		return false;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+/**
+ * \brief
+ * Key of a program, the sources and the stages, the transform feedback varying
+ * and the driver, the binary of another driver or version is not loaded.
+ */
+static uint64_t CacheKey(const GLenum *types, char **codes, int count, const char *varying, const char *defines)
+{
+	uint64_t hash = FNV_OFFSET;
+	const GLubyte *string;
+	GLuint version = CACHE_VERSION;
+	int i;
+
+	hash = Hash(hash, &version, sizeof(version));
+
+	for (i = 0; i < count; i++) {
+		hash = Hash(hash, &types[i], sizeof(types[i]));
+		hash = Hash(hash, codes[i]);
+	}
+
+	hash = Hash(hash, varying ? varying : "");
+	hash = Hash(hash, defines);
+
+	string = glGetString(GL_RENDERER);
+	hash = Hash(hash, string ? (const char *)string : "");
+	string = glGetString(GL_VERSION);
+	hash = Hash(hash, string ? (const char *)string : "");
+
+	return hash;
+}
+
+static void CachePath(uint64_t key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%08x%08x.bin", CACHE_DIR, (unsigned int)(key >> 32), (unsigned int)key);
+}
+
+/**
+ * \brief
+ * Returns 0 if there is no binary of the key, or the driver rejects it.
+ * A rejected binary is removed, the program is built and saved again.
+ */
+static GLuint LoadBinary(uint64_t key)
+{
+	char path[64];
+	ifstream file;
+	CacheHeader header;
+	char *binary;
+	GLuint program;
+	GLint status;
+
+	CachePath(key, path, sizeof(path));
+
+	file.open(path, ios::binary);
+	if (!file.is_open())
+		return 0u;
+
+	file.read((char *)&header, sizeof(header));
+	if (!file || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION
+		|| header.key != key || header.length == 0) {
+		file.close();
+		cerr << "Invalid shader cache " << path << endl;
+		remove(path);
+		return 0u;
+	}
+
+	try {
+		binary = new char[header.length];
+	} catch (...) {
+		cerr << "Failed to allocate binary" << endl;
+		file.close();
+		return 0u;
+	}
+
+	file.read(binary, header.length);
+	if (!file) {
+		delete[] binary;
+		file.close();
+		cerr << "Invalid shader cache " << path << endl;
+		remove(path);
+		return 0u;
+	}
+	file.close();
+
+	program = glCreateProgram();
+	if (program == 0) {
+		delete[] binary;
+		return 0u;
+	}
+
+	glProgramBinary(program, header.format, binary, header.length);
+	delete[] binary;
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
 	if (status == GL_FALSE) {
-		char buffer[256];
-		int len;
-		glGetShaderInfoLog(shader, sizeof(buffer) - 1, &len, buffer);
-		buffer[len] = '\0';
-		cerr << "Failed to compiler shader: " << buffer << endl;
+		// Such as a driver update which keeps the version string
+		cerr << "Shader cache is rejected " << path << endl;
+		glDeleteProgram(program);
+		remove(path);
+		return 0u;
 	}
 
-	return shader;
+	cout << "Shader cache " << path << endl;
+	return program;
+}
+
+static int SaveBinary(uint64_t key, GLuint program)
+{
+	char path[64];
+	ofstream file;
+	CacheHeader header;
+	char *binary;
+	GLint length = 0;
+	GLenum format;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return -EFAULT;
+
+	try {
+		binary = new char[length];
+	} catch (...) {
+		cerr << "Failed to allocate binary" << endl;
+		return -ENOMEM;
+	}
+
+	glGetProgramBinary(program, length, &length, &format, binary);
+	StatusPrint();
+
+	// It may exist already
+	MKDIR(CACHE_DIR);
+
+	CachePath(key, path, sizeof(path));
+	file.open(path, ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		cerr << "Failed to write shader cache " << path << endl;
+		delete[] binary;
+		return -EFAULT;
+	}
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.format = format;
+	header.length = length;
+	header.key = key;
+
+	file.write((const char *)&header, sizeof(header));
+	file.write(binary, length);
+	file.close();
+	delete[] binary;
+
+	if (!file) {
+		cerr << "Failed to write shader cache " << path << endl;
+		remove(path);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Starts to build a program of the stages, from the binary cache if it has the program.
+ * The varying is captured by transform feedback, NULL if there is none.
+ * Nothing waits for the compiler until Finish(), so the programs which are begun
+ * one after another may be compiled in parallel by the driver.
+ */
+GLuint CShader::Begin(const Stage *stages, int count, const char *varying, GLuint defines, Pending *pending)
+{
+	char *codes[STAGE_MAX];
+	GLenum types[STAGE_MAX];
+	char text[DEFINES_MAX];
+	GLuint program = 0;
+	unsigned int j;
+	int i;
+
+	pending->program = 0;
+	pending->stages = stages;
+	pending->count = 0;
+	pending->key = 0;
+	pending->cached = false;
+	pending->loaded = false;
+
+	if (count <= 0 || count > STAGE_MAX)
+		return 0u;
+
+	for (i = 0; i < count; i++) {
+		types[i] = stages[i].type;
+		codes[i] = ReadFile(stages[i].file);
+		if (!codes[i]) {
+			cerr << "Failed to read shader " << stages[i].file << endl;
+			while (--i >= 0)
+				delete[] codes[i];
+			return 0u;
+		}
+	}
+
+	DefineText(defines, text, sizeof(text));
+
+	pending->cached = BinarySupported();
+	if (pending->cached) {
+		pending->key = CacheKey(types, codes, count, varying, text);
+		program = LoadBinary(pending->key);
+	}
+
+	if (program) {
+		for (i = 0; i < count; i++)
+			delete[] codes[i];
+		pending->program = program;
+		pending->loaded = true;
+		return program;
+	}
+
+	for (i = 0; i < count; i++) {
+		pending->shaders[i] = LoadNCompile(stages[i].type, codes[i], text);
+		delete[] codes[i];
+	}
+	pending->count = count;
+
+	program = glCreateProgram();
+	if (program == 0) {
+		for (i = 0; i < count; i++)
+			glDeleteShader(pending->shaders[i]);
+		pending->count = 0;
+		return 0u;
+	}
+
+	for (i = 0; i < count; i++)
+		glAttachShader(program, pending->shaders[i]);
+
+	for (j = 0; j < sizeof(attributes) / sizeof(attributes[0]); j++)
+		glBindAttribLocation(program, attributes[j].location, attributes[j].name);
+
+	// Varyings must be declared before linking
+	if (varying)
+		glTransformFeedbackVaryings(program, 1, &varying, GL_INTERLEAVED_ATTRIBS);
+
+	if (pending->cached)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(program);
+	pending->program = program;
+	return program;
+}
+
+/**
+ * \brief
+ * Waits for the program of Begin(), it is deleted if it does not link.
+ */
+GLuint CShader::Finish(Pending *pending)
+{
+	GLuint program = pending->program;
+	GLint status;
+	int i;
+
+	if (!program || pending->loaded)
+		return program;
+
+	for (i = 0; i < pending->count; i++)
+		CheckShader(pending->shaders[i], pending->stages[i].file);
+
+	// After link the shaders to a program,
+	// We don't need them anymore.
+	for (i = 0; i < pending->count; i++) {
+		glDetachShader(program, pending->shaders[i]);
+		glDeleteShader(pending->shaders[i]);
+	}
+	pending->count = 0;
+
+	// Check the link result
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		cerr << "Failed to link program " << pending->stages[0].file << endl;
+		glDeleteProgram(program);
+		pending->program = 0;
+		return 0u;
+	}
+
+	if (pending->cached)
+		SaveBinary(pending->key, program);
+
+	return program;
+}
+
+GLuint CShader::Build(const Stage *stages, int count, const char *varying)
+{
+	Pending pending;
+
+	Begin(stages, count, varying, 0, &pending);
+	return Finish(&pending);
 }
 
 char *CShader::ReadFile(const char *filename)
@@ -143,49 +577,175 @@ char *CShader::ReadFile(const char *filename)
 	return code;
 }
 
-int CShader::Load(const char *vFile, const char *fFile)
+/**
+ * \brief
+ * Viewports of the split-screen, should be called before Load().
+ * More than one needs GL 4.1 for the invocations of maze.geom and gl_ViewportIndex.
+ */
+int CShader::SetViewports(int count)
 {
-	GLint vertShader;
-	GLint fragShader;
-	GLint status;
+	if (count < 1 || count > VIEWPORT_MAX || m_variantCount > 0)
+		return -EINVAL;
+
+	if (count > 1 && !IsGLVersion_4_1())
+		return -EFAULT;
+
+	m_viewports = count;
+	return 0;
+}
+
+/**
+ * \brief
+ * Builds every variant of the main program. All of them are begun before
+ * any of them is waited for.
+ * The geometry shader is only built in when there is more than one viewport.
+ */
+int CShader::Load(const char *vFile, const char *fFile, const char *gFile)
+{
+	Pending pending[VARIANT_MAX];
+	Stage stages[3];
+	GLuint defines;
+	GLuint program;
+	int stageCount = 2;
+	int count;
+	int i;
 
 	if (!vFile || !fFile) {
 		cerr << "Invalid parameter " << vFile << "," << fFile << endl;
 		return -EINVAL;
 	}
 
-	vertShader = LoadNCompile(GL_VERTEX_SHADER, vFile);
-	fragShader = LoadNCompile(GL_FRAGMENT_SHADER, fFile);
+	stages[0].type = GL_VERTEX_SHADER;
+	stages[0].file = vFile;
+	stages[1].type = GL_FRAGMENT_SHADER;
+	stages[1].file = fFile;
 
-	m_program = glCreateProgram();
-	if (m_program == 0)
-		return -EFAULT;
+	if (m_viewports > 1) {
+		if (!gFile) {
+			cerr << "Split-screen needs a geometry shader" << endl;
+			return -EINVAL;
+		}
+		stages[2].type = GL_GEOMETRY_SHADER;
+		stages[2].file = gFile;
+		stageCount = 3;
+	}
 
-	glAttachShader(m_program, vertShader);
-	glAttachShader(m_program, fragShader);
-	glLinkProgram(m_program);
+	// The old GL has no shadows, a variant of no stages is not built
+	count = sizeof(variants) / sizeof(variants[0]);
+	for (i = 0; i < count; i++) {
+		if (variants[i] & DEPTH)
+			Begin(stages, __OLD_GL ? 0 : 2, NULL, Defines(variants[i]), &pending[i]);
+		else
+			Begin(stages, stageCount, NULL, Defines(variants[i]), &pending[i]);
+	}
 
-	// After link the shaders to a program,
-	// We don't need them anymore.
-	glDetachShader(m_program, vertShader);
-	glDetachShader(m_program, fragShader);
-	glDeleteShader(vertShader);
-	glDeleteShader(fragShader);
+	for (i = 0; i < count; i++) {
+		program = Finish(&pending[i]);
+		if (program == 0)
+			continue;
 
-	// Check the link result
-	glGetProgramiv(m_program, GL_LINK_STATUS, &status);
-	if (status == GL_FALSE) {
-		cerr << "Failed to link program" << endl;
-		return -EFAULT;
-	}
+		defines = Defines(variants[i]);
+		m_variants[m_variantCount].defines = defines;
+		m_variants[m_variantCount].program = program;
+		m_variants[m_variantCount].mvpId = glGetUniformLocation(program, "mvp");
+		m_variantCount++;
 
-	m_mvpId = glGetUniformLocation(m_program, "mvp");
+		if (variants[i] == BLOCK) {
+			m_program = program;
+			m_mvpId = m_variants[m_variantCount - 1].mvpId;
+		}
+	}
 	StatusPrint();
+
+	if (m_program == 0)
+		return -EFAULT;
+
 	cout << "m_mvp index: " << m_mvpId << endl;
+	cout << "Shader variants: " << m_variantCount << endl;
 
 	return 0;
 }
 
+/**
+ * \brief
+ * The old shader offsets a block by a uniform, as it has no instanced attributes.
+ * Every variant of the split-screen goes through maze.geom, but the shadow maps.
+ */
+GLuint CShader::Defines(GLuint defines)
+{
+	if (__OLD_GL && (defines & BLOCK))
+		defines |= LEGACY_OFFSET;
+
+	if (m_viewports > 1 && !(defines & DEPTH))
+		defines |= VIEWPORTS;
+
+	return defines;
+}
+
+/**
+ * \brief
+ * Build a vertex + fragment program.
+ * The program is owned by the caller, CShader only keeps the main one.
+ */
+GLuint CShader::LoadProgram(const char *vFile, const char *fFile)
+{
+	Stage stages[2];
+
+	if (!vFile || !fFile) {
+		cerr << "Invalid parameter" << endl;
+		return 0u;
+	}
+
+	stages[0].type = GL_VERTEX_SHADER;
+	stages[0].file = vFile;
+	stages[1].type = GL_FRAGMENT_SHADER;
+	stages[1].file = fFile;
+
+	return Build(stages, 2, NULL);
+}
+
+/**
+ * \brief
+ * Build a standalone compute program.
+ * The program is owned by the caller, CShader only keeps the main one.
+ */
+GLuint CShader::LoadCompute(const char *cFile)
+{
+	Stage stage;
+
+	if (!cFile) {
+		cerr << "Invalid parameter" << endl;
+		return 0u;
+	}
+
+	stage.type = GL_COMPUTE_SHADER;
+	stage.file = cFile;
+
+	return Build(&stage, 1, NULL);
+}
+
+/**
+ * \brief
+ * Build a vertex + geometry program whose output is captured by transform feedback.
+ * Rasterization is expected to be discarded while it runs.
+ */
+GLuint CShader::LoadFeedback(const char *vFile, const char *gFile, const char *varying)
+{
+	Stage stages[2];
+
+	if (!vFile || !gFile || !varying) {
+		cerr << "Invalid parameter" << endl;
+		return 0u;
+	}
+
+	stages[0].type = GL_VERTEX_SHADER;
+	stages[0].file = vFile;
+	stages[1].type = GL_GEOMETRY_SHADER;
+	stages[1].file = gFile;
+
+	return Build(stages, 2, varying);
+}
+
 void CShader::UseProgram(void)
 {
 	glUseProgram(m_program);
@@ -196,9 +756,69 @@ GLuint CShader::Program(void)
 	return m_program;
 }
 
+/**
+ * \brief
+ * Returns the variant of the main program, the main program itself if it was not built.
+ */
+GLuint CShader::Program(GLuint defines)
+{
+	int i;
+
+	defines = Defines(defines);
+	for (i = 0; i < m_variantCount; i++) {
+		if (m_variants[i].defines == defines)
+			return m_variants[i].program;
+	}
+
+	return m_program;
+}
+
+/**
+ * \brief
+ * Returns 0 past the last variant.
+ */
+GLuint CShader::Variant(int index)
+{
+	if (index < 0 || index >= m_variantCount)
+		return 0u;
+
+	return m_variants[index].program;
+}
+
+/**
+ * \brief
+ * The attributes are bound to the same locations in every variant,
+ * but a variant may not use some of them.
+ */
+GLint CShader::AttribLocation(const char *name)
+{
+	GLint location;
+	int i;
+
+	for (i = 0; i < m_variantCount; i++) {
+		location = glGetAttribLocation(m_variants[i].program, name);
+		if (location >= 0)
+			return location;
+	}
+
+	return -1;
+}
+
 GLint CShader::MVPId(void)
 {
 	return m_mvpId;
 }
 
+GLint CShader::MVPId(GLuint program)
+{
+	int i;
+
+	for (i = 0; i < m_variantCount; i++) {
+		if (m_variants[i].program == program)
+			return m_variants[i].mvpId;
+	}
+
+	return m_mvpId;
+}
+
 // End of a file
@@ -3,16 +3,61 @@
 #if !defined(_CSHADER_H)
 #define _CSHADER_H
 
+#define STAGE_MAX 3
+#define VARIANT_MAX 5
+
+/**
+ * \brief
+ * Builds the programs. A linked program is saved by glGetProgramBinary into
+ * shadercache/, the next launch loads it instead of compiling the sources.
+ *
+ * The main program is built in variants, the defines of a variant are put
+ * into the sources, so a variant has only the paths of the objects which use it.
+ * Program() is the BLOCK variant, an object asks for its own by Program(defines).
+ * The split-screen adds VIEWPORTS and maze.geom to every variant, see SetViewports(),
+ * but the DEPTH ones, which draw the shadow maps of CShadows by a single camera.
+ */
 class CShader {
+public:
+	enum Define {
+		BLOCK = 0x01,	// Textured blocks
+		ENV = 0x02,	// Vertex colors
+		LINES = 0x04,	// Lines of CCoordinate
+		LEGACY_OFFSET = 0x08,	// The old shader, a block is offset by a uniform
+		VIEWPORTS = 0x10,	// maze.geom draws into the viewports of CFrame
+		DEPTH = 0x20	// Position only, for the shadow maps
+	};
+
 private:
+	struct Stage {
+		GLenum type;
+		const char *file;
+	};
+
+	struct VariantProgram {
+		GLuint defines;
+		GLuint program;
+		GLint mvpId;
+	};
+
+	struct Pending;
+
 	GLuint m_program;
 	GLint m_mvpId;
 	GLboolean m_mvpUpdated;
 
+	VariantProgram m_variants[VARIANT_MAX];
+	int m_variantCount;
+	int m_viewports;
+
 	static CShader *m_pInstance;
 
 	char *ReadFile(const char *filename);
-	GLuint LoadNCompile(GLenum type, const char *code);
+	GLuint LoadNCompile(GLenum type, const char *code, const char *defines);
+	GLuint Begin(const Stage *stages, int count, const char *varying, GLuint defines, Pending *pending);
+	GLuint Finish(Pending *pending);
+	GLuint Build(const Stage *stages, int count, const char *varying);
+	GLuint Defines(GLuint defines);
 
 	CShader(void);
 	virtual ~CShader(void);
@@ -21,10 +66,18 @@ public:
 	static CShader *GetInstance(void);
 	void Destroy(void);
 
-	int Load(const char *vFile = NULL, const char *fFile = NULL);
+	int SetViewports(int count);
+	int Load(const char *vFile = NULL, const char *fFile = NULL, const char *gFile = NULL);
+	GLuint LoadProgram(const char *vFile, const char *fFile);
+	GLuint LoadCompute(const char *cFile);
+	GLuint LoadFeedback(const char *vFile, const char *gFile, const char *varying);
 
 	GLint MVPId(void);
+	GLint MVPId(GLuint program);
 	GLuint Program(void);
+	GLuint Program(GLuint defines);
+	GLuint Variant(int index);
+	GLint AttribLocation(const char *name);
 	void UseProgram(void);
 };
 
@@ -0,0 +1,552 @@
+/**
+ * \brief
+ * A face looks along its forward vector of the table below with a 90 degree
+ * frustum from the light to its radius, its right vector is forward x up.
+ * The fragment shader picks the face by the major axis of the direction from
+ * the light and projects with the same vectors, so no matrices are uploaded.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CShader.h"
+#include "CVertices.h"
+#include "CFrame.h"
+#include "CTextureManager.h"
+#include "CObject.h"
+#include "CLod.h"
+#include "CLights.h"
+#include "CShadows.h"
+
+using namespace std;
+
+#define SHADOW_NEAR 0.05f	// Same as maze.frag
+#define SHADOW_DISTANCE (BLOCK_WIDTH * 6.0f)	// Lights farther than this from the eye get no slot
+#define SHADOW_BUDGET 1	// Lights whose maps are drawn per frame
+#define SHADOW_SLOPE 2.0f	// glPolygonOffset, against the acne of the lit sides
+#define SHADOW_BIAS 4.0f
+
+// Forward and up of the faces, same as maze.frag
+static const float faces[SHADOW_FACES][2][3] = {
+	{ { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+	{ { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f } },
+	{ { 0.0f, 0.0f, -1.0f }, { 0.0f, 1.0f, 0.0f } }
+};
+
+CShadows *CShadows::m_instance = NULL;
+
+CShadows::CShadows(void)
+: m_slotOf(NULL)
+, m_casterCount(0)
+, m_texture(0)
+, m_FBO(0)
+, m_copyFBO(0)
+, m_handle(0)
+, m_loaded(false)
+{
+	int i;
+
+	for (i = 0; i < SHADOW_SLOTS; i++) {
+		m_slots[i].light = -1;
+		m_slots[i].version = 0;
+		m_slots[i].valid = false;
+		m_slots[i].dynamic = false;
+	}
+
+	for (i = 0; i < SHADOW_CASTERS_MAX; i++) {
+		m_casters[i].object = NULL;
+		m_casters[i].light = -1;
+		m_casters[i].radius = 0.0f;
+	}
+}
+
+CShadows::~CShadows(void)
+{
+	// The texture belongs to CTextureManager
+	if (m_handle > 0)
+		CTextureManager::GetInstance()->Release(m_handle);
+
+	if (m_FBO)
+		glDeleteFramebuffers(1, &m_FBO);
+	if (m_copyFBO)
+		glDeleteFramebuffers(1, &m_copyFBO);
+
+	delete[] m_slotOf;
+}
+
+CShadows *CShadows::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CShadows();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CShadows::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * Should be called after CLights and CLod are loaded.
+ * Without the lights there is nothing to shadow.
+ */
+int CShadows::Load(void)
+{
+	CShader *shader = CShader::GetInstance();
+	GLuint program;
+	GLint location;
+	GLint unit;
+	GLenum status;
+	int i;
+
+	if (m_loaded)
+		return 0;
+
+	if (__OLD_GL || CLights::GetInstance()->Count() == 0 || CLights::GetInstance()->Baked()) {
+		m_loaded = true;
+		return 0;
+	}
+
+	try {
+		m_slotOf = new int[LIGHT_MAX];
+	} catch (...) {
+		cerr << "Failed to allocate the shadow slots" << endl;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < LIGHT_MAX; i++)
+		m_slotOf[i] = -1;
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + SHADOW_TEXTURE_UNIT);
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT16, SHADOW_SIZE, SHADOW_SIZE,
+		SHADOW_SLOTS * SHADOW_FACES * 2, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glActiveTexture(unit);
+	StatusPrint();
+
+	m_handle = CTextureManager::GetInstance()->Acquire("shadows", 0);
+	if (m_handle < 0) {
+		glDeleteTextures(1, &m_texture);
+		m_handle = 0;
+		cerr << "Failed to register the shadow maps" << endl;
+		return -EFAULT;
+	}
+	CTextureManager::GetInstance()->Assign(m_handle, GL_TEXTURE_2D_ARRAY, m_texture);
+
+	// Depth only, the cached maps then the copies which have the casters
+	glGenFramebuffers(1, &m_FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	// The faces are blitted through it before GL 4.3
+	if (status == GL_FRAMEBUFFER_COMPLETE && !IsGLVersion_4_3()) {
+		glGenFramebuffers(1, &m_copyFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_copyFBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, CMisc::Framebuffer());
+	StatusPrint();
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Shadow framebuffer is not complete" << endl;
+		return -EFAULT;
+	}
+
+	for (i = 0; (program = shader->Variant(i)) != 0; i++) {
+		location = glGetUniformLocation(program, "shadows");
+		if (location < 0)
+			continue;
+
+		glUseProgram(program);
+		glUniform1i(location, SHADOW_TEXTURE_UNIT);
+	}
+	shader->UseProgram();
+	StatusPrint();
+
+	m_loaded = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * The slot whose map the shader may sample for a light, -1 if it has none yet.
+ * It is past SHADOW_SLOTS if the casters are drawn over a copy of the map.
+ */
+int CShadows::Slot(int light)
+{
+	const CLights::Light *info;
+	int slot;
+
+	if (!m_slotOf || light < 0 || light >= LIGHT_MAX)
+		return -1;
+
+	slot = m_slotOf[light];
+	if (slot < 0 || !m_slots[slot].valid)
+		return -1;
+
+	info = CLights::GetInstance()->GetLight(light);
+	if (!info || info->version != m_slots[slot].version)
+		return -1;
+
+	return m_slots[slot].dynamic ? slot + SHADOW_SLOTS : slot;
+}
+
+/**
+ * \brief
+ * The object is drawn over the maps of the lights which it reaches, by Render()
+ * with the DEPTH variant of CShader. light (optional) is moved with it.
+ */
+int CShadows::AddCaster(CObject *object, int light)
+{
+	if (!object)
+		return -EINVAL;
+
+	if (m_casterCount >= SHADOW_CASTERS_MAX)
+		return -ENOSPC;
+
+	m_casters[m_casterCount].object = object;
+	m_casters[m_casterCount].light = light < 0 ? -1 : light;
+	m_casters[m_casterCount].radius = 0.0f;
+	return m_casterCount++;
+}
+
+int CShadows::DelCaster(CObject *object)
+{
+	int i;
+
+	for (i = 0; i < m_casterCount; i++) {
+		if (m_casters[i].object != object)
+			continue;
+
+		m_casters[i] = m_casters[--m_casterCount];
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * \brief
+ * View of a face from the light, the rows are right, up and backward, as a lookAt would give.
+ */
+static mat4 FaceView(int face, const vec3 &eye)
+{
+	vec3 forward = vec3(faces[face][0][0], faces[face][0][1], faces[face][0][2]);
+	vec3 up = vec3(faces[face][1][0], faces[face][1][1], faces[face][1][2]);
+	vec3 right = forward.cross(up);
+
+	return mat4(right.x, right.y, right.z, -right.dot(eye),
+		up.x, up.y, up.z, -up.dot(eye),
+		-forward.x, -forward.y, -forward.z, forward.dot(eye),
+		0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+/**
+ * \brief
+ * Draws the walls around a light into the six layers of its slot.
+ */
+int CShadows::Render(int slot)
+{
+	CFrame *frame = CFrame::GetInstance();
+	const CLights::Light *light = CLights::GetInstance()->GetLight(m_slots[slot].light);
+	GLint viewport[4];
+	mat4 projection;
+	vec3 eye;
+	int i;
+
+	if (!light)
+		return -EINVAL;
+
+	eye = light->position;
+	projection = mat4::perspective(PI / 2.0f, 1.0f, SHADOW_NEAR, light->radius);
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+	glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(SHADOW_SLOPE, SHADOW_BIAS);
+
+	for (i = 0; i < SHADOW_FACES; i++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, slot * SHADOW_FACES + i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		frame->SetCamera(FaceView(i, eye), projection);
+		CLod::GetInstance()->DrawCasters(eye, light->radius);
+	}
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	frame->RestoreCamera();
+	glBindFramebuffer(GL_FRAMEBUFFER, CMisc::Framebuffer());
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	StatusPrint();
+
+	m_slots[slot].version = light->version;
+	m_slots[slot].valid = true;
+	return 0;
+}
+
+/**
+ * \brief
+ * The casters in the model space of this frame, the lights which they carry are moved with them.
+ */
+void CShadows::Place(void)
+{
+	CLights *lights = CLights::GetInstance();
+	const CLights::Light *light;
+	mat4 toModel = CFrame::GetInstance()->World().inverse();
+	vec4 center;
+	vec4 axis;
+	vec3 position;
+	float radius;
+	int i;
+
+	for (i = 0; i < m_casterCount; i++) {
+		m_casters[i].radius = 0.0f;
+		if (!m_casters[i].object->Bounds(&position, &radius))
+			continue;
+
+		center = toModel * vec4(position.x, position.y, position.z, 1.0f);
+		axis = toModel * vec4(radius, 0.0f, 0.0f, 0.0f);
+		m_casters[i].center = vec3(center.x, center.y, center.z);
+		m_casters[i].radius = vec3(axis.x, axis.y, axis.z).length();
+
+		// The version goes up, so its map is drawn again
+		light = lights->GetLight(m_casters[i].light);
+		if (light && (light->position - m_casters[i].center).length() > 0.0f)
+			lights->Move(m_casters[i].light, m_casters[i].center);
+	}
+}
+
+/**
+ * \brief
+ * Copies the maps which are ready and which a caster reaches to slot + SHADOW_SLOTS,
+ * and draws the casters over the copies. A caster around a light does not shadow it.
+ * Returns the count of the slots which have the casters in this frame.
+ */
+int CShadows::Composite(void)
+{
+	CFrame *frame = CFrame::GetInstance();
+	CVertices *vertices = CVertices::GetInstance();
+	const CLights::Light *light;
+	GLint viewport[4];
+	mat4 projection;
+	mat4 toModel;
+	float distance;
+	int casters[SHADOW_CASTERS_MAX];
+	int drawn = 0;
+	int count;
+	int layer;
+	int slot;
+	int i;
+	int j;
+
+	for (slot = 0; slot < SHADOW_SLOTS; slot++) {
+		m_slots[slot].dynamic = false;
+		if (m_slots[slot].light < 0 || Slot(m_slots[slot].light) < 0)
+			continue;
+
+		light = CLights::GetInstance()->GetLight(m_slots[slot].light);
+		count = 0;
+		for (i = 0; i < m_casterCount; i++) {
+			distance = (m_casters[i].center - light->position).length();
+			if (m_casters[i].radius > 0.0f && distance > m_casters[i].radius
+				&& distance < light->radius + m_casters[i].radius)
+				casters[count++] = i;
+		}
+		if (count == 0)
+			continue;
+
+		if (drawn++ == 0) {
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+			glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(SHADOW_SLOPE, SHADOW_BIAS);
+			glUseProgram(CShader::GetInstance()->Program(CShader::DEPTH));
+			vertices->BindVAO();
+			vertices->BindEBO();
+
+			// The casters are drawn in the world space, the maps are in the model space
+			toModel = frame->World().inverse();
+		}
+
+		layer = (slot + SHADOW_SLOTS) * SHADOW_FACES;
+		if (IsGLVersion_4_3())
+			glCopyImageSubData(m_texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot * SHADOW_FACES,
+				m_texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, SHADOW_SIZE, SHADOW_SIZE, SHADOW_FACES);
+
+		projection = mat4::perspective(PI / 2.0f, 1.0f, SHADOW_NEAR, light->radius);
+		for (i = 0; i < SHADOW_FACES; i++) {
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, layer + i);
+			if (!IsGLVersion_4_3()) {
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, m_copyFBO);
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, slot * SHADOW_FACES + i);
+				glBlitFramebuffer(0, 0, SHADOW_SIZE, SHADOW_SIZE, 0, 0, SHADOW_SIZE, SHADOW_SIZE,
+					GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, m_FBO);
+			}
+
+			frame->SetCamera(FaceView(i, light->position) * toModel, projection);
+			for (j = 0; j < count; j++)
+				m_casters[casters[j]].object->Render();
+		}
+
+		m_slots[slot].dynamic = true;
+	}
+
+	if (drawn == 0)
+		return 0;
+
+	vertices->UnbindEBO();
+	vertices->UnbindVAO();
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	frame->RestoreCamera();
+	glBindFramebuffer(GL_FRAMEBUFFER, CMisc::Framebuffer());
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	StatusPrint();
+
+	return drawn;
+}
+
+/**
+ * \brief
+ * Gives the slots to the lights nearest to the eye, draws the stale maps and
+ * the casters over the maps which they reach.
+ * Should be called after CFrame::Update(), before CLights::Update() and before
+ * the frame is cleared.
+ * Returns 1 if the budget ran out, the rest of the maps are drawn in the next frames.
+ */
+int CShadows::Update(void)
+{
+	CLights *lights = CLights::GetInstance();
+	const CLights::Light *light;
+	bool taken[SHADOW_SLOTS];
+	mat4 inv;
+	vec4 eye4;
+	vec3 eyes[VIEWPORT_MAX];
+	float distance;
+	int budget = SHADOW_BUDGET;
+	int pending = 0;
+	int count = 0;
+	int viewports;
+	int slot;
+	int i;
+	int j;
+
+	if (!m_slotOf || !lights->Enabled())
+		return 0;
+
+	CTextureManager::GetInstance()->Bind(m_handle, SHADOW_TEXTURE_UNIT);
+
+	// The lights which the casters carry move before they are sorted
+	Place();
+
+	// Eyes of the model space, the split-screen shares the slots
+	viewports = CFrame::GetInstance()->Viewports();
+	for (i = 0; i < viewports; i++) {
+		inv = (mat4(CFrame::GetInstance()->View(i)) * CFrame::GetInstance()->World()).inverse();
+		eye4 = inv * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		eyes[i] = vec3(eye4.x, eye4.y, eye4.z) / eye4.w;
+	}
+
+	// The nearest spheres to any eye, sorted by insertion
+	for (i = 0; i < lights->Count(); i++) {
+		light = lights->GetLight(i);
+		distance = (light->position - eyes[0]).length() - light->radius;
+		for (j = 1; j < viewports; j++)
+			distance = min(distance, (light->position - eyes[j]).length() - light->radius);
+		if (distance > SHADOW_DISTANCE)
+			continue;
+		if (count == SHADOW_SLOTS && distance >= m_distances[count - 1])
+			continue;
+
+		j = count < SHADOW_SLOTS ? count++ : count - 1;
+		for (; j > 0 && m_distances[j - 1] > distance; j--) {
+			m_nearest[j] = m_nearest[j - 1];
+			m_distances[j] = m_distances[j - 1];
+		}
+		m_nearest[j] = i;
+		m_distances[j] = distance;
+	}
+
+	// Lights which have a slot keep it, the others take the slots which are not wanted
+	for (i = 0; i < SHADOW_SLOTS; i++)
+		taken[i] = false;
+	for (i = 0; i < count; i++) {
+		if (m_slotOf[m_nearest[i]] >= 0)
+			taken[m_slotOf[m_nearest[i]]] = true;
+	}
+
+	slot = 0;
+	for (i = 0; i < count; i++) {
+		if (m_slotOf[m_nearest[i]] >= 0)
+			continue;
+
+		while (taken[slot])
+			slot++;
+
+		if (m_slots[slot].light >= 0)
+			m_slotOf[m_slots[slot].light] = -1;
+
+		m_slots[slot].light = m_nearest[i];
+		m_slots[slot].valid = false;
+		m_slotOf[m_nearest[i]] = slot;
+		taken[slot] = true;
+	}
+
+	// Nearest first
+	for (i = 0; i < count; i++) {
+		if (Slot(m_nearest[i]) >= 0)
+			continue;
+
+		if (budget == 0) {
+			pending = 1;
+			break;
+		}
+
+		if (Render(m_slotOf[m_nearest[i]]) == 0)
+			budget--;
+	}
+
+	// Every frame, the casters may have moved
+	Composite();
+
+	return pending;
+}
+
+/* End of a file */
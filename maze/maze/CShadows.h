@@ -0,0 +1,87 @@
+#pragma once
+#if !defined(__CSHADOWS_H)
+#define __CSHADOWS_H
+
+#define SHADOW_SLOTS 16	// Lights which have a shadow map at a time
+#define SHADOW_FACES 6	// Layers of a slot, a cube around the light
+#define SHADOW_SIZE 256	// Texels per side of a face
+#define SHADOW_CASTERS_MAX 4	// Objects which are drawn over the maps every frame
+
+class CObject;
+
+/**
+ * \brief
+ * Shadows of the walls and of the moving casters for the lights of CLights
+ * which are nearest to the eye.
+ *
+ * A light with a slot has six faces of depth, layers slot * 6 ... slot * 6 + 5
+ * of a depth array, drawn from the merged boxes of CLod. The walls do not move
+ * and the maps are in the model space, as the lights are, so a map stays valid
+ * while the camera and CModel move. It is drawn again only when its light
+ * moves, that is the version of the light goes up by CLights::Move().
+ * Lights keep their slots until nearer lights need them, so walking back to
+ * a light finds its map ready.
+ *
+ * The casters of AddCaster() (the player) move, so they are not in the cached
+ * maps. Every frame a slot which a caster reaches has its faces copied into the
+ * second half of the array, slot + SHADOW_SLOTS, and the caster drawn over them
+ * by Render() of the object, which Slot() hands to the shader instead.
+ * A caster may carry a light, which is moved to the center of the caster and
+ * which the caster does not shadow.
+ *
+ * Both passes draw by the DEPTH variants of CShader.
+ * Stale maps are drawn SHADOW_BUDGET a frame, the lights without a map are unshadowed.
+ * The faces are laid out by the table of CShadows.cpp, which maze.frag repeats.
+ */
+class CShadows {
+private:
+	struct Slot {
+		int light;	// -1: free
+		unsigned int version;	// Of the light when drawn
+		bool valid;
+		bool dynamic;	// The casters are drawn over a copy in this frame
+	};
+
+	struct Caster {
+		CObject *object;
+		int light;	// Carried by the object, -1 for none
+		vec3 center;	// Model space, in this frame
+		float radius;	// 0 if the object has no bounds
+	};
+
+	Slot m_slots[SHADOW_SLOTS];
+	int *m_slotOf;	// Slot of a light, -1 for none
+	int m_nearest[SHADOW_SLOTS];	// Lights which want a slot this frame, nearest first
+	float m_distances[SHADOW_SLOTS];
+
+	Caster m_casters[SHADOW_CASTERS_MAX];
+	int m_casterCount;
+
+	GLuint m_texture;
+	GLuint m_FBO;
+	GLuint m_copyFBO;	// Source of the copies without glCopyImageSubData
+	int m_handle;	// Of CTextureManager
+	bool m_loaded;
+
+	int Render(int slot);
+	int Composite(void);
+	void Place(void);
+
+	CShadows(void);
+	virtual ~CShadows(void);
+
+	static CShadows *m_instance;
+
+public:
+	static CShadows *GetInstance(void);
+	void Destroy(void);
+
+	int Load(void);
+	int Update(void);
+	int Slot(int light);
+	int AddCaster(CObject *object, int light = -1);
+	int DelCaster(CObject *object);
+};
+
+#endif
+/* End of a file */
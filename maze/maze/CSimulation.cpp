@@ -0,0 +1,272 @@
+/**
+ * \brief
+ * The simulation thread runs a tick, captures the camera and the models by
+ * CFrame::Capture() and swaps the snapshot in, under the lock.
+ * The render thread copies the two published snapshots under the same lock,
+ * so a long tick only delays the next snapshot, the frames keep coming.
+ * Nothing moves without input, so the thread sleeps until there is some
+ * once a tick has changed nothing.
+ */
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CMovable.h"
+#include "CFrame.h"
+#include "CSimulation.h"
+
+using namespace std;
+
+#define TICKS_MAX 5	// Behind by more ticks, they are dropped
+
+#define MOVE_SPEED 5.0f	// Units per second
+#define TURN_SPEED (PI / 2.0f)	// Radians per second
+
+CSimulation *CSimulation::m_instance = NULL;
+
+CSimulation::CSimulation(void)
+: m_running(false)
+, m_tick(0.0)
+, m_keys(0)
+, m_turn(0.0f)
+, m_target(NULL)
+, m_latest(0)
+{
+}
+
+CSimulation::~CSimulation(void)
+{
+	Stop();
+}
+
+CSimulation *CSimulation::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CSimulation();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CSimulation::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+/**
+ * \brief
+ * The objects should be loaded, their state is the first snapshot.
+ */
+int CSimulation::Start(double tick)
+{
+	CFrame::Snapshot snapshot;
+
+	if (m_thread.joinable())
+		return -EBUSY;
+
+	if (!(tick > 0.0))
+		return -EINVAL;
+
+	CFrame::GetInstance()->Capture(&snapshot);
+	snapshot.time = glfwGetTime();
+
+	m_tick = tick;
+	m_snapshots[0] = snapshot;
+	m_snapshots[1] = snapshot;
+	m_running = true;
+
+	try {
+		m_thread = thread(&CSimulation::Main, this);
+	} catch (...) {
+		cerr << "Failed to start the simulation thread" << endl;
+		m_running = false;
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+int CSimulation::Stop(void)
+{
+	if (!m_thread.joinable())
+		return 0;
+
+	{
+		lock_guard<mutex> guard(m_lock);
+		m_running = false;
+	}
+	m_wake.notify_all();
+
+	m_thread.join();
+	return 0;
+}
+
+void CSimulation::SetKeys(unsigned int keys)
+{
+	lock_guard<mutex> guard(m_lock);
+
+	m_keys = keys;
+	if (keys)
+		m_wake.notify_one();
+}
+
+/**
+ * \brief
+ * Accumulated until the next tick.
+ */
+void CSimulation::Turn(float angle)
+{
+	lock_guard<mutex> guard(m_lock);
+
+	m_turn += angle;
+	m_wake.notify_one();
+}
+
+void CSimulation::SetTarget(CMovable *target)
+{
+	lock_guard<mutex> guard(m_lock);
+
+	m_target = target;
+	m_turn = 0.0f;
+}
+
+/**
+ * \brief
+ * Copies the snapshots, the current one is the latest tick.
+ */
+int CSimulation::Read(CFrame::Snapshot *previous, CFrame::Snapshot *current)
+{
+	lock_guard<mutex> guard(m_lock);
+
+	if (!previous || !current)
+		return -EINVAL;
+
+	*previous = m_snapshots[m_latest ^ 1];
+	*current = m_snapshots[m_latest];
+	return 0;
+}
+
+void CSimulation::Publish(const CFrame::Snapshot &snapshot)
+{
+	lock_guard<mutex> guard(m_lock);
+
+	m_latest ^= 1;
+	m_snapshots[m_latest] = snapshot;
+}
+
+/**
+ * \brief
+ * Moves the target by the keys which are held down.
+ */
+void CSimulation::Step(CMovable *target, unsigned int keys, float turn, float dt)
+{
+	float move = MOVE_SPEED * dt;
+	float rotate = TURN_SPEED * dt;
+
+	if (!target)
+		return;
+
+	if (keys & MOVE_FRONT)
+		target->Translate(CMovable::Direction::FRONT, move);
+	if (keys & MOVE_BACK)
+		target->Translate(CMovable::Direction::BACK, move);
+	if (keys & MOVE_LEFT)
+		target->Translate(CMovable::Direction::LEFT, move);
+	if (keys & MOVE_RIGHT)
+		target->Translate(CMovable::Direction::RIGHT, move);
+
+	if (keys & TURN_X)
+		target->Rotate(vec3(1.0f, 0.0f, 0.0f), rotate);
+	if (keys & TURN_X_BACK)
+		target->Rotate(vec3(1.0f, 0.0f, 0.0f), -rotate);
+	if (keys & TURN_Y)
+		target->Rotate(vec3(0.0f, 1.0f, 0.0f), rotate);
+	if (keys & TURN_Y_BACK)
+		target->Rotate(vec3(0.0f, 1.0f, 0.0f), -rotate);
+	if (keys & TURN_Z)
+		target->Rotate(vec3(0.0f, 0.0f, 1.0f), rotate);
+	if (keys & TURN_Z_BACK)
+		target->Rotate(vec3(0.0f, 0.0f, 1.0f), -rotate);
+
+	if (turn != 0.0f)
+		target->Rotate(vec3(0.0f, 1.0f, 0.0f), turn);
+}
+
+/**
+ * \brief
+ * A snapshot is stamped with the time it is due, not the time it is done,
+ * so the render thread sees evenly spaced ticks.
+ * A changed snapshot wakes the render thread, which may wait for events.
+ */
+void CSimulation::Main(void)
+{
+	CFrame::Snapshot snapshot;
+	CMovable *target;
+	unsigned int keys;
+	float turn;
+	bool idle = false;
+	double next;
+	double now;
+
+	next = glfwGetTime() + m_tick;
+
+	for (;;) {
+		{
+			unique_lock<mutex> guard(m_lock);
+
+			// The last tick has changed nothing and nothing will change
+			if (idle && !m_keys && m_turn == 0.0f) {
+				while (m_running && !m_keys && m_turn == 0.0f)
+					m_wake.wait(guard);
+				next = glfwGetTime();
+			}
+
+			now = glfwGetTime();
+			if (next > now)
+				m_wake.wait_for(guard, chrono::duration<double>(next - now));
+
+			if (!m_running)
+				break;
+
+			// Woken up early by nothing but the OS
+			if (glfwGetTime() < next)
+				continue;
+
+			keys = m_keys;
+			turn = m_turn;
+			target = m_target;
+			m_turn = 0.0f;
+		}
+
+		Step(target, keys, turn, (float)m_tick);
+
+		idle = CFrame::GetInstance()->Capture(&snapshot) == 0;
+		snapshot.time = next;
+		Publish(snapshot);
+
+		if (!idle)
+			glfwPostEmptyEvent();
+
+		next += m_tick;
+		if (glfwGetTime() - next > m_tick * TICKS_MAX)
+			next = glfwGetTime();
+	}
+}
+
+/* End of a file */
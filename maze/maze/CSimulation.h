@@ -0,0 +1,70 @@
+#pragma once
+#if !defined(__CSIMULATION_H)
+#define __CSIMULATION_H
+
+class CMovable;
+
+/**
+ * \brief
+ * Runs the simulation on its own thread at a fixed tick.
+ * The render thread hands the input over by SetKeys(), Turn() and SetTarget(),
+ * and draws the last two snapshots which the simulation has published (Read).
+ * While it runs, only the simulation thread moves CView, CModel and CPlayer.
+ */
+class CSimulation {
+public:
+	// Keys which are held down
+	enum Key {
+		MOVE_FRONT = 0x001,
+		MOVE_BACK = 0x002,
+		MOVE_LEFT = 0x004,
+		MOVE_RIGHT = 0x008,
+		TURN_X = 0x010,
+		TURN_X_BACK = 0x020,
+		TURN_Y = 0x040,
+		TURN_Y_BACK = 0x080,
+		TURN_Z = 0x100,
+		TURN_Z_BACK = 0x200
+	};
+
+private:
+	std::thread m_thread;
+	std::mutex m_lock;	// Everything below
+	std::condition_variable m_wake;
+	bool m_running;
+	double m_tick;
+
+	// Input of the render thread
+	unsigned int m_keys;
+	float m_turn;	// Pointer, around the Y axis
+	CMovable *m_target;
+
+	// Published snapshots, the latest and the one before
+	CFrame::Snapshot m_snapshots[2];
+	int m_latest;
+
+	void Main(void);
+	void Step(CMovable *target, unsigned int keys, float turn, float dt);
+	void Publish(const CFrame::Snapshot &snapshot);
+
+	CSimulation(void);
+	virtual ~CSimulation(void);
+
+	static CSimulation *m_instance;
+
+public:
+	static CSimulation *GetInstance(void);
+	void Destroy(void);
+
+	int Start(double tick);
+	int Stop(void);
+
+	void SetKeys(unsigned int keys);
+	void Turn(float angle);
+	void SetTarget(CMovable *target);
+
+	int Read(CFrame::Snapshot *previous, CFrame::Snapshot *current);
+};
+
+#endif
+/* End of a file */
@@ -1,18 +1,101 @@
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "glad/glad.h"
 
 #include "cgmath.h"
 #include "stb_image.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
+#include "CRingBuffer.h"
+#include "CTextureManager.h"
 #include "CTexture.h"
 
+#if defined(_WIN32)
+	// Define for windows
+#include <direct.h>
+#define MKDIR(path) _mkdir(path)
+#else
+	// Define for linux
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
+// EXT_texture_compression_s3tc, not loaded by glad
+#if !defined(GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
 using namespace std;
 
+#define UPLOAD_BUDGET (LAYER_SIZE * LAYER_SIZE * 4)	// Bytes per frame, the largest level
+#define PLACEHOLDER_GRAY 0x80
+#define ENCODE_THREADS_MAX 4	// Per layer, see Encode()
+#define ENCODE_ROWS_MIN 8	// Block rows of an encode thread at least
+
+#define CACHE_DIR "texturecache"
+#define CACHE_MAGIC 0x58545a4d	// "MZTX"
+#define CACHE_VERSION 1
+
+// Header of a cache file, followed by the levels, the largest first
+struct CacheHeader {
+	GLuint magic;
+	GLuint version;
+	GLenum format;
+	GLuint size;	// LAYER_SIZE
+	GLuint levels;
+	GLuint sourceSize;	// The image which is converted
+	int64_t sourceTime;
+};
+
 CTexture *CTexture::m_instance = NULL;
 
+// Wall images, a layer of the array each
+static const char * const layerFiles[] = {
+	"wall.jpg",
+	"puzzle.jpg",
+};
+
+// Tile of the atlas of wall.jpg for the edges LTRB (left, top, right, bottom)
+static const unsigned char atlas[16][2] = {
+	{ 0, 3 }, { 3, 3 }, { 0, 2 }, { 3, 2 },
+	{ 1, 3 }, { 2, 3 }, { 1, 2 }, { 2, 2 },
+	{ 0, 0 }, { 3, 0 }, { 0, 1 }, { 3, 1 },
+	{ 1, 0 }, { 2, 0 }, { 1, 1 }, { 2, 1 },
+};
+
 CTexture::CTexture(void)
+: m_array(0)
+, m_handle(0)
+, m_format(GL_RGBA8)
+, m_layers(0)
+, m_tileHandle(0)
+, m_nextJob(0)
+, m_ring(NULL)
+, m_uploadLevel(-1)
+, m_uploadLayer(0)
 {
+	int i;
+
+	for (i = 0; i < LAYER_MAX; i++) {
+		m_layerData[i].file = NULL;
+		m_layerData[i].texels = NULL;
+		m_layerData[i].mapped = NULL;
+		m_layerData[i].mappedSize = 0;
+		m_layerData[i].decoded = false;
+	}
+
 	glEnable(GL_TEXTURE_2D);
 	/**
 	 * GL_LINEAR  : More smooth
@@ -24,6 +107,23 @@ CTexture::CTexture(void)
 
 CTexture::~CTexture(void)
 {
+	int i;
+
+	Join();
+
+	for (i = 0; i < m_layers; i++)
+		Release(&m_layerData[i]);
+
+	delete m_ring;
+
+	// The array is not handed over yet
+	if (m_array && CTextureManager::GetInstance()->Texture(m_handle) != m_array)
+		glDeleteTextures(1, &m_array);
+
+	if (m_handle > 0)
+		CTextureManager::GetInstance()->Release(m_handle);
+	if (m_tileHandle > 0)
+		CTextureManager::GetInstance()->Release(m_tileHandle);
 }
 
 CTexture *CTexture::GetInstance(void)
@@ -39,55 +139,966 @@ CTexture *CTexture::GetInstance(void)
 	return m_instance;
 }
 
-GLuint CTexture::Load()
+static int LevelCount(void)
+{
+	int levels = 1;
+	int size;
+
+	for (size = LAYER_SIZE; size > 1; size >>= 1)
+		levels++;
+
+	return levels;
+}
+
+static int LevelSize(int level)
+{
+	return LAYER_SIZE >> level;
+}
+
+static bool Compressed(GLenum format)
+{
+	return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+// Bytes of a level of a layer, a compressed level is made of 4x4 blocks
+static size_t LevelBytes(GLenum format, int level)
+{
+	size_t blocks;
+	int size = LevelSize(level);
+
+	if (!Compressed(format))
+		return (size_t)size * size * 4;
+
+	blocks = (size_t)((size + 3) / 4) * ((size + 3) / 4);
+	return blocks * (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16);
+}
+
+// Bytes of the levels before the level
+static size_t LevelOffset(GLenum format, int level)
+{
+	size_t offset = 0;
+	int i;
+
+	for (i = 0; i < level; i++)
+		offset += LevelBytes(format, i);
+
+	return offset;
+}
+
+/**
+ * \brief
+ * Nearest texel of the image for level 0, a box filter of the level above for the rest.
+ * A gray layer is built if there is no image.
+ */
+static unsigned char *BuildLevels(const unsigned char *image, int width, int height)
+{
+	unsigned char *texels;
+	const unsigned char *src;
+	unsigned char *dst;
+	int levels = LevelCount();
+	int level;
+	int size;
+	int sx;
+	int sy;
+	int x;
+	int y;
+	int c;
+
+	try {
+		texels = new unsigned char[LevelOffset(GL_RGBA8, levels)];
+	} catch (...) {
+		return NULL;
+	}
+
+	if (!image) {
+		memset(texels, PLACEHOLDER_GRAY, LevelOffset(GL_RGBA8, levels));
+		return texels;
+	}
+
+	for (y = 0; y < LAYER_SIZE; y++) {
+		sy = y * height / LAYER_SIZE;
+		for (x = 0; x < LAYER_SIZE; x++) {
+			sx = x * width / LAYER_SIZE;
+			memcpy(&texels[(y * LAYER_SIZE + x) * 4], &image[(sy * width + sx) * 4], 4);
+		}
+	}
+
+	for (level = 1; level < levels; level++) {
+		src = texels + LevelOffset(GL_RGBA8, level - 1);
+		dst = texels + LevelOffset(GL_RGBA8, level);
+		size = LevelSize(level);
+
+		for (y = 0; y < size; y++) {
+			for (x = 0; x < size; x++) {
+				for (c = 0; c < 4; c++) {
+					dst[(y * size + x) * 4 + c] = (unsigned char)((
+						src[((2 * y) * size * 2 + 2 * x) * 4 + c]
+						+ src[((2 * y) * size * 2 + 2 * x + 1) * 4 + c]
+						+ src[((2 * y + 1) * size * 2 + 2 * x) * 4 + c]
+						+ src[((2 * y + 1) * size * 2 + 2 * x + 1) * 4 + c] + 2) / 4);
+				}
+			}
+		}
+	}
+
+	return texels;
+}
+
+static unsigned short Pack565(const int *rgb)
+{
+	return (unsigned short)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+static void Unpack565(unsigned short c, int *rgb)
+{
+	rgb[0] = ((c >> 11) & 0x1f) * 255 / 31;
+	rgb[1] = ((c >> 5) & 0x3f) * 255 / 63;
+	rgb[2] = (c & 0x1f) * 255 / 31;
+}
+
+/**
+ * \brief
+ * BC1 block of 16 RGBA texels, the ends are the corners of their bounding box,
+ * inset a little as the extremes are rarely worth an end of their own.
+ * Always the 4 color mode, the alpha is left to the BC3 alpha block.
+ */
+static void EncodeColor(const unsigned char *texels, unsigned char *block)
+{
+	int lo[3] = { 255, 255, 255 };
+	int hi[3] = { 0, 0, 0 };
+	int palette[4][3];
+	unsigned short c0;
+	unsigned short c1;
+	unsigned int indices = 0;
+	int inset;
+	int best;
+	int dist;
+	int d;
+	int i;
+	int j;
+	int k;
+
+	for (i = 0; i < 16; i++) {
+		for (k = 0; k < 3; k++) {
+			lo[k] = min(lo[k], (int)texels[i * 4 + k]);
+			hi[k] = max(hi[k], (int)texels[i * 4 + k]);
+		}
+	}
+
+	for (k = 0; k < 3; k++) {
+		inset = (hi[k] - lo[k]) / 16;
+		lo[k] += inset;
+		hi[k] -= inset;
+	}
+
+	c0 = Pack565(hi);
+	c1 = Pack565(lo);
+	if (c0 < c1) {
+		unsigned short tmp = c0;
+
+		c0 = c1;
+		c1 = tmp;
+	}
+
+	block[0] = c0 & 0xff;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 0xff;
+	block[3] = c1 >> 8;
+
+	// The 3 color mode, a flat block has every index at 0
+	if (c0 == c1) {
+		memset(block + 4, 0, 4);
+		return;
+	}
+
+	Unpack565(c0, palette[0]);
+	Unpack565(c1, palette[1]);
+	for (k = 0; k < 3; k++) {
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+
+	for (i = 0; i < 16; i++) {
+		best = 0;
+		dist = 0x7fffffff;
+		for (j = 0; j < 4; j++) {
+			d = 0;
+			for (k = 0; k < 3; k++)
+				d += (texels[i * 4 + k] - palette[j][k]) * (texels[i * 4 + k] - palette[j][k]);
+			if (d < dist) {
+				dist = d;
+				best = j;
+			}
+		}
+		indices |= (unsigned int)best << (i * 2);
+	}
+
+	block[4] = indices & 0xff;
+	block[5] = (indices >> 8) & 0xff;
+	block[6] = (indices >> 16) & 0xff;
+	block[7] = indices >> 24;
+}
+
+/**
+ * \brief
+ * BC3 alpha block, the 8 value mode between the smallest and the largest alpha.
+ */
+static void EncodeAlpha(const unsigned char *texels, unsigned char *block)
+{
+	int palette[8];
+	uint64_t indices = 0;
+	int a0 = 0;
+	int a1 = 255;
+	int best;
+	int dist;
+	int d;
+	int i;
+	int j;
+
+	for (i = 0; i < 16; i++) {
+		a0 = max(a0, (int)texels[i * 4 + 3]);
+		a1 = min(a1, (int)texels[i * 4 + 3]);
+	}
+
+	block[0] = (unsigned char)a0;
+	block[1] = (unsigned char)a1;
+
+	if (a0 == a1) {
+		memset(block + 2, 0, 6);
+		return;
+	}
+
+	palette[0] = a0;
+	palette[1] = a1;
+	for (j = 1; j < 7; j++)
+		palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+
+	for (i = 0; i < 16; i++) {
+		best = 0;
+		dist = 256;
+		for (j = 0; j < 8; j++) {
+			d = texels[i * 4 + 3] - palette[j];
+			d = d < 0 ? -d : d;
+			if (d < dist) {
+				dist = d;
+				best = j;
+			}
+		}
+		indices |= (uint64_t)best << (i * 3);
+	}
+
+	for (i = 0; i < 6; i++)
+		block[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/**
+ * \brief
+ * Compresses the block rows [first, last) of a level, dst is the first block of the level.
+ * A level smaller than a block repeats its last row and column.
+ */
+static void EncodeRows(const unsigned char *src, unsigned char *dst, int size, GLenum format, int first, int last)
+{
+	unsigned char tile[16 * 4];
+	int blockBytes = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8;
+	int bx;
+	int by;
+	int x;
+	int y;
+
+	dst += (size_t)first * ((size + 3) / 4) * blockBytes;
+
+	for (by = first * 4; by < last * 4; by += 4) {
+		for (bx = 0; bx < size; bx += 4) {
+			for (y = 0; y < 4; y++) {
+				for (x = 0; x < 4; x++)
+					memcpy(&tile[(y * 4 + x) * 4],
+						&src[(min(by + y, size - 1) * size + min(bx + x, size - 1)) * 4], 4);
+			}
+
+			if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+				EncodeAlpha(tile, dst);
+				dst += 8;
+			}
+			EncodeColor(tile, dst);
+			dst += 8;
+		}
+	}
+}
+
+/**
+ * \brief
+ * Compresses the levels of BuildLevels() into BC1 or BC3 blocks.
+ * The block rows of a level are split across up to ENCODE_THREADS_MAX threads,
+ * this one takes the first range and any range whose thread fails to start.
+ * The levels with less than ENCODE_ROWS_MIN rows per thread are encoded here.
+ */
+static unsigned char *Encode(const unsigned char *texels, GLenum format)
+{
+	thread workers[ENCODE_THREADS_MAX - 1];
+	unsigned char *blocks;
+	unsigned char *dst;
+	const unsigned char *src;
+	unsigned int threads;
+	int levels = LevelCount();
+	int started;
+	int count;
+	int level;
+	int size;
+	int rows;
+	int i;
+
+	try {
+		blocks = new unsigned char[LevelOffset(format, levels)];
+	} catch (...) {
+		return NULL;
+	}
+
+	threads = thread::hardware_concurrency();
+	if (threads == 0 || threads > ENCODE_THREADS_MAX)
+		threads = ENCODE_THREADS_MAX;
+
+	for (level = 0; level < levels; level++) {
+		src = texels + LevelOffset(GL_RGBA8, level);
+		dst = blocks + LevelOffset(format, level);
+		size = LevelSize(level);
+		rows = (size + 3) / 4;
+
+		count = min((int)threads, rows / ENCODE_ROWS_MIN);
+		if (count < 1)
+			count = 1;
+
+		for (started = 1; started < count; started++) {
+			try {
+				workers[started - 1] = thread(EncodeRows, src, dst, size, format,
+					rows * started / count, rows * (started + 1) / count);
+			} catch (...) {
+				cerr << "Failed to start an encode thread" << endl;
+				break;
+			}
+		}
+
+		EncodeRows(src, dst, size, format, 0, rows / count);
+		if (started < count)
+			EncodeRows(src, dst, size, format, rows * started / count, rows);
+
+		for (i = 0; i < started - 1; i++)
+			workers[i].join();
+	}
+
+	return blocks;
+}
+
+static void CachePath(const char *file, GLenum format, char *path, size_t size)
+{
+	const char *name = strrchr(file, '/');
+
+	name = name ? name + 1 : file;
+	snprintf(path, size, "%s/%s.%s", CACHE_DIR, name,
+		format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? "bc1" :
+		format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? "bc3" : "rgba");
+}
+
+/**
+ * \brief
+ * Maps a file into memory, read only. Windows reads it instead.
+ */
+static unsigned char *MapFile(const char *path, size_t *size)
+{
+#if defined(_WIN32)
+	unsigned char *data;
+	ifstream file;
+	streampos length;
+
+	file.open(path, ios::binary | ios::ate);
+	if (!file.is_open())
+		return NULL;
+
+	length = file.tellg();
+	try {
+		data = new unsigned char[(size_t)length];
+	} catch (...) {
+		return NULL;
+	}
+
+	file.seekg(0, ios::beg);
+	file.read((char *)data, length);
+	if (!file) {
+		delete[] data;
+		return NULL;
+	}
+
+	*size = (size_t)length;
+	return data;
+#else
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	*size = (size_t)st.st_size;
+	return (unsigned char *)data;
+#endif
+}
+
+static void UnmapFile(unsigned char *data, size_t size)
+{
+#if defined(_WIN32)
+	delete[] data;
+#else
+	munmap(data, size);
+#endif
+}
+
+/**
+ * \brief
+ * Maps the levels of the cache file of a layer, which has to be newer than the image.
+ */
+static unsigned char *LoadCache(const char *file, GLenum format, size_t *mappedSize)
 {
-	unsigned char *image0;
-	unsigned char *image1;
-	
+	const CacheHeader *header;
+	unsigned char *mapped;
+	struct stat st;
+	char path[256];
+	size_t size;
+
+	if (stat(file, &st) < 0)
+		return NULL;
+
+	CachePath(file, format, path, sizeof(path));
+	mapped = MapFile(path, &size);
+	if (!mapped)
+		return NULL;
+
+	header = (const CacheHeader *)mapped;
+	if (size < sizeof(*header) + LevelOffset(format, LevelCount())
+		|| header->magic != CACHE_MAGIC || header->version != CACHE_VERSION
+		|| header->format != format || header->size != LAYER_SIZE
+		|| header->levels != (GLuint)LevelCount()
+		|| header->sourceSize != (GLuint)st.st_size || header->sourceTime != (int64_t)st.st_mtime) {
+		UnmapFile(mapped, size);
+		return NULL;
+	}
+
+	*mappedSize = size;
+	return mapped;
+}
+
+static int SaveCache(const char *file, GLenum format, const unsigned char *levels)
+{
+	CacheHeader header;
+	struct stat st;
+	ofstream out;
+	char path[256];
+
+	if (stat(file, &st) < 0)
+		return -EINVAL;
+
+	// It may exist already
+	MKDIR(CACHE_DIR);
+
+	CachePath(file, format, path, sizeof(path));
+	out.open(path, ios::binary | ios::trunc);
+	if (!out.is_open()) {
+		cerr << "Failed to write texture cache " << path << endl;
+		return -EFAULT;
+	}
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.format = format;
+	header.size = LAYER_SIZE;
+	header.levels = LevelCount();
+	header.sourceSize = (GLuint)st.st_size;
+	header.sourceTime = (int64_t)st.st_mtime;
+
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)levels, LevelOffset(format, LevelCount()));
+	out.close();
+
+	if (!out) {
+		cerr << "Failed to write texture cache " << path << endl;
+		remove(path);
+		return -EFAULT;
+	}
+
+	cout << "Texture cache " << path << " is written" << endl;
+	return 0;
+}
+
+void CTexture::Release(Layer *layer)
+{
+	if (layer->mapped)
+		UnmapFile(layer->mapped, layer->mappedSize);
+	else
+		delete[] layer->texels;
+
+	layer->mapped = NULL;
+	layer->mappedSize = 0;
+	layer->texels = NULL;
+}
+
+/**
+ * \brief
+ * Body of a worker, loads the layers until there is none left.
+ * A layer comes from its cache file if it is there, the image is decoded,
+ * mipmapped, compressed and cached otherwise.
+ * stb_image keeps no state of a decode but its failure reason, which only
+ * the failed decode of a thread reads.
+ */
+void CTexture::Decode(void)
+{
+	unsigned char *mapped;
+	unsigned char *image;
+	unsigned char *texels;
+	unsigned char *blocks;
+	size_t mappedSize = 0;
+	Layer *layer;
 	int width;
 	int height;
 	int comp;
-	GLuint texId[2];
-	
-
-	// load an image
-	image0 = stbi_load("test.jpg", &width, &height, &comp, 0);
-	image1 = stbi_load("wall.jpg", &width, &height, &comp, 0);
-	
-	if (!image0 && !image1) {
-		cerr << "Failed to load an image" << endl;
-		return 0;
+	int job;
+
+	for (;;) {
+		{
+			lock_guard<mutex> guard(m_lock);
+
+			if (m_nextJob >= m_layers)
+				return;
+			job = m_nextJob++;
+		}
+
+		layer = &m_layerData[job];
+		texels = NULL;
+
+		mapped = LoadCache(layer->file, m_format, &mappedSize);
+		if (mapped) {
+			texels = mapped + sizeof(CacheHeader);
+		} else {
+			image = stbi_load(layer->file, &width, &height, &comp, 4);
+			if (!image)
+				cerr << "Failed to load an image " << layer->file << endl;
+
+			texels = BuildLevels(image, width, height);
+			if (texels && Compressed(m_format)) {
+				blocks = Encode(texels, m_format);
+				delete[] texels;
+				texels = blocks;
+			}
+
+			// A missing image is not cached, it may be there next time
+			if (image && texels)
+				SaveCache(layer->file, m_format, texels);
+
+			if (image)
+				stbi_image_free(image); // release the original image
+		}
+
+		{
+			lock_guard<mutex> guard(m_lock);
+
+			layer->mapped = mapped;
+			layer->mappedSize = mappedSize;
+			layer->texels = texels;
+			layer->decoded = true;
+		}
 	}
+}
+
+/**
+ * \brief
+ * Starts the workers, the images are loaded here if there is none.
+ */
+void CTexture::Start(void)
+{
+	unsigned int threads;
+	int i;
+
+	m_nextJob = 0;
+
+	threads = thread::hardware_concurrency();
+	if (threads == 0 || threads > DECODE_THREADS_MAX)
+		threads = DECODE_THREADS_MAX;
+	if (threads > (unsigned int)m_layers)
+		threads = m_layers;
+
+	for (i = 0; i < (int)threads; i++) {
+		try {
+			m_workers[i] = thread(&CTexture::Decode, this);
+		} catch (...) {
+			cerr << "Failed to start a decode thread" << endl;
+			break;
+		}
+	}
+
+	if (i == 0)
+		Decode();
+}
+
+void CTexture::Join(void)
+{
+	int i;
+
+	for (i = 0; i < DECODE_THREADS_MAX; i++) {
+		if (m_workers[i].joinable())
+			m_workers[i].join();
+	}
+}
 
-	glGenTextures(1, &texId[0]);
-	glBindTexture(GL_TEXTURE_2D, texId[0]);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image0);
+/**
+ * \brief
+ * The layers and their format, BC3 if an image has alpha, BC1 otherwise,
+ * RGBA8 if the driver has no S3TC.
+ */
+void CTexture::Prepare(void)
+{
+	bool alpha = false;
+	int width;
+	int height;
+	int comp;
+	int i;
+
+	for (i = 0; i < (int)(sizeof(layerFiles) / sizeof(layerFiles[0])) && i < LAYER_MAX; i++) {
+		m_layerData[i].file = layerFiles[i];
+		if (stbi_info(layerFiles[i], &width, &height, &comp) && (comp == 2 || comp == 4))
+			alpha = true;
+	}
+	m_layers = i;
+
+	if (!CMisc::ExtensionSupported("GL_EXT_texture_compression_s3tc"))
+		m_format = GL_RGBA8;
+	else if (alpha)
+		m_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	else
+		m_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+/**
+ * \brief
+ * Converts the wall images into the cache files and waits for them, see -bake of maze.cpp.
+ */
+int CTexture::Bake(void)
+{
+	int i;
+
+	if (m_layers)
+		return -EBUSY;
+
+	Prepare();
+	Start();
+	Join();
+
+	for (i = 0; i < m_layers; i++)
+		Release(&m_layerData[i]);
+
+	cout << m_layers << " wall layers are baked" << endl;
+	return 0;
+}
+
+/**
+ * \brief
+ * Allocates the texture array and starts to load the wall images into it.
+ * The handle has the placeholder until Update() has something to show.
+ * A reference of the handle is returned, a negative value if it is not created.
+ */
+int CTexture::Load(void)
+{
+	CTextureManager *manager = CTextureManager::GetInstance();
+	unsigned char gray[LAYER_MAX * 4];
+	char name[TEXTURE_NAME_MAX];
+	GLuint placeholder;
+	GLint unit;
+	int levels = LevelCount();
+	int level;
+	int size;
+	int i;
+
+	if (m_handle > 0)
+		return manager->AddRef(m_handle);
+
+	Prepare();
+
+	// Keyed by the images and the format they are stored in
+	name[0] = '\0';
+	for (i = 0; i < m_layers; i++) {
+		if (strlen(name) + strlen(m_layerData[i].file) + 2 > sizeof(name))
+			break;
+		if (i > 0)
+			strcat(name, ",");
+		strcat(name, m_layerData[i].file);
+	}
+
+	m_handle = manager->Acquire(name, m_format);
+	if (m_handle < 0)
+		return m_handle;
+
+	try {
+		m_ring = new CRingBuffer(GL_PIXEL_UNPACK_BUFFER, UPLOAD_BUDGET);
+	} catch (...) {
+		cerr << "Failed to allocate the ring buffer" << endl;
+		manager->Release(m_handle);
+		m_handle = 0;
+		return -ENOMEM;
+	}
+
+	if (m_ring->Load() < 0) {
+		cerr << "Failed to allocate the upload buffer" << endl;
+		delete m_ring;
+		m_ring = NULL;
+		manager->Release(m_handle);
+		m_handle = 0;
+		return -EFAULT;
+	}
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + UPLOAD_TEXTURE_UNIT);
+
+	// Storage of every level, filled by Update()
+	glGenTextures(1, &m_array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_array);
+	for (level = 0; level < levels; level++) {
+		size = LevelSize(level);
+		if (Compressed(m_format))
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, m_format, size, size, m_layers,
+				0, (GLsizei)(LevelBytes(m_format, level) * m_layers), NULL);
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, m_layers,
+				0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	StatusPrint();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glActiveTexture(GL_TEXTURE0);
 
-	glGenTextures(1, &texId[1]);
-	glBindTexture(GL_TEXTURE_2D, texId[1]);
-	glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image1);
+	memset(gray, PLACEHOLDER_GRAY, sizeof(gray));
+	glGenTextures(1, &placeholder);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, placeholder);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, m_layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, gray);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	StatusPrint();
+
+	glActiveTexture(unit);
+
+	manager->Assign(m_handle, GL_TEXTURE_2D_ARRAY, placeholder);
+	manager->Bind(m_handle, 0);
+
+	m_uploadLevel = levels - 1;
+	m_uploadLayer = 0;
+
+	Start();
+
+	cout << m_layers << " wall layers are loading, format 0x" << hex << m_format << dec << endl;
+
+	return manager->AddRef(m_handle);
+}
+
+/**
+ * \brief
+ * Uploads the loaded levels which fit in a region of the ring buffer.
+ * Returns 1 while some levels are still to come, 0 once the array is complete,
+ * so the frames keep coming in the on-demand mode until then.
+ */
+int CTexture::Update(void)
+{
+	Layer *layer;
+	unsigned char *dst;
+	GLintptr offset;
+	GLsizeiptr bytes;
+	GLint unit;
+	bool decoded;
+	int levels = LevelCount();
+	int size;
+
+	if (!m_ring || m_uploadLevel < 0)
+		return 0;
+
+	// The uploads of the last frame are consumed by the commands issued so far
+	m_ring->Fence();
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + UPLOAD_TEXTURE_UNIT);
+
+	while (m_uploadLevel >= 0) {
+		layer = &m_layerData[m_uploadLayer];
+		{
+			lock_guard<mutex> guard(m_lock);
+			decoded = layer->decoded;
+		}
+		if (!decoded)
+			break;
+
+		size = LevelSize(m_uploadLevel);
+		bytes = (GLsizeiptr)LevelBytes(m_format, m_uploadLevel);
+
+		// The region of this frame is full
+		dst = (unsigned char *)m_ring->Alloc(bytes, &offset);
+		if (!dst)
+			break;
+
+		if (layer->texels)
+			memcpy(dst, layer->texels + LevelOffset(m_format, m_uploadLevel), bytes);
+		else if (Compressed(m_format))
+			memset(dst, 0, bytes);
+		else
+			memset(dst, PLACEHOLDER_GRAY, bytes);
+		m_ring->Flush();
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_array);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_ring->Buffer());
+		if (Compressed(m_format))
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, m_uploadLevel, 0, 0, m_uploadLayer, size, size, 1,
+				m_format, (GLsizei)bytes, (void *)offset);
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, m_uploadLevel, 0, 0, m_uploadLayer, size, size, 1,
+				GL_RGBA, GL_UNSIGNED_BYTE, (void *)offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		StatusPrint();
+
+		// The largest level is the last one of a layer
+		if (m_uploadLevel == 0)
+			Release(layer);
+
+		if (++m_uploadLayer < m_layers)
+			continue;
+
+		// Every layer has the level, it can be sampled from now on
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, m_uploadLevel);
+		if (m_uploadLevel == levels - 1) {
+			// The placeholder is deleted, unit 0 switches to the array
+			CTextureManager::GetInstance()->Assign(m_handle, GL_TEXTURE_2D_ARRAY, m_array);
+			CTextureManager::GetInstance()->Bind(m_handle, 0);
+			cout << "Wall layers are shown" << endl;
+		}
+
+		m_uploadLayer = 0;
+		m_uploadLevel--;
+	}
+
+	glActiveTexture(unit);
+
+	if (m_uploadLevel >= 0)
+		return 1;
+
+	// Every layer is loaded
+	Join();
+
+	cout << "Wall layers are resident" << endl;
+	return 0;
+}
+
+int CTexture::Layers(void)
+{
+	return m_layers;
+}
+
+/**
+ * \brief
+ * Color of an edge, the same integer hash on every driver.
+ * An edge of the last row or column is the edge of the first one,
+ * so the cells wrap around TILE_INDEX_SIZE without a seam.
+ */
+static inline uint32_t EdgeBit(uint32_t x, uint32_t y, uint32_t axis)
+{
+	uint32_t h;
+
+	h = (x & (TILE_INDEX_SIZE - 1)) * 0x8da6b343u
+		^ (y & (TILE_INDEX_SIZE - 1)) * 0xd8163841u
+		^ axis * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+
+	return h >> 31;
+}
+
+/**
+ * \brief
+ * Builds the atlas position of the Wang tile of each cell into an integer texture,
+ * bound to TILE_TEXTURE_UNIT. The fragment shader fetches a texel instead of
+ * hashing the four edges itself.
+ * The table is TILE_INDEX_SIZE x TILE_INDEX_SIZE cells and is built once,
+ * so the hash is plain scalar code.
+ */
+int CTexture::LoadTiles(void)
+{
+	CTextureManager *manager = CTextureManager::GetInstance();
+	uint32_t edges[TILE_INDEX_SIZE];
+	uint32_t index[TILE_INDEX_SIZE];
+	unsigned char *texels;
+	GLuint tiles;
+	GLint unit;
+	uint32_t x;
+	uint32_t y;
+
+	if (m_tileHandle > 0)
+		return manager->AddRef(m_tileHandle);
+
+	try {
+		texels = new unsigned char[TILE_INDEX_SIZE * TILE_INDEX_SIZE * 2];
+	} catch (...) {
+		cerr << "Failed to allocate the tiles" << endl;
+		return -ENOMEM;
+	}
+
+	m_tileHandle = manager->Acquire("tiles", TILE_INDEX_SIZE);
+	if (m_tileHandle < 0) {
+		delete[] texels;
+		return m_tileHandle;
+	}
+
+	for (y = 0; y < TILE_INDEX_SIZE; y++) {
+		// Left: the vertical edge of the cell, right: the one of the next cell
+		for (x = 0; x < TILE_INDEX_SIZE; x++)
+			index[x] = EdgeBit(x, y, 1) | (EdgeBit(x + 1, y, 1) << 2);
+
+		// Top: the horizontal edge of the cell, bottom: the one of the row below
+		for (x = 0; x < TILE_INDEX_SIZE; x++)
+			edges[x] = (EdgeBit(x, y, 0) << 1) | (EdgeBit(x, y - 1, 0) << 3);
+
+		for (x = 0; x < TILE_INDEX_SIZE; x++) {
+			index[x] |= edges[x];
+			texels[(y * TILE_INDEX_SIZE + x) * 2 + 0] = atlas[index[x]][0];
+			texels[(y * TILE_INDEX_SIZE + x) * 2 + 1] = atlas[index[x]][1];
+		}
+	}
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+	glActiveTexture(GL_TEXTURE0 + UPLOAD_TEXTURE_UNIT);
+
+	glGenTextures(1, &tiles);
+	glBindTexture(GL_TEXTURE_2D, tiles);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8UI, TILE_INDEX_SIZE, TILE_INDEX_SIZE, 0, GL_RG_INTEGER, GL_UNSIGNED_BYTE, texels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	StatusPrint();
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glActiveTexture(GL_TEXTURE1);
-	
 
-	stbi_image_free(image0); // release the original image
-	stbi_image_free(image1); // release the original image
-	
-//	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(unit);
+	delete[] texels;
 
-	return 1;
+	manager->Assign(m_tileHandle, GL_TEXTURE_2D, tiles);
+	manager->Bind(m_tileHandle, TILE_TEXTURE_UNIT);
+	return manager->AddRef(m_tileHandle);
 }
 
 /* End of a file */
@@ -2,15 +2,72 @@
 #if !defined(__CTEXTURE_H)
 #define __CTEXTURE_H
 
+#define TILE_INDEX_SIZE 64	// Same as maze.frag, a power of two
+#define LAYER_SIZE 256	// Texels per side of a layer, a power of two
+#define LAYER_MAX 16
+#define DECODE_THREADS_MAX 4
+
+class CRingBuffer;
+
+/**
+ * \brief
+ * Loads the images of the blocks into a texture array, a wall picks its layer
+ * by its material (see CMaze), so every material is drawn by the same draw.
+ * LoadTiles() builds the Wang tile of every cell of a face, see TileTex() of maze.frag.
+ * Both are kept by CTextureManager, they are built by the first call and every
+ * call returns a new reference of the same handle, which the caller releases.
+ *
+ * Load() returns at once, the layers are loaded by worker threads from their
+ * cache files in texturecache/, which hold every mip level in the format of the
+ * array, BC1/BC3 if the driver has S3TC. A layer without a valid cache file is
+ * decoded, mipmapped and compressed, and its cache file is written.
+ * Update() uploads the loaded levels through a pixel unpack CRingBuffer,
+ * the smallest levels first and no more than a region per frame.
+ * The handle has a gray placeholder until the smallest level of every layer is
+ * there, then the base level of the array goes down as the larger levels arrive.
+ */
 class CTexture {
 private:
+	struct Layer {
+		const char *file;
+		unsigned char *texels;	// Every level in m_format, the largest first
+		unsigned char *mapped;	// Cache file, texels points into it
+		size_t mappedSize;
+		bool decoded;	// Under m_lock
+	};
+
+	GLuint m_array;	// Texture of m_handle once it can be shown
+	int m_handle;	// Reference of CTexture, see CTextureManager
+	GLenum m_format;
+	int m_layers;
+	int m_tileHandle;
+
+	Layer m_layerData[LAYER_MAX];
+	std::thread m_workers[DECODE_THREADS_MAX];
+	std::mutex m_lock;
+	int m_nextJob;	// Under m_lock, next layer to decode
+
+	CRingBuffer *m_ring;
+	int m_uploadLevel;	// Level which is being uploaded, -1 when every level is
+	int m_uploadLayer;
+
+	void Prepare(void);
+	void Start(void);
+	void Join(void);
+	void Decode(void);
+	void Release(Layer *layer);
+
 	CTexture(void);
 	virtual ~CTexture(void);
 
 	static CTexture *m_instance;
 public:
 	static CTexture *GetInstance(void);
-	GLuint Load();
+	int Load(void);
+	int Bake(void);
+	int Update(void);
+	int Layers(void);
+	int LoadTiles(void);
 };
 
 #endif
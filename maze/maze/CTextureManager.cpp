@@ -0,0 +1,231 @@
+/**
+ * \brief
+ * Slots are searched linearly, there are a few textures and they are
+ * acquired at load time, the frames only Bind() them.
+ */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+
+#include "glad/glad.h"
+#include "GLFW/glfw3.h"
+
+#include "cgmath.h"
+
+#include "CMisc.h"
+#include "CDebug.h"
+#include "CTextureManager.h"
+
+using namespace std;
+
+CTextureManager *CTextureManager::m_instance = NULL;
+
+CTextureManager::CTextureManager(void)
+{
+	int i;
+
+	for (i = 0; i < TEXTURE_HANDLE_MAX; i++) {
+		m_entries[i].name[0] = '\0';
+		m_entries[i].params = 0;
+		m_entries[i].target = 0;
+		m_entries[i].texture = 0;
+		m_entries[i].refs = 0;
+	}
+
+	for (i = 0; i < TEXTURE_UNIT_MAX; i++)
+		m_bound[i] = 0;
+}
+
+CTextureManager::~CTextureManager(void)
+{
+	int i;
+
+	for (i = 0; i < TEXTURE_HANDLE_MAX; i++) {
+		if (m_entries[i].refs > 0)
+			Delete(&m_entries[i]);
+	}
+}
+
+CTextureManager *CTextureManager::GetInstance(void)
+{
+	if (!m_instance) {
+		try {
+			m_instance = new CTextureManager();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	return m_instance;
+}
+
+void CTextureManager::Destroy(void)
+{
+	m_instance = NULL;
+	delete this;
+}
+
+CTextureManager::Entry *CTextureManager::Get(int handle)
+{
+	if (handle <= 0 || handle > TEXTURE_HANDLE_MAX)
+		return NULL;
+
+	if (m_entries[handle - 1].refs <= 0)
+		return NULL;
+
+	return &m_entries[handle - 1];
+}
+
+/**
+ * \brief
+ * Deletes the texture of a slot, a unit which has it is not tracked any more
+ * as the name may be given to another texture.
+ */
+void CTextureManager::Delete(Entry *entry)
+{
+	int i;
+
+	if (!entry->texture)
+		return;
+
+	for (i = 0; i < TEXTURE_UNIT_MAX; i++) {
+		if (m_bound[i] == entry->texture)
+			m_bound[i] = 0;
+	}
+
+	glDeleteTextures(1, &entry->texture);
+	entry->texture = 0;
+}
+
+/**
+ * \brief
+ * Returns the handle of the texture of the key, a new slot if there is none.
+ * Texture() of a new slot is 0 until its user calls Assign().
+ */
+int CTextureManager::Acquire(const char *name, unsigned int params)
+{
+	Entry *entry;
+	int free = -1;
+	int i;
+
+	if (!name || strlen(name) >= TEXTURE_NAME_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < TEXTURE_HANDLE_MAX; i++) {
+		entry = &m_entries[i];
+		if (entry->refs <= 0) {
+			if (free < 0)
+				free = i;
+			continue;
+		}
+
+		if (entry->params == params && !strcmp(entry->name, name)) {
+			entry->refs++;
+			return i + 1;
+		}
+	}
+
+	if (free < 0) {
+		cerr << "No texture slot for " << name << endl;
+		return -ENOMEM;
+	}
+
+	entry = &m_entries[free];
+	strcpy(entry->name, name);
+	entry->params = params;
+	entry->target = 0;
+	entry->texture = 0;
+	entry->refs = 1;
+	return free + 1;
+}
+
+/**
+ * \brief
+ * Another reference of a handle, for a user who does not know its key.
+ */
+int CTextureManager::AddRef(int handle)
+{
+	Entry *entry = Get(handle);
+
+	if (!entry)
+		return -EINVAL;
+
+	entry->refs++;
+	return handle;
+}
+
+/**
+ * \brief
+ * The texture is deleted with the last reference, the handle is invalid afterwards.
+ */
+int CTextureManager::Release(int handle)
+{
+	Entry *entry = Get(handle);
+
+	if (!entry)
+		return -EINVAL;
+
+	if (--entry->refs > 0)
+		return entry->refs;
+
+	Delete(entry);
+	entry->name[0] = '\0';
+	return 0;
+}
+
+/**
+ * \brief
+ * The texture belongs to the slot from now on, the one it had is deleted.
+ */
+int CTextureManager::Assign(int handle, GLenum target, GLuint texture)
+{
+	Entry *entry = Get(handle);
+
+	if (!entry)
+		return -EINVAL;
+
+	if (entry->texture != texture)
+		Delete(entry);
+
+	entry->target = target;
+	entry->texture = texture;
+	return 0;
+}
+
+GLuint CTextureManager::Texture(int handle)
+{
+	Entry *entry = Get(handle);
+
+	return entry ? entry->texture : 0;
+}
+
+/**
+ * \brief
+ * Binds the texture to a unit, unless Bind() has done so already.
+ */
+int CTextureManager::Bind(int handle, int unit)
+{
+	Entry *entry = Get(handle);
+	GLint active;
+
+	if (!entry || !entry->texture || unit < 0)
+		return -EINVAL;
+
+	if (unit < TEXTURE_UNIT_MAX && m_bound[unit] == entry->texture)
+		return 0;
+
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(entry->target, entry->texture);
+	glActiveTexture(active);
+	StatusPrint();
+
+	if (unit < TEXTURE_UNIT_MAX)
+		m_bound[unit] = entry->texture;
+
+	return 0;
+}
+
+/* End of a file */
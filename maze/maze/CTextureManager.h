@@ -0,0 +1,56 @@
+#pragma once
+#if !defined(__CTEXTUREMANAGER_H)
+#define __CTEXTUREMANAGER_H
+
+#define TEXTURE_HANDLE_MAX 32
+#define TEXTURE_NAME_MAX 64
+#define TEXTURE_UNIT_MAX 16	// Units whose binding is tracked
+
+/**
+ * \brief
+ * Textures shared by their users, keyed by a path and the parameters they are
+ * built with. Acquire() returns the same handle for the same key and counts
+ * the references, the texture is deleted by the last Release().
+ *
+ * A handle is the slot of the texture plus one, it does not change while the
+ * texture lives. The first user creates the GL texture and hands it over by
+ * Assign(), which may replace it later, e.g. a placeholder by the real image,
+ * so the users keep the handle and see the new texture once it is bound.
+ * Bind() skips the units which have the texture already, so switching the
+ * texture of a unit costs a bind, not a load.
+ */
+class CTextureManager {
+private:
+	struct Entry {
+		char name[TEXTURE_NAME_MAX];
+		unsigned int params;
+		GLenum target;
+		GLuint texture;
+		int refs;	// Free slot if 0
+	};
+
+	Entry m_entries[TEXTURE_HANDLE_MAX];
+	GLuint m_bound[TEXTURE_UNIT_MAX];	// Texture of a unit, as bound by Bind()
+
+	Entry *Get(int handle);
+	void Delete(Entry *entry);
+
+	CTextureManager(void);
+	virtual ~CTextureManager(void);
+
+	static CTextureManager *m_instance;
+
+public:
+	static CTextureManager *GetInstance(void);
+	void Destroy(void);
+
+	int Acquire(const char *name, unsigned int params);
+	int AddRef(int handle);
+	int Release(int handle);
+	int Assign(int handle, GLenum target, GLuint texture);
+	GLuint Texture(int handle);
+	int Bind(int handle, int unit);
+};
+
+#endif
+/* End of a file */
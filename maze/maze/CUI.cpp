@@ -1,14 +1,27 @@
 #include <iostream>
+#include <fstream>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
+#if defined(USE_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include "cgmath.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
 #include "CMovable.h"
 #include "CView.h"
 #include "CUI.h"
@@ -18,9 +31,40 @@
 #include "CPerspective.h"
 #include "CModel.h"
 #include "CBlock.h"
+#include "CCulling.h"
+#include "CLod.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
+#include "CRenderQueue.h"
+#include "CSimulation.h"
+#include "CTexture.h"
+#include "CMaze.h"
+#include "CProfiler.h"
+#include "CLights.h"
+#include "CShadows.h"
+#include "CMinimap.h"
+#include "CFog.h"
 
 using namespace std;
 
+#define TICK_RATE 60.0	// Hz
+#define SLEEP_MARGIN 0.002	// Seconds of the frame limit which are spun, not slept
+#define REPORT_INTERVAL 5.0	// Seconds between the frame time reports
+#define SETTLE_FRAMES 2	// The occlusion of a frame uses the depth of the one before
+
+#define BENCH_WARMUP 10	// Frames before the measured ones
+#define BENCH_WARMUP_MAX 300	// Until the textures and the impostors have settled
+#define BENCH_ORBIT 0.6	// Radius of the camera path, of the half size of the maze
+#define BENCH_HEIGHT_MIN 0.25f	// Heights of the path, in BLOCK_WIDTH of the model space
+#define BENCH_HEIGHT_MAX 6.0f
+
+// A measured frame of Benchmark()
+struct BenchSample {
+	double ms;
+	unsigned int draws;
+	GLuint primitives;
+};
+
 CUI *CUI::m_instance = NULL;
 float CUI::m_ptrX = 0.0f;
 float CUI::m_ptrY = 0.0f;
@@ -43,7 +87,7 @@ void CUI::ptrCB(GLFWwindow *win, double x, double y)
 		return;
 	}
 
-	if (CUI::GetInstance()->ControlTarget() != CView::GetInstance())
+	if (CUI::GetInstance()->ControlTarget() != CView::GetInstance(CUI::GetInstance()->m_view))
 		return;
 
 	xd = (x - m_ptrX);
@@ -55,7 +99,7 @@ void CUI::ptrCB(GLFWwindow *win, double x, double y)
 		else
 			xd = 180.0f - xd;
 
-		CUI::GetInstance()->ControlTarget()->Rotate(vec3(0.0f, 1.0f, 0.0f), PI / xd);
+		CSimulation::GetInstance()->Turn(PI / xd);
 	}
 
 	if (fabs(yd) >= 1.0f) {
@@ -74,7 +118,13 @@ void CUI::ptrCB(GLFWwindow *win, double x, double y)
 void resizeCB(GLFWwindow* win, int width, int height)
 {
 	glViewport(0, 0, width, height);
-	CPerspective::GetInstance()->SetRatio((float)width / (float)height);
+	CUI::GetInstance()->Resize(width, height);
+	CUI::GetInstance()->Redraw();
+}
+
+void refreshCB(GLFWwindow* win)
+{
+	CUI::GetInstance()->Redraw();
 }
 
 void CUI::keyCB(GLFWwindow *win, int key, int scancode, int action, int mods)
@@ -87,6 +137,9 @@ void CUI::keyCB(GLFWwindow *win, int key, int scancode, int action, int mods)
 		CUI::GetInstance()->SetControlTarget(CPlayer::GetInstance());
 
 	if (action == GLFW_PRESS) {
+		// Toggles change the frame
+		CUI::GetInstance()->Redraw();
+
 		switch (key) {
 		case GLFW_KEY_1:
 			CUI::GetInstance()->SetControlTarget(CPlayer::GetInstance());
@@ -94,50 +147,60 @@ void CUI::keyCB(GLFWwindow *win, int key, int scancode, int action, int mods)
 			break;
 		case GLFW_KEY_2:
 			cout << "Camera" << endl;
-			CUI::GetInstance()->SetControlTarget(CView::GetInstance());
+			CUI::GetInstance()->SetControlTarget(CView::GetInstance(CUI::GetInstance()->m_view));
 			break;
 		case GLFW_KEY_3:
 			CUI::GetInstance()->SetControlTarget(CModel::GetInstance());
 			cout << "Model" << endl;
 			break;
-		case GLFW_KEY_UP: // Front : Move eye to up side
-			CUI::GetInstance()->ControlTarget()->Translate(CMovable::Direction::FRONT, 0.5f);
+		case GLFW_KEY_L:
+			CLod::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_DOWN: // Back
-			CUI::GetInstance()->ControlTarget()->Translate(CMovable::Direction::BACK, 0.5f);
+		case GLFW_KEY_C:
+			CCulling::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_LEFT: // Left
-			CUI::GetInstance()->ControlTarget()->Translate(CMovable::Direction::LEFT, 0.5f);
+		case GLFW_KEY_N:
+			// The camera of the next viewport of the split-screen
+			CUI::GetInstance()->m_view = (CUI::GetInstance()->m_view + 1) % CUI::GetInstance()->m_viewports;
+			CUI::GetInstance()->SetControlTarget(CView::GetInstance(CUI::GetInstance()->m_view));
+			cout << "Camera " << CUI::GetInstance()->m_view << endl;
 			break;
-		case GLFW_KEY_RIGHT: // Right
-			CUI::GetInstance()->ControlTarget()->Translate(CMovable::Direction::RIGHT, 0.5f);
+		case GLFW_KEY_M:
+			CMultiDraw::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_Q:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(1.0f, 0.0f, 0.0f), PI / 18.0f);
+		case GLFW_KEY_I:
+			CLights::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_A:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(1.0f, 0.0f, 0.0f), -PI / 18.0f);
+		case GLFW_KEY_TAB:
+			CMinimap::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_W:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(0.0f, 1.0f, 0.0f), PI / 18.0f);
+		case GLFW_KEY_F:
+			CFog::GetInstance()->Toggle();
 			break;
-		case GLFW_KEY_S:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(0.0f, 1.0f, 0.0f), -PI / 18.0f);
+		case GLFW_KEY_V:
+			CUI::GetInstance()->SetSwapInterval(CUI::GetInstance()->m_swapInterval ? 0 : 1);
+			cout << "Vsync " << (CUI::GetInstance()->m_swapInterval ? "on" : "off") << endl;
 			break;
+		// Held keys, see Input()
+		case GLFW_KEY_UP:
+		case GLFW_KEY_DOWN:
+		case GLFW_KEY_LEFT:
+		case GLFW_KEY_RIGHT:
+		case GLFW_KEY_Q:
+		case GLFW_KEY_A:
+		case GLFW_KEY_W:
+		case GLFW_KEY_S:
 		case GLFW_KEY_E:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(0.0f, 0.0f, 1.0f), PI / 18.0f);
-			break;
 		case GLFW_KEY_D:
-			CUI::GetInstance()->ControlTarget()->Rotate(vec3(0.0f, 0.0f, 1.0f), -PI / 18.0f);
-			break;
-		case GLFW_KEY_N:
-			break;
-		case GLFW_KEY_M:
 			break;
 		case GLFW_KEY_O:
 			break;
 		case GLFW_KEY_P:
 			break;
+		case GLFW_KEY_F12:
+			if (CProfiler::GetInstance()->WriteTrace() < 0)
+				cout << "No profile, see -profile" << endl;
+			break;
 		case GLFW_KEY_ESCAPE:
 			glfwSetWindowShouldClose(win, 1);
 			break;
@@ -159,20 +222,84 @@ void CUI::keyCB(GLFWwindow *win, int key, int scancode, int action, int mods)
 	}
 }
 
+/**
+ * \brief
+ * Hands the keys which are held down over to the simulation.
+ */
+void CUI::Input(void)
+{
+	static const struct {
+		int key;
+		unsigned int bit;
+	} keys[] = {
+		{ GLFW_KEY_UP, CSimulation::MOVE_FRONT },	// Front : Move eye to up side
+		{ GLFW_KEY_DOWN, CSimulation::MOVE_BACK },
+		{ GLFW_KEY_LEFT, CSimulation::MOVE_LEFT },
+		{ GLFW_KEY_RIGHT, CSimulation::MOVE_RIGHT },
+		{ GLFW_KEY_Q, CSimulation::TURN_X },
+		{ GLFW_KEY_A, CSimulation::TURN_X_BACK },
+		{ GLFW_KEY_W, CSimulation::TURN_Y },
+		{ GLFW_KEY_S, CSimulation::TURN_Y_BACK },
+		{ GLFW_KEY_E, CSimulation::TURN_Z },
+		{ GLFW_KEY_D, CSimulation::TURN_Z_BACK },
+	};
+	unsigned int held = 0;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (glfwGetKey(m_win, keys[i].key) == GLFW_PRESS)
+			held |= keys[i].bit;
+	}
+
+	CSimulation::GetInstance()->SetKeys(held);
+}
+
+/**
+ * \brief
+ * Waits until the frame which began at start has taken 1 / m_maxFps seconds.
+ */
+void CUI::Limit(double start)
+{
+	double end;
+	double wait;
+
+	if (m_maxFps <= 0.0)
+		return;
+
+	end = start + 1.0 / m_maxFps;
+	wait = end - glfwGetTime();
+
+	// The sleep of the OS may take longer than asked, the end of the wait is spun
+	if (wait > SLEEP_MARGIN)
+		this_thread::sleep_for(chrono::duration<double>(wait - SLEEP_MARGIN));
+
+	while (glfwGetTime() < end)
+		this_thread::yield();
+}
+
 CUI::CUI(void)
 	: m_win(NULL)
+	, m_display(NULL)
+	, m_context(NULL)
+	, m_fbo(0)
+	, m_width(0)
+	, m_height(0)
+	, m_headless(false)
 	, m_objectList(NULL)
+	, m_target(NULL)
+	, m_viewports(1)
+	, m_view(0)
+	, m_tick(1.0 / TICK_RATE)
+	, m_maxFps(0.0)
+	, m_swapInterval(1)
+	, m_onDemand(false)
+	, m_redraw(true)
+	, m_pending(0)
 {
-	int status;
-
-	status = glfwInit();
-	if (status == 0) {
-		cout << "glfwInit: " << status;
-		return;
-	}
+	m_rbo[0] = 0;
+	m_rbo[1] = 0;
 
 	glfwSetErrorCallback(errorCB);
-	cout << "glfw Version: " << atof(glfwGetVersionString()) << endl;
 }
 
 CUI::~CUI(void)
@@ -182,7 +309,11 @@ CUI::~CUI(void)
 
 void CUI::SetControlTarget(CMovable *target)
 {
+	CSimulation *sim = CSimulation::GetInstance();
+
 	m_target = target;
+	if (sim)
+		sim->SetTarget(target);
 }
 
 CMovable *CUI::ControlTarget(void)
@@ -210,48 +341,213 @@ void CUI::Destroy(void)
 	m_instance = NULL;
 }
 
+/**
+ * \brief
+ * glad and the version flags of CMisc for the context which is current.
+ */
+int CUI::LoadGL(GLADloadproc loader)
+{
+	GLint major;
+	GLint minor;
+
+	if (!gladLoadGLLoader(loader)) {
+		cerr << "Failed to load the GL functions" << endl;
+		return -EFAULT;
+	}
+	CMisc::SetLoader(loader);
+
+	// The errors of StatusPrint() from here on
+	CDebug::Load();
+
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	cout << "GL Version " << major << "." << minor << endl;
+
+	if (major > 3 || (major == 3 && minor >= 1))
+		CMisc::EnableVersion_3_1();
+
+	if (major > 3 || (major == 3 && minor >= 2))
+		CMisc::EnableVersion_3_2();
+
+	if (major > 4 || (major == 4 && minor >= 1))
+		CMisc::EnableVersion_4_1();
+
+	if (major > 4 || (major == 4 && minor >= 3))
+		CMisc::EnableVersion_4_3();
+
+	if (major > 4 || (major == 4 && minor >= 4))
+		CMisc::EnableVersion_4_4();
+
+	return 0;
+}
+
+/**
+ * \brief
+ * An EGL context without any surface, which Mesa (llvmpipe as well) creates
+ * with no display server on its surfaceless platform. The frames are drawn
+ * into a framebuffer object of the size, see CMisc::Framebuffer().
+ */
+int CUI::CreateHeadless(int w, int h)
+{
+#if !defined(USE_EGL)
+	cerr << "Headless mode needs EGL, see HEADLESS of the Makefile" << endl;
+	return -ENOSYS;
+#else
+	static const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context;
+	EGLConfig config;
+	EGLint count = 0;
+	const char *extensions;
+	GLenum status;
+
+	extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		cerr << "Failed to initialize EGL" << endl;
+		return -EFAULT;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)
+		|| !eglChooseConfig(display, configAttribs, &config, 1, &count) || count == 0) {
+		cerr << "No EGL config for OpenGL" << endl;
+		eglTerminate(display);
+		return -EFAULT;
+	}
+
+	// The version is up to the driver, as it is for the window
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+	if (context == EGL_NO_CONTEXT) {
+		cerr << "Failed to create an EGL context" << endl;
+		eglTerminate(display);
+		return -EFAULT;
+	}
+
+	// EGL_KHR_surfaceless_context
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		cerr << "Failed to make the EGL context current" << endl;
+		eglDestroyContext(display, context);
+		eglTerminate(display);
+		return -EFAULT;
+	}
+
+	m_display = display;
+	m_context = context;
+
+	if (LoadGL((GLADloadproc)eglGetProcAddress) < 0) {
+		DestroyContext();
+		return -EFAULT;
+	}
+
+	glGenRenderbuffers(2, m_rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_rbo[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+	// Same format as the depth copy of CCulling::BuildHiZ()
+	glBindRenderbuffer(GL_RENDERBUFFER, m_rbo[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_rbo[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_rbo[1]);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	StatusPrint();
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Headless framebuffer is not complete " << status << endl;
+		DestroyContext();
+		return -EFAULT;
+	}
+
+	CMisc::SetFramebuffer(m_fbo);
+	glViewport(0, 0, w, h);
+	Resize(w, h);
+
+	cout << "Headless " << w << "x" << h << " on " << glGetString(GL_RENDERER) << endl;
+	return 0;
+#endif
+}
+
 int CUI::CreateContext(int w, int h, const char *title)
 {
+	int status;
+
 	if (w == 0 || h == 0) {
 		w = 1024;
 		h = 768;
 	}
 
+	if (m_headless)
+		return CreateHeadless(w, h);
+
 	if (!title)
 		title = "Tile-base Texture Mapping";
 
+	status = glfwInit();
+	if (status == 0) {
+		cout << "glfwInit: " << status;
+		return -EFAULT;
+	}
+	cout << "glfw Version: " << atof(glfwGetVersionString()) << endl;
+
+#if !defined(NDEBUG)
+	// Drivers may leave the debug output of other contexts quiet
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
+
 	m_win = glfwCreateWindow(w, h, title, NULL, NULL);
 	if (!m_win)
 		return -EFAULT;
 
 	glfwSetWindowSizeCallback(m_win, resizeCB);
+	glfwSetWindowRefreshCallback(m_win, refreshCB);
 	glfwMakeContextCurrent(m_win);
 	glfwSetKeyCallback(m_win, keyCB);
 	glfwSetCursorPosCallback(m_win, ptrCB);
-	glfwSwapInterval(1);
+	SetSwapInterval(m_swapInterval);
 
 	/**
 	 * gladLoadGLLoader should be called after glfwMakeContextCurrent
 	 */
-	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
-
-	GLint major;
-	GLint minor;
-
-	glGetIntegerv(GL_MAJOR_VERSION, &major);
-	glGetIntegerv(GL_MINOR_VERSION, &minor);
-
-	if (major >= 3 && minor >= 1)
-		CMisc::EnableVersion_3_1();
-	else
-		cout << "GL Version " << major << "." << minor << endl;
+	if (LoadGL((GLADloadproc)glfwGetProcAddress) < 0)
+		return -EFAULT;
 
 	glViewport(0, 0, 1024, 768);
-	return 0;
+	return Resize(w, h);
 }
 
 int CUI::DestroyContext(void)
 {
+#if defined(USE_EGL)
+	if (m_display) {
+		if (m_fbo) {
+			glDeleteFramebuffers(1, &m_fbo);
+			glDeleteRenderbuffers(2, m_rbo);
+			m_fbo = 0;
+			CMisc::SetFramebuffer(0);
+		}
+
+		eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(m_display, m_context);
+		eglTerminate(m_display);
+		m_display = NULL;
+		m_context = NULL;
+		return 0;
+	}
+#endif
+
 	if (m_win == NULL)
 		return -EFAULT;
 
@@ -259,34 +555,529 @@ int CUI::DestroyContext(void)
 	return 0;
 }
 
-int CUI::Run(void)
+/**
+ * \brief
+ * Draws the frame of the camera and the models which CFrame::Update() has set.
+ * query (optional) counts the primitives which the objects draw.
+ * Returns 1 if something is still to come, e.g. the levels of the wall images.
+ */
+int CUI::Frame(GLuint query)
 {
+	CRenderQueue *queue = CRenderQueue::GetInstance();
+	CProfiler *profiler = CProfiler::GetInstance();
+	GLfloat rects[VIEWPORT_MAX][4];
+	const GLint *rect;
 	CObject *obj;
+	int pending = 0;
+	int zone;
+	int i;
+	int j;
 
-	if (m_win == NULL)
+	profiler->BeginFrame();
+
+	// Cells which the eye sees first, their impostors are captured again below
+	zone = profiler->Begin("Fog");
+	CFog::GetInstance()->Update();
+	profiler->End(zone);
+
+	// Culling uses the levels of the chunks and its own program, so they go first
+	zone = profiler->Begin("Lod");
+	if (CLod::GetInstance()->Update() > 0)
+		pending = 1;
+	profiler->End(zone);
+
+	// Maps of the lights which came near, the lights below point at them
+	zone = profiler->Begin("Shadows");
+	if (CShadows::GetInstance()->Update() > 0)
+		pending = 1;
+	profiler->End(zone);
+
+	// Levels of the wall images which are decoded by now
+	zone = profiler->Begin("Texture");
+	if (CTexture::GetInstance()->Update() > 0)
+		pending = 1;
+	profiler->End(zone);
+
+	zone = profiler->Begin("Cull");
+	CCulling::GetInstance()->Cull();
+	profiler->End(zone);
+
+	// For the camera of CFrame::Update(), which the draws below use
+	zone = profiler->Begin("Lights");
+	CLights::GetInstance()->Update();
+	profiler->End(zone);
+
+	CShader::GetInstance()->UseProgram();
+
+	// The split-screen draws every viewport by the same draws, see maze.geom
+	if (m_viewports > 1) {
+		for (i = 0; i < m_viewports; i++) {
+			rect = CFrame::GetInstance()->Viewport(i);
+			for (j = 0; j < 4; j++)
+				rects[i][j] = (GLfloat)rect[j];
+		}
+		glViewportArrayv(0, m_viewports, (const GLfloat *)rects);
+	}
+
+	zone = profiler->Begin("Clear");
+	glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	profiler->End(zone);
+
+	if (query)
+		glBeginQuery(GL_PRIMITIVES_GENERATED, query);
+
+	// Objects only submit packets, the queue picks the order and the state
+	zone = profiler->Begin("Submit", false);
+	queue->Begin();
+	for (obj = m_objectList; obj; obj = obj->Next())
+		obj->Submit(queue);
+	profiler->End(zone);
+
+	zone = profiler->Begin("Queue");
+	queue->Execute();
+	profiler->End(zone);
+
+	if (query)
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+
+	// The passes below are of the whole window
+	if (m_viewports > 1)
+		glViewport(0, 0, m_width, m_height);
+
+	// Depth of this frame is used for the occlusion test of the next frame
+	zone = profiler->Begin("HiZ");
+	CCulling::GetInstance()->BuildHiZ();
+	profiler->End(zone);
+
+	// Over the frame, after the depth of the occlusion test is taken
+	zone = profiler->Begin("Minimap");
+	CMinimap::GetInstance()->Update();
+	CMinimap::GetInstance()->Draw();
+	profiler->End(zone);
+
+	profiler->EndFrame();
+	return pending;
+}
+
+/**
+ * \brief
+ * The simulation runs at a fixed tick on its own thread, the frames are drawn
+ * as fast as the vsync and the frame limit let them, between the last two ticks.
+ * The simulation thread is stopped and destroyed on the way out.
+ */
+int CUI::Run(void)
+{
+	CRenderQueue *queue = CRenderQueue::GetInstance();
+	CFrame *frame = CFrame::GetInstance();
+	CSimulation *sim = CSimulation::GetInstance();
+	CFrame::Snapshot previous;
+	CFrame::Snapshot current;
+	double start;
+	double alpha;
+	double reported;
+	int frames = 0;
+
+	if (m_win == NULL || queue == NULL || frame == NULL || sim == NULL)
 		return -EFAULT;
 
+	if (!ControlTarget())
+		SetControlTarget(CPlayer::GetInstance());
+
+	if (sim->Start(m_tick) < 0) {
+		sim->Destroy();
+		return -EFAULT;
+	}
+
+	reported = glfwGetTime();
+
 	while (glfwWindowShouldClose(m_win) == 0) {
-		CShader::GetInstance()->UseProgram();
+		start = glfwGetTime();
+
+		glfwPollEvents();
+		Input();
 
-		glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// Between the last two ticks, a late tick holds the latest one
+		sim->Read(&previous, &current);
+		alpha = (start - current.time) / m_tick;
+		if (alpha < 0.0)
+			alpha = 0.0;
+		else if (alpha > 1.0)
+			alpha = 1.0;
+
+		if (m_redraw || frame->Changed(previous, current)) {
+			m_pending = SETTLE_FRAMES;
+			m_redraw = false;
+		}
 
-		obj = m_objectList;
-		CVertices::GetInstance()->BindVAO();
-		CVertices::GetInstance()->BindEBO();
-		while (obj) {
-			obj->Render();
-			obj = obj->Next();
+		// The simulation posts an event with a changed snapshot
+		if (m_onDemand && m_pending == 0) {
+			glfwWaitEvents();
+			reported = glfwGetTime();
+			frames = 0;
+			continue;
 		}
-		CVertices::GetInstance()->UnbindEBO();
-		CVertices::GetInstance()->UnbindVAO();
 
-		//glfwPollEvents();
-		glfwWaitEvents();
+		// Not on demand the frames keep coming, the count stays at 0
+		if (m_pending > 0)
+			m_pending--;
+
+		// Camera and models of this frame, the only place where they are read
+		frame->Update(previous, current, (float)alpha);
+
+		if (Frame(0) > 0)
+			Redraw();
+
 		glfwSwapBuffers(m_win);
+		Limit(start);
+
+		frames++;
+		if (start - reported >= REPORT_INTERVAL) {
+			cout << "Frame time " << (start - reported) * 1000.0 / frames << " ms" << endl;
+			reported = start;
+			frames = 0;
+		}
+	}
+
+	sim->Stop();
+	sim->Destroy();
+	return 0;
+}
+
+static int CompareSamples(const void *a, const void *b)
+{
+	double ma = ((const BenchSample *)a)->ms;
+	double mb = ((const BenchSample *)b)->ms;
+
+	return ma < mb ? -1 : (ma > mb ? 1 : 0);
+}
+
+// A quoted JSON string, the driver strings may hold quotes and backslashes
+static void WriteString(ostream &out, const GLubyte *s)
+{
+	const char *c = s ? (const char *)s : "";
+	char hex[8];
+
+	out << '"';
+	for (; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			out << '\\' << *c;
+		else if ((unsigned char)*c < 0x20) {
+			snprintf(hex, sizeof(hex), "\\u%04x", (unsigned char)*c);
+			out << hex;
+		} else
+			out << *c;
+	}
+	out << '"';
+}
+
+// Nearest rank of the sorted samples
+static double Percentile(const BenchSample *samples, int count, double p)
+{
+	int rank = (int)ceil(p / 100.0 * count) - 1;
+
+	if (rank < 0)
+		rank = 0;
+	if (rank >= count)
+		rank = count - 1;
+
+	return samples[rank].ms;
+}
+
+/**
+ * \brief
+ * Point t (0 to 1) of the camera path, a loop over the maze which dives between
+ * the walls and climbs above them twice per lap, looking ahead and toward the middle.
+ * The path is in the model space, half the instance space of CMaze::CellOffset().
+ */
+static void BenchPath(double t, vec3 *eye, vec3 *at)
+{
+	CMaze *maze = CMaze::GetInstance();
+	float rx = (float)(maze->Width() * BLOCK_WIDTH * 0.5 * BENCH_ORBIT);
+	float rz = (float)(maze->Height() * BLOCK_WIDTH * 0.5 * BENCH_ORBIT);
+	float a = (float)(2.0 * PI * t);
+	float ahead = a + 0.5f;
+	float height;
+
+	height = BENCH_HEIGHT_MIN + (BENCH_HEIGHT_MAX - BENCH_HEIGHT_MIN) * (0.5f - 0.5f * cosf(2.0f * a));
+	*eye = vec3(rx * cosf(a), height * BLOCK_WIDTH, rz * sinf(a));
+	*at = vec3(0.5f * rx * cosf(ahead), 0.0f, 0.5f * rz * sinf(ahead));
+}
+
+// The camera of point t for the next frame, the viewports of the split-screen are spread over the path
+static void BenchCamera(double t)
+{
+	CFrame::Snapshot snapshot;
+	vec3 eye;
+	vec3 at;
+	int count = CFrame::GetInstance()->Viewports();
+	int i;
+
+	for (i = 0; i < count; i++) {
+		BenchPath(t + (double)i / count, &eye, &at);
+		CView::GetInstance(i)->Place(eye, at);
+	}
+	CFrame::GetInstance()->Capture(&snapshot);
+	snapshot.time = 0.0;
+	CFrame::GetInstance()->Update(snapshot, snapshot, 1.0f);
+}
+
+/**
+ * \brief
+ * Flies the camera along BenchPath() for the frames and reports the frame
+ * times, the draw calls and the primitives of the objects as JSON, to the
+ * report file or to the standard output.
+ * The simulation does not run, every frame is the camera of its point of the
+ * path, and glFinish() makes the time of a frame cover its GPU work.
+ * The frames before the first measured one compile the shaders and stream
+ * the wall images in, as the first frames of a session do.
+ */
+int CUI::Benchmark(int frames, const char *report)
+{
+	CFrame *frame = CFrame::GetInstance();
+	CMaze *maze = CMaze::GetInstance();
+	chrono::steady_clock::time_point start;
+	BenchSample *samples;
+	ofstream file;
+	ostream *out = &cout;
+	GLuint query;
+	double sum = 0.0;
+	double draws = 0.0;
+	double primitives = 0.0;
+	unsigned int maxDraws = 0;
+	GLuint maxPrimitives = 0;
+	int pending;
+	int i;
+
+	if (frames <= 0)
+		return -EINVAL;
+
+	if ((!m_win && !m_fbo) || !frame || !maze)
+		return -EFAULT;
+
+	try {
+		samples = new BenchSample[frames];
+	} catch (...) {
+		return -ENOMEM;
+	}
+
+	if (report) {
+		file.open(report, ios::trunc);
+		if (!file.is_open()) {
+			cerr << "Failed to open " << report << endl;
+			delete[] samples;
+			return -EINVAL;
+		}
+		out = &file;
+	}
+
+	glGenQueries(1, &query);
+
+	// At the start of the path until nothing is pending
+	for (i = 0; i < BENCH_WARMUP_MAX; i++) {
+		BenchCamera(0.0);
+		pending = Frame(0);
+		if (m_win)
+			glfwSwapBuffers(m_win);
+		glFinish();
+
+		if (pending == 0 && i >= BENCH_WARMUP)
+			break;
+	}
+
+	for (i = 0; i < frames; i++) {
+		start = chrono::steady_clock::now();
+		BenchCamera((double)i / frames);
+		CMisc::ResetDrawCalls();
+
+		Frame(query);
+		if (m_win)
+			glfwSwapBuffers(m_win);
+		glFinish();
+
+		samples[i].ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		samples[i].draws = CMisc::DrawCalls();
+		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples[i].primitives);
+	}
+
+	glDeleteQueries(1, &query);
+	StatusPrint();
+
+	for (i = 0; i < frames; i++) {
+		sum += samples[i].ms;
+		draws += samples[i].draws;
+		primitives += samples[i].primitives;
+		maxDraws = max(maxDraws, samples[i].draws);
+		maxPrimitives = max(maxPrimitives, samples[i].primitives);
+	}
+
+	qsort(samples, frames, sizeof(*samples), CompareSamples);
+
+	*out << "{" << endl << "\t\"renderer\": ";
+	WriteString(*out, glGetString(GL_RENDERER));
+	*out << "," << endl << "\t\"version\": ";
+	WriteString(*out, glGetString(GL_VERSION));
+	*out << "," << endl
+		<< "\t\"headless\": " << (m_fbo ? "true" : "false") << "," << endl
+		<< "\t\"width\": " << m_width << "," << endl
+		<< "\t\"height\": " << m_height << "," << endl
+		<< "\t\"viewports\": " << m_viewports << "," << endl
+		<< "\t\"maze\": [" << maze->Width() << ", " << maze->Height() << "]," << endl
+		<< "\t\"walls\": " << maze->WallCount() << "," << endl
+		<< "\t\"frames\": " << frames << "," << endl
+		<< "\t\"frame_ms\": {"
+		<< "\"mean\": " << sum / frames
+		<< ", \"min\": " << samples[0].ms
+		<< ", \"p50\": " << Percentile(samples, frames, 50.0)
+		<< ", \"p90\": " << Percentile(samples, frames, 90.0)
+		<< ", \"p95\": " << Percentile(samples, frames, 95.0)
+		<< ", \"p99\": " << Percentile(samples, frames, 99.0)
+		<< ", \"max\": " << samples[frames - 1].ms << "}," << endl
+		<< "\t\"fps\": " << (sum > 0.0 ? 1000.0 * frames / sum : 0.0) << "," << endl
+		<< "\t\"draw_calls\": {\"mean\": " << draws / frames << ", \"max\": " << maxDraws << "}," << endl
+		<< "\t\"primitives\": {\"mean\": " << primitives / frames << ", \"max\": " << maxPrimitives << "}" << endl
+		<< "}" << endl;
+
+	delete[] samples;
+	return 0;
+}
+
+/**
+ * \brief
+ * Splits the window into viewports of the same size, a CView and a CPerspective
+ * each: 2 side by side, 3 and 4 in two rows. The first one is at the top left.
+ * Should be called after the context is created and before the shader is loaded,
+ * more than one needs GL 4.1. N moves the camera of the next viewport.
+ */
+int CUI::SetViewports(int count)
+{
+	int status;
+	int i;
+
+	if (count < 1 || count > VIEWPORT_MAX)
+		return -EINVAL;
+
+	status = CShader::GetInstance()->SetViewports(count);
+	if (status < 0) {
+		cerr << "Split-screen needs GL 4.1" << endl;
+		return status;
+	}
+
+	// The cameras start at the same place, each looks another way
+	for (i = m_viewports; i < count; i++) {
+		if (!CView::GetInstance(i) || !CPerspective::GetInstance(i))
+			return -ENOMEM;
+		CView::GetInstance(i)->Rotate(vec3(0.0f, 1.0f, 0.0f), 2.0f * PI * i / count);
+	}
+
+	m_viewports = count;
+	return Resize(m_width, m_height);
+}
+
+/**
+ * \brief
+ * Lays the viewports out over the window of the size, see SetViewports().
+ */
+int CUI::Resize(int w, int h)
+{
+	GLint rects[VIEWPORT_MAX][4];
+	int columns = m_viewports > 1 ? 2 : 1;
+	int rows = m_viewports > 2 ? 2 : 1;
+	int i;
+
+	if (w <= 0 || h <= 0)
+		return -EINVAL;
+
+	m_width = w;
+	m_height = h;
+
+	// The window has its origin at the bottom left
+	for (i = 0; i < m_viewports; i++) {
+		rects[i][2] = w / columns;
+		rects[i][3] = h / rows;
+		rects[i][0] = i % columns * rects[i][2];
+		rects[i][1] = (rows - 1 - i / columns) * rects[i][3];
+		CPerspective::GetInstance(i)->SetRatio((float)rects[i][2] / (float)rects[i][3]);
+	}
+
+	return CFrame::GetInstance()->SetViewports(m_viewports, rects);
+}
+
+/**
+ * \brief
+ * An offscreen context instead of the window, see CreateHeadless().
+ * Should be set before the context is created.
+ */
+int CUI::SetHeadless(bool headless)
+{
+	if (m_win || m_display)
+		return -EBUSY;
+
+	m_headless = headless;
+	return 0;
+}
+
+int CUI::SetTickRate(double hz)
+{
+	if (!(hz > 0.0))
+		return -EINVAL;
+
+	m_tick = 1.0 / hz;
+	return 0;
+}
+
+/**
+ * \brief
+ * maxFps 0.0 leaves the pace to the vsync.
+ */
+int CUI::SetFrameLimit(double maxFps)
+{
+	if (maxFps < 0.0)
+		return -EINVAL;
+
+	m_maxFps = maxFps;
+	return 0;
+}
+
+/**
+ * \brief
+ * Redraws only when the camera, a model, the window or a toggle has changed,
+ * the thread sleeps in glfwWaitEvents() in between.
+ */
+int CUI::SetOnDemand(bool onDemand)
+{
+	m_onDemand = onDemand;
+	m_redraw = true;
+	return 0;
+}
+
+void CUI::Redraw(void)
+{
+	m_redraw = true;
+}
+
+/**
+ * \brief
+ * interval -1 is the adaptive vsync, a late frame tears instead of waiting
+ * for the next refresh. It falls back to 1 if the driver does not have it.
+ * Applied when the context is created if there is no window yet.
+ */
+int CUI::SetSwapInterval(int interval)
+{
+	if (interval < -1)
+		return -EINVAL;
+
+	m_swapInterval = interval;
+	if (!m_win)
+		return 0;
+
+	if (interval < 0 && !glfwExtensionSupported("WGL_EXT_swap_control_tear")
+		&& !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+		cerr << "Adaptive vsync is not available" << endl;
+		interval = 1;
 	}
 
+	glfwSwapInterval(interval);
 	return 0;
 }
 
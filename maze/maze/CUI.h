@@ -16,8 +16,31 @@ private:
 	static void ptrCB(GLFWwindow *win, double x, double y);
 
 	GLFWwindow *m_win;
+	void *m_display;	// EGLDisplay of the headless context
+	void *m_context;	// EGLContext
+	GLuint m_fbo;	// Headless, the frames are drawn here
+	GLuint m_rbo[2];	// Color, depth
+	int m_width;
+	int m_height;
+	bool m_headless;
 	CObject *m_objectList;
 	CMovable *m_target;
+	int m_viewports;	// Of the split-screen, see SetViewports()
+	int m_view;	// Viewport whose CView the keys move
+
+	double m_tick;	// Seconds of a simulation tick
+	double m_maxFps;	// 0.0: no limit
+	int m_swapInterval;	// -1: adaptive vsync, 0: off, 1: on
+
+	bool m_onDemand;	// Draws only when something has changed
+	bool m_redraw;
+	int m_pending;	// Frames to draw after the last change
+
+	void Input(void);
+	void Limit(double start);
+	int LoadGL(GLADloadproc loader);
+	int CreateHeadless(int w, int h);
+	int Frame(GLuint query);
 
 	CUI(void);
 	virtual ~CUI(void);
@@ -30,6 +53,16 @@ public:
 	int CreateContext(int w = 0, int h = 0, const char *title = NULL);
 	int DestroyContext(void);
 	int Run(void);
+	int Benchmark(int frames, const char *report);
+
+	int SetTickRate(double hz);
+	int SetFrameLimit(double maxFps);
+	int SetSwapInterval(int interval);
+	int SetOnDemand(bool onDemand);
+	int SetHeadless(bool headless);
+	int SetViewports(int count);
+	int Resize(int w, int h);
+	void Redraw(void);
 
 	void SetControlTarget(CMovable *target);
 	CMovable *ControlTarget(void);
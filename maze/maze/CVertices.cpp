@@ -1,84 +1,97 @@
 #include <iostream>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
 
 #include "cgmath.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
 #include "CShader.h"
 #include "CVertices.h"
 
 using namespace std;
 
-const CVertices::VertexInfo CVertices::m_vertices[] = {
-	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f) },
-	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f) }, // 0
-
-	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f) }, // 1
-
-	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f) },
-	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f) }, // 2
-
-	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f) }, 
-	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f) }, // 3
-
-	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f) }, // 4
-
-	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f) }, // 5
-
-	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f) }, // 6
-
-	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f) }, // 7 
-	
-	// 16
-	{ vec3(-1000.0f, 0.0f, 0.0f), vec4(0.0f, 1.0f, 0.0f, 1.0f) },
-	{ vec3(1000.0f, 0.0f, 0.0f), vec4(0.0f, 1.0f, 0.0f, 1.0f) }, // X axis
-	{ vec3(0.0f, -1000.0f, 0.0f), vec4(0.0f, 0.0f, 1.0f, 1.0f) },
-	{ vec3(0.0f, 1000.0f, 0.0f), vec4(0.0f, 0.0f, 1.0f, 1.0f) }, // Y axis
-	{ vec3(0.0f, 0.0f, -1000.0f), vec4(0.0f, 1.0f, 1.0f, 1.0f) },
-	{ vec3(0.0f, 0.0f, 1000.0f), vec4(0.0f, 1.0f, 1.0f, 1.0f) }, // Z axis
-	{ vec3(1000.0f, -BLOCK_WIDTH, -1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f) },
-	{ vec3(1000.0f, -BLOCK_WIDTH, 1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f) },
-	{ vec3(-1000.0f, -BLOCK_WIDTH, 1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f) },
-	{ vec3(-1000.0f, -BLOCK_WIDTH, -1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f) }, // Land
+const CVertices::VertexInfo CVertices::m_cubeVertices[] = {
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f) },
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f) },
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f) }, // Front
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(1.0f, 0.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(1.0f, 0.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(1.0f, 0.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(1.0f, 0.0f, 0.0f) }, // Right
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(-1.0f, 0.0f, 0.0f) },
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(-1.0f, 0.0f, 0.0f) },
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(-1.0f, 0.0f, 0.0f) },
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(-1.0f, 0.0f, 0.0f) }, // Left
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f) },
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f) },
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f) }, // Back
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(-BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH,  BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f) }, // Up
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f) },
+	{ vec3(-BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH, -BLOCK_WIDTH), vec4(1.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f) },
+	{ vec3(BLOCK_WIDTH, -BLOCK_WIDTH,  BLOCK_WIDTH), vec4(1.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f) }, // Down
 };
 
-// 0, 1, 2 == 0 +++
-// 3, 4, 5 == 1 -++
-// 6, 7    == 2 --+
-// 8, 9    == 3 +-+
-// 10, 11  == 4 +--
-// 12      == 5 ++-
-// 13      == 6 -+-
-// 14, 15  == 7 ---
-const GLuint CVertices::m_indices[] = {
-	2, 3, 6, //               0, 1, 2
-	6, 9, 2, // Front         2, 3, 0
-	0, 8, 11, //              0, 3, 4
-	11, 12, 0, // Right       4, 5, 0
-	15, 7, 4, //              7, 2, 1
-	4, 13, 15, // Left        1, 6, 7
-	15, 13, 12, //            7, 6, 5
-	12, 11, 15, // Back       5, 4, 7
-	13, 5, 1, //              6, 1, 0
-	1, 12, 13, // Up          0, 5, 6
-	6, 14, 10, //             2, 7, 4
-	10, 9, 6, // Down         4, 3, 2
-	0xFFFFFFFF, // Cube (36, 0 - 35)
-	16, 17,  0xFFFFFFFF, // (2, 37 - 38) X axis
-	18, 19,  0xFFFFFFFF, // (2, 40 - 41) Y axis
-	20, 21, 0xFFFFFFFF, // (2, 43 - 44) Z axis
-	22, 25, 23, 24, 0xFFFFFFFF // (4, 46 - 49) Land
+const CVertices::VertexInfo CVertices::m_axesVertices[] = {
+	{ vec3(-1000.0f, 0.0f, 0.0f), vec4(0.0f, 1.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) },
+	{ vec3(1000.0f, 0.0f, 0.0f), vec4(0.0f, 1.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) }, // X axis
+	{ vec3(0.0f, -1000.0f, 0.0f), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) },
+	{ vec3(0.0f, 1000.0f, 0.0f), vec4(0.0f, 0.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) }, // Y axis
+	{ vec3(0.0f, 0.0f, -1000.0f), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) },
+	{ vec3(0.0f, 0.0f, 1000.0f), vec4(0.0f, 1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f) }, // Z axis
+};
+
+const CVertices::VertexInfo CVertices::m_landVertices[] = {
+	{ vec3(1000.0f, -BLOCK_WIDTH, -1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(1000.0f, -BLOCK_WIDTH, 1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(-1000.0f, -BLOCK_WIDTH, 1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f), vec3(0.0f, 1.0f, 0.0f) },
+	{ vec3(-1000.0f, -BLOCK_WIDTH, -1000.0f), vec4(0.9f, 0.8f, 0.7f, 1.0f), vec3(0.0f, 1.0f, 0.0f) }, // Land
+};
+
+// Four vertices per face, so every face has its own normal and UV
+const GLuint CVertices::m_cubeIndices[] = {
+	0, 1, 2,
+	2, 3, 0, // Front
+	4, 5, 6,
+	6, 7, 4, // Right
+	8, 9, 10,
+	10, 11, 8, // Left
+	12, 13, 14,
+	14, 15, 12, // Back
+	16, 17, 18,
+	18, 19, 16, // Up
+	20, 21, 22,
+	22, 23, 20, // Down
+};
+
+const GLuint CVertices::m_axesIndices[] = {
+	0, 1, // X axis
+	2, 3, // Y axis
+	4, 5, // Z axis
+};
+
+// Triangles of the former strip 0, 3, 1, 2, so every mesh but the axes is GL_TRIANGLES
+const GLuint CVertices::m_landIndices[] = {
+	0, 3, 1,
+	1, 3, 2,
 };
 
 CVertices *CVertices::m_instance = NULL;
 
 CVertices::CVertices(void)
+: m_vertexData(NULL)
+, m_indexData(NULL)
+, m_vertexCount(0)
+, m_indexCount(0)
 {
 	if (__OLD_GL) {
 		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
@@ -90,10 +103,21 @@ CVertices::CVertices(void)
 
 	glGenVertexArrays(1, &m_VAO);
 	glGenBuffers(MAX, m_VBO);
+
+	memset(m_meshes, 0, sizeof(m_meshes));
+
+	Register(CUBE, GL_TRIANGLES, m_cubeVertices, sizeof(m_cubeVertices) / sizeof(*m_cubeVertices),
+		m_cubeIndices, sizeof(m_cubeIndices) / sizeof(*m_cubeIndices));
+	Register(AXES, GL_LINES, m_axesVertices, sizeof(m_axesVertices) / sizeof(*m_axesVertices),
+		m_axesIndices, sizeof(m_axesIndices) / sizeof(*m_axesIndices));
+	Register(LAND, GL_TRIANGLES, m_landVertices, sizeof(m_landVertices) / sizeof(*m_landVertices),
+		m_landIndices, sizeof(m_landIndices) / sizeof(*m_landIndices));
 }
 
 CVertices::~CVertices(void)
 {
+	delete[] m_vertexData;
+	delete[] m_indexData;
 	glDeleteBuffers(1, &m_VAO);
 	glDeleteBuffers(MAX, m_VBO);
 }
@@ -131,6 +155,11 @@ int CVertices::UnbindEBO(void)
 	return 0;
 }
 
+GLuint CVertices::VAO(void)
+{
+	return m_VAO;
+}
+
 int CVertices::BindVAO(void)
 {
 	glBindVertexArray(m_VAO);
@@ -145,6 +174,111 @@ int CVertices::UnbindVAO(void)
 	return 0;
 }
 
+/**
+ * \brief
+ * Appends a mesh to the shared vertex and index buffers.
+ * Indices are local to the mesh, they are rebased while packing,
+ * so a mesh is drawn by its index range only (no base vertex, GL 3.1 is fine).
+ * Meshes registered after Load() are uploaded by the next Load().
+ */
+int CVertices::Register(Mesh mesh, GLenum mode, const VertexInfo *vertices, int vertexCount, const GLuint *indices, int indexCount)
+{
+	VertexInfo *vertexData;
+	GLuint *indexData;
+	int i;
+
+	if (mesh < 0 || mesh >= MESH_MAX || !vertices || !indices || vertexCount <= 0 || indexCount <= 0)
+		return -EINVAL;
+
+	if (m_meshes[mesh].count) {
+		cerr << "Mesh " << mesh << " is already registered" << endl;
+		return -EINVAL;
+	}
+
+	try {
+		vertexData = new VertexInfo[m_vertexCount + vertexCount];
+		indexData = new GLuint[m_indexCount + indexCount];
+	} catch (...) {
+		cerr << "Failed to allocate the mesh data" << endl;
+		return -EFAULT;
+	}
+
+	for (i = 0; i < m_vertexCount; i++)
+		vertexData[i] = m_vertexData[i];
+	for (i = 0; i < vertexCount; i++)
+		vertexData[m_vertexCount + i] = vertices[i];
+
+	if (m_indexCount)
+		memcpy(indexData, m_indexData, sizeof(*indexData) * m_indexCount);
+	for (i = 0; i < indexCount; i++)
+		indexData[m_indexCount + i] = indices[i] + m_vertexCount;
+
+	delete[] m_vertexData;
+	delete[] m_indexData;
+	m_vertexData = vertexData;
+	m_indexData = indexData;
+
+	m_meshes[mesh].mode = mode;
+	m_meshes[mesh].count = indexCount;
+	m_meshes[mesh].firstIndex = m_indexCount;
+	m_meshes[mesh].firstVertex = m_vertexCount;
+	m_meshes[mesh].vertexCount = vertexCount;
+
+	m_vertexCount += vertexCount;
+	m_indexCount += indexCount;
+	return 0;
+}
+
+const CVertices::MeshInfo *CVertices::GetMesh(Mesh mesh)
+{
+	if (mesh < 0 || mesh >= MESH_MAX)
+		return NULL;
+
+	return &m_meshes[mesh];
+}
+
+/**
+ * \brief
+ * The VAO and EBO should be bound.
+ */
+int CVertices::Draw(Mesh mesh, GLsizei instanceCount)
+{
+	const MeshInfo *info = GetMesh(mesh);
+
+	if (!info || !info->count)
+		return -EINVAL;
+
+	if (instanceCount == 1) {
+		glDrawElements(info->mode, info->count, GL_UNSIGNED_INT, (void *)(sizeof(GLuint) * info->firstIndex));
+	} else {
+		glDrawElementsInstanced(info->mode, info->count, GL_UNSIGNED_INT,
+			(void *)(sizeof(GLuint) * info->firstIndex), instanceCount);
+	}
+	CMisc::CountDraw();
+	StatusPrint();
+
+	return 0;
+}
+
+/**
+ * \brief
+ * Fills the indirect draw command of a mesh.
+ */
+int CVertices::Command(Mesh mesh, GLuint instanceCount, GLuint baseInstance, DrawCommand *command)
+{
+	const MeshInfo *info = GetMesh(mesh);
+
+	if (!info || !info->count || !command)
+		return -EINVAL;
+
+	command->count = info->count;
+	command->instanceCount = instanceCount;
+	command->firstIndex = info->firstIndex;
+	command->baseVertex = 0;
+	command->baseInstance = baseInstance;
+	return 0;
+}
+
 int CVertices::Load(void)
 {
 	BindVAO();
@@ -157,7 +291,7 @@ int CVertices::Load(void)
 int CVertices::UpdateIndices(void)
 {
 	BindEBO();
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(m_indices), m_indices, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*m_indexData) * m_indexCount, m_indexData, GL_STATIC_DRAW);
 	UnbindEBO();
 	return 0;
 }
@@ -167,6 +301,7 @@ int CVertices::UpdateVertices(void)
 	GLint vertexId;
 	GLint texCoordId;
 	GLint colorId;
+	GLint normalId;
 
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO[VERTEX]);
 	/**
@@ -177,33 +312,43 @@ int CVertices::UpdateVertices(void)
 	* But very rarely, the information will be updated.
 	* So we do not use the dynamic_draw from here.
 	*/
-	glBufferData(GL_ARRAY_BUFFER, sizeof(m_vertices), m_vertices, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(*m_vertexData) * m_vertexCount, m_vertexData, GL_STATIC_DRAW);
 
-	vertexId = glGetAttribLocation(CShader::GetInstance()->Program(), "position");
+	vertexId = CShader::GetInstance()->AttribLocation("position");
 	cout << "position index: " << vertexId << endl;
 	if (vertexId >= 0) {
 		glEnableVertexAttribArray(vertexId);
 		glVertexAttribPointer(vertexId, 3, GL_FLOAT, GL_FALSE,
-			sizeof(*m_vertices),
+			sizeof(*m_vertexData),
 			(void *)0);
 	}
 
-	texCoordId = glGetAttribLocation(CShader::GetInstance()->Program(), "texCoord");
+	texCoordId = CShader::GetInstance()->AttribLocation("texCoord");
 	cout << "texCoord index: " << texCoordId << endl;
 	if (texCoordId >= 0) {
 		glEnableVertexAttribArray(texCoordId);
 		glVertexAttribPointer(texCoordId, 2, GL_FLOAT, GL_TRUE,
-			sizeof(*m_vertices),
-			(void *)sizeof(m_vertices->vertex));
+			sizeof(*m_vertexData),
+			(void *)sizeof(m_vertexData->vertex));
 	}
 
-	colorId = glGetAttribLocation(CShader::GetInstance()->Program(), "color");
+	colorId = CShader::GetInstance()->AttribLocation("color");
 	cout << "color index: " << colorId << endl;
 	if (colorId >= 0) {
 		glEnableVertexAttribArray(colorId);
 		glVertexAttribPointer(colorId, 4, GL_FLOAT, GL_FALSE,
-			sizeof(*m_vertices),
-			(void *)sizeof(m_vertices->vertex));
+			sizeof(*m_vertexData),
+			(void *)sizeof(m_vertexData->vertex));
+	}
+
+	// Lines have none, they are not lit
+	normalId = CShader::GetInstance()->AttribLocation("normal");
+	cout << "normal index: " << normalId << endl;
+	if (normalId >= 0) {
+		glEnableVertexAttribArray(normalId);
+		glVertexAttribPointer(normalId, 3, GL_FLOAT, GL_FALSE,
+			sizeof(*m_vertexData),
+			(void *)offsetof(VertexInfo, normal));
 	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
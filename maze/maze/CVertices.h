@@ -4,7 +4,43 @@
 
 #define BLOCK_WIDTH 4.0f
 
+/**
+ * \brief
+ * Registry of the meshes, every mesh is packed into one shared vertex buffer
+ * and one shared index buffer, and is addressed by its recorded index range.
+ */
 class CVertices {
+public:
+	enum Mesh {
+		CUBE = 0x00,	// Blocks and the player
+		AXES = 0x01,	// GL_LINES
+		LAND = 0x02,
+		MESH_MAX = 0x03
+	};
+
+	struct VertexInfo {
+		vec3 vertex;
+		vec4 color;	// Color(Four elements) and UV (Two elements)
+		vec3 normal;	// Of the face, for the lights of CLights
+	};
+
+	struct MeshInfo {
+		GLenum mode;
+		GLsizei count;
+		GLuint firstIndex;
+		GLint firstVertex;
+		GLsizei vertexCount;
+	};
+
+	// Layout is defined by glDrawElementsIndirect
+	struct DrawCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
 private:
 	enum VBO {
 		VERTEX = 0x00,
@@ -15,11 +51,18 @@ private:
 	GLuint m_VAO; // Array Object
 	GLuint m_VBO[MAX]; // Buffer Object
 
-	static const struct VertexInfo {
-		vec3 vertex;
-		vec4 color;	// Color(Four elements) and UV (Two elements)
-	} m_vertices[26];
-	static const GLuint m_indices[51];
+	VertexInfo *m_vertexData;
+	GLuint *m_indexData;
+	int m_vertexCount;
+	int m_indexCount;
+	MeshInfo m_meshes[MESH_MAX];
+
+	static const VertexInfo m_cubeVertices[24];
+	static const VertexInfo m_axesVertices[6];
+	static const VertexInfo m_landVertices[4];
+	static const GLuint m_cubeIndices[36];
+	static const GLuint m_axesIndices[6];
+	static const GLuint m_landIndices[6];
 
 	int UpdateVertices(void);
 	int UpdateIndices(void);
@@ -35,6 +78,12 @@ public:
 
 	int Load(void);
 
+	int Register(Mesh mesh, GLenum mode, const VertexInfo *vertices, int vertexCount, const GLuint *indices, int indexCount);
+	const MeshInfo *GetMesh(Mesh mesh);
+	int Draw(Mesh mesh, GLsizei instanceCount = 1);
+	int Command(Mesh mesh, GLuint instanceCount, GLuint baseInstance, DrawCommand *command);
+
+	GLuint VAO(void);
 	int BindVAO(void); // Array
 	int UnbindVAO(void);
 
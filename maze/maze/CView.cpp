@@ -1,5 +1,7 @@
 #include <iostream>
 
+#include "glad/glad.h"
+
 #include "cgmath.h"
 
 #include "CMisc.h"
@@ -8,15 +10,16 @@
 
 using namespace std;
 
-CView *CView::m_instance = NULL;
+CView *CView::m_instances[VIEWPORT_MAX] = { NULL, };
 
-CView::CView(void)
+CView::CView(int index)
 : m_eye(0.0f, 0.0f, 0.0f)
 , m_at(0.0f, 0.0f, -1.0f)
 , m_up(0.0f, 1.0f, 0.0f)
 , m_updated(true)
 , m_rotateAxis(0.0f, 0.0f, 0.0f)
 , m_rotateAngle(0.0f)
+, m_index(index)
 {
 	m_rotate.setIdentity();
 	m_translate.setTranslate(0.0f, 0.0f, -30.0f);
@@ -27,23 +30,26 @@ CView::~CView(void)
 
 }
 
-CView *CView::GetInstance(void)
+CView *CView::GetInstance(int idx)
 {
-	if (!m_instance) {
+	if (idx < 0 || idx >= VIEWPORT_MAX)
+		return NULL;
+
+	if (!m_instances[idx]) {
 		try {
-			m_instance = new CView();
+			m_instances[idx] = new CView(idx);
 		}
 		catch (...) {
 			return NULL;
 		}
 	}
 
-	return m_instance;
+	return m_instances[idx];
 }
 
 void CView::Destroy(void)
 {
-	m_instance = NULL;
+	m_instances[m_index] = NULL;
 	delete this;
 }
 
@@ -62,6 +68,20 @@ bool CView::Updated(void)
 	return m_updated;
 }
 
+/**
+ * \brief
+ * Puts the eye at a point looking at another, the moves so far are dropped.
+ */
+void CView::Place(const vec3 &eye, const vec3 &at)
+{
+	m_eye = eye;
+	m_at = at;
+	m_up = vec3(0.0f, 1.0f, 0.0f);
+	m_rotate.setIdentity();
+	m_translate.setIdentity();
+	m_updated = true;
+}
+
 void CView::Rotate(vec3 axis, float angle)
 {
 	m_rotate = mat4::rotate(axis, angle) * m_rotate;
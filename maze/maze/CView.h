@@ -2,6 +2,7 @@
  * \brief
  * This class is used for manipulating Camera(aka. Eye)
  * Coordinate system of the camera is inverted of the world's one.
+ * There is a camera a viewport of the split-screen, GetInstance() is the first one.
  */
 
 #pragma once
@@ -24,18 +25,21 @@ private:
 	mat4 m_rotate;
 	mat4 m_translate;
 
-	static CView *m_instance;
+	int m_index;	// Viewport, see CUI::SetViewports()
 
-	CView(void);
+	static CView *m_instances[VIEWPORT_MAX];
+
+	CView(int index);
 	virtual ~CView(void);
 
 public:
-	static CView *GetInstance(void);
+	static CView *GetInstance(int idx = 0);
 	void Destroy(void);
 
 	mat4 Matrix(void);
 
 	bool Updated(void);
+	void Place(const vec3 &eye, const vec3 &at);
 
 	virtual void Translate(CMovable::Direction d, float amount);
 	virtual void Rotate(vec3 axis, float angle);
@@ -3,9 +3,14 @@
 #endif
 
 #include <iostream>
+#include <thread>
+#include <mutex>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <chrono>
 
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
@@ -13,6 +18,7 @@
 #include "cgmath.h"
 
 #include "CMisc.h"
+#include "CDebug.h"
 #include "CShader.h"
 #include "CVertices.h"
 #include "CObject.h"
@@ -21,30 +27,128 @@
 #include "CPlayer.h"
 #include "CCoordinate.h"
 #include "CEnvironment.h"
+#include "CCulling.h"
+#include "CMaze.h"
+#include "CLod.h"
+#include "CFrame.h"
+#include "CMultiDraw.h"
+#include "CRenderQueue.h"
+#include "CTexture.h"
+#include "CProfiler.h"
+#include "CLights.h"
+#include "CShadows.h"
+#include "CLightmap.h"
+#include "CMinimap.h"
+#include "CFog.h"
 
 #include "CUI.h"
 
 using namespace std;
 
+#define BENCH_FRAMES 600	// Of -headless without -bench
+#define LANTERN_RADIUS (BLOCK_WIDTH * 2.0f)	// Light which the player carries
+
 int main(int argc, char *argv[])
 {
 	CShader *shader;
 	CVertices *vertices;
-//	CPlayer *player;
+	CPlayer *player;
 	CBlock *block;
 	CCoordinate *coord;
 	CEnvironment *env;
+	CCulling *culling;
+	CMaze *maze;
+	CLod *lod;
+	CMultiDraw *multiDraw;
+	CRenderQueue *queue;
+	CFrame *frame;
+	CLights *lights;
+	CShadows *shadows;
+	CLightmap *lightmap;
+	CMinimap *minimap;
+	CFog *fog;
 	CUI *ui;
+	bool bake = false;
+	bool headless = false;
+	const char *report = NULL;
+	const char *profile = NULL;
+	int benchFrames = 0;
+	int mazeSize = 0;
+	int lightMode = CLightmap::RUNTIME;
+	int fogPlayers = 0;
+	int viewports = 1;
 	int status;
+	int i;
 
 	srand((unsigned int)time(NULL));
 
 	ui = CUI::GetInstance();
 
+	// -vsync <-1|0|1> -fps <limit, 0: none> -tick <Hz> -ondemand <0|1>
+	// -bake <0|1>: writes the texture cache and quits
+	// -headless <0|1>: offscreen, runs the benchmark, needs make HEADLESS=1
+	// -bench <frames> -report <json file> -maze <cells per side>
+	// -profile <trace file>: zones of the last frames, on exit and by F12
+	// -gldebug <0-4>: severity of the debug output, 0: none, 4: notifications
+	// -lightmap <0|1|2>: 0: lights every frame, 1: baked lightmap, 2: lights and vertex AO
+	// -fog <players>: cells which the players have not seen are dark, 0: no fog
+	// -split <viewports>: split-screen of 1 to 4 viewports, a camera each, N switches the camera
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "-vsync"))
+			status = ui->SetSwapInterval(atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "-fps"))
+			status = ui->SetFrameLimit(atof(argv[i + 1]));
+		else if (!strcmp(argv[i], "-tick"))
+			status = ui->SetTickRate(atof(argv[i + 1]));
+		else if (!strcmp(argv[i], "-ondemand"))
+			status = ui->SetOnDemand(atoi(argv[i + 1]) != 0);
+		else if (!strcmp(argv[i], "-bake")) {
+			bake = atoi(argv[i + 1]) != 0;
+			status = 0;
+		} else if (!strcmp(argv[i], "-headless")) {
+			headless = atoi(argv[i + 1]) != 0;
+			status = ui->SetHeadless(headless);
+		} else if (!strcmp(argv[i], "-bench")) {
+			benchFrames = atoi(argv[i + 1]);
+			status = benchFrames > 0 ? 0 : -EINVAL;
+		} else if (!strcmp(argv[i], "-report")) {
+			report = argv[i + 1];
+			status = 0;
+		} else if (!strcmp(argv[i], "-maze")) {
+			mazeSize = atoi(argv[i + 1]);
+			status = 0;
+		} else if (!strcmp(argv[i], "-profile")) {
+			profile = argv[i + 1];
+			status = 0;
+		} else if (!strcmp(argv[i], "-lightmap")) {
+			lightMode = atoi(argv[i + 1]);
+			status = lightMode >= CLightmap::RUNTIME && lightMode <= CLightmap::VERTEX_AO ? 0 : -EINVAL;
+		} else if (!strcmp(argv[i], "-fog")) {
+			fogPlayers = atoi(argv[i + 1]);
+			status = fogPlayers >= 0 && fogPlayers <= FOG_PLAYERS_MAX ? 0 : -EINVAL;
+		} else if (!strcmp(argv[i], "-split")) {
+			viewports = atoi(argv[i + 1]);
+			status = viewports >= 1 && viewports <= VIEWPORT_MAX ? 0 : -EINVAL;
+		} else if (!strcmp(argv[i], "-gldebug"))
+			status = CDebug::SetSeverity(atoi(argv[i + 1]));
+		else
+			status = -EINVAL;
+
+		if (status < 0)
+			cerr << "Invalid option " << argv[i] << " " << argv[i + 1] << endl;
+	}
+
 	status = ui->CreateContext();
 	if (status < 0)
 		return status;
 
+	// The S3TC support of the driver picks the format of the cache
+	if (bake) {
+		status = CTexture::GetInstance() ? CTexture::GetInstance()->Bake() : -EFAULT;
+		ui->DestroyContext();
+		return status;
+	}
+
 	shader = CShader::GetInstance();
 	if (!shader) {
 		ui->DestroyContext();
@@ -58,19 +162,96 @@ int main(int argc, char *argv[])
 		return -EFAULT;
 	}
 
-/*
+	frame = CFrame::GetInstance();
+	if (!frame) {
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
 	player = CPlayer::GetInstance();
 	if (!player) {
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	maze = CMaze::GetInstance();
+	if (!maze) {
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	// The objects below size themselves by the maze
+	if (mazeSize && maze->Generate(mazeSize, mazeSize) < 0)
+		cerr << "Invalid maze size " << mazeSize << endl;
+
+	culling = CCulling::GetInstance();
+	if (!culling) {
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	lod = CLod::GetInstance();
+	if (!lod) {
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	multiDraw = CMultiDraw::GetInstance();
+	if (!multiDraw) {
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	queue = CRenderQueue::GetInstance();
+	if (!queue) {
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
 		vertices->Destroy();
 		shader->Destroy();
 		ui->DestroyContext();
 		return -EFAULT;
 	}
-*/
 
 	block = CBlock::GetInstance();
 	if (!block) {
-		//player->Destroy();
+		player->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		frame->Destroy();
 		vertices->Destroy();
 		shader->Destroy();
 		ui->DestroyContext();
@@ -80,7 +261,13 @@ int main(int argc, char *argv[])
 	coord = CCoordinate::GetInstance();
 	if (!coord) {
 		block->Destroy();
-		//player->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
 		vertices->Destroy();
 		shader->Destroy();
 		ui->DestroyContext();
@@ -91,44 +278,203 @@ int main(int argc, char *argv[])
 	if (!env) {
 		coord->Destroy();
 		block->Destroy();
-		//player->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
 		vertices->Destroy();
 		shader->Destroy();
 		ui->DestroyContext();
 		return -EFAULT;
 	}
 
+	lights = CLights::GetInstance();
+	if (!lights) {
+		env->Destroy();
+		coord->Destroy();
+		block->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	lightmap = CLightmap::GetInstance();
+	if (!lightmap) {
+		lights->Destroy();
+		env->Destroy();
+		coord->Destroy();
+		block->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+	lightmap->SetMode(lightMode);
+
+	shadows = CShadows::GetInstance();
+	if (!shadows) {
+		lightmap->Destroy();
+		lights->Destroy();
+		env->Destroy();
+		coord->Destroy();
+		block->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	minimap = CMinimap::GetInstance();
+	if (!minimap) {
+		shadows->Destroy();
+		lightmap->Destroy();
+		lights->Destroy();
+		env->Destroy();
+		coord->Destroy();
+		block->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+
+	fog = CFog::GetInstance();
+	if (!fog) {
+		minimap->Destroy();
+		shadows->Destroy();
+		lightmap->Destroy();
+		lights->Destroy();
+		env->Destroy();
+		coord->Destroy();
+		block->Destroy();
+		queue->Destroy();
+		multiDraw->Destroy();
+		lod->Destroy();
+		culling->Destroy();
+		maze->Destroy();
+		player->Destroy();
+		frame->Destroy();
+		vertices->Destroy();
+		shader->Destroy();
+		ui->DestroyContext();
+		return -EFAULT;
+	}
+	fog->SetPlayers(fogPlayers);
+
+	// The shader draws the viewports by a geometry shader, so before it is loaded
+	if (viewports > 1 && ui->SetViewports(viewports) < 0)
+		cerr << "Split-screen is not available" << endl;
+
 	/**
 	 * Shader must be loaded first.
 	 */
 	if (__OLD_GL)
 		shader->Load(CMisc::m_oldVertexShaderFile, CMisc::m_oldFragmentShaderFile);
 	else
-		shader->Load(CMisc::m_vertexShaderFile, CMisc::m_fragmentShaderFile);
+		shader->Load(CMisc::m_vertexShaderFile, CMisc::m_fragmentShaderFile, CMisc::m_geometryShaderFile);
 
 	vertices->Load();
+	// Uniform blocks of the camera and the objects, the objects register their slots on Load
+	frame->Load();
 	block->Load();
-	//player->Load();
+	lod->Load();
+	// Draws of the objects are batched if GL 4.3 is available
+	multiDraw->Load();
+	player->Load();
 	coord->Load();
 	env->Load();
+	// Samplers of every variant, so after the objects which build them
+	lights->Load();
+	// Bakes the lights, or reads them from lightcache/, CShadows is off for them
+	lightmap->Load();
+	shadows->Load();
+	// The player shadows the lights around it, its lantern follows it
+	shadows->AddCaster(player, lights->Add(vec3(0.0f, 0.0f, 0.0f), vec3(0.8f, 0.7f, 0.5f), LANTERN_RADIUS));
+	// Shown by the tab key
+	minimap->Load();
+	// Explored cells of -fog, F toggles it
+	fog->Load();
 
 	ui->AddObject(env);
 	ui->AddObject(block);
-//	ui->AddObject(player);
+	ui->AddObject(lod);
+	ui->AddObject(player);
 	ui->AddObject(coord);
 
-	ui->Run();
+	if (profile && (!CProfiler::GetInstance() || CProfiler::GetInstance()->Load(profile) < 0))
+		cerr << "Failed to start the profiler" << endl;
+
+	// Nothing to look at without a window
+	if (headless && benchFrames == 0)
+		benchFrames = BENCH_FRAMES;
+
+	if (benchFrames > 0)
+		status = ui->Benchmark(benchFrames, report);
+	else
+		status = ui->Run();
+
+	// The frames create the profiler, with or without -profile
+	if (CProfiler::GetInstance()) {
+		if (profile)
+			CProfiler::GetInstance()->WriteTrace();
+		CProfiler::GetInstance()->Destroy();
+	}
 
 	ui->DelObject(env);
 	ui->DelObject(coord);
-//	ui->DelObject(player);
+	ui->DelObject(player);
+	shadows->DelCaster(player);
+	ui->DelObject(lod);
 	ui->DelObject(block);
 
 	coord->Destroy();
-//	player->Destroy();
+	player->Destroy();
 	block->Destroy();
 	env->Destroy();
+	fog->Destroy();
+	minimap->Destroy();
+	shadows->Destroy();
+	lightmap->Destroy();
+	lights->Destroy();
+	queue->Destroy();
+	multiDraw->Destroy();
+	lod->Destroy();
+	culling->Destroy();
+	maze->Destroy();
 
+	frame->Destroy();
 	vertices->Destroy();
 	shader->Destroy();
 
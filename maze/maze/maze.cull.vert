@@ -0,0 +1,41 @@
+#version 150
+// Transform feedback culling for contexts without compute shaders.
+// Frustum test only, the geometry shader drops the invisible instances.
+// The split-screen keeps an instance which any of its viewports sees.
+#define VIEWPORT_MAX 4	// Same as CMisc.h
+uniform mat4 mvp[VIEWPORT_MAX];
+uniform int viewports;
+uniform float halfExtent;
+uniform bool useLod;
+uniform usamplerBuffer chunkLevel;
+in vec4 offset;
+in uint chunk;
+out vec4 instanceOffset;
+flat out int instanceVisible;
+
+void main()
+{
+	instanceOffset = offset;
+	instanceVisible = 0;
+
+	for (int v = 0; v < viewports && instanceVisible == 0; v++) {
+		ivec3 below = ivec3(0);
+		ivec3 above = ivec3(0);
+
+		for (int c = 0; c < 8; c++) {
+			vec3 corner = vec3((c & 1) != 0 ? halfExtent : -halfExtent,
+				(c & 2) != 0 ? halfExtent : -halfExtent,
+				(c & 4) != 0 ? halfExtent : -halfExtent);
+			vec4 clip = mvp[v] * (vec4(corner, 1.0) + vec4(offset.xyz, 1.0));
+
+			below += ivec3(lessThan(clip.xyz, -clip.www));
+			above += ivec3(greaterThan(clip.xyz, clip.www));
+		}
+
+		instanceVisible = (any(equal(below, ivec3(8))) || any(equal(above, ivec3(8)))) ? 0 : 1;
+	}
+
+	// Chunks which are not at the full level are drawn by CLod
+	if (useLod && texelFetch(chunkLevel, int(chunk)).r != 0u)
+		instanceVisible = 0;
+}
@@ -1,69 +1,252 @@
-#version 130
+#version 140
 
-#define HASH(in1, in2) (int(fract(sin(dot(vec2(in1+2*in2, in1+in2),vec2(12.9898,78.233))) * 43758.5453) > 0.5))
+#define TILE_INDEX_SIZE 64	// Same as CTexture.h
 
-vec4 TileTex(sampler2D texSampler, vec2 uv)
+uniform usampler2D tiles;	// Atlas position of the tile of a cell, see CTexture::LoadTiles
+
+vec4 TileTex(sampler2DArray texSampler, vec2 uv, int layer)
 {
-    //uv.y = 1.0-uv.y;
-	    
-	vec2 t = floor(uv);
-    
-	int tileX = int(t.x);
-	int tileY = int(t.y);
-
-    vec2 tile = vec2(0.0, 0.0);    
-   
-    // use the hashing algorithm
-
-    // BRTL - Bottom, Rright, Top, Left
-    int B = HASH(tileY-1, tileX);
-    int R = HASH(tileX+1, tileY);
-    int T = HASH(tileY, tileX);
-    int L = HASH(tileX, tileY);	    
-
-    const vec2 tiles[16] = 
-    {
-        vec2(0.0, 3.0), // 0, 0, 0, 0     // 0
-        vec2(3.0, 3.0), // 0, 0, 0, 1     // 1
-        vec2(0.0, 2.0), // 0, 0, 1, 0     // 2
-        vec2(3.0, 2.0), // 0, 0, 1, 1     // 3
-        vec2(1.0, 3.0), // 0, 1, 0, 0     // 4
-        vec2(2.0, 3.0), // 0, 1, 0, 1     // 5
-        vec2(1.0, 2.0), // 0, 1, 1, 0     // 6
-        vec2(2.0, 2.0), // 0, 1, 1, 1     // 7
-        vec2(0.0, 0.0), // 1, 0, 0, 0     // 8
-        vec2(3.0, 0.0), // 1, 0, 0, 1     // 9 
-        vec2(0.0, 1.0), // 1, 0, 1, 0     // 10
-        vec2(3.0, 1.0), // 1, 0, 1, 1     // 11
-        vec2(1.0, 0.0), // 1, 1, 0, 0     // 12
-        vec2(2.0, 0.0), // 1, 1, 0, 1     // 13
-        vec2(1.0, 1.0), // 1, 1, 1, 0     // 14
-        vec2(2.0, 1.0), // 1, 1, 1, 1     // 15
-    };
-        
-	tile = tiles[L + 2*T + 4*R + 8*B];
-    	
+	// The cells repeat every TILE_INDEX_SIZE, the tiles match across the wrap
+	ivec2 cell = ivec2(floor(uv)) & ivec2(TILE_INDEX_SIZE - 1);
+	vec2 tile = vec2(texelFetch(tiles, cell, 0).rg);
+
 	vec2 finalCoords;
 	finalCoords.x = (tile.x/4.0) + fract(uv.x)/4.0;
 	finalCoords.y = ((3.0-tile.y)/4.0) + fract(uv.y)/4.0;
-	  
+
 	finalCoords.y = 1.0-finalCoords.y;
-	return textureGrad(texSampler, finalCoords, dFdx(uv/4.0), dFdy(uv/4.0));
-	 
+	return textureGrad(texSampler, vec3(finalCoords, float(layer)), dFdx(uv/4.0), dFdy(uv/4.0));
 }
-	
+
+#define VIEWPORT_MAX 4	// Same as CMisc.h
+
+// Same as maze.vert, see CFrame
+layout(std140, row_major) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec4 clusterScale;	// 1 / tile width, 1 / tile height, slice scale, slice bias
+	ivec4 clusterGrid;	// Clusters of the axes, w: lights, 0 for none
+	vec4 ambient;
+	mat4 views[VIEWPORT_MAX];
+	mat4 viewProjections[VIEWPORT_MAX];
+	vec4 viewportRects[VIEWPORT_MAX];	// x, y, width, height in pixels
+	ivec4 viewports;
+};
+
+#if defined(VIEWPORTS)
+flat in int fragViewport;	// See maze.geom
+#else
+const int fragViewport = 0;
+#endif
+
+uniform samplerBuffer lights;	// View space position and radius, color, model space position and shadow slot, see CLights
+uniform usamplerBuffer clusters;	// (first << 8) | count of a cluster, then the light indices
+uniform sampler2DArrayShadow shadows;	// Six faces a slot, see CShadows
+
+#define SHADOW_NEAR 0.05f	// Same as CShadows.cpp
+#define LIGHT_FALLOFF 0.25f	// Same as CLights.h
+#define LIGHT_MAX 1024	// Lights of a viewport, same as CLights.h
+
+// Forward and up of the faces, same as CShadows.cpp
+const vec3 faceForward[6] = vec3[6](vec3(1.0f, 0.0f, 0.0f), vec3(-1.0f, 0.0f, 0.0f),
+	vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, -1.0f));
+const vec3 faceUp[6] = vec3[6](vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f),
+	vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+/**
+ * Lit fraction of a fragment, d is from the light to it in the model space.
+ * The face is the one of the major axis, the depth is projected as the face was drawn.
+ */
+float Shadow(int slot, vec3 d, float radius)
+{
+	vec3 a = abs(d);
+	vec3 forward;
+	vec3 up;
+	vec2 uv;
+	float m;
+	float depth;
+	int face;
+
+	if (a.x >= a.y && a.x >= a.z) {
+		face = d.x > 0.0f ? 0 : 1;
+		m = a.x;
+	} else if (a.y >= a.z) {
+		face = d.y > 0.0f ? 2 : 3;
+		m = a.y;
+	} else {
+		face = d.z > 0.0f ? 4 : 5;
+		m = a.z;
+	}
+
+	forward = faceForward[face];
+	up = faceUp[face];
+	uv = vec2(dot(d, cross(forward, up)), dot(d, up)) / m * 0.5f + 0.5f;
+	depth = ((radius + SHADOW_NEAR) - 2.0f * radius * SHADOW_NEAR / m) / (radius - SHADOW_NEAR) * 0.5f + 0.5f;
+
+	// No mipmaps, so no derivatives within the loop of the lights
+	return textureGrad(shadows, vec4(uv, float(slot * 6 + face), depth), vec2(0.0f), vec2(0.0f));
+}
+
+/**
+ * Ambient plus the lights of the cluster of the fragment,
+ * their falloff reaches 0 at the radius, so the clusters may cut them off.
+ * A viewport has its own clusters and view space lights after the ones before it.
+ */
+vec3 Lighting(vec3 position, vec3 normal, vec3 model, float occlusion)
+{
+	vec3 light = ambient.rgb * occlusion;
+	ivec3 cluster;
+	uint header;
+	int first;
+	int count;
+	int i;
+
+	if (clusterGrid.w == 0)
+		return light;
+
+	cluster.xy = min(ivec2((gl_FragCoord.xy - viewportRects[fragViewport].xy) * clusterScale.xy), clusterGrid.xy - 1);
+	cluster.z = clamp(int(log(-position.z) * clusterScale.z + clusterScale.w), 0, clusterGrid.z - 1);
+	cluster.z += fragViewport * clusterGrid.z;
+	header = texelFetch(clusters, (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x).r;
+	first = int(header >> 8u);
+	count = int(header & 0xffu);
+
+	normal = normalize(normal);
+	for (i = 0; i < count; i++) {
+		int index = int(texelFetch(clusters, first + i).r) + fragViewport * LIGHT_MAX;
+		vec4 sphere = texelFetch(lights, index * 3);
+		vec3 color = texelFetch(lights, index * 3 + 1).rgb;
+		vec4 origin = texelFetch(lights, index * 3 + 2);
+		vec3 toLight = sphere.xyz - position;
+		float distance = max(length(toLight), 0.0001f);
+		float window = clamp(1.0f - pow(distance / sphere.w, 4.0f), 0.0f, 1.0f);
+		float lambert = max(dot(normal, toLight / distance), 0.0f);
+
+		// The lights without a map are not shadowed
+		if (lambert > 0.0f && origin.w >= 0.0f)
+			lambert *= Shadow(int(origin.w), model - origin.xyz, sphere.w);
+
+		light += color * lambert * window * window / (1.0f + LIGHT_FALLOFF * distance * distance);
+	}
+
+	return light;
+}
+
+#define BLOCK_WIDTH 4.0f	// Same as CVertices.h
+#define CHUNK_SIZE 8	// Same as CMaze.h
+#define LIGHTMAP_TEXELS 8	// Same as CLightmap.h
+#define LIGHTMAP_WALLS_X 4
+#define LIGHTMAP_RANGE 2.0f	// Same as CLightmap.cpp
+#define CELL_OPEN 255u
+
+uniform int lightMode;	// 0: the lights, 1: baked, 2: the lights and vertex AO, see CLightmap
+uniform sampler2DArray lightmap;	// A layer a chunk, six faces a wall
+uniform usampler2D cells;	// Slot of the wall of a cell in its chunk, CELL_OPEN for none
+
+/**
+ * Baked light of a wall fragment, the face is the one of the major axis of
+ * the normal. The cell is the one half a cell behind the face, so a merged
+ * box of CLod finds the wall of every fragment as the blocks do.
+ */
+vec3 Baked(vec3 model, vec3 normal)
+{
+	ivec2 size = textureSize(cells, 0);
+	vec3 a = abs(normal);
+	vec3 local;
+	vec2 uv;
+	vec2 tile;
+	ivec2 cell;
+	int slot;
+	int face;
+	int layer;
+
+	if (a.x >= a.y && a.x >= a.z)
+		face = normal.x > 0.0f ? 0 : 1;
+	else if (a.y >= a.z)
+		face = normal.y > 0.0f ? 2 : 3;
+	else
+		face = normal.z > 0.0f ? 4 : 5;
+
+	cell = ivec2(floor((model.xz - faceForward[face].xz * (BLOCK_WIDTH * 0.25f)) / BLOCK_WIDTH + vec2(size / 2) + 0.5f));
+	cell = clamp(cell, ivec2(0), size - 1);
+	slot = int(texelFetch(cells, cell, 0).r);
+	if (uint(slot) == CELL_OPEN)
+		return ambient.rgb;
+
+	// Texels of the face, their centers stay within the tile
+	local = model - vec3(float(cell.x - size.x / 2), 0.0f, float(cell.y - size.y / 2)) * BLOCK_WIDTH;
+	uv = vec2(dot(local, cross(faceForward[face], faceUp[face])), dot(local, faceUp[face])) / BLOCK_WIDTH + 0.5f;
+	uv = clamp(uv * float(LIGHTMAP_TEXELS), 0.5f, float(LIGHTMAP_TEXELS) - 0.5f);
+	tile = vec2(float(slot % LIGHTMAP_WALLS_X * 6 + face), float(slot / LIGHTMAP_WALLS_X)) * float(LIGHTMAP_TEXELS);
+	layer = cell.y / CHUNK_SIZE * ((size.x + CHUNK_SIZE - 1) / CHUNK_SIZE) + cell.x / CHUNK_SIZE;
+
+	return textureLod(lightmap, vec3((tile + uv) / vec2(textureSize(lightmap, 0).xy), float(layer)), 0.0f).rgb * LIGHTMAP_RANGE;
+}
+
+#define FOG_LIGHT 0.2f	// Of the cells which are not explored
+
+uniform usampler2DArray explored;	// A bit a cell, a layer a player, see CFog
+uniform ivec3 fog;	// Cells of the maze, player of the first viewport, -1 for no fog
+
+/**
+ * Light of the fog of the player, the cell is found as Baked() does,
+ * the land takes the cell above it and the land around the maze is clear.
+ * A viewport is the next player, the last player has the viewports past it.
+ */
+float Fog(vec3 model, vec3 normal)
+{
+	vec3 a = abs(normal);
+	ivec2 cell;
+	uint bits;
+
+	if (fog.z < 0)
+		return 1.0f;
+
+	if (a.x >= a.y && a.x >= a.z)
+		normal = vec3(sign(normal.x), 0.0f, 0.0f);
+	else if (a.y >= a.z)
+		normal = vec3(0.0f);
+	else
+		normal = vec3(0.0f, 0.0f, sign(normal.z));
+
+	cell = ivec2(floor((model.xz - normal.xz * (BLOCK_WIDTH * 0.25f)) / BLOCK_WIDTH + vec2(fog.xy / 2) + 0.5f));
+	if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, fog.xy)))
+		return 1.0f;
+
+	bits = texelFetch(explored, ivec3(cell.x >> 3, cell.y, min(fog.z + fragViewport, textureSize(explored, 0).z - 1)), 0).r;
+	return (bits & (1u << uint(cell.x & 7))) != 0u ? 1.0f : FOG_LIGHT;
+}
+
 in vec4 fragColor;
 in vec2 fragTexCoord;
-uniform sampler2D tex;
-uniform sampler2D tex2;
-uniform bool isBlock;
+in vec3 fragPosition;
+in vec3 fragNormal;
+in vec3 fragModel;
+in float fragOcclusion;
+uniform sampler2DArray tex;	// Wall images, a layer each
+#if defined(BLOCK)
+flat in int fragLayer;
+in vec3 fragModelNormal;
+#endif
 
 void main()
 {
-	
-	if (isBlock) {
-		gl_FragColor = TileTex(tex, fragTexCoord * vec2(4.0f, 4.0f));		
-	} else {
-		gl_FragColor = fragColor;
-	}
+#if defined(DEPTH)
+	// Shadow maps, the depth only
+#elif defined(BLOCK)
+	vec4 texel = TileTex(tex, fragTexCoord * vec2(4.0f, 4.0f), fragLayer);
+	vec3 light;
+
+	if (lightMode == 1)
+		light = Baked(fragModel, fragModelNormal);
+	else
+		light = Lighting(fragPosition, fragNormal, fragModel, fragOcclusion);
+	gl_FragColor = vec4(texel.rgb * light * Fog(fragModel, fragModelNormal), texel.a);
+#elif defined(ENV)
+	gl_FragColor = vec4(fragColor.rgb * Lighting(fragPosition, fragNormal, fragModel, fragOcclusion)
+		* Fog(fragModel, vec3(0.0f, 1.0f, 0.0f)), fragColor.a);
+#else
+	gl_FragColor = fragColor;
+#endif
 }
\ No newline at end of file
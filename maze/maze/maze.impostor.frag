@@ -0,0 +1,13 @@
+#version 130
+in vec2 fragTexCoord;
+uniform sampler2D tex;
+void main()
+{
+	vec4 color = texture(tex, fragTexCoord);
+
+	// The background of the capture is transparent
+	if (color.a < 0.5)
+		discard;
+
+	gl_FragColor = color;
+}
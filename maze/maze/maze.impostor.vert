@@ -0,0 +1,22 @@
+#version 140
+// Camera facing quad of a far chunk, see CLod
+layout(std140, row_major) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+};
+
+#define OBJECT_MAX 8
+layout(std140, row_major) uniform Objects {
+	mat4 model[OBJECT_MAX];
+	ivec4 objectFlags[OBJECT_MAX];
+};
+uniform int object;	// Object of CLod, set once
+in vec4 position;
+in vec2 texCoord;
+out vec2 fragTexCoord;
+void main()
+{
+	gl_Position = viewProjection * model[object] * position;
+	fragTexCoord = texCoord;
+}
@@ -0,0 +1,40 @@
+#version 140
+// Cells of CMinimap, level 0 a bit each, eight cells of a row in a texel,
+// the levels above a byte of the walls of their cells each, in the rows after
+// level 0 and wrapped around the rows of the texture
+uniform usampler2D map;
+uniform ivec4 level;	// x: first row of the level, y: the level, zw: cells of level 0
+uniform vec2 eye;	// In cells of level 0
+uniform int levelWidth;	// Cells of a row of the level
+in vec2 fragCell;
+
+#define WALL_COLOR vec4(0.8f, 0.72f, 0.6f, 0.9f)
+#define OPEN_COLOR vec4(0.1f, 0.1f, 0.1f, 0.7f)
+#define EYE_COLOR vec4(1.0f, 0.2f, 0.1f, 1.0f)
+#define EYE_PIXELS 3.0f
+
+void main()
+{
+	ivec2 cell = ivec2(floor(fragCell));
+	ivec2 texel = cell >> level.y;
+	float pixel = fwidth(fragCell.x);	// Before the discard
+	uint bits;
+
+	if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, level.zw)))
+		discard;
+
+	if (level.y == 0) {
+		bits = texelFetch(map, ivec2(texel.x >> 3, texel.y), 0).r;
+		gl_FragColor = ((bits >> uint(texel.x & 7)) & 1u) != 0u ? WALL_COLOR : OPEN_COLOR;
+	} else {
+		int i = texel.y * levelWidth + texel.x;
+		int pitch = textureSize(map, 0).x;
+
+		bits = texelFetch(map, ivec2(i % pitch, level.x + i / pitch), 0).r;
+		gl_FragColor = mix(OPEN_COLOR, WALL_COLOR, float(bits) / 255.0f);
+	}
+
+	// A few pixels, or a cell when the cells are larger
+	if (length(fragCell - eye) < max(EYE_PIXELS * pixel, 0.5f))
+		gl_FragColor = EYE_COLOR;
+}
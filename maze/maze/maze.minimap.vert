@@ -0,0 +1,14 @@
+#version 140
+// Quad of CMinimap, the corners come from gl_VertexID, there are no attributes
+uniform ivec4 level;	// Same as maze.minimap.frag
+out vec2 fragCell;
+void main()
+{
+	vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+	float side = float(max(level.z, level.w));
+
+	gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+
+	// Row 0 of the maze at the top, the maze in the middle of the square
+	fragCell = vec2(corner.x, 1.0f - corner.y) * side - (vec2(side) - vec2(level.zw)) * 0.5f;
+}
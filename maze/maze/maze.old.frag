@@ -1,13 +1,15 @@
 #version 130
 in vec4 fragColor;
 in vec2 fragTexCoord;
-uniform sampler2D tex;
-uniform bool isBlock;
+uniform sampler2DArray tex;
+#if defined(BLOCK)
+flat in int fragLayer;
+#endif
 void main()
 {
-	if (isBlock) {
-		gl_FragColor = texture2D(tex, fragTexCoord);
-	} else {
-		gl_FragColor = fragColor;
-	}
+#if defined(BLOCK)
+	gl_FragColor = texture(tex, vec3(fragTexCoord, float(fragLayer)));
+#else
+	gl_FragColor = fragColor;
+#endif
 }
@@ -1,22 +1,29 @@
 #version 130
 uniform mat4 mvp;
-uniform bool isBlock;
-uniform vec4 offset;
+#if defined(LEGACY_OFFSET)
+uniform vec4 offset;	// xyz: position of the instance, w: material, see CMaze
+#endif
 in vec2 texCoord;
 in vec4 position;
 in vec4 color;
 out vec4 fragColor;
 out vec2 fragTexCoord;
+#if defined(BLOCK)
+uniform int layers;
+uniform int layerShift;
+flat out int fragLayer;
+#endif
 
 void main()
 {
-	if (isBlock) {
-		gl_Position = mvp * (position + offset);
-		fragTexCoord = texCoord;
-		fragColor = vec4(0.0f, 0.0f, 0.0f, 0.0f);
-	} else {
-		gl_Position = mvp * position;
-		fragColor = color;
-		fragTexCoord = vec2(0.0f, 0.0f);
-	}
+#if defined(BLOCK)
+	gl_Position = mvp * (position + vec4(offset.xyz, 1.0f));
+	fragTexCoord = texCoord;
+	fragColor = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	fragLayer = (int(offset.w) + layerShift) % layers;
+#else
+	gl_Position = mvp * position;
+	fragColor = color;
+	fragTexCoord = vec2(0.0f, 0.0f);
+#endif
 }
@@ -1,22 +1,115 @@
-#version 130
-uniform mat4 mvp;
-uniform bool isBlock;
-in vec4 offset;
+#version 140
+
+// BLOCK, ENV or LINES is defined by CShader, a variant has one path only
+// DEPTH: the position only, for the shadow maps of CShadows, BLOCK with it for the walls
+// VIEWPORTS: maze.geom writes the outputs for every viewport of the split-screen
+
+#define VIEWPORT_MAX 4	// Same as CMisc.h
+
+// Written once per frame, see CFrame
+layout(std140, row_major) uniform Frame {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec4 clusterScale;	// Same as maze.frag
+	ivec4 clusterGrid;
+	vec4 ambient;
+	mat4 views[VIEWPORT_MAX];	// Same as maze.geom
+	mat4 viewProjections[VIEWPORT_MAX];
+	vec4 viewportRects[VIEWPORT_MAX];
+	ivec4 viewports;
+};
+
+#define OBJECT_MAX 8
+layout(std140, row_major) uniform Objects {
+	mat4 model[OBJECT_MAX];
+	ivec4 objectFlags[OBJECT_MAX];	// x: block
+};
+in uint drawId;	// Object of the draw, see CFrame::BindObject
+
+in vec4 offset;	// xyz: position of the instance, w: material, see CMaze
+in vec4 scale;	// Merged boxes of CLod, (1, 1, 1, 1) for a block
 in vec2 texCoord;
 in vec4 position;
 in vec4 color;
+in vec3 normal;
+#if defined(VIEWPORTS)
+#define fragColor vertColor
+#define fragTexCoord vertTexCoord
+#define fragPosition vertPosition
+#define fragNormal vertNormal
+#define fragModel vertModel
+#define fragOcclusion vertOcclusion
+#define fragLayer vertLayer
+#define fragModelNormal vertModelNormal
+out vec4 vertWorld;	// maze.geom projects it for each viewport
+out vec3 vertWorldNormal;
+#endif
 out vec4 fragColor;
 out vec2 fragTexCoord;
+out vec3 fragPosition;	// View space, for the lights
+out vec3 fragNormal;
+out vec3 fragModel;	// Model space, for the shadows
+out float fragOcclusion;	// Of the ambient light
+#if defined(BLOCK)
+uniform int layers;	// Of the texture array, see CTexture
+uniform int layerShift;	// See CBlock::ChangeTex
+flat out int fragLayer;
+
+#define BLOCK_WIDTH 4.0f	// Same as CVertices.h
+#define CELL_OPEN 255u	// Same as CLightmap.h
+#define VERTEX_AO 0.5f	// Ambient which a corner against another wall loses
+
+uniform int lightMode;	// 2: vertex AO, see CLightmap
+uniform usampler2D cells;	// Slot of the wall of a cell, CELL_OPEN for none
+out vec3 fragModelNormal;	// For the lightmap
+#endif
 void main()
 {
-	if (isBlock) {
-		gl_Position = mvp * (position + offset);
-		fragTexCoord = texCoord;
-		fragColor = vec4(0.0f, 0.0f, 0.0f, 0.0f);
-	} else {
-		gl_Position = mvp * position;
-		fragColor = color;
-		fragTexCoord = vec2(0.0f, 0.0f);
+	mat4 m = viewProjection * model[drawId];
+	mat4 mv = view * model[drawId];
+
+#if defined(DEPTH) && defined(BLOCK)
+	gl_Position = m * (position * scale + vec4(offset.xyz, 1.0f));
+#elif defined(DEPTH)
+	gl_Position = m * position;
+#elif defined(BLOCK)
+	gl_Position = m * (position * scale + vec4(offset.xyz, 1.0f));
+	fragTexCoord = texCoord * vec2(max(scale.x, scale.z), scale.y);
+	fragColor = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	fragLayer = (int(offset.w) + layerShift) % layers;
+
+	// The w of the position above is 2, the offsets are in twice the model space
+	fragModel = (position.xyz * scale.xyz + offset.xyz) * 0.5f;
+	fragPosition = (mv * vec4(fragModel, 1.0f)).xyz;
+	fragModelNormal = normal;
+	fragOcclusion = 1.0f;
 
+	// A corner of a side is in the shade of the wall of the cell across it
+	if (lightMode == 2 && normal.y == 0.0f) {
+		vec3 tangent = vec3(normal.z, 0.0f, -normal.x);
+		vec3 corner = fragModel + (normal + tangent * sign(dot(position.xyz, tangent))) * (BLOCK_WIDTH * 0.5f);
+		ivec2 size = textureSize(cells, 0);
+		ivec2 cell = ivec2(floor(corner.xz / BLOCK_WIDTH + vec2(size / 2) + 0.5f));
+
+		if (all(greaterThanEqual(cell, ivec2(0))) && all(lessThan(cell, size))
+			&& texelFetch(cells, cell, 0).r != CELL_OPEN)
+			fragOcclusion = 1.0f - VERTEX_AO;
 	}
+#else
+	gl_Position = m * position;
+	fragColor = color;
+	fragTexCoord = vec2(0.0f, 0.0f);
+	fragModel = position.xyz;
+	fragPosition = (mv * position).xyz;
+	fragOcclusion = 1.0f;
+#endif
+#if !defined(DEPTH)
+	fragNormal = mat3(mv) * normal;
+#endif
+
+#if defined(VIEWPORTS)
+	vertWorld = model[drawId] * vec4(fragModel, 1.0f);
+	vertWorldNormal = mat3(model[drawId]) * normal;
+#endif
 }